@@ -0,0 +1,259 @@
+#include "BallGrid.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+    inline bool _IsSameRange(const uint3& a, const uint3& b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+
+    // Orbit parameters following SparseVolume::_AddBall
+    struct BenchBall {
+        float fPower;
+        float fOrbitRadius;
+        float fOrbitSpeed;
+        float fOrbitStartPhase;
+    };
+
+    void _PlaceBalls(const std::vector<BenchBall>& balls, float time,
+        BallGrid& grid)
+    {
+        for (size_t i = 0; i < balls.size(); ++i) {
+            const BenchBall& ball = balls[i];
+            const float phase = time * ball.fOrbitSpeed + ball.fOrbitStartPhase;
+            grid.f4Balls[i] = float4(ball.fOrbitRadius * std::cos(phase),
+                ball.fOrbitRadius * std::sin(phase),
+                0.3f * ball.fOrbitRadius * std::sin(
+                    2.f * time * ball.fOrbitSpeed + ball.fOrbitStartPhase),
+                ball.fPower);
+        }
+    }
+}
+
+BallGrid::BallGrid()
+    : _cellSize(0),
+    _cullRatio(0.f),
+    _gridReso(0, 0, 0),
+    _invalidated(true),
+    _movedBalls(0)
+{
+    _vParam.u3VoxelReso = uint3(0, 0, 0);
+    _vParam.fVoxelSize = 0.f;
+    _vParam.fMinDensity = 0.f;
+}
+
+BallGrid::~BallGrid()
+{
+}
+
+void
+BallGrid::Update(const VolumeParam& vParam, uint cellSize, float cullRatio)
+{
+    if (!_IsSameRange(vParam.u3VoxelReso, _vParam.u3VoxelReso) ||
+        vParam.fVoxelSize != _vParam.fVoxelSize ||
+        vParam.fMinDensity != _vParam.fMinDensity ||
+        cellSize != _cellSize || cullRatio != _cullRatio) {
+        _invalidated = true;
+    }
+    _vParam = vParam;
+    _cellSize = cellSize;
+    _cullRatio = cullRatio;
+    if (_invalidated) {
+        const uint3& reso = vParam.u3VoxelReso;
+        _gridReso = uint3((reso.x + cellSize - 1) / cellSize,
+            (reso.y + cellSize - 1) / cellSize,
+            (reso.z + cellSize - 1) / cellSize);
+        _cells.assign((size_t)_gridReso.x * _gridReso.y * _gridReso.z,
+            std::vector<uint32_t>());
+        _dirtyCells.assign(_cells.size(), 0);
+        _mergeFrom.assign(_cells.size(), 0);
+        _ranges.clear();
+    }
+
+    const uint32_t numOfBalls = (uint32_t)f4Balls.size();
+    const uint32_t oldBalls = (uint32_t)_ranges.size();
+    auto forEachCell = [&](const CellRange& range, auto func) {
+        for (uint z = range.lo.z; z <= range.hi.z; ++z) {
+            for (uint y = range.lo.y; y <= range.hi.y; ++y) {
+                for (uint x = range.lo.x; x <= range.hi.x; ++x) {
+                    func(CellIdx(x, y, z));
+                }
+            }
+        }
+    };
+    // Balls leaving (or entering) cells, one pass per touched cell drops
+    // the leaving ones instead of one search per ball and cell
+    _moved.assign(std::max(numOfBalls, oldBalls), 0);
+    _movedBalls = 0;
+    for (uint32_t i = 0; i < std::max(numOfBalls, oldBalls); ++i) {
+        CellRange range = {};
+        if (i < numOfBalls) {
+            range = _ComputeRange(f4Balls[i]);
+            if (i < oldBalls && _IsSameRange(range.lo, _ranges[i].lo) &&
+                _IsSameRange(range.hi, _ranges[i].hi)) {
+                continue;
+            }
+        }
+        _moved[i] = 1;
+        ++_movedBalls;
+        if (i < oldBalls) {
+            forEachCell(_ranges[i], [&](size_t cell) {
+                _dirtyCells[cell] = 1;
+            });
+        }
+        if (i < numOfBalls) {
+            // old range isn't needed anymore
+            if (i < oldBalls) {
+                _ranges[i] = range;
+            } else {
+                _ranges.push_back(range);
+            }
+        }
+    }
+    _ranges.resize(numOfBalls);
+    for (size_t cell = 0; cell < _cells.size(); ++cell) {
+        if (_dirtyCells[cell]) {
+            std::vector<uint32_t>& balls = _cells[cell];
+            balls.erase(std::remove_if(balls.begin(), balls.end(),
+                [&](uint32_t ball) { return _moved[ball] != 0; }),
+                balls.end());
+            _mergeFrom[cell] = (uint32_t)balls.size();
+        }
+    }
+    // Moved balls are appended in ascending order, so every cell holds two
+    // sorted runs merged in _Flatten
+    for (uint32_t i = 0; i < numOfBalls; ++i) {
+        if (!_moved[i]) {
+            continue;
+        }
+        forEachCell(_ranges[i], [&](size_t cell) {
+            std::vector<uint32_t>& balls = _cells[cell];
+            if (!_dirtyCells[cell]) {
+                _dirtyCells[cell] = 1;
+                _mergeFrom[cell] = (uint32_t)balls.size();
+            }
+            balls.push_back(i);
+        });
+    }
+    _Flatten();
+    _invalidated = false;
+}
+
+BallGrid::CellRange
+BallGrid::_ComputeRange(const float4& ball) const
+{
+    const float radius = BallBins::InfluenceRadius(
+        ball.w, _vParam.fMinDensity, _cullRatio) / _vParam.fVoxelSize;
+    const float center[3] = {ball.x, ball.y, ball.z};
+    const uint reso[3] = {_vParam.u3VoxelReso.x, _vParam.u3VoxelReso.y,
+        _vParam.u3VoxelReso.z};
+    uint lo[3], hi[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        // voxel i has its center at (i - half + 0.5) * voxelSize
+        float c = center[axis] / _vParam.fVoxelSize + reso[axis] * 0.5f - 0.5f;
+        float fLo = std::max(0.f, std::ceil(c - radius));
+        float fHi = std::min(reso[axis] - 1.f, std::floor(c + radius));
+        if (fLo > fHi) {
+            CellRange empty = {uint3(1, 1, 1), uint3(0, 0, 0)};
+            return empty;
+        }
+        lo[axis] = (uint)fLo / _cellSize;
+        hi[axis] = (uint)fHi / _cellSize;
+    }
+    CellRange range = {uint3(lo[0], lo[1], lo[2]), uint3(hi[0], hi[1], hi[2])};
+    return range;
+}
+
+void
+BallGrid::_Flatten()
+{
+    _cellOffsets.resize(_cells.size() + 1);
+    _cellOffsets[0] = 0;
+    for (size_t i = 0; i < _cells.size(); ++i) {
+        if (_dirtyCells[i]) {
+            std::inplace_merge(_cells[i].begin(),
+                _cells[i].begin() + _mergeFrom[i], _cells[i].end());
+            _dirtyCells[i] = 0;
+        }
+        _cellOffsets[i + 1] = _cellOffsets[i] + (uint32_t)_cells[i].size();
+    }
+    _cellEntries.resize(_cellOffsets.back());
+    for (size_t i = 0; i < _cells.size(); ++i) {
+        std::copy(_cells[i].begin(), _cells[i].end(),
+            _cellEntries.begin() + _cellOffsets[i]);
+    }
+}
+
+std::vector<BallGrid::ScalingResult>
+BallGrid::BenchmarkScaling(const PerCallDataCB& perCall, uint reso,
+    const std::vector<uint>& ballCounts, uint cellSize, float cullRatio,
+    WorkStealingPool* pool)
+{
+    std::vector<ScalingResult> results;
+    PerFrameDataCB perFrame = {};
+    PerCallDataCB cb = perCall;
+    VolumeParam& vParam = cb.vParam;
+    vParam.u3VoxelReso = uint3(reso, reso, reso);
+    const uint ratio = std::max<uint>(1, vParam.uVoxelBrickRatio);
+    vParam.uVoxelBrickRatio = ratio;
+    const float volSize = reso * vParam.fVoxelSize;
+    // ~60fps animation step
+    const float timeStep = 1.f / 60.f;
+
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    vol.Resize(vParam.u3VoxelReso, ratio);
+    for (uint ballCount : ballCounts) {
+        std::mt19937 rng(ballCount);
+        std::uniform_real_distribution<float> rand01(0.f, 1.f);
+        const float sizeScale = std::cbrt((float)MAX_BALLS / ballCount);
+        std::vector<BenchBall> balls(ballCount);
+        for (auto& ball : balls) {
+            float r = (0.6f * rand01(rng) + 0.7f) * volSize * 0.05f;
+            ball.fOrbitRadius = volSize * (0.3f + (rand01(rng) - 0.3f) * 0.2f);
+            float speedF = 6.f * (rand01(rng) - 0.5f);
+            if (std::abs(speedF) < 1.f) {
+                speedF = speedF > 0.f ? 1.f : -1.f;
+            }
+            ball.fOrbitSpeed = 1.f / (r * r) * 0.0005f * speedF;
+            ball.fOrbitStartPhase = rand01(rng) * 6.28f;
+            r *= sizeScale;
+            ball.fPower = r * r;
+        }
+
+        BallGrid grid;
+        grid.f4Balls.resize(ballCount);
+        grid.f4BallsCol.resize(ballCount);
+        for (uint i = 0; i < ballCount; ++i) {
+            grid.f4BallsCol[i] = float4(rand01(rng), rand01(rng), rand01(rng),
+                1.f);
+        }
+        ScalingResult result = {};
+        result.uNumOfBalls = ballCount;
+
+        _PlaceBalls(balls, 0.f, grid);
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        grid.Update(vParam, cellSize, cullRatio);
+        result.dRebuildMs = ElapsedMs(start);
+
+        _PlaceBalls(balls, timeStep, grid);
+        start = BenchmarkClock::now();
+        grid.Update(vParam, cellSize, cullRatio);
+        result.dIncrementalMs = ElapsedMs(start);
+        result.uMovedBalls = grid.GetMovedBalls();
+        result.dAvgBallsPerCell =
+            (double)grid.GetCellEntries().size() / grid.GetCellCount();
+
+        updater.SetBallGrid(&grid);
+        start = BenchmarkClock::now();
+        updater.Update(perFrame, cb, vol, true,
+            CPUVolumeUpdater::kSIMDLane, pool);
+        result.dUpdateMs = ElapsedMs(start);
+        result.dVoxelsPerSec =
+            (double)reso * reso * reso / (result.dUpdateMs * 1e-3);
+        results.push_back(result);
+    }
+    return results;
+}
@@ -0,0 +1,94 @@
+#pragma once
+// Growable metaball storage (f4Balls/f4BallsCol of PerFrameDataCB without the
+// MAX_BALLS limit) plus a uniform grid over the volume. Every ball is listed
+// in all cells its influence box (see BallBins::InfluenceRadius) overlaps, so
+// a voxel only accumulates the balls of its own cell.
+//
+// The grid is kept incrementally: per ball the covered cell range of the last
+// Update is remembered, only balls whose range changed are removed from their
+// old cells and inserted into the new ones. Cell lists stay sorted by ball
+// index so accumulation order matches the full loop.
+#include "CPUVolumeUpdater.h"
+
+class BallGrid
+{
+public:
+    struct ScalingResult {
+        uint uNumOfBalls;
+        double dRebuildMs; // grid built from scratch
+        double dIncrementalMs; // grid update after one animation step
+        size_t uMovedBalls; // balls re-binned by that update
+        double dUpdateMs; // volume update querying the grid
+        double dVoxelsPerSec;
+        double dAvgBallsPerCell;
+    };
+
+    // ball i: xyz center, w power / color, same as PerFrameDataCB
+    std::vector<float4> f4Balls;
+    std::vector<float4> f4BallsCol;
+
+    BallGrid();
+    ~BallGrid();
+
+    // Bring the cell lists in line with f4Balls. Any change of volume
+    // params, cell size (in voxels) or cull ratio rebuilds from scratch
+    void Update(const VolumeParam& vParam, uint cellSize, float cullRatio);
+    inline void Invalidate() { _invalidated = true; };
+
+    inline const uint3& GetGridReso() const { return _gridReso; };
+    inline uint GetCellSize() const { return _cellSize; };
+    inline size_t GetCellCount() const { return _cells.size(); };
+    // Balls re-binned by the last Update
+    inline size_t GetMovedBalls() const { return _movedBalls; };
+    inline size_t CellIdx(uint x, uint y, uint z) const {
+        return x + (size_t)y * _gridReso.x +
+            (size_t)z * _gridReso.x * _gridReso.y;
+    }
+    // CSR layout for upload, balls of cell i are
+    // cellEntries[cellOffsets[i], cellOffsets[i+1])
+    inline const std::vector<uint32_t>& GetCellOffsets() const {
+        return _cellOffsets;
+    };
+    inline const std::vector<uint32_t>& GetCellEntries() const {
+        return _cellEntries;
+    };
+    inline const uint32_t* GetBalls(size_t cell) const {
+        return _cellEntries.data() + _cellOffsets[cell];
+    }
+    inline uint GetBallCount(size_t cell) const {
+        return _cellOffsets[cell + 1] - _cellOffsets[cell];
+    }
+
+    // Orbiting random balls at reso^3 for every ball count, ball size shrinks
+    // with the count so the occupied volume stays about the same
+    static std::vector<ScalingResult> BenchmarkScaling(
+        const PerCallDataCB& perCall, uint reso,
+        const std::vector<uint>& ballCounts, uint cellSize, float cullRatio,
+        WorkStealingPool* pool = nullptr);
+
+private:
+    // covered cells [lo, hi], lo.x > hi.x when empty
+    struct CellRange {
+        uint3 lo;
+        uint3 hi;
+    };
+
+    CellRange _ComputeRange(const float4& ball) const;
+    void _Flatten();
+
+    VolumeParam _vParam;
+    uint _cellSize;
+    float _cullRatio;
+    uint3 _gridReso;
+    bool _invalidated;
+    size_t _movedBalls;
+    std::vector<CellRange> _ranges;
+    std::vector<uint8_t> _moved;
+    std::vector<std::vector<uint32_t>> _cells;
+    // cells touched by this Update, their list is sorted up to _mergeFrom
+    // and from there on
+    std::vector<uint8_t> _dirtyCells;
+    std::vector<uint32_t> _mergeFrom;
+    std::vector<uint32_t> _cellOffsets;
+    std::vector<uint32_t> _cellEntries;
+};
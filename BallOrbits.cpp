@@ -0,0 +1,182 @@
+#include "BallOrbits.h"
+#include "SIMDLane.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+    // Cephes style sinf/cosf: reduce by pi/2 (3 part Cody-Waite), minimax
+    // polynomials on [-pi/4, pi/4], quadrant fix-up done arithmetically with
+    // 0/1 factors so it only needs the basic lane ops
+    template <typename L>
+    inline void _SinCos(L x, L& sinX, L& cosX)
+    {
+        const L one = L::Set1(1.f);
+        const L half = L::Set1(0.5f);
+        L j = Floor(x * L::Set1(0.636619772f) + half);
+        L r = ((x - j * L::Set1(1.5703125f)) -
+            j * L::Set1(4.837512969970703125e-4f)) -
+            j * L::Set1(7.549789948768648e-8f);
+        L r2 = r * r;
+        L s = r + r * r2 * (L::Set1(-1.6666654611e-1f) +
+            r2 * (L::Set1(8.3321608736e-3f) +
+            r2 * L::Set1(-1.9515295891e-4f)));
+        L c = one - half * r2 + r2 * r2 * (L::Set1(4.166664568298827e-2f) +
+            r2 * (L::Set1(-1.388731625493765e-3f) +
+            r2 * L::Set1(2.443315711809948e-5f)));
+        // quadrant q in 0..3, odd quadrants swap sin and cos
+        L q = j - L::Set1(4.f) * Floor(j * L::Set1(0.25f));
+        L swap = q - L::Set1(2.f) * Floor(q * half);
+        L keep = one - swap;
+        // sin is negative in quadrant 2, 3, cos in quadrant 1, 2
+        L signS = one - L::Set1(2.f) * Floor(q * half);
+        L q1 = q + one;
+        q1 = q1 - L::Set1(4.f) * Floor(q1 * L::Set1(0.25f));
+        L signC = one - L::Set1(2.f) * Floor(q1 * half);
+        sinX = (s * keep + c * swap) * signS;
+        cosX = (c * keep + s * swap) * signC;
+    }
+
+    template <typename L>
+    void _Evaluate(float time, const float* power, const float* orbitRadius,
+        const float* orbitSpeed, const float* orbitStartPhase,
+        uint numOfBalls, float4* balls)
+    {
+        const L t = L::Set1(time);
+        const L t2 = L::Set1(2.f * time);
+        const L zScale = L::Set1(0.3f);
+        float x[L::kWidth], y[L::kWidth], z[L::kWidth];
+        uint i = 0;
+        for (; i + L::kWidth <= numOfBalls; i += L::kWidth) {
+            const L radius = L::Load(orbitRadius + i);
+            const L speed = L::Load(orbitSpeed + i);
+            const L phase = L::Load(orbitStartPhase + i);
+            L sinA, cosA, sin2A, cos2A;
+            _SinCos(t * speed + phase, sinA, cosA);
+            _SinCos(t2 * speed + phase, sin2A, cos2A);
+            (radius * cosA).Store(x);
+            (radius * sinA).Store(y);
+            (zScale * radius * sin2A).Store(z);
+            for (uint k = 0; k < (uint)L::kWidth; ++k) {
+                balls[i + k] = float4(x[k], y[k], z[k], power[i + k]);
+            }
+        }
+        // tail with the scalar lane, same polynomial
+        for (; i < numOfBalls; ++i) {
+            SIMD::Lane1 sinA, cosA, sin2A, cos2A;
+            _SinCos(SIMD::Lane1::Set1(time * orbitSpeed[i] +
+                orbitStartPhase[i]), sinA, cosA);
+            _SinCos(SIMD::Lane1::Set1(2.f * time * orbitSpeed[i] +
+                orbitStartPhase[i]), sin2A, cos2A);
+            balls[i] = float4(orbitRadius[i] * cosA.v,
+                orbitRadius[i] * sinA.v, 0.3f * orbitRadius[i] * sin2A.v,
+                power[i]);
+        }
+    }
+
+    // Layout and loop of SparseVolume::Ball / _UpdatePerFrameData
+    struct AoSBall {
+        float fPower;
+        float fOribtRadius;
+        float fOribtSpeed;
+        float fOribtStartPhase;
+        float4 f4Color;
+    };
+}
+
+BallOrbits::BallOrbits()
+{
+}
+
+BallOrbits::~BallOrbits()
+{
+}
+
+void
+BallOrbits::Add(float fPower, float fOrbitRadius, float fOrbitSpeed,
+    float fOrbitStartPhase, const float4& f4Color)
+{
+    _power.push_back(fPower);
+    _orbitRadius.push_back(fOrbitRadius);
+    _orbitSpeed.push_back(fOrbitSpeed);
+    _orbitStartPhase.push_back(fOrbitStartPhase);
+    _color.push_back(f4Color);
+}
+
+void
+BallOrbits::Evaluate(float time, uint numOfBalls, float4* balls,
+    float4* cols) const
+{
+    numOfBalls = std::min<uint>(numOfBalls, (uint)Size());
+    _Evaluate<SIMD::LaneN>(time, _power.data(), _orbitRadius.data(),
+        _orbitSpeed.data(), _orbitStartPhase.data(), numOfBalls, balls);
+    if (cols) {
+        std::copy(_color.begin(), _color.begin() + numOfBalls, cols);
+    }
+}
+
+std::vector<BallOrbits::BenchmarkResult>
+BallOrbits::Benchmark(const std::vector<uint>& ballCounts, uint iterations)
+{
+    std::vector<BenchmarkResult> results;
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> rand01(0.f, 1.f);
+    for (uint ballCount : ballCounts) {
+        std::vector<AoSBall> aos(ballCount);
+        BallOrbits soa;
+        for (auto& ball : aos) {
+            ball.fPower = 0.0025f * (0.5f + rand01(rng));
+            ball.fOribtRadius = 0.3f * (0.5f + rand01(rng));
+            ball.fOribtSpeed = 0.2f * (6.f * rand01(rng) - 3.f);
+            ball.fOribtStartPhase = rand01(rng) * 6.28f;
+            ball.f4Color = float4(rand01(rng), rand01(rng), rand01(rng), 1.f);
+            soa.Add(ball.fPower, ball.fOribtRadius, ball.fOribtSpeed,
+                ball.fOribtStartPhase, ball.f4Color);
+        }
+        std::vector<float4> aosBalls(ballCount), aosCols(ballCount);
+        std::vector<float4> soaBalls(ballCount), soaCols(ballCount);
+        BenchmarkResult result = {};
+        result.uNumOfBalls = ballCount;
+
+        // a few minutes into the animation
+        double animateTime = 100.0;
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        for (uint it = 0; it < iterations; ++it) {
+            animateTime += 1.0 / 60.0;
+            for (uint i = 0; i < ballCount; i++) {
+                AoSBall ball = aos[i];
+                aosBalls[i].x =
+                    ball.fOribtRadius * (float)cosf((float)animateTime *
+                        ball.fOribtSpeed + ball.fOribtStartPhase);
+                aosBalls[i].y =
+                    ball.fOribtRadius * (float)sinf((float)animateTime *
+                        ball.fOribtSpeed + ball.fOribtStartPhase);
+                aosBalls[i].z =
+                    0.3f * ball.fOribtRadius * (float)sinf(
+                        2.f * (float)animateTime * ball.fOribtSpeed +
+                        ball.fOribtStartPhase);
+                aosBalls[i].w = ball.fPower;
+                aosCols[i] = ball.f4Color;
+            }
+        }
+        result.dAoSMs = ElapsedMs(start) / iterations;
+
+        animateTime = 100.0;
+        start = BenchmarkClock::now();
+        for (uint it = 0; it < iterations; ++it) {
+            animateTime += 1.0 / 60.0;
+            soa.Evaluate((float)animateTime, ballCount, soaBalls.data(),
+                soaCols.data());
+        }
+        result.dSoAMs = ElapsedMs(start) / iterations;
+
+        for (uint i = 0; i < ballCount; ++i) {
+            result.fMaxError = std::max(result.fMaxError, std::max(
+                std::abs(aosBalls[i].x - soaBalls[i].x), std::max(
+                std::abs(aosBalls[i].y - soaBalls[i].y),
+                std::abs(aosBalls[i].z - soaBalls[i].z))));
+        }
+        results.push_back(result);
+    }
+    return results;
+}
@@ -0,0 +1,42 @@
+#pragma once
+// SoA store of the metaball orbits (SparseVolume::Ball split into one array
+// per field). Positions of a batch of balls are evaluated with a vectorized
+// sincos and written straight into f4Balls/f4BallsCol layout, i.e. directly
+// into PerFrameDataCB or BallGrid storage.
+#include "CPUVolumeUpdater.h"
+
+class BallOrbits
+{
+public:
+    struct BenchmarkResult {
+        uint uNumOfBalls;
+        double dAoSMs; // scalar cosf/sinf loop over AoS balls
+        double dSoAMs; // SIMD batch
+        // largest position difference between both
+        float fMaxError;
+    };
+
+    BallOrbits();
+    ~BallOrbits();
+
+    void Add(float fPower, float fOrbitRadius, float fOrbitSpeed,
+        float fOrbitStartPhase, const float4& f4Color);
+    inline size_t Size() const { return _power.size(); };
+
+    // Position of ball i at time: xy on the orbit circle, z oscillating at
+    // twice the orbit speed, w power. cols may be nullptr, colors don't
+    // change over time
+    void Evaluate(float time, uint numOfBalls, float4* balls,
+        float4* cols) const;
+
+    // AoS scalar loop as in _UpdatePerFrameData vs Evaluate
+    static std::vector<BenchmarkResult> Benchmark(
+        const std::vector<uint>& ballCounts, uint iterations = 10);
+
+private:
+    std::vector<float> _power;
+    std::vector<float> _orbitRadius;
+    std::vector<float> _orbitSpeed;
+    std::vector<float> _orbitStartPhase;
+    std::vector<float4> _color;
+};
@@ -0,0 +1,12 @@
+#pragma once
+// Wall clock of the CPU benchmarks and the per call timings they report
+#include <chrono>
+
+typedef std::chrono::high_resolution_clock BenchmarkClock;
+
+// Milliseconds since start
+inline double ElapsedMs(const BenchmarkClock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(
+        BenchmarkClock::now() - start).count();
+}
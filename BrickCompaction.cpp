@@ -0,0 +1,139 @@
+#include "BrickCompaction.h"
+#include "WorkStealingPool.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <cstddef>
+
+namespace {
+    // flag words counted and scanned per job
+    const uint32_t kWordChunk = 256;
+    // compactions timed per ratio, a single one is too short to measure
+    const uint kBenchmarkRuns = 16;
+
+    static_assert(sizeof(BrickCompaction::DrawIndexedArgs) ==
+        BRICK_DRAW_ARGS_GRID - BRICK_DRAW_ARGS_NEAR_FAR &&
+        offsetof(BrickCompaction::DrawIndexedArgs, uInstanceCount) ==
+        BRICK_DRAW_ARGS_INSTANCES,
+        "BrickCompaction::DrawIndexedArgs out of sync with BRICK_DRAW_ARGS");
+}
+
+BrickCompaction::BrickCompaction()
+{
+    const DrawIndexedArgs nearFar = {CUBE_TRIANGLESTRIP_LENGTH, 0, 0, 0, 0};
+    const DrawIndexedArgs grid = {CUBE_LINESTRIP_LENGTH, 0, 0, 0, 0};
+    _args[0] = nearFar;
+    _args[1] = grid;
+}
+
+BrickCompaction::~BrickCompaction()
+{
+}
+
+void
+BrickCompaction::Compact(const CPUVolume& vol, WorkStealingPool* pool)
+{
+    const BrickFlags& flags = vol.flags;
+    const uint32_t wordCount = (uint32_t)flags.GetWordCount();
+    const uint32_t chunks = (wordCount + kWordChunk - 1) / kWordChunk;
+    _chunkOffsets.assign((size_t)chunks + 1, 0);
+
+    auto countChunk = [&](uint32_t chunk, uint32_t) {
+        _chunkOffsets[chunk + 1] = (uint32_t)flags.Count(chunk * kWordChunk,
+            std::min((chunk + 1) * kWordChunk, wordCount));
+    };
+    if (pool) {
+        pool->ParallelFor(chunks, countChunk);
+    } else {
+        for (uint32_t chunk = 0; chunk < chunks; ++chunk) {
+            countChunk(chunk, 0);
+        }
+    }
+    for (uint32_t chunk = 0; chunk < chunks; ++chunk) {
+        _chunkOffsets[chunk + 1] += _chunkOffsets[chunk];
+    }
+
+    _activeBricks.resize(_chunkOffsets.back());
+    auto scanChunk = [&](uint32_t chunk, uint32_t) {
+        flags.Scan(chunk * kWordChunk,
+            std::min((chunk + 1) * kWordChunk, wordCount),
+            _activeBricks.data() + _chunkOffsets[chunk]);
+    };
+    if (pool) {
+        pool->ParallelFor(chunks, scanChunk);
+    } else {
+        for (uint32_t chunk = 0; chunk < chunks; ++chunk) {
+            scanChunk(chunk, 0);
+        }
+    }
+    _args[0].uInstanceCount = _args[1].uInstanceCount =
+        (uint32_t)_activeBricks.size();
+}
+
+std::vector<BrickCompaction::BenchmarkResult>
+BrickCompaction::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, const std::vector<uint>& ratios,
+    WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    BrickCompaction compaction;
+    std::vector<uint8_t> bytes;
+    std::vector<uint32_t> reference, bitScan;
+    for (uint ratio : ratios) {
+        vParam.uVoxelBrickRatio = std::max<uint>(1, ratio);
+        vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+        updater.Update(perFrame, cb, vol, true, CPUVolumeUpdater::kSIMDLane,
+            pool);
+        BenchmarkResult result = {};
+        result.uBrickRatio = vParam.uVoxelBrickRatio;
+        result.uBrickCount = vol.flags.GetBrickCount();
+        result.uFlagBytes = vol.flags.GetWordCount() * sizeof(uint32_t);
+        bytes.resize(result.uBrickCount);
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            bytes[i] = vol.flags.Test(i) ? 1 : 0;
+        }
+
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        for (uint run = 0; run < kBenchmarkRuns; ++run) {
+            compaction.Compact(vol, pool);
+        }
+        result.dCompactMs = ElapsedMs(start) / kBenchmarkRuns;
+
+        start = BenchmarkClock::now();
+        for (uint run = 0; run < kBenchmarkRuns; ++run) {
+            reference.clear();
+            for (uint32_t i = 0; i < (uint32_t)bytes.size(); ++i) {
+                if (bytes[i]) {
+                    reference.push_back(i);
+                }
+            }
+        }
+        result.dByteScanMs = ElapsedMs(start) / kBenchmarkRuns;
+
+        bitScan.resize(vol.flags.GetBrickCount());
+        const uint32_t* scanEnd = bitScan.data();
+        start = BenchmarkClock::now();
+        for (uint run = 0; run < kBenchmarkRuns; ++run) {
+            scanEnd = vol.flags.Scan(0, vol.flags.GetWordCount(),
+                bitScan.data());
+        }
+        result.dBitScanMs = ElapsedMs(start) / kBenchmarkRuns;
+        bitScan.resize(scanEnd - bitScan.data());
+
+        const std::vector<uint32_t>& bricks = compaction.GetActiveBricks();
+        result.uFlaggedBricks = bricks.size();
+        result.uGridIndices = result.uBrickCount * CUBE_TRIANGLESTRIP_LENGTH;
+        result.uCompactIndices =
+            (size_t)compaction.GetNearFarArgs().uInstanceCount *
+            compaction.GetNearFarArgs().uIndexCountPerInstance;
+        result.bMatches = bricks == reference && bitScan == reference &&
+            compaction.GetNearFarArgs().uInstanceCount == reference.size() &&
+            compaction.GetGridArgs().uInstanceCount == reference.size();
+        results.push_back(result);
+    }
+    return results;
+}
@@ -0,0 +1,68 @@
+#pragma once
+// CPU counterpart of SparseVolume_BrickCompact_cs.hlsl. The flat indices of
+// the bricks flagged in CPUVolume::flags get packed into a list, and the
+// D3D12_DRAW_INDEXED_ARGUMENTS records _RenderNearFar and _RenderBrickGrid
+// draw from get one instance per listed brick, instead of one per brick of
+// the grid. Chunks of flag words are popcounted across the pool and scanned
+// behind an exclusive prefix sum of the counts, so unlike the GPU, which
+// packs groups in whatever order they finish, the list stays in flat order.
+#include "CPUVolumeUpdater.h"
+
+class BrickCompaction
+{
+public:
+    // Layout of D3D12_DRAW_INDEXED_ARGUMENTS
+    struct DrawIndexedArgs {
+        uint32_t uIndexCountPerInstance;
+        uint32_t uInstanceCount;
+        uint32_t uStartIndexLocation;
+        int32_t iBaseVertexLocation;
+        uint32_t uStartInstanceLocation;
+    };
+
+    struct BenchmarkResult {
+        uint uBrickRatio;
+        size_t uBrickCount; // instances of the full grid
+        size_t uFlaggedBricks;
+        double dCompactMs;
+        // single threaded scans of the flags as one byte per brick (the
+        // former R8_UINT _flagVol) and as BrickFlags words
+        double dByteScanMs;
+        double dBitScanMs;
+        size_t uFlagBytes; // BrickFlags words, uBrickCount bytes before
+        // indices run through SparseVolume_StepInfo_vs.hlsl by the near/far
+        // pass, for the full grid and for the compacted list
+        size_t uGridIndices;
+        size_t uCompactIndices;
+        // list and records equal the byte scan
+        bool bMatches;
+    };
+
+    BrickCompaction();
+    ~BrickCompaction();
+
+    void Compact(const CPUVolume& vol, WorkStealingPool* pool = nullptr);
+
+    inline const std::vector<uint32_t>& GetActiveBricks() const {
+        return _activeBricks;
+    };
+    // Records at BRICK_DRAW_ARGS_NEAR_FAR and BRICK_DRAW_ARGS_GRID
+    inline const DrawIndexedArgs& GetNearFarArgs() const {
+        return _args[0];
+    };
+    inline const DrawIndexedArgs& GetGridArgs() const { return _args[1]; };
+
+    // Compact the flags of reso^3 for every brick ratio against serial
+    // scans, volume updated through the balls of perFrame
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, const std::vector<uint>& ratios,
+        WorkStealingPool* pool = nullptr);
+
+private:
+    // flagged bricks per chunk of words, then where each chunk's bricks
+    // start
+    std::vector<uint32_t> _chunkOffsets;
+    std::vector<uint32_t> _activeBricks;
+    DrawIndexedArgs _args[2];
+};
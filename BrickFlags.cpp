@@ -0,0 +1,119 @@
+#include "BrickFlags.h"
+#include "SIMDLane.h"
+#include <algorithm>
+
+namespace {
+    inline uint32_t _Popcount(uint32_t word)
+    {
+#if defined(_MSC_VER)
+        return __popcnt(word);
+#else
+        return (uint32_t)__builtin_popcount(word);
+#endif
+    }
+
+    // lowest set bit, word != 0
+    inline uint32_t _LowestBit(uint32_t word)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward(&idx, word);
+        return (uint32_t)idx;
+#else
+        return (uint32_t)__builtin_ctz(word);
+#endif
+    }
+
+    inline uint32_t* _ScanWord(uint32_t word, uint32_t base, uint32_t* out)
+    {
+        while (word) {
+            *out++ = base + _LowestBit(word);
+            word &= word - 1u;
+        }
+        return out;
+    }
+
+    // words tested at once for being all empty
+#if SIMD_AVX2
+    const size_t kScanWords = 8;
+    inline bool _EmptyWords(const uint32_t* words)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)words);
+        return _mm256_testz_si256(v, v) != 0;
+    }
+#elif SIMD_SSE
+    const size_t kScanWords = 4;
+    inline bool _EmptyWords(const uint32_t* words)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)words);
+        return _mm_movemask_epi8(
+            _mm_cmpeq_epi32(v, _mm_setzero_si128())) == 0xffff;
+    }
+#elif SIMD_NEON
+    const size_t kScanWords = 4;
+    inline bool _EmptyWords(const uint32_t* words)
+    {
+        const uint32x4_t v = vld1q_u32(words);
+        const uint32x2_t half = vorr_u32(vget_low_u32(v), vget_high_u32(v));
+        return (vget_lane_u32(half, 0) | vget_lane_u32(half, 1)) == 0;
+    }
+#else
+    const size_t kScanWords = 1;
+    inline bool _EmptyWords(const uint32_t* words)
+    {
+        return *words == 0;
+    }
+#endif
+}
+
+void
+BrickFlags::Resize(size_t brickCount)
+{
+    _brickCount = brickCount;
+    _words.assign((brickCount + kWordBits - 1) / kWordBits, 0);
+}
+
+void
+BrickFlags::ClearAll()
+{
+    std::fill(_words.begin(), _words.end(), 0);
+}
+
+size_t
+BrickFlags::Count(size_t wordBegin, size_t wordEnd) const
+{
+    size_t count = 0;
+    for (size_t i = wordBegin; i < wordEnd; ++i) {
+        count += _Popcount(_words[i]);
+    }
+    return count;
+}
+
+uint32_t*
+BrickFlags::Scan(size_t wordBegin, size_t wordEnd, uint32_t* out) const
+{
+    const uint32_t* words = _words.data();
+    size_t i = wordBegin;
+    for (; i + kScanWords <= wordEnd; i += kScanWords) {
+        if (_EmptyWords(words + i)) {
+            continue;
+        }
+        for (size_t j = i; j < i + kScanWords; ++j) {
+            out = _ScanWord(words[j], (uint32_t)(j * kWordBits), out);
+        }
+    }
+    for (; i < wordEnd; ++i) {
+        out = _ScanWord(words[i], (uint32_t)(i * kWordBits), out);
+    }
+    return out;
+}
+
+size_t
+BrickFlags::CountDiff(const BrickFlags& a, const BrickFlags& b)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < a._words.size(); ++i) {
+        count += _Popcount(a._words[i] ^ b._words[i]);
+    }
+    return count;
+}
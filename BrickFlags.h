@@ -0,0 +1,72 @@
+#pragma once
+// One bit per brick, bit (i & 31) of word i >> 5 for the flat brick index i
+// (CPUVolume::BrickIdx), the layout _flagVol has on the GPU. Counting goes
+// by popcount, clearing and comparing a word at a time, and the scan skips
+// empty words a SIMD register at a time.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class BrickFlags
+{
+public:
+    enum {
+        kWordBits = 32,
+    };
+
+    // brickCount bricks, none flagged
+    void Resize(size_t brickCount);
+    void ClearAll();
+
+    inline size_t GetBrickCount() const { return _brickCount; };
+    inline size_t GetWordCount() const { return _words.size(); };
+    inline const uint32_t* GetWords() const { return _words.data(); };
+
+    inline bool Test(size_t brick) const {
+        return (_words[brick / kWordBits] >> (brick % kWordBits)) & 1u;
+    };
+    // Safe while other workers flag bricks of the same word, most calls find
+    // the bit set already and skip the atomic
+    inline void Set(size_t brick) {
+        uint32_t* word = &_words[brick / kWordBits];
+        const uint32_t bit = 1u << (brick % kWordBits);
+        if (!(_LoadRelaxed(word) & bit)) {
+            _AtomicOr(word, bit);
+        }
+    };
+    // Not safe against Set on bricks of the same word
+    inline void Reset(size_t brick) {
+        _words[brick / kWordBits] &= ~(1u << (brick % kWordBits));
+    };
+
+    // Flagged bricks of words [wordBegin, wordEnd)
+    size_t Count(size_t wordBegin, size_t wordEnd) const;
+    inline size_t Count() const { return Count(0, _words.size()); };
+    // Write the flat indices of the flagged bricks of words
+    // [wordBegin, wordEnd) to out in ascending order, returns the end
+    uint32_t* Scan(size_t wordBegin, size_t wordEnd, uint32_t* out) const;
+    // Bricks flagged in only one of a and b, both of the same size
+    static size_t CountDiff(const BrickFlags& a, const BrickFlags& b);
+
+private:
+    static inline uint32_t _LoadRelaxed(const uint32_t* word) {
+#if defined(_MSC_VER)
+        return *(const volatile uint32_t*)word;
+#else
+        return __atomic_load_n(word, __ATOMIC_RELAXED);
+#endif
+    };
+    static inline void _AtomicOr(uint32_t* word, uint32_t bit) {
+#if defined(_MSC_VER)
+        _InterlockedOr((volatile long*)word, (long)bit);
+#else
+        __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+#endif
+    };
+
+    std::vector<uint32_t> _words;
+    size_t _brickCount = 0;
+};
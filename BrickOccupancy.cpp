@@ -0,0 +1,213 @@
+#include "BrickOccupancy.h"
+#include "WorkStealingPool.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace {
+    // Float rounding inside Ball() can push the evaluated density slightly
+    // above the analytic bound, keep some headroom
+    const float _boundMargin = 0.999f;
+
+    inline bool _IsSameReso(const uint3& a, const uint3& b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+}
+
+BrickOccupancy::BrickOccupancy()
+    : _reso(0, 0, 0),
+    _brickReso(0, 0, 0),
+    _ratio(0),
+    _invalidated(true)
+{
+}
+
+BrickOccupancy::~BrickOccupancy()
+{
+}
+
+float
+BrickOccupancy::DensityUpperBound(const PerFrameDataCB& perFrame,
+    uint numOfBalls, const float3& boxMin, const float3& boxMax,
+    float earlyOut)
+{
+    float bound = 0.f;
+    for (uint i = 0; i < numOfBalls; ++i) {
+        const float4& ball = perFrame.f4Balls[i];
+        float dx = std::max(0.f,
+            std::max(boxMin.x - ball.x, ball.x - boxMax.x));
+        float dy = std::max(0.f,
+            std::max(boxMin.y - ball.y, ball.y - boxMax.y));
+        float dz = std::max(0.f,
+            std::max(boxMin.z - ball.z, ball.z - boxMax.z));
+        float distSq = dx * dx + dy * dy + dz * dz;
+        if (distSq <= 0.f) {
+            return std::numeric_limits<float>::infinity();
+        }
+        bound += ball.w / distSq;
+        if (bound >= earlyOut) {
+            break;
+        }
+    }
+    return bound;
+}
+
+void
+BrickOccupancy::Build(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, WorkStealingPool* pool)
+{
+    const VolumeParam& vParam = perCall.vParam;
+    const uint3& reso = vParam.u3VoxelReso;
+    const uint ratio = vParam.uVoxelBrickRatio;
+    if (!_IsSameReso(reso, _reso) || ratio != _ratio) {
+        _reso = reso;
+        _ratio = ratio;
+        _brickReso = uint3(reso.x / ratio, reso.y / ratio, reso.z / ratio);
+        _invalidated = true;
+    }
+    const size_t brickCount =
+        (size_t)_brickReso.x * _brickReso.y * _brickReso.z;
+    _prevOccupied.swap(_occupied);
+    _prevOccupied.resize(brickCount, 0);
+    _occupied.assign(brickCount, 0);
+
+    const uint numOfBalls = std::min<uint>(perCall.uNumOfBalls, MAX_BALLS);
+    const float voxelSize = vParam.fVoxelSize;
+    const float threshold = vParam.fMinDensity * _boundMargin;
+    auto classifySlice = [&](uint32_t z, uint32_t) {
+        // bounds of the voxel centers inside the brick
+        float3 boxMin, boxMax;
+        boxMin.z = (z * ratio - reso.z * 0.5f + 0.5f) * voxelSize;
+        boxMax.z = boxMin.z + (ratio - 1) * voxelSize;
+        for (uint y = 0; y < _brickReso.y; ++y) {
+            boxMin.y = (y * ratio - reso.y * 0.5f + 0.5f) * voxelSize;
+            boxMax.y = boxMin.y + (ratio - 1) * voxelSize;
+            for (uint x = 0; x < _brickReso.x; ++x) {
+                boxMin.x = (x * ratio - reso.x * 0.5f + 0.5f) * voxelSize;
+                boxMax.x = boxMin.x + (ratio - 1) * voxelSize;
+                float bound = DensityUpperBound(
+                    perFrame, numOfBalls, boxMin, boxMax, threshold);
+                _occupied[x + (size_t)y * _brickReso.x +
+                    (size_t)z * _brickReso.x * _brickReso.y] =
+                    bound >= threshold ? 1 : 0;
+            }
+        }
+    };
+    if (pool) {
+        pool->ParallelFor(_brickReso.z, classifySlice);
+    } else {
+        for (uint z = 0; z < _brickReso.z; ++z) {
+            classifySlice(z, 0);
+        }
+    }
+
+    _occupiedBricks.clear();
+    _dispatchBricks.clear();
+    for (size_t i = 0; i < brickCount; ++i) {
+        if (_occupied[i]) {
+            _occupiedBricks.push_back((uint32_t)i);
+        }
+        if (_occupied[i] || _prevOccupied[i] || _invalidated) {
+            _dispatchBricks.push_back((uint32_t)i);
+        }
+    }
+    _invalidated = false;
+}
+
+void
+BrickOccupancy::GetDispatchGroups(std::vector<uint32_t>& groups) const
+{
+    GetDispatchGroups(_dispatchBricks, _reso, _ratio, groups);
+}
+
+void
+BrickOccupancy::GetDispatchGroups(const std::vector<uint32_t>& bricks,
+    const uint3& reso, uint ratio, std::vector<uint32_t>& groups)
+{
+    const uint3 brickReso(reso.x / ratio, reso.y / ratio, reso.z / ratio);
+    const uint3 groupReso((reso.x + THREAD_X - 1) / THREAD_X,
+        (reso.y + THREAD_Y - 1) / THREAD_Y,
+        (reso.z + THREAD_Z - 1) / THREAD_Z);
+    std::vector<uint8_t> mask(
+        (size_t)groupReso.x * groupReso.y * groupReso.z, 0);
+    for (uint32_t brick : bricks) {
+        const uint bx = brick % brickReso.x;
+        const uint by = (brick / brickReso.x) % brickReso.y;
+        const uint bz = brick / (brickReso.x * brickReso.y);
+        for (uint z = bz * ratio / THREAD_Z;
+            z <= ((bz + 1) * ratio - 1) / THREAD_Z; ++z) {
+            for (uint y = by * ratio / THREAD_Y;
+                y <= ((by + 1) * ratio - 1) / THREAD_Y; ++y) {
+                for (uint x = bx * ratio / THREAD_X;
+                    x <= ((bx + 1) * ratio - 1) / THREAD_X; ++x) {
+                    mask[x + (size_t)y * groupReso.x +
+                        (size_t)z * groupReso.x * groupReso.y] = 1;
+                }
+            }
+        }
+    }
+    groups.clear();
+    for (uint z = 0; z < groupReso.z; ++z) {
+        for (uint y = 0; y < groupReso.y; ++y) {
+            for (uint x = 0; x < groupReso.x; ++x) {
+                if (mask[x + (size_t)y * groupReso.x +
+                    (size_t)z * groupReso.x * groupReso.y]) {
+                    groups.push_back(x | y << 10 | z << 20);
+                }
+            }
+        }
+    }
+}
+
+std::vector<BrickOccupancy::BenchmarkResult>
+BrickOccupancy::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, const std::vector<uint>& resos,
+    WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    CPUVolumeUpdater updater;
+    CPUVolume fullVol, sparseVol;
+    BrickOccupancy occupancy;
+    PerCallDataCB cb = perCall;
+    const uint ratio = std::max<uint>(1, cb.vParam.uVoxelBrickRatio);
+    cb.vParam.uVoxelBrickRatio = ratio;
+    for (uint reso : resos) {
+        cb.vParam.u3VoxelReso = uint3(reso, reso, reso);
+        BenchmarkResult result = {};
+        result.u3Reso = cb.vParam.u3VoxelReso;
+        fullVol.Resize(cb.vParam.u3VoxelReso, ratio);
+        sparseVol.Resize(cb.vParam.u3VoxelReso, ratio);
+
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        updater.Update(perFrame, cb, fullVol, true,
+            CPUVolumeUpdater::kSIMDLane, pool);
+        result.dFullMs = ElapsedMs(start);
+
+        // first frame after (re)creation touches everything
+        occupancy.Build(perFrame, cb, pool);
+        updater.UpdateBricks(perFrame, cb, sparseVol, true,
+            occupancy.GetDispatchBricks(), CPUVolumeUpdater::kSIMDLane, pool);
+        sparseVol.flags.ClearAll();
+
+        start = BenchmarkClock::now();
+        occupancy.Build(perFrame, cb, pool);
+        result.dPrePassMs = ElapsedMs(start);
+        start = BenchmarkClock::now();
+        updater.UpdateBricks(perFrame, cb, sparseVol, true,
+            occupancy.GetDispatchBricks(), CPUVolumeUpdater::kSIMDLane, pool);
+        result.dSparseMs = ElapsedMs(start);
+        result.uBrickCount = occupancy.GetBrickCount();
+        result.uOccupiedBricks = occupancy.GetOccupiedBricks().size();
+
+        result.uFlagMismatches =
+            BrickFlags::CountDiff(fullVol.flags, sparseVol.flags);
+        for (size_t i = 0; i < fullVol.voxels.size(); ++i) {
+            result.uVoxelMismatches += memcmp(&fullVol.voxels[i],
+                &sparseVol.voxels[i], sizeof(float4)) != 0 ? 1 : 0;
+        }
+        results.push_back(result);
+    }
+    return results;
+}
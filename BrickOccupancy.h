@@ -0,0 +1,74 @@
+#pragma once
+// Analytic brick occupancy pre-pass. The density of the metaball field inside
+// a brick is bounded from above by sum(fPower / minDistSq(brick, ball)), any
+// brick whose bound stays below fMinDensity can't get flagged by the volume
+// update and is skipped entirely.
+//
+// Skipped bricks keep their previous content. To keep that content valid
+// (below fMinDensity) a brick that turns empty is still updated once more,
+// so the dispatch list is this frame's occupied bricks plus last frame's.
+#include "CPUVolumeUpdater.h"
+
+class BrickOccupancy
+{
+public:
+    struct BenchmarkResult {
+        uint3 u3Reso;
+        size_t uBrickCount;
+        size_t uOccupiedBricks;
+        double dPrePassMs;
+        double dFullMs; // update of the whole volume
+        double dSparseMs; // update of the dispatch list only
+        // against the full update, both have to be 0
+        size_t uFlagMismatches;
+        size_t uVoxelMismatches;
+    };
+
+    BrickOccupancy();
+    ~BrickOccupancy();
+
+    // Classify all bricks for the given frame, the brick grid follows
+    // perCall.vParam (u3VoxelReso / uVoxelBrickRatio)
+    void Build(const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        WorkStealingPool* pool = nullptr);
+    // Next Build dispatches every brick, needed whenever the volume content
+    // is lost (new buffer, resolution or ratio change)
+    inline void Invalidate() { _invalidated = true; };
+
+    // Bricks that need the volume update this frame (flat brick index)
+    inline const std::vector<uint32_t>& GetDispatchBricks() const {
+        return _dispatchBricks;
+    };
+    // Bricks possibly containing density in [fMinDensity, fMaxDensity]
+    inline const std::vector<uint32_t>& GetOccupiedBricks() const {
+        return _occupiedBricks;
+    };
+    inline size_t GetBrickCount() const { return _occupied.size(); };
+    inline const uint3& GetBrickReso() const { return _brickReso; };
+    // THREAD_X/Y/Z groups covering the dispatch bricks, packed as
+    // x | y << 10 | z << 20 (see SparseVolume_VolumeUpdate_cs.hlsl)
+    void GetDispatchGroups(std::vector<uint32_t>& groups) const;
+    // Same for any list of flat brick indices of a volume at reso
+    static void GetDispatchGroups(const std::vector<uint32_t>& bricks,
+        const uint3& reso, uint ratio, std::vector<uint32_t>& groups);
+
+    // Steady state cost (second frame with unchanged balls) of pre-pass +
+    // sparse update against the full update, at reso^3 for every reso
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        const std::vector<uint>& resos, WorkStealingPool* pool = nullptr);
+
+    static float DensityUpperBound(const PerFrameDataCB& perFrame,
+        uint numOfBalls, const float3& boxMin, const float3& boxMax,
+        float earlyOut);
+
+private:
+    uint3 _reso;
+    uint3 _brickReso;
+    uint _ratio;
+    bool _invalidated;
+    std::vector<uint8_t> _occupied;
+    std::vector<uint8_t> _prevOccupied;
+    std::vector<uint32_t> _occupiedBricks;
+    std::vector<uint32_t> _dispatchBricks;
+};
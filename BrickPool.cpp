@@ -0,0 +1,196 @@
+#include "BrickPool.h"
+#include "BrickOccupancy.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+    inline size_t _PoolCapacity(size_t usedSlots)
+    {
+        const size_t slots = std::max<size_t>(usedSlots * 2,
+            BrickPool::kSlotGranularity);
+        return (slots + BrickPool::kSlotGranularity - 1) /
+            BrickPool::kSlotGranularity * BrickPool::kSlotGranularity;
+    }
+}
+
+BrickPool::BrickPool()
+    : _invalidated(true),
+    _capacity(0),
+    _nextSlot(0),
+    _dirtyBegin(0),
+    _dirtyEnd(0)
+{
+}
+
+BrickPool::~BrickPool()
+{
+}
+
+bool
+BrickPool::Update(const std::vector<uint32_t>& occupiedBricks,
+    size_t brickCount)
+{
+    const size_t needed = occupiedBricks.size();
+    if (brickCount != _slots.size()) {
+        _slots.assign(brickCount, BRICK_POOL_EMPTY);
+        _invalidated = true;
+    }
+    const bool resize = needed > _capacity ||
+        (needed * 4 < _capacity && _capacity > kSlotGranularity);
+    if (_invalidated || resize) {
+        // an invalidated pool keeps its capacity while the bricks fit
+        _Repack(occupiedBricks, resize ? _PoolCapacity(needed) : _capacity);
+        return true;
+    }
+
+    _dirtyBegin = brickCount;
+    _dirtyEnd = 0;
+    _added.clear();
+    // both lists ascending, release what dropped out before handing out
+    // slots so new bricks reuse them
+    size_t i = 0, j = 0;
+    while (i < _mapped.size() || j < needed) {
+        if (j == needed ||
+            (i < _mapped.size() && _mapped[i] < occupiedBricks[j])) {
+            const uint32_t brick = _mapped[i++];
+            _freeSlots.push_back(_slots[brick]);
+            _slots[brick] = BRICK_POOL_EMPTY;
+            _MarkDirty(brick);
+        } else if (i == _mapped.size() || occupiedBricks[j] < _mapped[i]) {
+            _added.push_back(occupiedBricks[j++]);
+        } else {
+            ++i;
+            ++j;
+        }
+    }
+    for (uint32_t brick : _added) {
+        if (_freeSlots.empty()) {
+            _slots[brick] = _nextSlot++;
+        } else {
+            _slots[brick] = _freeSlots.back();
+            _freeSlots.pop_back();
+        }
+        _MarkDirty(brick);
+    }
+    _mapped = occupiedBricks;
+    return false;
+}
+
+void
+BrickPool::_Repack(const std::vector<uint32_t>& occupiedBricks,
+    size_t capacity)
+{
+    std::fill(_slots.begin(), _slots.end(), BRICK_POOL_EMPTY);
+    for (size_t i = 0; i < occupiedBricks.size(); ++i) {
+        _slots[occupiedBricks[i]] = (uint32_t)i;
+    }
+    _mapped = occupiedBricks;
+    _freeSlots.clear();
+    _nextSlot = (uint32_t)occupiedBricks.size();
+    _capacity = capacity;
+    _dirtyBegin = 0;
+    _dirtyEnd = _slots.size();
+    _invalidated = false;
+}
+
+void
+BrickPool::_MarkDirty(size_t brick)
+{
+    _dirtyBegin = std::min(_dirtyBegin, brick);
+    _dirtyEnd = std::max(_dirtyEnd, brick + 1);
+}
+
+std::vector<BrickPool::BenchmarkResult>
+BrickPool::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, const std::vector<uint>& resos,
+    uint frames, WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    PerFrameDataCB frameCB = perFrame;
+    PerCallDataCB cb = perCall;
+    const uint ratio = std::max<uint>(1, cb.vParam.uVoxelBrickRatio);
+    cb.vParam.uVoxelBrickRatio = ratio;
+    const uint numOfBalls = std::min<uint>(cb.uNumOfBalls, MAX_BALLS);
+    const float step = 0.5f * perCall.vParam.fVoxelSize;
+    // same scene at every reso
+    const float extent =
+        perCall.vParam.u3VoxelReso.x * perCall.vParam.fVoxelSize;
+
+    BrickOccupancy occupancy;
+    for (uint reso : resos) {
+        cb.vParam.u3VoxelReso = uint3(reso, reso, reso);
+        cb.vParam.fVoxelSize = extent / reso;
+        std::copy(perFrame.f4Balls, perFrame.f4Balls + numOfBalls,
+            frameCB.f4Balls);
+        std::mt19937 rng(0);
+        std::uniform_real_distribution<float> rand01(0.f, 1.f);
+        std::vector<float3> dir(numOfBalls);
+        for (auto& d : dir) {
+            float x = rand01(rng) - 0.5f;
+            float y = rand01(rng) - 0.5f;
+            float z = rand01(rng) - 0.5f;
+            float len = std::sqrt(x * x + y * y + z * z) + 1e-6f;
+            d = float3(x / len * step, y / len * step, z / len * step);
+        }
+
+        BenchmarkResult result = {};
+        result.u3Reso = cb.vParam.u3VoxelReso;
+        BrickPool brickPool;
+        for (uint frame = 0; frame <= frames; ++frame) {
+            for (uint i = 0; frame && i < numOfBalls; ++i) {
+                frameCB.f4Balls[i].x += dir[i].x;
+                frameCB.f4Balls[i].y += dir[i].y;
+                frameCB.f4Balls[i].z += dir[i].z;
+            }
+            BenchmarkClock::time_point start = BenchmarkClock::now();
+            occupancy.Build(frameCB, cb, pool);
+            const double occupancyMs = ElapsedMs(start);
+            start = BenchmarkClock::now();
+            const bool reallocated = brickPool.Update(
+                occupancy.GetOccupiedBricks(), occupancy.GetBrickCount());
+            const double poolMs = ElapsedMs(start);
+            // first frame creates the pool
+            if (frame == 0) {
+                continue;
+            }
+            result.dOccupancyMs += occupancyMs;
+            result.dPoolMs += poolMs;
+            result.uReallocations += reallocated ? 1 : 0;
+            result.dOccupiedBricks += occupancy.GetOccupiedBricks().size();
+            result.dTableUpload += (double)(brickPool.GetDirtyEnd() -
+                std::min(brickPool.GetDirtyBegin(), brickPool.GetDirtyEnd())) /
+                occupancy.GetBrickCount();
+        }
+        result.dOccupancyMs /= frames;
+        result.dPoolMs /= frames;
+        result.dOccupiedBricks /= frames;
+        result.dTableUpload /= frames;
+        result.uBrickCount = occupancy.GetBrickCount();
+        result.uCapacity = brickPool.GetCapacity();
+        const double voxelMB = 4.0 * sizeof(float) / (1024.0 * 1024.0);
+        result.dDenseMB = (double)reso * reso * reso * voxelMB;
+        result.dPoolMB = (double)result.uCapacity * ratio * ratio * ratio *
+            voxelMB;
+        result.dTableMB =
+            result.uBrickCount * sizeof(uint32_t) / (1024.0 * 1024.0);
+
+        std::vector<uint8_t> occupied(result.uBrickCount, 0);
+        std::vector<uint8_t> used(result.uCapacity, 0);
+        for (uint32_t brick : occupancy.GetOccupiedBricks()) {
+            occupied[brick] = 1;
+        }
+        const std::vector<uint32_t>& slots = brickPool.GetSlots();
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (!occupied[i]) {
+                result.uSlotErrors += slots[i] != BRICK_POOL_EMPTY ? 1 : 0;
+            } else if (slots[i] >= result.uCapacity || used[slots[i]]) {
+                ++result.uSlotErrors;
+            } else {
+                used[slots[i]] = 1;
+            }
+        }
+        results.push_back(result);
+    }
+    return results;
+}
@@ -0,0 +1,81 @@
+#pragma once
+// Slot allocation of the sparse brick pool (VOXEL_LAYOUT_BRICK_POOL). Only
+// occupied bricks get a slot of ratio^3 voxels, the slot table maps every
+// brick of the flag volume grid to its slot or to BRICK_POOL_EMPTY.
+//
+// Bricks keep their slot as long as they stay occupied and freed slots are
+// handed out again first, so only the changed part of the table needs an
+// upload. The pool grows to twice the occupied bricks once they don't fit
+// any more, so growth stays rare, and shrinks the same way once less than a
+// quarter of it is in use. Both repack the slots in brick order and lose the
+// pool content.
+#include "CPUVolumeUpdater.h"
+
+class BrickPool
+{
+public:
+    struct BenchmarkResult {
+        uint3 u3Reso;
+        size_t uBrickCount;
+        double dOccupiedBricks; // average per frame
+        size_t uCapacity; // slots after the last frame
+        uint uReallocations;
+        double dOccupancyMs; // BrickOccupancy::Build per frame
+        double dPoolMs; // Update per frame
+        double dTableUpload; // average share of the table to upload
+        // memory with 32 bit voxels
+        double dDenseMB;
+        double dPoolMB;
+        double dTableMB;
+        // occupied bricks without a unique slot below capacity, plus empty
+        // bricks holding one, has to be 0
+        size_t uSlotErrors;
+    };
+
+    enum {
+        kSlotGranularity = 64,
+    };
+
+    BrickPool();
+    ~BrickPool();
+
+    // Map exactly occupiedBricks (ascending flat brick indices) out of a
+    // grid of brickCount bricks. Returns true when the slots got repacked,
+    // every occupied brick has to be rewritten and the pool reallocated if
+    // GetCapacity changed
+    bool Update(const std::vector<uint32_t>& occupiedBricks,
+        size_t brickCount);
+    // Next Update repacks (pool content lost)
+    inline void Invalidate() { _invalidated = true; };
+
+    inline const std::vector<uint32_t>& GetSlots() const { return _slots; };
+    inline size_t GetCapacity() const { return _capacity; };
+    inline size_t GetUsedSlots() const { return _mapped.size(); };
+    // Slot table entries [begin, end) changed by the last Update
+    inline size_t GetDirtyBegin() const { return _dirtyBegin; };
+    inline size_t GetDirtyEnd() const { return _dirtyEnd; };
+
+    // Animate frames (balls moving half a voxel of perCall per frame) over
+    // the volume of perCall resampled to reso^3, brick ratio of perCall
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        const std::vector<uint>& resos, uint frames,
+        WorkStealingPool* pool = nullptr);
+
+private:
+    void _Repack(const std::vector<uint32_t>& occupiedBricks,
+        size_t capacity);
+    void _MarkDirty(size_t brick);
+
+    bool _invalidated;
+    size_t _capacity;
+    // slots below are either handed out or in _freeSlots
+    uint32_t _nextSlot;
+    size_t _dirtyBegin;
+    size_t _dirtyEnd;
+    std::vector<uint32_t> _slots;
+    // bricks holding a slot, ascending
+    std::vector<uint32_t> _mapped;
+    std::vector<uint32_t> _freeSlots;
+    std::vector<uint32_t> _added;
+};
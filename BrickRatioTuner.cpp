@@ -0,0 +1,278 @@
+#include "BrickRatioTuner.h"
+#include "BrickOccupancy.h"
+#include "CPURaymarcher.h"
+#include "WorkStealingPool.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace {
+    // same headroom as BrickOccupancy
+    const float _boundMargin = 0.999f;
+
+    // flagged parents refined per job
+    const uint32_t kParentChunk = 256;
+}
+
+BrickRatioTuner::BrickRatioTuner()
+{
+}
+
+BrickRatioTuner::~BrickRatioTuner()
+{
+}
+
+void
+BrickRatioTuner::_Classify(size_t levelIdx, const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, WorkStealingPool* pool)
+{
+    const VolumeParam& vParam = perCall.vParam;
+    const uint3& reso = vParam.u3VoxelReso;
+    const uint numOfBalls = std::min<uint>(perCall.uNumOfBalls, MAX_BALLS);
+    const float voxelSize = vParam.fVoxelSize;
+    const float threshold = vParam.fMinDensity * _boundMargin;
+    CPUVolume& level = _levels[levelIdx];
+    const uint ratio = level.uBrickRatio;
+    const float extent = (ratio - 1) * voxelSize;
+    auto classify = [&](uint x, uint y, uint z) {
+        // bounds of the voxel centers inside the brick, as BrickOccupancy
+        const float3 boxMin((x * ratio - reso.x * 0.5f + 0.5f) * voxelSize,
+            (y * ratio - reso.y * 0.5f + 0.5f) * voxelSize,
+            (z * ratio - reso.z * 0.5f + 0.5f) * voxelSize);
+        const float3 boxMax(boxMin.x + extent, boxMin.y + extent,
+            boxMin.z + extent);
+        if (BrickOccupancy::DensityUpperBound(perFrame, numOfBalls, boxMin,
+            boxMax, threshold) >= threshold) {
+            level.flags.Set(level.BrickIdx(x, y, z));
+        }
+    };
+
+    // the coarsest gets every brick bounded
+    if (levelIdx + 1 == _levels.size()) {
+        const uint3 brickReso = level.GetBrickReso();
+        auto classifySlice = [&](uint32_t z, uint32_t) {
+            for (uint y = 0; y < brickReso.y; ++y) {
+                for (uint x = 0; x < brickReso.x; ++x) {
+                    classify(x, y, z);
+                }
+            }
+        };
+        if (pool) {
+            pool->ParallelFor(brickReso.z, classifySlice);
+        } else {
+            for (uint z = 0; z < brickReso.z; ++z) {
+                classifySlice(z, 0);
+            }
+        }
+        return;
+    }
+
+    // finer ones only the children of the bricks flagged one ratio up
+    const CPUVolume& parent = _levels[levelIdx + 1];
+    const uint factor = parent.uBrickRatio / ratio;
+    const uint3 parentReso = parent.GetBrickReso();
+    _parents.resize(parent.flags.GetBrickCount());
+    const uint32_t* parentsEnd = parent.flags.Scan(0,
+        parent.flags.GetWordCount(), _parents.data());
+    _parents.resize(parentsEnd - _parents.data());
+    auto refineChunk = [&](uint32_t chunk, uint32_t) {
+        const size_t end = std::min<size_t>(
+            (size_t)(chunk + 1) * kParentChunk, _parents.size());
+        for (size_t i = (size_t)chunk * kParentChunk; i < end; ++i) {
+            const uint32_t idx = _parents[i];
+            const uint px = idx % parentReso.x;
+            const uint py = idx / parentReso.x % parentReso.y;
+            const uint pz = idx / (parentReso.x * parentReso.y);
+            for (uint z = pz * factor; z < (pz + 1) * factor; ++z) {
+                for (uint y = py * factor; y < (py + 1) * factor; ++y) {
+                    for (uint x = px * factor; x < (px + 1) * factor; ++x) {
+                        classify(x, y, z);
+                    }
+                }
+            }
+        }
+    };
+    const uint32_t chunks =
+        ((uint32_t)_parents.size() + kParentChunk - 1) / kParentChunk;
+    if (pool) {
+        pool->ParallelFor(chunks, refineChunk);
+    } else {
+        for (uint32_t chunk = 0; chunk < chunks; ++chunk) {
+            refineChunk(chunk, 0);
+        }
+    }
+}
+
+BrickRatioTuner::Candidate
+BrickRatioTuner::_Price(size_t levelIdx, const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint width, uint height,
+    WorkStealingPool* pool)
+{
+    const CPUVolume& level = _levels[levelIdx];
+    _nearFar.Rasterize(level, perFrame, perCall.vParam, width, height,
+        kRasterScale, pool);
+    double length = 0.0;
+    for (uint y = 0; y < _nearFar.GetHeight(); ++y) {
+        for (uint x = 0; x < _nearFar.GetWidth(); ++x) {
+            const NearFarRasterizer::Range& range = _nearFar.GetNearFar(x, y);
+            if (range.fFar > range.fNear) {
+                length += range.fFar - range.fNear;
+            }
+        }
+    }
+    const uint renderScale = std::max<uint>(1, perCall.uRenderScale);
+    // a raster pixel stands for kRasterScale^2 full resolution ones
+    const double pixelArea = (double)kRasterScale * kRasterScale;
+    const double stepLength = perCall.vParam.fVoxelSize * perCall.fStepScale;
+
+    Candidate candidate;
+    candidate.uRatio = level.uBrickRatio;
+    candidate.uBrickCount = level.flags.GetBrickCount();
+    candidate.uFlaggedBricks = _nearFar.GetFlaggedBricks();
+    candidate.dPixels = _nearFar.GetCoveredPixels() * pixelArea;
+    candidate.dSamples = length / stepLength * pixelArea /
+        (renderScale * renderScale);
+    candidate.dStepCost = _weights.fFlagWord * level.flags.GetWordCount() +
+        _weights.fIndex * candidate.uFlaggedBricks *
+        CUBE_TRIANGLESTRIP_LENGTH + _weights.fPixel * candidate.dPixels;
+    candidate.dMarchCost = _weights.fSample * candidate.dSamples;
+    candidate.dCost = candidate.dStepCost + candidate.dMarchCost;
+    return candidate;
+}
+
+uint
+BrickRatioTuner::Tune(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, const std::vector<uint>& ratios,
+    uint width, uint height, WorkStealingPool* pool)
+{
+    const uint current = perCall.vParam.uVoxelBrickRatio;
+    if (ratios.empty()) {
+        return current;
+    }
+    _levels.resize(ratios.size());
+    for (size_t i = 0; i < ratios.size(); ++i) {
+        CPUVolume& level = _levels[i];
+        level.u3Reso = perCall.vParam.u3VoxelReso;
+        level.uBrickRatio = ratios[i];
+        const uint3 brickReso = level.GetBrickReso();
+        level.flags.Resize((size_t)brickReso.x * brickReso.y * brickReso.z);
+    }
+    // Coarse to fine the near/far pass grows and the raymarch shrinks, stop
+    // once the cost turns up, the finer ratios only get more expensive to
+    // classify and price
+    _candidates.clear();
+    for (size_t i = _levels.size(); i-- > 0;) {
+        _Classify(i, perFrame, perCall, pool);
+        _candidates.push_back(_Price(i, perFrame, perCall, width, height,
+            pool));
+        if (_candidates.size() > 1 && _candidates.back().dCost >
+            _candidates[_candidates.size() - 2].dCost) {
+            break;
+        }
+    }
+    std::reverse(_candidates.begin(), _candidates.end());
+    _cheapest = 0;
+    for (size_t i = 1; i < _candidates.size(); ++i) {
+        if (_candidates[i].dCost < _candidates[_cheapest].dCost) {
+            _cheapest = i;
+        }
+    }
+
+    const Candidate& cheapest = _candidates[_cheapest];
+    const Candidate* inUse = nullptr;
+    for (const Candidate& candidate : _candidates) {
+        if (candidate.uRatio == current) {
+            inUse = &candidate;
+        }
+    }
+    // nothing to settle against
+    if (!inUse) {
+        _pendingTunes = 0;
+        return cheapest.uRatio;
+    }
+    if (cheapest.uRatio == current ||
+        cheapest.dCost >= inUse->dCost * (1.0 - _hysteresis)) {
+        _pendingTunes = 0;
+        return current;
+    }
+    if (_pendingRatio != cheapest.uRatio) {
+        _pendingRatio = cheapest.uRatio;
+        _pendingTunes = 0;
+    }
+    if (++_pendingTunes < kSettleTunes) {
+        return current;
+    }
+    _pendingTunes = 0;
+    return cheapest.uRatio;
+}
+
+std::vector<BrickRatioTuner::BenchmarkResult>
+BrickRatioTuner::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, const std::vector<uint>& ratios,
+    const std::vector<uint>& ballCounts, uint width, uint height,
+    WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    if (ratios.empty()) {
+        return results;
+    }
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+
+    CPURaymarcher::RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    // the near/far path goes ray by ray
+    settings.uPacketSize = 0;
+    cb.uRenderScale = settings.uRenderScale;
+    CPURaymarcher::Image image;
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    NearFarRasterizer nearFar;
+    BrickRatioTuner tuner;
+    for (uint balls : ballCounts) {
+        cb.uNumOfBalls = std::min<uint>(balls, MAX_BALLS);
+        BenchmarkResult result = {};
+        result.uNumOfBalls = cb.uNumOfBalls;
+        double measuredMs = DBL_MAX;
+        for (uint ratio : ratios) {
+            vParam.uVoxelBrickRatio = ratio;
+            vol.Resize(vParam.u3VoxelReso, ratio);
+            updater.Update(perFrame, cb, vol, true,
+                CPUVolumeUpdater::kSIMDLane, pool);
+            BenchmarkClock::time_point start = BenchmarkClock::now();
+            nearFar.Rasterize(vol, perFrame, vParam, width, height, 1, pool);
+            result.rasterMs.push_back(ElapsedMs(start));
+            settings.pNearFar = &nearFar;
+            CPURaymarcher::RenderStats stats = CPURaymarcher::Render(
+                vol, perFrame, cb, settings, image, pool);
+            result.renderMs.push_back(stats.dMs);
+            const double ms = result.rasterMs.back() + stats.dMs;
+            if (ms < measuredMs) {
+                measuredMs = ms;
+                result.uMeasuredRatio = ratio;
+            }
+        }
+
+        // the frame holds still, so the tuner settles once the cheapest
+        // candidate won kSettleTunes times
+        vParam.uVoxelBrickRatio = ratios.back();
+        tuner.Reset();
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        for (;;) {
+            const uint ratio =
+                tuner.Tune(perFrame, cb, ratios, width, height, pool);
+            ++result.uTunes;
+            if (ratio == vParam.uVoxelBrickRatio && !tuner.IsPending()) {
+                break;
+            }
+            vParam.uVoxelBrickRatio = ratio;
+        }
+        result.dTuneMs = ElapsedMs(start) / result.uTunes;
+        result.candidates = tuner.GetCandidates();
+        result.uCheapestRatio = result.candidates[tuner.GetCheapest()].uRatio;
+        result.uTunedRatio = vParam.uVoxelBrickRatio;
+        results.push_back(result);
+    }
+    return results;
+}
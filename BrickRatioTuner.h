@@ -0,0 +1,117 @@
+#pragma once
+// Picks uVoxelBrickRatio for the near/far (StepInfoTex) path from what each
+// candidate ratio would cost this frame. The flags of every candidate stay
+// resident: the coarsest ratio gets classified by
+// BrickOccupancy::DensityUpperBound and each finer one only bounds the
+// children of the bricks flagged one ratio up, as a child's bound can't
+// exceed its parent's. A NearFarRasterizer pass over each candidate's flags
+// at 1/kRasterScale then prices it, the near/far pass (flag words reset and
+// compacted, cube indices and fill of the flagged bricks) against the
+// raymarch samples between near and far it leaves. Going from coarse to
+// fine, the first candidate costing more than the one before ends the tune.
+//
+// The cheapest candidate only replaces the current ratio once it beats it
+// by the hysteresis on kSettleTunes tunes in a row, so the ratio settles
+// instead of flipping between two close candidates.
+#include "NearFarRasterizer.h"
+
+class BrickRatioTuner
+{
+public:
+    enum {
+        kRasterScale = 8, // near/far priced at 1/kRasterScale resolution
+        kSettleTunes = 3,
+    };
+
+    // GPU cost of each unit of work relative to a raymarch sample
+    struct CostWeights {
+        float fFlagWord = 0.05f; // _flagVol word reset and compacted
+        float fIndex = 0.1f; // StepInfo VS index of a flagged brick
+        float fPixel = 0.5f; // StepInfo PS invocation with the min blend
+        float fSample = 1.f; // raymarch step
+    };
+
+    struct Candidate {
+        uint uRatio;
+        size_t uBrickCount;
+        size_t uFlaggedBricks; // bounded from above, see BrickOccupancy
+        double dPixels; // StepInfo PS invocations at full resolution
+        double dSamples; // raymarch steps at uRenderScale
+        double dStepCost; // near/far pass
+        double dMarchCost;
+        double dCost;
+    };
+
+    struct BenchmarkResult {
+        uint uNumOfBalls;
+        std::vector<Candidate> candidates;
+        // measured on the CPU for each candidate with the volume updated at
+        // its ratio: near/far rasterized at full resolution, and the
+        // raymarch over it
+        std::vector<double> rasterMs;
+        std::vector<double> renderMs;
+        uint uMeasuredRatio; // lowest raster + render
+        uint uCheapestRatio; // lowest modeled cost
+        // where repeated Tune settled starting from the coarsest candidate,
+        // after uTunes calls
+        uint uTunedRatio;
+        uint uTunes;
+        double dTuneMs; // per Tune
+    };
+
+    BrickRatioTuner();
+    ~BrickRatioTuner();
+
+    inline void SetWeights(const CostWeights& weights) { _weights = weights; };
+    inline const CostWeights& GetWeights() const { return _weights; };
+    // share of the current ratio's cost a candidate has to save
+    inline void SetHysteresis(float hysteresis) { _hysteresis = hysteresis; };
+    // Forget the candidate waiting to settle
+    inline void Reset() { _pendingTunes = 0; };
+    inline bool IsPending() const { return _pendingTunes != 0; };
+
+    // Price every ratio of ratios (powers of two, ascending) for the frame
+    // rendered width x height at perCall.uRenderScale, returns the ratio
+    // to use from now on, perCall.vParam.uVoxelBrickRatio unless another
+    // one settled
+    uint Tune(const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        const std::vector<uint>& ratios, uint width, uint height,
+        WorkStealingPool* pool = nullptr);
+
+    // candidates priced by the last Tune, a tail of ratios
+    inline const std::vector<Candidate>& GetCandidates() const {
+        return _candidates;
+    };
+    // index into GetCandidates of the lowest cost
+    inline size_t GetCheapest() const { return _cheapest; };
+
+    // Tune against measured CPU costs at reso^3 with the first
+    // ballCounts[i] balls of perFrame, rendered width x height
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, const std::vector<uint>& ratios,
+        const std::vector<uint>& ballCounts, uint width, uint height,
+        WorkStealingPool* pool = nullptr);
+
+private:
+    // Flag the bricks of _levels[levelIdx], the ones above it flagged
+    void _Classify(size_t levelIdx, const PerFrameDataCB& perFrame,
+        const PerCallDataCB& perCall, WorkStealingPool* pool);
+    Candidate _Price(size_t levelIdx, const PerFrameDataCB& perFrame,
+        const PerCallDataCB& perCall, uint width, uint height,
+        WorkStealingPool* pool);
+
+    CostWeights _weights;
+    float _hysteresis = 0.1f;
+    // candidate that beat the current ratio the last _pendingTunes tunes
+    uint _pendingRatio = 0;
+    uint _pendingTunes = 0;
+    // flags only, one per candidate in ratios order, the ones finer than
+    // the last priced left clear
+    std::vector<CPUVolume> _levels;
+    // flat indices of the flagged bricks of the level being refined
+    std::vector<uint32_t> _parents;
+    std::vector<Candidate> _candidates;
+    size_t _cheapest = 0;
+    NearFarRasterizer _nearFar;
+};
@@ -0,0 +1,2002 @@
+#include "CPURaymarcher.h"
+#include "DensityPyramid.h"
+#include "NearFarRasterizer.h"
+#include "TransferFunctionLUT.h"
+#include "WorkStealingPool.h"
+#include "SIMDLane.h"
+#include "TemporalSchedule.inl"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
+#include <string>
+
+namespace {
+    inline float4 _Mad(const float4& a, float s, const float4& b)
+    {
+        return float4(a.x * s + b.x, a.y * s + b.y, a.z * s + b.z,
+            a.w * s + b.w);
+    }
+
+    // depthWeight of SparseVolume_Upsample_ps.hlsl
+    inline float _DepthWeight(float fRefDepth, float fDepth)
+    {
+        const float fRelative = std::fabs(fDepth - fRefDepth) /
+            std::max(std::max(fRefDepth, fDepth), 1e-6f);
+        const float fScaled = fRelative / UPSAMPLE_DEPTH_TOLERANCE;
+        return 1.f / (1.f + fScaled * fScaled);
+    }
+
+    // Set associative LRU cache, ways kept most recent first
+    class _CacheModel
+    {
+    public:
+        _CacheModel(size_t bytes, uint ways)
+            : _ways(ways), _sets((uint)(bytes / kLineSize / ways)),
+            _tags((size_t)_sets * ways, UINT64_MAX), _misses(0)
+        {
+        }
+
+        // true on hit
+        bool Access(uint64_t line)
+        {
+            uint64_t* set = &_tags[(size_t)(line % _sets) * _ways];
+            uint way = 0;
+            while (way < _ways && set[way] != line) {
+                ++way;
+            }
+            const bool hit = way < _ways;
+            if (!hit) {
+                ++_misses;
+                way = _ways - 1;
+            }
+            for (; way > 0; --way) {
+                set[way] = set[way - 1];
+            }
+            set[0] = line;
+            return hit;
+        }
+        inline uint64_t GetMisses() const { return _misses; };
+
+        enum { kLineSize = 64 };
+
+    private:
+        uint _ways;
+        uint _sets;
+        std::vector<uint64_t> _tags;
+        uint64_t _misses;
+    };
+
+    struct _NoProbe {
+        inline void operator()(size_t) {}
+    };
+
+    struct _CacheProbe {
+        _CacheModel l1;
+        _CacheModel l2;
+        size_t elementSize;
+
+        _CacheProbe(size_t elemSize)
+            : l1(32 * 1024, 8), l2(1024 * 1024, 16), elementSize(elemSize) {}
+        inline void operator()(size_t idx)
+        {
+            const uint64_t line = idx * elementSize / _CacheModel::kLineSize;
+            if (!l1.Access(line)) {
+                l2.Access(line);
+            }
+        }
+    };
+
+    // tex_srvDataVol[BUFFER_INDEX(idx)]: buffer indices wrap in 32 bit and
+    // only fail past the end of the buffer, Texture3D fails per axis
+    template <typename P>
+    inline float4 _Load(const CPUVolume& vol, int x, int y, int z, P& probe)
+    {
+        size_t idx;
+        if (vol.type == CPUVolume::k3DTexBuffer) {
+            if ((uint)x >= vol.u3Reso.x || (uint)y >= vol.u3Reso.y ||
+                (uint)z >= vol.u3Reso.z) {
+                return float4(0.f, 0.f, 0.f, 0.f);
+            }
+            idx = vol.FlatIdx(x, y, z);
+        } else {
+            idx = voxelIdx((uint)x, (uint)y, (uint)z, vol.u3Reso, vol.layout);
+        }
+        if (idx >= vol.GetVoxelCount()) {
+            return float4(0.f, 0.f, 0.f, 0.f);
+        }
+        probe(idx);
+        return vol.GetVoxel(idx);
+    }
+
+    template <typename P>
+    float4 _ReadVolume(const CPUVolume& vol, const float3& f3Idx, bool filter,
+        P& probe)
+    {
+        // modf: integer part truncated, fraction keeps the sign
+        const int x = (int)f3Idx.x;
+        const int y = (int)f3Idx.y;
+        const int z = (int)f3Idx.z;
+        if (!filter) {
+            return _Load(vol, x, y, z, probe);
+        }
+        const float dx = f3Idx.x - (float)x - 0.5f;
+        const float dy = f3Idx.y - (float)y - 0.5f;
+        const float dz = f3Idx.z - (float)z - 0.5f;
+        const float4 v000 = _Load(vol, x, y, z, probe);
+        const float4 v001 = _Load(vol, x, y, z + 1, probe);
+        const float4 v010 = _Load(vol, x, y + 1, z, probe);
+        const float4 v011 = _Load(vol, x, y + 1, z + 1, probe);
+        const float4 v100 = _Load(vol, x + 1, y, z, probe);
+        const float4 v101 = _Load(vol, x + 1, y, z + 1, probe);
+        const float4 v110 = _Load(vol, x + 1, y + 1, z, probe);
+        const float4 v111 = _Load(vol, x + 1, y + 1, z + 1, probe);
+        float4 result(0.f, 0.f, 0.f, 0.f);
+        result = _Mad(v000, (1.f - dx) * (1.f - dy) * (1.f - dz), result);
+        result = _Mad(v100, dx * (1.f - dy) * (1.f - dz), result);
+        result = _Mad(v010, (1.f - dx) * dy * (1.f - dz), result);
+        result = _Mad(v001, (1.f - dx) * (1.f - dy) * dz, result);
+        result = _Mad(v101, dx * (1.f - dy) * dz, result);
+        result = _Mad(v011, (1.f - dx) * dy * dz, result);
+        result = _Mad(v110, dx * dy * (1.f - dz), result);
+        result = _Mad(v111, dx * dy * dz, result);
+        return result;
+    }
+
+    // getNormal with NORMAL_FINITE_DIFF before the normalization
+    template <typename P>
+    inline float3 _FiniteDifferences(const CPUVolume& vol,
+        const float3& f3Idx, bool filter, P& probe)
+    {
+        const float f000 = _ReadVolume(vol, f3Idx, filter, probe).x;
+        const float f100 = _ReadVolume(vol, float3(f3Idx.x + 1.f,
+            f3Idx.y, f3Idx.z), filter, probe).x;
+        const float f010 = _ReadVolume(vol, float3(f3Idx.x,
+            f3Idx.y + 1.f, f3Idx.z), filter, probe).x;
+        const float f001 = _ReadVolume(vol, float3(f3Idx.x,
+            f3Idx.y, f3Idx.z + 1.f), filter, probe).x;
+        return float3(f100 - f000, f010 - f000, f001 - f000);
+    }
+
+    // tex_srvGradientVol[idx] unpacked, out of range reads give 0
+    inline float3 _LoadGradient(const CPUVolume& vol, int x, int y, int z)
+    {
+        if ((uint)x >= vol.u3Reso.x || (uint)y >= vol.u3Reso.y ||
+            (uint)z >= vol.u3Reso.z) {
+            return float3(0.f, 0.f, 0.f);
+        }
+        return unpackGradient(vol.gradients[vol.FlatIdx(x, y, z)]);
+    }
+
+    // getNormal with NORMAL_GRADIENT_VOL before the normalization, filter
+    // reads the 8 neighbors
+    inline float3 _ReadGradient(const CPUVolume& vol, const float3& f3Idx,
+        bool filter)
+    {
+        const int x = (int)f3Idx.x;
+        const int y = (int)f3Idx.y;
+        const int z = (int)f3Idx.z;
+        if (!filter) {
+            return _LoadGradient(vol, x, y, z);
+        }
+        const float d[3] = {f3Idx.x - (float)x - 0.5f,
+            f3Idx.y - (float)y - 0.5f, f3Idx.z - (float)z - 0.5f};
+        float3 f3Gradient(0.f, 0.f, 0.f);
+        for (uint i = 0; i < 8; ++i) {
+            const uint cx = i & 1, cy = (i >> 1) & 1, cz = i >> 2;
+            const float w = (cx ? d[0] : 1.f - d[0]) *
+                (cy ? d[1] : 1.f - d[1]) * (cz ? d[2] : 1.f - d[2]);
+            const float3 f3G = _LoadGradient(vol, x + cx, y + cy, z + cz);
+            f3Gradient = float3(f3Gradient.x + f3G.x * w,
+                f3Gradient.y + f3G.y * w, f3Gradient.z + f3G.z * w);
+        }
+        return f3Gradient;
+    }
+
+    inline float _TransferFunction(const VolumeParam& vParam, float fDensity)
+    {
+        const float fOpacity = (fDensity - vParam.fMinDensity) /
+            (vParam.fMaxDensity - vParam.fMinDensity);
+        const float fp2 = fOpacity * fOpacity + 0.02f;
+        const float fp4 = fp2 * fp2;
+        return fp4 * 0.3f + fp2 * 0.1f + fOpacity * 0.15f;
+    }
+
+    // safeSteps of ADAPTIVE_STEP: steps of fDeltaT the field stays below
+    // fThreshold for, at least 1. Filtered reads extrapolate (even below 0
+    // next to a ball center), so the bound starts from the voxel the sample
+    // is in, whose value is exact
+    template <typename P>
+    inline float _SafeSteps(const CPUVolume& vol, float fDeltaT,
+        float fMinBallRadius, const float3& f3Idx, float fThreshold,
+        P& probe)
+    {
+        const float fDensity = std::max(
+            _Load(vol, (int)f3Idx.x, (int)f3Idx.y, (int)f3Idx.z, probe).x,
+            fThreshold * ADAPTIVE_STEP_FLOOR);
+        if (fDensity >= fThreshold) {
+            return 1.f;
+        }
+        const float fDist = fMinBallRadius *
+            (1.f / std::sqrt(fDensity) - 1.f / std::sqrt(fThreshold));
+        return std::max(std::floor(
+            fDist / fDeltaT - ADAPTIVE_STEP_MARGIN), 1.f);
+    }
+
+    // Whether a readVolume sample on the segment between the voxel indices
+    // f3A and f3B may reach fThreshold, by the ranges of the level's cells
+    // around the segment's bounding box. Indices past the volume clamp to
+    // the border cells, which see the zeros out there as well
+    inline bool _MayReach(const DensityPyramid& pyramid, uint level,
+        const float3& f3A, const float3& f3B, float fThreshold, bool filter)
+    {
+        const uint3& reso = pyramid.GetLevelReso(level);
+        const float fSize = (float)pyramid.GetCellSize(level);
+        auto cell = [fSize](float fIdx, uint cells) {
+            return (uint)std::min(std::max(std::floor(fIdx / fSize), 0.f),
+                (float)(cells - 1));
+        };
+        const uint x0 = cell(std::min(f3A.x, f3B.x), reso.x);
+        const uint x1 = cell(std::max(f3A.x, f3B.x), reso.x);
+        const uint y0 = cell(std::min(f3A.y, f3B.y), reso.y);
+        const uint y1 = cell(std::max(f3A.y, f3B.y), reso.y);
+        const uint z0 = cell(std::min(f3A.z, f3B.z), reso.z);
+        const uint z1 = cell(std::max(f3A.z, f3B.z), reso.z);
+        for (uint z = z0; z <= z1; ++z) {
+            for (uint y = y0; y <= y1; ++y) {
+                for (uint x = x0; x <= x1; ++x) {
+                    if (!pyramid.IsEmpty(level, x, y, z, fThreshold,
+                        FLT_MAX, filter)) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    // Opacity of a fVoxelSize * fStepScale long step ending at f4Field, with
+    // the color to composite. f4Front is the sample one step before
+    inline float _Classify(const VolumeParam& vParam,
+        const CPURaymarcher::MarchSettings& march, const float4& f4Field,
+        const float4& f4Front, float3& f3Color)
+    {
+        float fAlpha = 0.f;
+        f3Color = float3(f4Field.y, f4Field.z, f4Field.w);
+        if (march.uTransferMode == TRANSFER_PREINTEGRATED) {
+            fAlpha = 1.f - std::exp(-march.fStepScale *
+                march.pLUT->GetExtinction(f4Front.x, f4Field.x));
+            f3Color = float3((f4Front.y + f4Field.y) * 0.5f,
+                (f4Front.z + f4Field.z) * 0.5f,
+                (f4Front.w + f4Field.w) * 0.5f);
+        } else if (f4Field.x >= vParam.fMinDensity &&
+            f4Field.x <= vParam.fMaxDensity) {
+            fAlpha = march.uTransferMode == TRANSFER_LUT ?
+                march.pLUT->GetOpacity(f4Field.x) :
+                _TransferFunction(vParam, f4Field.x) * 0.25f;
+            if (march.fStepScale != 1.f) {
+                fAlpha = 1.f - std::pow(1.f - fAlpha, march.fStepScale);
+            }
+        }
+        return fAlpha;
+    }
+
+    // State of one accumulatedShading loop, stepped one sample at a time so
+    // a tile of rays can advance in lockstep like the lanes of a GPU wave
+    struct _Ray {
+        const CPURaymarcher::MarchSettings* march;
+        float fDeltaT;
+        float3 f3P;
+        float3 f3Step;
+        float t;
+        float tFar;
+        float4 f4AccuData;
+        uint samples;
+        // sample one step back for TRANSFER_PREINTEGRATED, none at the
+        // start and after a jump
+        float4 f4Front;
+        bool hasFront;
+
+        _Ray(const VolumeParam& vParam, const float3& f3Origin,
+            const float3& f3Dir, float tNear, float _tFar,
+            const CPURaymarcher::MarchSettings& _march)
+            : march(&_march), fDeltaT(vParam.fVoxelSize * _march.fStepScale),
+            f3P(f3Origin.x + f3Dir.x * tNear, f3Origin.y + f3Dir.y * tNear,
+                f3Origin.z + f3Dir.z * tNear),
+            f3Step(f3Dir.x * fDeltaT, f3Dir.y * fDeltaT, f3Dir.z * fDeltaT),
+            t(tNear), tFar(_tFar), f4AccuData(0.f, 0.f, 0.f, 0.f), samples(0),
+            f4Front(0.f, 0.f, 0.f, 0.f), hasFront(false)
+        {
+        }
+        // Move fSteps steps ahead without sampling in between
+        inline void Jump(float fSteps) {
+            f3P = float3(f3P.x + f3Step.x * fSteps, f3P.y + f3Step.y * fSteps,
+                f3P.z + f3Step.z * fSteps);
+            t += fDeltaT * fSteps;
+            hasFront = hasFront && fSteps == 1.f;
+        }
+        inline float4 GetColor() const {
+            return float4(f4AccuData.x * f4AccuData.w,
+                f4AccuData.y * f4AccuData.w, f4AccuData.z * f4AccuData.w,
+                f4AccuData.w * f4AccuData.w);
+        };
+    };
+
+    // One iteration of the accumulatedShading loop, false once the ray is
+    // done
+    template <typename P>
+    inline bool _Step(const CPUVolume& vol, const VolumeParam& vParam,
+        _Ray& ray, bool filter, P& probe)
+    {
+        if (ray.t > ray.tFar) {
+            return false;
+        }
+        const CPURaymarcher::MarchSettings& march = *ray.march;
+        const float fVoxelSize = vParam.fVoxelSize;
+        const float3 f3Idx(
+            ray.f3P.x / fVoxelSize + vParam.u3VoxelReso.x * 0.5f,
+            ray.f3P.y / fVoxelSize + vParam.u3VoxelReso.y * 0.5f,
+            ray.f3P.z / fVoxelSize + vParam.u3VoxelReso.z * 0.5f);
+        const float4 f4Field = _ReadVolume(vol, f3Idx, filter, probe);
+        ++ray.samples;
+        float3 f3Color;
+        const float fAlpha = _Classify(vParam, march, f4Field,
+            ray.hasFront ? ray.f4Front : f4Field, f3Color);
+        ray.f4Front = f4Field;
+        ray.hasFront = true;
+        if (fAlpha > 0.f) {
+            const float4 f4CurData(f3Color.x * fAlpha, f3Color.y * fAlpha,
+                f3Color.z * fAlpha, fAlpha);
+            ray.f4AccuData =
+                _Mad(f4CurData, 1.f - ray.f4AccuData.w, ray.f4AccuData);
+        }
+        if (ray.f4AccuData.w >= 0.95f) {
+            return false;
+        }
+        float fSteps = 1.f;
+        if (march.fMinBallRadius > 0.f && f4Field.x < vParam.fMinDensity) {
+            fSteps = _SafeSteps(vol, ray.fDeltaT, march.fMinBallRadius,
+                f3Idx, vParam.fMinDensity, probe);
+        }
+        ray.Jump(fSteps);
+        return true;
+    }
+
+    // 3D-DDA over the bricks of BRICK_DDA, maxT holds the t of the next
+    // brick border along each axis
+    struct _BrickDDA {
+        int brick[3];
+        int step[3];
+        float deltaT[3];
+        float maxT[3];
+
+        _BrickDDA(const VolumeParam& vParam, const float3& f3P,
+            const float3& f3Dir, float t)
+        {
+            const float fBrickSize =
+                vParam.fVoxelSize * vParam.uVoxelBrickRatio;
+            const float p[3] = {f3P.x, f3P.y, f3P.z};
+            const float d[3] = {f3Dir.x, f3Dir.y, f3Dir.z};
+            const uint reso[3] = {vParam.u3VoxelReso.x, vParam.u3VoxelReso.y,
+                vParam.u3VoxelReso.z};
+            for (int axis = 0; axis < 3; ++axis) {
+                const float fBrick = (p[axis] / vParam.fVoxelSize +
+                    reso[axis] * 0.5f) / vParam.uVoxelBrickRatio;
+                brick[axis] = (int)std::floor(fBrick);
+                step[axis] = d[axis] > 0.f ? 1 : -1;
+                deltaT[axis] = std::fabs(fBrickSize / d[axis]);
+                maxT[axis] = d[axis] == 0.f ? 1e30f : t +
+                    ((float)(brick[axis] + (step[axis] > 0 ? 1 : 0)) -
+                    fBrick) * fBrickSize / d[axis];
+            }
+        }
+        inline float GetExitT() const {
+            return std::min(maxT[0], std::min(maxT[1], maxT[2]));
+        };
+        // step into the brick t is in
+        inline void CatchUp(float t) {
+            while (t >= GetExitT()) {
+                const int axis = maxT[0] <= maxT[1] && maxT[0] <= maxT[2]
+                    ? 0 : (maxT[1] <= maxT[2] ? 1 : 2);
+                brick[axis] += step[axis];
+                maxT[axis] += deltaT[axis];
+            }
+        };
+    };
+
+    // emptyBrick: filtered reads reach one voxel further along +xyz (the
+    // samplers one voxel back as well) and extrapolate past the voxels they
+    // read, landing in range next to a brick that holds such a voxel, so the
+    // flags get dilated by a brick. Bricks outside the grid are empty
+    bool _EmptyBrick(const CPUVolume& vol, const int* brick, bool filter)
+    {
+        const uint3 brickReso = vol.GetBrickReso();
+        const int reach = filter ? 1 : 0;
+        for (int z = brick[2] - reach; z <= brick[2] + reach; ++z) {
+            for (int y = brick[1] - reach; y <= brick[1] + reach; ++y) {
+                for (int x = brick[0] - reach; x <= brick[0] + reach; ++x) {
+                    if ((uint)x < brickReso.x && (uint)y < brickReso.y &&
+                        (uint)z < brickReso.z && vol.flags.Test(vol.BrickIdx(
+                            (uint)x, (uint)y, (uint)z))) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    inline float3 _Normalize(const float3& v)
+    {
+        const float invLen = 1.f / std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+        return float3(v.x * invLen, v.y * invLen, v.z * invLen);
+    }
+
+    inline float3 _Cross(const float3& a, const float3& b)
+    {
+        return float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x);
+    }
+
+    inline float _Sign(float v)
+    {
+        return v > 0.f ? 1.f : (v < 0.f ? -1.f : 0.f);
+    }
+
+    // Row vector times matrix, which is mul(matrix, v) in the shaders
+    inline float4 _Transform(const float* m, float x, float y, float z,
+        float w)
+    {
+        return float4(x * m[0] + y * m[4] + z * m[8] + w * m[12],
+            x * m[1] + y * m[5] + z * m[9] + w * m[13],
+            x * m[2] + y * m[6] + z * m[10] + w * m[14],
+            x * m[3] + y * m[7] + z * m[11] + w * m[15]);
+    }
+
+    // General 4x4 inverse by cofactors, false when singular
+    bool _Invert(const float* m, float* inv)
+    {
+        inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] -
+            m[9] * m[6] * m[15] + m[9] * m[7] * m[14] +
+            m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+        inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] +
+            m[8] * m[6] * m[15] - m[8] * m[7] * m[14] -
+            m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+        inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] -
+            m[8] * m[5] * m[15] + m[8] * m[7] * m[13] +
+            m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+        inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] +
+            m[8] * m[5] * m[14] - m[8] * m[6] * m[13] -
+            m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+        inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] +
+            m[9] * m[2] * m[15] - m[9] * m[3] * m[14] -
+            m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+        inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] -
+            m[8] * m[2] * m[15] + m[8] * m[3] * m[14] +
+            m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+        inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] +
+            m[8] * m[1] * m[15] - m[8] * m[3] * m[13] -
+            m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+        inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] -
+            m[8] * m[1] * m[14] + m[8] * m[2] * m[13] +
+            m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+        inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] -
+            m[5] * m[2] * m[15] + m[5] * m[3] * m[14] +
+            m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+        inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] +
+            m[4] * m[2] * m[15] - m[4] * m[3] * m[14] -
+            m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+        inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] -
+            m[4] * m[1] * m[15] + m[4] * m[3] * m[13] +
+            m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+        inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] +
+            m[4] * m[1] * m[14] - m[4] * m[2] * m[13] -
+            m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+        inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] +
+            m[5] * m[2] * m[11] - m[5] * m[3] * m[10] -
+            m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+        inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] -
+            m[4] * m[2] * m[11] + m[4] * m[3] * m[10] +
+            m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+        inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] +
+            m[4] * m[1] * m[11] - m[4] * m[3] * m[9] -
+            m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+        inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] -
+            m[4] * m[1] * m[10] + m[4] * m[2] * m[9] +
+            m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+        const float det =
+            m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+        if (det == 0.f) {
+            return false;
+        }
+        const float invDet = 1.f / det;
+        for (int i = 0; i < 16; ++i) {
+            inv[i] *= invDet;
+        }
+        return true;
+    }
+
+    // One orthographic ray per voxel of an n x n image perpendicular to dir.
+    // Rays go in kRayTile^2 tiles advancing in lockstep, about what a GPU
+    // wave covers on screen. Returns the total sample count
+    template <typename P>
+    uint64_t _MarchOrtho(const CPUVolume& vol, const VolumeParam& vParam,
+        const float3& f3Dir, const float3& f3U, uint n, P& probe)
+    {
+        enum { kRayTile = 8 };
+        const float3 f3V = _Cross(f3Dir, f3U);
+        const float fBack = 2.f * n * vParam.fVoxelSize;
+        uint64_t totalSamples = 0;
+        const CPURaymarcher::MarchSettings march;
+        std::vector<_Ray> rays;
+        for (uint tileJ = 0; tileJ < n; tileJ += kRayTile) {
+            for (uint tileI = 0; tileI < n; tileI += kRayTile) {
+                rays.clear();
+                const uint endJ = std::min<uint>(tileJ + kRayTile, n);
+                const uint endI = std::min<uint>(tileI + kRayTile, n);
+                for (uint j = tileJ; j < endJ; ++j) {
+                    const float fv =
+                        ((float)j - n * 0.5f + 0.5f) * vParam.fVoxelSize;
+                    for (uint i = tileI; i < endI; ++i) {
+                        const float fu =
+                            ((float)i - n * 0.5f + 0.5f) * vParam.fVoxelSize;
+                        const float3 f3Origin(
+                            f3U.x * fu + f3V.x * fv - f3Dir.x * fBack,
+                            f3U.y * fu + f3V.y * fv - f3Dir.y * fBack,
+                            f3U.z * fu + f3V.z * fv - f3Dir.z * fBack);
+                        float tNear, tFar;
+                        if (CPURaymarcher::IntersectBox(f3Origin, f3Dir,
+                            vParam.f3BoxMin, vParam.f3BoxMax, tNear, tFar)) {
+                            rays.push_back(_Ray(vParam, f3Origin, f3Dir,
+                                std::max(tNear, 0.f), tFar, march));
+                        }
+                    }
+                }
+                // finished rays are swapped out of the active range
+                size_t active = rays.size();
+                while (active) {
+                    for (size_t r = 0; r < active;) {
+                        if (_Step(vol, vParam, rays[r], true, probe)) {
+                            ++r;
+                        } else {
+                            totalSamples += rays[r].samples;
+                            std::swap(rays[r], rays[--active]);
+                        }
+                    }
+                }
+            }
+        }
+        return totalSamples;
+    }
+
+#if SIMD_AVX2 || SIMD_SSE || SIMD_NEON
+    typedef SIMD::Lane4 _Lane4;
+#else
+    typedef SIMD::Lane1 _Lane4;
+#endif
+    enum { kMaxPacketSize = 16 };
+
+    inline uint _PopCount(uint32_t bits)
+    {
+        uint count = 0;
+        for (; bits; bits &= bits - 1) {
+            ++count;
+        }
+        return count;
+    }
+
+    // Ray packet of kRays rays from one origin, lane r of chunk c is ray
+    // c * L::kWidth + r. The slab distances of the box are shared by all
+    // rays, each ray keeps its own t range, and the step loop runs masked
+    // until every ray left the box or got opaque (f4AccuData.w >= 0.95).
+    // Voxel loads and table lookups go ray by ray, position, interpolation,
+    // transferFunction and blending run across the lanes in _Step's
+    // operation order, so colors match the scalar march bit for bit
+    template <typename L, uint kRays>
+    void _MarchPacket(const CPUVolume& vol, const VolumeParam& vParam,
+        const CPURaymarcher::MarchSettings& march, const float3& f3Origin,
+        const float3* f3Dirs, uint32_t rayMask, bool filter,
+        float4* f4Colors, uint32_t& hitMask, uint64_t& samples)
+    {
+        enum { kWidth = L::kWidth, kChunks = kRays / L::kWidth };
+        static_assert(kRays <= kMaxPacketSize, "packet too large");
+        static_assert(kRays % L::kWidth == 0,
+            "packet has to be whole lanes");
+        _NoProbe probe;
+        const uint32_t laneBits = (uint32_t)((1ull << kWidth) - 1);
+        const float fVoxelSize = vParam.fVoxelSize;
+        const float fDeltaT = fVoxelSize * march.fStepScale;
+        const bool simdTransfer = march.uTransferMode == TRANSFER_POLYNOMIAL;
+
+        float dir[3][kRays];
+        for (uint r = 0; r < kRays; ++r) {
+            dir[0][r] = f3Dirs[r].x;
+            dir[1][r] = f3Dirs[r].y;
+            dir[2][r] = f3Dirs[r].z;
+        }
+        const L origin[3] = {L::Set1(f3Origin.x), L::Set1(f3Origin.y),
+            L::Set1(f3Origin.z)};
+        const L slabMin[3] = {L::Set1(vParam.f3BoxMin.x - f3Origin.x),
+            L::Set1(vParam.f3BoxMin.y - f3Origin.y),
+            L::Set1(vParam.f3BoxMin.z - f3Origin.z)};
+        const L slabMax[3] = {L::Set1(vParam.f3BoxMax.x - f3Origin.x),
+            L::Set1(vParam.f3BoxMax.y - f3Origin.y),
+            L::Set1(vParam.f3BoxMax.z - f3Origin.z)};
+        const L half[3] = {L::Set1(vParam.u3VoxelReso.x * 0.5f),
+            L::Set1(vParam.u3VoxelReso.y * 0.5f),
+            L::Set1(vParam.u3VoxelReso.z * 0.5f)};
+        const L zero = L::Set1(0.f);
+        const L one = L::Set1(1.f);
+
+        L p[kChunks][3], step[kChunks][3], t[kChunks], tFar[kChunks];
+        L accu[kChunks][4], sampled[kChunks];
+        uint32_t active[kChunks];
+        // sample one step back per ray for TRANSFER_PREINTEGRATED
+        float4 front[kRays];
+        uint32_t hasFront = 0;
+        hitMask = 0;
+        for (uint c = 0; c < kChunks; ++c) {
+            const uint base = c * kWidth;
+            L d[3], tMin[3], tMax[3];
+            uint32_t axisParallel = 0;
+            for (int axis = 0; axis < 3; ++axis) {
+                d[axis] = L::Load(&dir[axis][base]);
+                const L invR = one / d[axis];
+                const L tBot = invR * slabMin[axis];
+                const L tTop = invR * slabMax[axis];
+                tMin[axis] = Min(tTop, tBot);
+                tMax[axis] = Max(tTop, tBot);
+                axisParallel |= CmpGE(d[axis], zero) & CmpLE(d[axis], zero);
+            }
+            L tNear = Max(Max(tMin[0], tMin[1]), Max(tMin[0], tMin[2]));
+            t[c] = Min(Min(tMax[0], tMax[1]), Min(tMax[0], tMax[2]));
+            uint32_t hit = CmpLE(tNear, t[c]) & (rayMask >> base) & laneBits;
+            if (axisParallel & (rayMask >> base) & laneBits) {
+                // 0 * inf slabs, IntersectBox keeps the HLSL min/max
+                float tn[kWidth], tf[kWidth];
+                tNear.Store(tn);
+                t[c].Store(tf);
+                for (uint r = 0; r < kWidth; ++r) {
+                    if (axisParallel >> r & 1u) {
+                        hit &= ~(1u << r);
+                        if (rayMask >> (base + r) & 1u &&
+                            CPURaymarcher::IntersectBox(f3Origin,
+                                f3Dirs[base + r], vParam.f3BoxMin,
+                                vParam.f3BoxMax, tn[r], tf[r])) {
+                            hit |= 1u << r;
+                        }
+                    }
+                }
+                tNear = L::Load(tn);
+                t[c] = L::Load(tf);
+            }
+            tFar[c] = t[c];
+            t[c] = Max(tNear, zero) + L::Set1(march.fStartOffset);
+            for (int axis = 0; axis < 3; ++axis) {
+                p[c][axis] = origin[axis] + d[axis] * t[c];
+                step[c][axis] = d[axis] * L::Set1(fDeltaT);
+            }
+            for (int i = 0; i < 4; ++i) {
+                accu[c][i] = zero;
+            }
+            sampled[c] = zero;
+            active[c] = hit;
+            hitMask |= hit << base;
+        }
+
+        float idx[3][kWidth], trunc[3][kWidth];
+        float field[8][4][kWidth];
+        float alpha[kWidth], color[3][kWidth], steps[kWidth];
+        const int corners = filter ? 8 : 1;
+        const bool linear = vol.type == CPUVolume::k3DTexBuffer ||
+            vol.layout == VOXEL_LAYOUT_LINEAR;
+        const bool full = vol.bit == CPUVolume::k32Bit;
+        const size_t row = vol.u3Reso.x;
+        const size_t slice = row * vol.u3Reso.y;
+        size_t offset[8];
+        for (int corner = 0; corner < 8; ++corner) {
+            offset[corner] = (corner >> 2) + (corner >> 1 & 1) * row +
+                (corner & 1) * slice;
+        }
+        bool anyActive = hitMask != 0;
+        while (anyActive) {
+            anyActive = false;
+            for (uint c = 0; c < kChunks; ++c) {
+                uint32_t m = active[c] & CmpLE(t[c], tFar[c]);
+                if (!m) {
+                    active[c] = 0;
+                    continue;
+                }
+                const uint base = c * kWidth;
+                L f3Idx[3];
+                for (int axis = 0; axis < 3; ++axis) {
+                    f3Idx[axis] = p[c][axis] / L::Set1(fVoxelSize) +
+                        half[axis];
+                    f3Idx[axis].Store(idx[axis]);
+                }
+                // gather, lanes done read 0
+                for (uint r = 0; r < kWidth; ++r) {
+                    const int x = (int)idx[0][r];
+                    const int y = (int)idx[1][r];
+                    const int z = (int)idx[2][r];
+                    trunc[0][r] = (float)x;
+                    trunc[1][r] = (float)y;
+                    trunc[2][r] = (float)z;
+                    if (!(m >> r & 1u)) {
+                        for (int corner = 0; corner < corners; ++corner) {
+                            for (int i = 0; i < 4; ++i) {
+                                field[corner][i][r] = 0.f;
+                            }
+                        }
+                        continue;
+                    }
+                    // all corners inside a linear volume: one index, the
+                    // neighbors are fixed offsets from it
+                    const bool direct = linear &&
+                        (uint)x + corners / 8 < vol.u3Reso.x &&
+                        (uint)y + corners / 8 < vol.u3Reso.y &&
+                        (uint)z + corners / 8 < vol.u3Reso.z;
+                    const size_t baseIdx = direct ?
+                        vol.FlatIdx(x, y, z) : 0;
+                    for (int corner = 0; corner < corners; ++corner) {
+                        float4 v;
+                        if (direct) {
+                            const size_t i = baseIdx + offset[corner];
+                            v = full ? vol.voxels[i] : vol.GetVoxel(i);
+                        } else {
+                            v = _Load(vol, x + (corner >> 2),
+                                y + (corner >> 1 & 1), z + (corner & 1),
+                                probe);
+                        }
+                        field[corner][0][r] = v.x;
+                        field[corner][1][r] = v.y;
+                        field[corner][2][r] = v.z;
+                        field[corner][3][r] = v.w;
+                    }
+                }
+                L f4Field[4];
+                if (filter) {
+                    L dx = f3Idx[0] - L::Load(trunc[0]) - L::Set1(0.5f);
+                    L dy = f3Idx[1] - L::Load(trunc[1]) - L::Set1(0.5f);
+                    L dz = f3Idx[2] - L::Load(trunc[2]) - L::Set1(0.5f);
+                    // corner bits are xyz, in _ReadVolume's order
+                    const int order[8] = {0, 4, 2, 1, 5, 3, 6, 7};
+                    L weight[8];
+                    weight[0] = (one - dx) * (one - dy) * (one - dz);
+                    weight[4] = dx * (one - dy) * (one - dz);
+                    weight[2] = (one - dx) * dy * (one - dz);
+                    weight[1] = (one - dx) * (one - dy) * dz;
+                    weight[5] = dx * (one - dy) * dz;
+                    weight[3] = (one - dx) * dy * dz;
+                    weight[6] = dx * dy * (one - dz);
+                    weight[7] = dx * dy * dz;
+                    for (int i = 0; i < 4; ++i) {
+                        f4Field[i] = zero;
+                        for (int corner : order) {
+                            f4Field[i] = L::Load(field[corner][i]) *
+                                weight[corner] + f4Field[i];
+                        }
+                    }
+                } else {
+                    for (int i = 0; i < 4; ++i) {
+                        f4Field[i] = L::Load(field[0][i]);
+                    }
+                }
+                sampled[c] = sampled[c] + Select(m, one, zero);
+
+                L fAlpha;
+                L f3Color[3] = {f4Field[1], f4Field[2], f4Field[3]};
+                if (simdTransfer) {
+                    const L fMin = L::Set1(vParam.fMinDensity);
+                    const L fMax = L::Set1(vParam.fMaxDensity);
+                    const uint32_t inRange = m &
+                        CmpGE(f4Field[0], fMin) & CmpLE(f4Field[0], fMax);
+                    const L fOpacity = (f4Field[0] - fMin) /
+                        L::Set1(vParam.fMaxDensity - vParam.fMinDensity);
+                    const L fp2 = fOpacity * fOpacity + L::Set1(0.02f);
+                    const L fp4 = fp2 * fp2;
+                    fAlpha = (fp4 * L::Set1(0.3f) + fp2 * L::Set1(0.1f) +
+                        fOpacity * L::Set1(0.15f)) * L::Set1(0.25f);
+                    if (march.fStepScale != 1.f) {
+                        fAlpha.Store(alpha);
+                        for (uint r = 0; r < kWidth; ++r) {
+                            alpha[r] = 1.f -
+                                std::pow(1.f - alpha[r], march.fStepScale);
+                        }
+                        fAlpha = L::Load(alpha);
+                    }
+                    fAlpha = Select(inRange, fAlpha, zero);
+                } else {
+                    float value[4][kWidth];
+                    for (int i = 0; i < 4; ++i) {
+                        f4Field[i].Store(value[i]);
+                    }
+                    for (uint r = 0; r < kWidth; ++r) {
+                        alpha[r] = 0.f;
+                        if (!(m >> r & 1u)) {
+                            continue;
+                        }
+                        const float4 f4Sample(value[0][r], value[1][r],
+                            value[2][r], value[3][r]);
+                        float3 f3Col;
+                        alpha[r] = _Classify(vParam, march, f4Sample,
+                            hasFront >> (base + r) & 1u ?
+                            front[base + r] : f4Sample, f3Col);
+                        color[0][r] = f3Col.x;
+                        color[1][r] = f3Col.y;
+                        color[2][r] = f3Col.z;
+                        front[base + r] = f4Sample;
+                    }
+                    hasFront |= m << base;
+                    fAlpha = L::Load(alpha);
+                    for (int i = 0; i < 3; ++i) {
+                        f3Color[i] = Select(m, L::Load(color[i]), zero);
+                    }
+                }
+                const L fScale = one - accu[c][3];
+                for (int i = 0; i < 3; ++i) {
+                    accu[c][i] = f3Color[i] * fAlpha * fScale + accu[c][i];
+                }
+                accu[c][3] = fAlpha * fScale + accu[c][3];
+                m &= ~CmpGE(accu[c][3], L::Set1(0.95f));
+
+                L fSteps = one;
+                if (march.fMinBallRadius > 0.f) {
+                    const uint32_t below =
+                        m & ~CmpGE(f4Field[0], L::Set1(vParam.fMinDensity));
+                    if (below) {
+                        for (uint r = 0; r < kWidth; ++r) {
+                            steps[r] = below >> r & 1u ? _SafeSteps(vol,
+                                fDeltaT, march.fMinBallRadius,
+                                float3(idx[0][r], idx[1][r], idx[2][r]),
+                                vParam.fMinDensity, probe) : 1.f;
+                        }
+                        fSteps = L::Load(steps);
+                        hasFront &= ~((below &
+                            ~CmpLE(fSteps, one)) << base);
+                    }
+                }
+                for (int axis = 0; axis < 3; ++axis) {
+                    p[c][axis] = Select(m,
+                        p[c][axis] + step[c][axis] * fSteps, p[c][axis]);
+                }
+                t[c] = Select(m, t[c] + L::Set1(fDeltaT) * fSteps, t[c]);
+                active[c] = m;
+                anyActive |= m != 0;
+            }
+        }
+
+        samples = 0;
+        for (uint c = 0; c < kChunks; ++c) {
+            float out[4][kWidth], count[kWidth];
+            for (int i = 0; i < 3; ++i) {
+                (accu[c][i] * accu[c][3]).Store(out[i]);
+            }
+            (accu[c][3] * accu[c][3]).Store(out[3]);
+            sampled[c].Store(count);
+            for (uint r = 0; r < kWidth; ++r) {
+                const uint ray = c * kWidth + r;
+                if (hitMask >> ray & 1u) {
+                    f4Colors[ray] =
+                        float4(out[0][r], out[1][r], out[2][r], out[3][r]);
+                    samples += (uint64_t)count[r];
+                }
+            }
+        }
+    }
+
+    typedef void (*_PacketFunc)(const CPUVolume& vol,
+        const VolumeParam& vParam, const CPURaymarcher::MarchSettings& march,
+        const float3& f3Origin, const float3* f3Dirs, uint32_t rayMask,
+        bool filter, float4* f4Colors, uint32_t& hitMask, uint64_t& samples);
+
+    // 4 ray packets fill one Lane4, larger ones the widest lanes there are.
+    // nullptr for single rays
+    _PacketFunc _SelectPacket(uint packetSize)
+    {
+        switch (packetSize) {
+        case 4: return _MarchPacket<_Lane4, 4>;
+        case 8: return _MarchPacket<SIMD::LaneN, 8>;
+        case 16: return _MarchPacket<SIMD::LaneN, 16>;
+        default: return nullptr;
+        }
+    }
+}
+
+float4
+CPURaymarcher::ReadVolume(const CPUVolume& vol, const float3& f3Idx,
+    bool filter)
+{
+    _NoProbe probe;
+    return _ReadVolume(vol, f3Idx, filter, probe);
+}
+
+bool
+CPURaymarcher::IntersectBox(const float3& f3Origin, const float3& f3Dir,
+    const float3& f3BoxMin, const float3& f3BoxMax, float& tNear, float& tFar)
+{
+    // HLSL min/max return the non NaN operand (0 * inf on axis parallel
+    // rays), so do fminf/fmaxf
+    const float invR[3] = {1.f / f3Dir.x, 1.f / f3Dir.y, 1.f / f3Dir.z};
+    const float o[3] = {f3Origin.x, f3Origin.y, f3Origin.z};
+    const float boxMin[3] = {f3BoxMin.x, f3BoxMin.y, f3BoxMin.z};
+    const float boxMax[3] = {f3BoxMax.x, f3BoxMax.y, f3BoxMax.z};
+    float tMin[3], tMax[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        const float tBot = invR[axis] * (boxMin[axis] - o[axis]);
+        const float tTop = invR[axis] * (boxMax[axis] - o[axis]);
+        tMin[axis] = fminf(tTop, tBot);
+        tMax[axis] = fmaxf(tTop, tBot);
+    }
+    tNear = fmaxf(fmaxf(tMin[0], tMin[1]), fmaxf(tMin[0], tMin[2]));
+    tFar = fminf(fminf(tMax[0], tMax[1]), fminf(tMax[0], tMax[2]));
+    return tNear <= tFar;
+}
+
+float4
+CPURaymarcher::AccumulatedShading(const CPUVolume& vol,
+    const VolumeParam& vParam, const float3& f3Origin, const float3& f3Dir,
+    float tNear, float tFar, bool filter, uint& samples,
+    const MarchSettings& march)
+{
+    _NoProbe probe;
+    _Ray ray(vParam, f3Origin, f3Dir, tNear, tFar, march);
+    while (_Step(vol, vParam, ray, filter, probe)) {
+    }
+    samples = ray.samples;
+    return ray.GetColor();
+}
+
+float4
+CPURaymarcher::AccumulatedShadingDDA(const CPUVolume& vol,
+    const VolumeParam& vParam, const float3& f3Origin, const float3& f3Dir,
+    float tNear, float tFar, bool filter, uint& samples,
+    const MarchSettings& march)
+{
+    _NoProbe probe;
+    _Ray ray(vParam, f3Origin, f3Dir, tNear, tFar, march);
+    _BrickDDA dda(vParam, ray.f3P, f3Dir, tNear);
+    for (;;) {
+        if (ray.t <= ray.tFar) {
+            dda.CatchUp(ray.t);
+            if (_EmptyBrick(vol, dda.brick, filter)) {
+                // jump to the first step past the brick
+                ray.Jump(std::ceil((dda.GetExitT() - ray.t) / ray.fDeltaT));
+                continue;
+            }
+        }
+        if (!_Step(vol, vParam, ray, filter, probe)) {
+            break;
+        }
+    }
+    samples = ray.samples;
+    return ray.GetColor();
+}
+
+float4
+CPURaymarcher::AccumulatedShadingPyramid(const CPUVolume& vol,
+    const DensityPyramid& pyramid, const VolumeParam& vParam,
+    const float3& f3Origin, const float3& f3Dir, float tNear, float tFar,
+    bool filter, uint& samples, const MarchSettings& march)
+{
+    _NoProbe probe;
+    _Ray ray(vParam, f3Origin, f3Dir, tNear, tFar, march);
+    const float fVoxelSize = vParam.fVoxelSize;
+    const float3 f3Half(vParam.u3VoxelReso.x * 0.5f,
+        vParam.u3VoxelReso.y * 0.5f, vParam.u3VoxelReso.z * 0.5f);
+    // one step moves the voxel index by f3Dir * fStepScale
+    const float dir[3] = {f3Dir.x * march.fStepScale,
+        f3Dir.y * march.fStepScale, f3Dir.z * march.fStepScale};
+    for (;;) {
+        if (ray.t <= ray.tFar) {
+            const float idx[3] = {ray.f3P.x / fVoxelSize + f3Half.x,
+                ray.f3P.y / fVoxelSize + f3Half.y,
+                ray.f3P.z / fVoxelSize + f3Half.z};
+            int level = -1;
+            if (idx[0] >= 0.f && idx[1] >= 0.f && idx[2] >= 0.f &&
+                idx[0] < vParam.u3VoxelReso.x &&
+                idx[1] < vParam.u3VoxelReso.y &&
+                idx[2] < vParam.u3VoxelReso.z) {
+                // coarsest empty cell around the sample
+                const uint voxel[3] = {(uint)idx[0], (uint)idx[1],
+                    (uint)idx[2]};
+                while (level + 1 < DensityPyramid::kNumLevels &&
+                    pyramid.IsEmpty(level + 1, voxel[0] >> (level + 2),
+                        voxel[1] >> (level + 2), voxel[2] >> (level + 2),
+                        vParam.fMinDensity, vParam.fMaxDensity, filter)) {
+                    ++level;
+                }
+                if (level >= 0) {
+                    // jump to the first step past the cell
+                    const float fSize = (float)pyramid.GetCellSize(level);
+                    float fExit = FLT_MAX;
+                    for (int axis = 0; axis < 3; ++axis) {
+                        if (dir[axis] == 0.f) {
+                            continue;
+                        }
+                        const float fCell =
+                            (float)(voxel[axis] >> (level + 1));
+                        const float fBound =
+                            (fCell + (dir[axis] > 0.f ? 1.f : 0.f)) * fSize;
+                        fExit = std::min(fExit,
+                            (fBound - idx[axis]) / dir[axis]);
+                    }
+                    ray.Jump(std::max(1.f, std::ceil(fExit)));
+                    continue;
+                }
+            }
+        }
+        if (!_Step(vol, vParam, ray, filter, probe)) {
+            break;
+        }
+    }
+    samples = ray.samples;
+    return ray.GetColor();
+}
+
+bool
+CPURaymarcher::IsoSurfaceShading(const CPUVolume& vol,
+    const PerFrameDataCB& perFrame, const VolumeParam& vParam,
+    const float3& f3Origin, const float3& f3Dir, float tNear, float tFar,
+    float fISOValue, uint normal, bool filter, float4& f4Color,
+    float& fDepth, uint& samples, const IsoSettings& iso)
+{
+    _NoProbe probe;
+    const float fVoxelSize = vParam.fVoxelSize;
+    const float fDeltaT = fVoxelSize * iso.fIsoStepScale;
+    const float3 f3Half(vParam.u3VoxelReso.x * 0.5f,
+        vParam.u3VoxelReso.y * 0.5f, vParam.u3VoxelReso.z * 0.5f);
+    auto index = [&](const float3& f3P) {
+        return float3(f3P.x / fVoxelSize + f3Half.x,
+            f3P.y / fVoxelSize + f3Half.y, f3P.z / fVoxelSize + f3Half.z);
+    };
+    auto lerp = [](const float3& a, const float3& b, float s) {
+        return float3(a.x + s * (b.x - a.x), a.y + s * (b.y - a.y),
+            a.z + s * (b.z - a.z));
+    };
+    // guard cells hold a whole coarse step, so its bounding box covers at
+    // most 2 of them along each axis
+    uint guardLevel = 0;
+    while (guardLevel + 1 < DensityPyramid::kNumLevels &&
+        (float)(2u << guardLevel) < iso.fIsoStepScale) {
+        ++guardLevel;
+    }
+    float3 f3P(f3Origin.x + f3Dir.x * tNear, f3Origin.y + f3Dir.y * tNear,
+        f3Origin.z + f3Dir.z * tNear);
+    float3 f3PreP = f3P;
+    const float3 f3Step(f3Dir.x * fDeltaT, f3Dir.y * fDeltaT,
+        f3Dir.z * fDeltaT);
+    const float3 f3VoxelStep(f3Dir.x * fVoxelSize, f3Dir.y * fVoxelSize,
+        f3Dir.z * fVoxelSize);
+    float t = tNear;
+    float fPreDensity = 0.f;
+    float fCurDensity = 0.f;
+    samples = 0;
+    while (t <= tFar) {
+        fPreDensity = fCurDensity;
+        fCurDensity = _ReadVolume(vol, index(f3P), filter, probe).x;
+        ++samples;
+        if (_Sign(fCurDensity - fISOValue) != _Sign(fPreDensity - fISOValue)) {
+            // refineCrossing, Illinois false position inside the bracket
+            float fPre = fPreDensity - fISOValue;
+            float fCur = fCurDensity - fISOValue;
+            int moved = 0;
+            for (uint i = 0; i < iso.uIsoRefineSteps; ++i) {
+                const float3 f3M = lerp(f3PreP, f3P, fPre / (fPre - fCur));
+                const float fM =
+                    _ReadVolume(vol, index(f3M), filter, probe).x - fISOValue;
+                ++samples;
+                if (_Sign(fM) == _Sign(fPre)) {
+                    f3PreP = f3M;
+                    fPre = fM;
+                    fCur *= moved < 0 ? 0.5f : 1.f;
+                    moved = -1;
+                } else {
+                    f3P = f3M;
+                    fCur = fM;
+                    fPre *= moved > 0 ? 0.5f : 1.f;
+                    moved = 1;
+                }
+            }
+            const float3 f3SurfPos =
+                lerp(f3PreP, f3P, fPre / (fPre - fCur));
+            const float4 f4ProjPos = _Transform(
+                (const float*)&perFrame.mWorldViewProj,
+                f3SurfPos.x, f3SurfPos.y, f3SurfPos.z, 1.f);
+            fDepth = f4ProjPos.z / f4ProjPos.w;
+            if (normal == NORMAL_GRADIENT_VOL) {
+                const float3 f3Normal = _Normalize(_ReadGradient(vol,
+                    index(f3SurfPos), filter));
+                f4Color = float4(f3Normal.x * 0.5f + 0.5f,
+                    f3Normal.y * 0.5f + 0.5f, f3Normal.z * 0.5f + 0.5f, 1.f);
+            } else if (normal == NORMAL_FINITE_DIFF) {
+                const float3 f3Normal = _Normalize(_FiniteDifferences(vol,
+                    index(f3SurfPos), filter, probe));
+                f4Color = float4(f3Normal.x * 0.5f + 0.5f,
+                    f3Normal.y * 0.5f + 0.5f, f3Normal.z * 0.5f + 0.5f, 1.f);
+            } else {
+                const float fStripe = f3SurfPos.z * 20.f;
+                const float fFrac = fStripe - std::floor(fStripe);
+                f4Color = float4(fFrac, fFrac, fFrac, fFrac);
+            }
+            return true;
+        }
+        f3PreP = f3P;
+        if (iso.fMinBallRadius > 0.f && fCurDensity < fISOValue) {
+            // land one step short of the bound, so the crossing still gets
+            // bracketed by two neighboring samples
+            const float fSkip = _SafeSteps(vol, fDeltaT, iso.fMinBallRadius,
+                index(f3P), fISOValue, probe) - 1.f;
+            f3P = float3(f3P.x + f3Step.x * fSkip, f3P.y + f3Step.y * fSkip,
+                f3P.z + f3Step.z * fSkip);
+            t += fDeltaT * fSkip;
+        }
+        // the march is below fISOValue here, a coarse step may only skip
+        // cells that can't reach it
+        if (iso.pGuard && fDeltaT > fVoxelSize && _MayReach(*iso.pGuard,
+            guardLevel, index(f3P), index(float3(f3P.x + f3Step.x,
+            f3P.y + f3Step.y, f3P.z + f3Step.z)), fISOValue, filter)) {
+            f3P = float3(f3P.x + f3VoxelStep.x, f3P.y + f3VoxelStep.y,
+                f3P.z + f3VoxelStep.z);
+            t += fVoxelSize;
+            continue;
+        }
+        f3P = float3(f3P.x + f3Step.x, f3P.y + f3Step.y, f3P.z + f3Step.z);
+        t += fDeltaT;
+    }
+    return false;
+}
+
+float
+CPURaymarcher::TransferFunction(const VolumeParam& vParam, float fDensity)
+{
+    return _TransferFunction(vParam, fDensity);
+}
+
+float
+CPURaymarcher::MinBallRadius(const float4* f4Balls, uint numOfBalls)
+{
+    if (!numOfBalls) {
+        return 0.f;
+    }
+    float fMinPower = f4Balls[0].w;
+    for (uint i = 1; i < numOfBalls; ++i) {
+        fMinPower = std::min(fMinPower, f4Balls[i].w);
+    }
+    return std::sqrt(fMinPower);
+}
+
+float4
+CPURaymarcher::Transform(const float* m, float x, float y, float z, float w)
+{
+    return _Transform(m, x, y, z, w);
+}
+
+bool
+CPURaymarcher::Invert(const float* m, float* inv)
+{
+    return _Invert(m, inv);
+}
+
+CPURaymarcher::RenderStats
+CPURaymarcher::Render(const CPUVolume& vol, const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, const RenderSettings& settings,
+    Image& image, WorkStealingPool* pool)
+{
+    RenderStats stats = {};
+    const VolumeParam& vParam = perCall.vParam;
+    image.uWidth = settings.uWidth;
+    image.uHeight = settings.uHeight;
+    image.color.assign((size_t)image.uWidth * image.uHeight,
+        settings.f4ClearColor);
+    image.depth.assign((size_t)image.uWidth * image.uHeight,
+        settings.fClearDepth);
+    // traced into target, with uRenderScale it gets upsampled afterwards
+    const uint scale = std::max<uint>(1, settings.uRenderScale);
+    Image lowRes;
+    Image& target = scale > 1 ? lowRes : image;
+    const uint width = (settings.uWidth + scale - 1) / scale;
+    const uint height = (settings.uHeight + scale - 1) / scale;
+    // the low resolution viewport is fractional like the GPU one, so pixel
+    // centers stay where Upsample expects them
+    const float fViewWidth = (float)settings.uWidth / scale;
+    const float fViewHeight = (float)settings.uHeight / scale;
+    if (scale > 1) {
+        lowRes.uWidth = width;
+        lowRes.uHeight = height;
+        lowRes.color.assign((size_t)width * height, settings.f4ClearColor);
+        lowRes.depth.assign((size_t)width * height, settings.fClearDepth);
+    }
+
+    float invWVP[16];
+    if (!width || !height ||
+        !_Invert((const float*)&perFrame.mWorldViewProj, invWVP)) {
+        return stats;
+    }
+    const uint tileSize = std::max<uint>(1, settings.uTileSize);
+    const uint tilesX = (width + tileSize - 1) / tileSize;
+    const uint tilesY = (height + tileSize - 1) / tileSize;
+    stats.uTiles = tilesX * tilesY;
+    stats.uNumWorkers = pool ? pool->GetNumWorkers() : 1;
+    const float3 f3Eye(perFrame.f4ViewPos.x, perFrame.f4ViewPos.y,
+        perFrame.f4ViewPos.z);
+    const float fISOValue = (vParam.fMinDensity + vParam.fMaxDensity) * 0.5f;
+    const float fMinBallRadius =
+        settings.bAdaptiveStep ? perCall.fMinBallRadius : 0.f;
+    MarchSettings march;
+    march.fMinBallRadius = fMinBallRadius;
+    march.fStepScale = perCall.fStepScale;
+    march.pLUT = settings.pTransferLUT;
+    march.uTransferMode =
+        march.pLUT ? perCall.uTransferMode : TRANSFER_POLYNOMIAL;
+    // temporal schedule and start jitter, in the shader's operation order
+    const uint temporalFrame = settings.bTemporal ? perCall.uTemporalFrame : 0;
+    const uint rayDivider =
+        settings.bTemporal ? perCall.uTemporalRayDivider : 0;
+    const uint maxSamples = perCall.uTemporalMaxSamples;
+    const float fJitter = temporalJitter(temporalFrame, rayDivider);
+    march.fStartOffset = fJitter * vParam.fVoxelSize * perCall.fStepScale;
+    const float fIsoStartOffset =
+        fJitter * vParam.fVoxelSize * perCall.fIsoStepScale;
+    IsoSettings iso;
+    iso.fMinBallRadius = fMinBallRadius;
+    iso.fIsoStepScale = perCall.fIsoStepScale;
+    iso.uIsoRefineSteps = perCall.uIsoRefineSteps;
+    iso.pGuard = settings.pPyramid;
+    auto scheduled = [&](uint x, uint y) {
+        return temporalScheduled(x, y, temporalFrame, rayDivider, maxSamples);
+    };
+    // scheduled pixels sit one per block of lattice^2 (the Bayer block), so
+    // packets gather theirs from lattice times their own footprint
+    uint lattice = 1;
+    if (temporalFrame != 0) {
+        for (uint block = 1; block < rayDivider; block <<= 2) {
+            lattice <<= 1;
+        }
+    }
+    // per tile counters, summed up afterwards so workers share nothing
+    std::vector<uint64_t> tileRays(stats.uTiles, 0);
+    std::vector<uint64_t> tileSamples(stats.uTiles, 0);
+    std::vector<uint64_t> tilePixels(stats.uTiles, 0);
+
+    // packets only march plain accumulated shading
+    const _PacketFunc packetFunc = settings.bIsoSurface ||
+        settings.pPyramid || settings.bBrickDDA || settings.pNearFar
+        ? nullptr : _SelectPacket(settings.uPacketSize);
+    const uint packetWidth = settings.uPacketSize == 4 ? 2 : 4;
+    const uint packetHeight = settings.uPacketSize / packetWidth;
+
+    auto rayDir = [&](uint x, uint y) {
+        const float fNdcX = (x + 0.5f) * 2.f / fViewWidth - 1.f;
+        const float fNdcY = 1.f - (y + 0.5f) * 2.f / fViewHeight;
+        // a point halfway in depth is in front of the eye with regular,
+        // reversed and infinite far projections alike, the ray through it is
+        // the one through f4Pos on the cube
+        const float4 f4Pos = _Transform(invWVP, fNdcX, fNdcY, 0.5f, 1.f);
+        return _Normalize(float3(f4Pos.x / f4Pos.w - f3Eye.x,
+            f4Pos.y / f4Pos.w - f3Eye.y, f4Pos.z / f4Pos.w - f3Eye.z));
+    };
+
+    auto renderTile = [&](uint32_t tile, uint32_t) {
+        const uint x0 = tile % tilesX * tileSize;
+        const uint y0 = tile / tilesX * tileSize;
+        const uint x1 = std::min(x0 + tileSize, width);
+        const uint y1 = std::min(y0 + tileSize, height);
+        if (packetFunc) {
+            float3 f3Dirs[kMaxPacketSize];
+            float4 f4Colors[kMaxPacketSize];
+            size_t pixels[kMaxPacketSize];
+            const uint footprintWidth = packetWidth * lattice;
+            const uint footprintHeight = packetHeight * lattice;
+            for (uint py = y0; py < y1; py += footprintHeight) {
+                for (uint px = x0; px < x1; px += footprintWidth) {
+                    // rays past the tile stay masked off
+                    uint32_t rayMask = 0;
+                    uint r = 0;
+                    for (uint y = py; y < std::min(py + footprintHeight, y1);
+                        ++y) {
+                        for (uint x = px; x < std::min(px + footprintWidth,
+                            x1) && r < settings.uPacketSize; ++x) {
+                            if (scheduled(x, y)) {
+                                f3Dirs[r] = rayDir(x, y);
+                                pixels[r] = (size_t)y * width + x;
+                                rayMask |= 1u << r++;
+                            }
+                        }
+                    }
+                    for (; r < settings.uPacketSize; ++r) {
+                        f3Dirs[r] = float3(1.f, 1.f, 1.f);
+                    }
+                    uint32_t hitMask;
+                    uint64_t samples;
+                    packetFunc(vol, vParam, march, f3Eye, f3Dirs, rayMask,
+                        settings.bFilter, f4Colors, hitMask, samples);
+                    for (r = 0; r < settings.uPacketSize; ++r) {
+                        if (hitMask >> r & 1u) {
+                            target.color[pixels[r]] = f4Colors[r];
+                            target.depth[pixels[r]] = 0.f;
+                        }
+                    }
+                    tileRays[tile] += _PopCount(hitMask);
+                    tileSamples[tile] += samples;
+                    tilePixels[tile] += _PopCount(rayMask);
+                }
+            }
+            return;
+        }
+        for (uint y = y0; y < y1; ++y) {
+            for (uint x = x0; x < x1; ++x) {
+                if (!scheduled(x, y)) {
+                    continue;
+                }
+                ++tilePixels[tile];
+                const float3 f3Dir = rayDir(x, y);
+                float tNear, tFar;
+                if (settings.pNearFar) {
+                    const NearFarRasterizer::Range& range =
+                        settings.pNearFar->GetNearFar(x, y);
+                    tNear = range.fNear;
+                    tFar = range.fFar;
+                    if (!(tFar - tNear > 0.f)) {
+                        continue;
+                    }
+                } else if (!IntersectBox(f3Eye, f3Dir, vParam.f3BoxMin,
+                    vParam.f3BoxMax, tNear, tFar)) {
+                    continue;
+                }
+                tNear = std::max(tNear, 0.f) + (settings.bIsoSurface
+                    ? fIsoStartOffset : march.fStartOffset);
+                const size_t pixel = (size_t)y * width + x;
+                float4 f4Col(0.01f, 0.01f, 0.01f, 0.f);
+                float fDepth = 0.f;
+                uint samples;
+                if (settings.bIsoSurface) {
+                    IsoSurfaceShading(vol, perFrame, vParam, f3Eye, f3Dir,
+                        tNear, tFar, fISOValue, !settings.bUseNormal
+                        ? NORMAL_NONE : settings.bGradientNormal
+                        ? NORMAL_GRADIENT_VOL : NORMAL_FINITE_DIFF,
+                        settings.bFilter, f4Col, fDepth, samples, iso);
+                } else if (settings.pPyramid) {
+                    f4Col = AccumulatedShadingPyramid(vol,
+                        *settings.pPyramid, vParam, f3Eye, f3Dir, tNear, tFar,
+                        settings.bFilter, samples, march);
+                } else if (settings.bBrickDDA) {
+                    f4Col = AccumulatedShadingDDA(vol, vParam, f3Eye, f3Dir,
+                        tNear, tFar, settings.bFilter, samples, march);
+                } else {
+                    f4Col = AccumulatedShading(vol, vParam, f3Eye, f3Dir,
+                        tNear, tFar, settings.bFilter, samples, march);
+                }
+                target.color[pixel] = f4Col;
+                target.depth[pixel] = fDepth;
+                ++tileRays[tile];
+                tileSamples[tile] += samples;
+            }
+        }
+    };
+
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+    if (pool) {
+        pool->ParallelFor(stats.uTiles, renderTile);
+    } else {
+        for (uint tile = 0; tile < stats.uTiles; ++tile) {
+            renderTile(tile, 0);
+        }
+    }
+    if (scale > 1) {
+        BenchmarkClock::time_point upsampleStart = BenchmarkClock::now();
+        Upsample(lowRes, scale, settings.uWidth, settings.uHeight, image,
+            pool);
+        stats.dUpsampleMs = ElapsedMs(upsampleStart);
+    }
+    stats.dMs = ElapsedMs(start);
+    for (uint tile = 0; tile < stats.uTiles; ++tile) {
+        stats.uRays += tileRays[tile];
+        stats.uSamples += tileSamples[tile];
+        stats.uPixels += tilePixels[tile];
+    }
+    stats.dRaysPerSec = stats.uRays / std::max(stats.dMs * 1e-3, 1e-9);
+    stats.dSamplesPerRay =
+        (double)stats.uSamples / std::max<uint64_t>(stats.uRays, 1);
+    return stats;
+}
+
+void
+CPURaymarcher::Upsample(const Image& lowRes, uint scale, uint width,
+    uint height, Image& image, WorkStealingPool* pool)
+{
+    image.uWidth = width;
+    image.uHeight = height;
+    image.color.assign((size_t)width * height, float4(0.f, 0.f, 0.f, 0.f));
+    image.depth.assign((size_t)width * height, 0.f);
+    if (!lowRes.uWidth || !lowRes.uHeight) {
+        return;
+    }
+    const int maxX = (int)lowRes.uWidth - 1;
+    const int maxY = (int)lowRes.uHeight - 1;
+    const float fScale = (float)std::max<uint>(1, scale);
+    auto lowResIdx = [&](int x, int y) {
+        return (size_t)std::min(std::max(y, 0), maxY) * lowRes.uWidth +
+            std::min(std::max(x, 0), maxX);
+    };
+    auto upsampleRow = [&](uint32_t y, uint32_t) {
+        // low res texel space, texel centers at integers
+        const float fY = (y + 0.5f) / fScale - 0.5f;
+        const float fBaseY = std::floor(fY);
+        const float fracY = fY - fBaseY;
+        for (uint x = 0; x < width; ++x) {
+            const float fX = (x + 0.5f) / fScale - 0.5f;
+            const float fBaseX = std::floor(fX);
+            const float fracX = fX - fBaseX;
+            // the nearest low res sample is the depth reference
+            const float fRefDepth = lowRes.depth[lowResIdx(
+                (int)std::floor(fX + 0.5f), (int)std::floor(fY + 0.5f))];
+            float4 f4Sum(0.f, 0.f, 0.f, 0.f);
+            float fWeightSum = 0.f;
+            for (int i = 0; i < 4; ++i) {
+                const int dx = i & 1;
+                const int dy = i >> 1;
+                const size_t idx =
+                    lowResIdx((int)fBaseX + dx, (int)fBaseY + dy);
+                const float fWeight = (dx ? fracX : 1.f - fracX) *
+                    (dy ? fracY : 1.f - fracY) *
+                    _DepthWeight(fRefDepth, lowRes.depth[idx]);
+                f4Sum = _Mad(lowRes.color[idx], fWeight, f4Sum);
+                fWeightSum += fWeight;
+            }
+            // the nearest sample has a bilinear weight of at least 0.25
+            const size_t pixel = (size_t)y * width + x;
+            image.color[pixel] = float4(f4Sum.x / fWeightSum,
+                f4Sum.y / fWeightSum, f4Sum.z / fWeightSum,
+                f4Sum.w / fWeightSum);
+            image.depth[pixel] = fRefDepth;
+        }
+    };
+    if (pool) {
+        pool->ParallelFor(height, upsampleRow);
+    } else {
+        for (uint y = 0; y < height; ++y) {
+            upsampleRow(y, 0);
+        }
+    }
+}
+
+bool
+CPURaymarcher::SavePFM(const Image& image, const char* fileName)
+{
+    std::ofstream file(fileName, std::ios::binary);
+    // negative scale: little endian, rows go bottom to top
+    file << "PF\n" << image.uWidth << " " << image.uHeight << "\n-1.0\n";
+    std::vector<float> row((size_t)image.uWidth * 3);
+    for (uint y = image.uHeight; file && y-- > 0;) {
+        for (uint x = 0; x < image.uWidth; ++x) {
+            const float4& c = image.color[(size_t)y * image.uWidth + x];
+            row[x * 3] = c.x;
+            row[x * 3 + 1] = c.y;
+            row[x * 3 + 2] = c.z;
+        }
+        file.write((const char*)row.data(), row.size() * sizeof(float));
+    }
+    return !file.fail();
+}
+
+bool
+CPURaymarcher::LoadPFM(Image& image, const char* fileName)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    std::string magic;
+    uint width = 0, height = 0;
+    float scale = 0.f;
+    file >> magic >> width >> height >> scale;
+    // one whitespace ends the header
+    file.get();
+    if (!file || magic != "PF" || scale >= 0.f) {
+        return false;
+    }
+    image.uWidth = width;
+    image.uHeight = height;
+    image.color.assign((size_t)width * height, float4(0.f, 0.f, 0.f, 0.f));
+    image.depth.clear();
+    std::vector<float> row((size_t)width * 3);
+    for (uint y = height; file && y-- > 0;) {
+        file.read((char*)row.data(), row.size() * sizeof(float));
+        for (uint x = 0; x < width; ++x) {
+            image.color[(size_t)y * width + x] =
+                float4(row[x * 3], row[x * 3 + 1], row[x * 3 + 2], 0.f);
+        }
+    }
+    return !file.fail();
+}
+
+CPURaymarcher::ImageDiff
+CPURaymarcher::Compare(const Image& a, const Image& b, float tolerance)
+{
+    ImageDiff diff = {};
+    if (a.uWidth != b.uWidth || a.uHeight != b.uHeight ||
+        a.color.size() != b.color.size()) {
+        diff.bSizeMismatch = true;
+        return diff;
+    }
+    double sumSq = 0.0;
+    for (size_t i = 0; i < a.color.size(); ++i) {
+        const float err[3] = {std::fabs(a.color[i].x - b.color[i].x),
+            std::fabs(a.color[i].y - b.color[i].y),
+            std::fabs(a.color[i].z - b.color[i].z)};
+        float maxErr = 0.f;
+        for (float e : err) {
+            maxErr = std::max(maxErr, e);
+            sumSq += (double)e * e;
+        }
+        diff.fMaxError = std::max(diff.fMaxError, maxErr);
+        diff.uDiffPixels += maxErr > tolerance ? 1 : 0;
+    }
+    diff.dRMSE =
+        std::sqrt(sumSq / std::max<size_t>(a.color.size() * 3, 1));
+    return diff;
+}
+
+std::vector<CPURaymarcher::AdaptiveStepResult>
+CPURaymarcher::BenchmarkAdaptiveStep(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso,
+    const std::vector<uint>& ballCounts, uint width, uint height,
+    WorkStealingPool* pool)
+{
+    std::vector<AdaptiveStepResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+
+    RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    settings.bUseNormal = true;
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    Image fixedImage, adaptiveImage;
+    for (uint ballCount : ballCounts) {
+        cb.uNumOfBalls = std::min<uint>(ballCount, MAX_BALLS);
+        cb.fMinBallRadius = MinBallRadius(perFrame.f4Balls, cb.uNumOfBalls);
+        vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+        updater.Update(perFrame, cb, vol, false,
+            CPUVolumeUpdater::kSIMDLane, pool);
+        for (int iso = 0; iso < 2; ++iso) {
+            AdaptiveStepResult result = {};
+            result.uNumOfBalls = cb.uNumOfBalls;
+            result.bIsoSurface = iso != 0;
+            settings.bIsoSurface = result.bIsoSurface;
+            settings.bAdaptiveStep = false;
+            const RenderStats fixed =
+                Render(vol, perFrame, cb, settings, fixedImage, pool);
+            settings.bAdaptiveStep = true;
+            const RenderStats adaptive =
+                Render(vol, perFrame, cb, settings, adaptiveImage, pool);
+            result.dFixedMs = fixed.dMs;
+            result.dAdaptiveMs = adaptive.dMs;
+            result.dFixedSamplesPerRay = fixed.dSamplesPerRay;
+            result.dAdaptiveSamplesPerRay = adaptive.dSamplesPerRay;
+            const ImageDiff diff =
+                Compare(fixedImage, adaptiveImage, 1.f / 255.f);
+            result.fMaxError = diff.fMaxError;
+            result.uDiffPixels = diff.uDiffPixels;
+            results.push_back(result);
+        }
+    }
+    return results;
+}
+
+std::vector<CPURaymarcher::NormalResult>
+CPURaymarcher::BenchmarkNormals(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, uint numOfBalls, uint width,
+    uint height, WorkStealingPool* pool)
+{
+    std::vector<NormalResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+    cb.uNumOfBalls = std::min<uint>(numOfBalls, MAX_BALLS);
+
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+    BenchmarkClock::time_point start = BenchmarkClock::now();
+    updater.Update(perFrame, cb, vol, false, CPUVolumeUpdater::kSIMDLane,
+        pool);
+    const double dPlainUpdateMs = ElapsedMs(start);
+    // the density stays bit identical, only the gradients get added
+    vol.EnableGradients();
+    start = BenchmarkClock::now();
+    updater.Update(perFrame, cb, vol, false, CPUVolumeUpdater::kSIMDLane,
+        pool);
+    const double dGradientUpdateMs = ElapsedMs(start);
+
+    float invWVP[16];
+    if (!_Invert((const float*)&perFrame.mWorldViewProj, invWVP)) {
+        return results;
+    }
+    RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    settings.bIsoSurface = true;
+    // g_SceneDepthBuffer clears to 0 (reversed z)
+    settings.fClearDepth = 0.f;
+    Image image;
+    const uint normals[] = {NORMAL_NONE, NORMAL_FINITE_DIFF,
+        NORMAL_GRADIENT_VOL};
+    for (int filter = 1; filter >= 0; --filter) {
+        settings.bFilter = filter != 0;
+        for (uint normal : normals) {
+            settings.bUseNormal = normal != NORMAL_NONE;
+            settings.bGradientNormal = normal == NORMAL_GRADIENT_VOL;
+            const RenderStats stats =
+                Render(vol, perFrame, cb, settings, image, pool);
+            NormalResult result = {};
+            result.uNormal = normal;
+            result.bFilter = settings.bFilter;
+            result.dUpdateMs = normal == NORMAL_GRADIENT_VOL
+                ? dGradientUpdateMs : dPlainUpdateMs;
+            result.dMs = stats.dMs;
+            result.dRaysPerSec = stats.dRaysPerSec;
+            double dErrorSum = 0.0;
+            std::vector<float3> hits;
+            for (uint y = 0; normal != NORMAL_NONE && y < height; ++y) {
+                for (uint x = 0; x < width; ++x) {
+                    const size_t pixel = (size_t)y * width + x;
+                    const float4& f4Col = image.color[pixel];
+                    if (f4Col.w != 1.f) {
+                        continue;
+                    }
+                    // hit back in local space from its depth
+                    const float4 f4P = _Transform(invWVP,
+                        (x + 0.5f) * 2.f / width - 1.f,
+                        1.f - (y + 0.5f) * 2.f / height,
+                        image.depth[pixel], 1.f);
+                    const float3 f3P(f4P.x / f4P.w, f4P.y / f4P.w,
+                        f4P.z / f4P.w);
+                    hits.push_back(float3(
+                        f3P.x / vParam.fVoxelSize + reso * 0.5f,
+                        f3P.y / vParam.fVoxelSize + reso * 0.5f,
+                        f3P.z / vParam.fVoxelSize + reso * 0.5f));
+                    float3 f3Gradient(0.f, 0.f, 0.f);
+                    for (uint i = 0; i < cb.uNumOfBalls; ++i) {
+                        const float4& f4Ball = perFrame.f4Balls[i];
+                        const float3 f3d(f3P.x - f4Ball.x, f3P.y - f4Ball.y,
+                            f3P.z - f4Ball.z);
+                        const float fDistSq =
+                            f3d.x * f3d.x + f3d.y * f3d.y + f3d.z * f3d.z;
+                        const float k = f4Ball.w / (fDistSq * fDistSq);
+                        f3Gradient = float3(f3Gradient.x - f3d.x * k,
+                            f3Gradient.y - f3d.y * k, f3Gradient.z - f3d.z * k);
+                    }
+                    const float3 f3Ref = _Normalize(f3Gradient);
+                    const float3 f3Normal = _Normalize(float3(
+                        f4Col.x * 2.f - 1.f, f4Col.y * 2.f - 1.f,
+                        f4Col.z * 2.f - 1.f));
+                    const float fCos = std::min(std::max(f3Ref.x * f3Normal.x +
+                        f3Ref.y * f3Normal.y + f3Ref.z * f3Normal.z, -1.f),
+                        1.f);
+                    const float fErrorDeg = std::acos(fCos) * 57.2957795f;
+                    dErrorSum += fErrorDeg;
+                    result.fMaxErrorDeg =
+                        std::max(result.fMaxErrorDeg, fErrorDeg);
+                    ++result.uHits;
+                }
+            }
+            result.dMeanErrorDeg = dErrorSum / std::max<uint64_t>(
+                result.uHits, 1);
+            // the normals alone (a small share of the render), one thread
+            // over the hits again
+            _NoProbe probe;
+            // keeps the loop from being optimized away
+            volatile float fSink = 0.f;
+            const uint passes = 16;
+            start = BenchmarkClock::now();
+            for (uint pass = 0; pass < passes; ++pass) {
+                for (const float3& f3Idx : hits) {
+                    fSink = _Normalize(normal == NORMAL_GRADIENT_VOL
+                        ? _ReadGradient(vol, f3Idx, settings.bFilter)
+                        : _FiniteDifferences(vol, f3Idx, settings.bFilter,
+                        probe)).x;
+                }
+            }
+            (void)fSink;
+            result.dNormalNsPerHit = hits.empty() ? 0.0 :
+                ElapsedMs(start) * 1e6 / ((double)hits.size() * passes);
+            results.push_back(result);
+        }
+    }
+    return results;
+}
+
+std::vector<CPURaymarcher::IsoRefineResult>
+CPURaymarcher::BenchmarkIsoRefine(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, uint numOfBalls, uint width,
+    uint height, WorkStealingPool* pool)
+{
+    std::vector<IsoRefineResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+    cb.uNumOfBalls = std::min<uint>(numOfBalls, MAX_BALLS);
+
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+    updater.Update(perFrame, cb, vol, false, CPUVolumeUpdater::kSIMDLane,
+        pool);
+    DensityPyramid pyramid;
+    pyramid.Build(vol, pool);
+
+    float invWVP[16];
+    if (!_Invert((const float*)&perFrame.mWorldViewProj, invWVP)) {
+        return results;
+    }
+    RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    settings.bIsoSurface = true;
+    // g_SceneDepthBuffer clears to 0 (reversed z)
+    settings.fClearDepth = 0.f;
+    // hit back in local space from its depth, w is 0 for a miss
+    auto hits = [&](const Image& image) {
+        std::vector<float4> f4Hits((size_t)width * height,
+            float4(0.f, 0.f, 0.f, 0.f));
+        for (uint y = 0; y < height; ++y) {
+            for (uint x = 0; x < width; ++x) {
+                const size_t pixel = (size_t)y * width + x;
+                if (image.depth[pixel] == settings.fClearDepth) {
+                    continue;
+                }
+                const float4 f4P = _Transform(invWVP,
+                    (x + 0.5f) * 2.f / width - 1.f,
+                    1.f - (y + 0.5f) * 2.f / height, image.depth[pixel], 1.f);
+                f4Hits[pixel] = float4(f4P.x / f4P.w, f4P.y / f4P.w,
+                    f4P.z / f4P.w, 1.f);
+            }
+        }
+        return f4Hits;
+    };
+
+    Image image;
+    cb.fIsoStepScale = 0.25f;
+    cb.uIsoRefineSteps = 8;
+    Render(vol, perFrame, cb, settings, image, pool);
+    const std::vector<float4> f4RefHits = hits(image);
+
+    const float stepScales[] = {1.f, 2.f, 3.f, 4.f};
+    const uint refineSteps[] = {0, 2, 4};
+    for (float fStepScale : stepScales) {
+        for (int guard = 0; guard < (fStepScale > 1.f ? 2 : 1); ++guard) {
+            settings.pPyramid = guard ? &pyramid : nullptr;
+            for (uint steps : refineSteps) {
+                cb.fIsoStepScale = fStepScale;
+                cb.uIsoRefineSteps = steps;
+                const RenderStats stats =
+                    Render(vol, perFrame, cb, settings, image, pool);
+                const std::vector<float4> f4Hits = hits(image);
+                IsoRefineResult result = {};
+                result.fIsoStepScale = fStepScale;
+                result.uIsoRefineSteps = steps;
+                result.bGuard = guard != 0;
+                result.dMs = stats.dMs;
+                result.dSamplesPerRay = stats.dSamplesPerRay;
+                double dErrorSum = 0.0;
+                for (size_t pixel = 0; pixel < f4Hits.size(); ++pixel) {
+                    const float4& f4Hit = f4Hits[pixel];
+                    const float4& f4Ref = f4RefHits[pixel];
+                    if (f4Hit.w == 0.f) {
+                        result.uMissedHits += f4Ref.w != 0.f;
+                        continue;
+                    }
+                    ++result.uHits;
+                    if (f4Ref.w == 0.f) {
+                        ++result.uFarOffHits;
+                        continue;
+                    }
+                    const float3 f3d(f4Hit.x - f4Ref.x, f4Hit.y - f4Ref.y,
+                        f4Hit.z - f4Ref.z);
+                    const float fError = std::sqrt(f3d.x * f3d.x +
+                        f3d.y * f3d.y + f3d.z * f3d.z) / vParam.fVoxelSize;
+                    if (fError > 1.f) {
+                        ++result.uFarOffHits;
+                        continue;
+                    }
+                    dErrorSum += fError;
+                    result.fMaxErrorVoxels =
+                        std::max(result.fMaxErrorVoxels, fError);
+                }
+                result.dMeanErrorVoxels = dErrorSum / std::max<uint64_t>(
+                    result.uHits - result.uFarOffHits, 1);
+                results.push_back(result);
+            }
+        }
+    }
+    return results;
+}
+
+std::vector<CPURaymarcher::LayoutResult>
+CPURaymarcher::BenchmarkLayouts(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso)
+{
+    std::vector<LayoutResult> results;
+    PerCallDataCB cb = perCall;
+    VolumeParam& vParam = cb.vParam;
+    vParam.u3VoxelReso = uint3(reso, reso, reso);
+    vParam.uVoxelBrickRatio = std::max<uint>(1, vParam.uVoxelBrickRatio);
+    const float halfSize = 0.5f * reso * vParam.fVoxelSize;
+    vParam.f3BoxMax = float3(halfSize, halfSize, halfSize);
+    vParam.f3BoxMin = float3(-halfSize, -halfSize, -halfSize);
+
+    struct RaySetup {
+        const char* name;
+        float3 dir;
+        float3 u;
+    };
+    const RaySetup setups[] = {
+        {"x", float3(1.f, 0.f, 0.f), float3(0.f, 1.f, 0.f)},
+        {"z", float3(0.f, 0.f, 1.f), float3(1.f, 0.f, 0.f)},
+        {"diagonal", _Normalize(float3(1.f, 1.f, 1.f)),
+            _Normalize(float3(1.f, -1.f, 0.f))},
+    };
+    const uint layouts[] = {VOXEL_LAYOUT_LINEAR, VOXEL_LAYOUT_SWIZZLED};
+
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    for (uint layout : layouts) {
+        vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio,
+            CPUVolume::kTypedBuffer, CPUVolume::k32Bit, layout);
+        updater.Update(perFrame, cb, vol, false);
+        for (const RaySetup& setup : setups) {
+            LayoutResult result = {};
+            result.uLayout = layout;
+            result.szRayDir = setup.name;
+            _NoProbe noProbe;
+            BenchmarkClock::time_point start = BenchmarkClock::now();
+            result.uSamples = _MarchOrtho(vol, vParam, setup.dir, setup.u,
+                reso, noProbe);
+            result.dMs = ElapsedMs(start);
+            result.dSamplesPerSec = result.uSamples / (result.dMs * 1e-3);
+
+            _CacheProbe cacheProbe(sizeof(float4));
+            _MarchOrtho(vol, vParam, setup.dir, setup.u, reso, cacheProbe);
+            const double samples = (double)std::max<uint64_t>(1,
+                result.uSamples);
+            result.dL1MissesPerSample = cacheProbe.l1.GetMisses() / samples;
+            result.dL2MissesPerSample = cacheProbe.l2.GetMisses() / samples;
+            results.push_back(result);
+        }
+    }
+    return results;
+}
+
+std::vector<CPURaymarcher::BrickDDAResult>
+CPURaymarcher::BenchmarkBrickDDA(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso,
+    const std::vector<uint>& ballCounts, uint width, uint height,
+    WorkStealingPool* pool)
+{
+    std::vector<BrickDDAResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+
+    RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    Image plainImage, ddaImage;
+    for (uint ballCount : ballCounts) {
+        cb.uNumOfBalls = std::min<uint>(ballCount, MAX_BALLS);
+        vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+        updater.Update(perFrame, cb, vol, true,
+            CPUVolumeUpdater::kSIMDLane, pool);
+
+        BrickDDAResult result = {};
+        result.uNumOfBalls = cb.uNumOfBalls;
+        result.dOccupiedBricks = (double)vol.flags.Count() /
+            std::max<size_t>(vol.flags.GetBrickCount(), 1);
+        settings.bBrickDDA = false;
+        const RenderStats plain =
+            Render(vol, perFrame, cb, settings, plainImage, pool);
+        settings.bBrickDDA = true;
+        const RenderStats dda =
+            Render(vol, perFrame, cb, settings, ddaImage, pool);
+        result.dPlainMs = plain.dMs;
+        result.dDDAMs = dda.dMs;
+        result.dPlainSamplesPerRay = plain.dSamplesPerRay;
+        result.dDDASamplesPerRay = dda.dSamplesPerRay;
+        result.dPlainRaysPerSec = plain.dRaysPerSec;
+        result.dDDARaysPerSec = dda.dRaysPerSec;
+        const ImageDiff diff = Compare(plainImage, ddaImage, 1.f / 255.f);
+        result.fMaxError = diff.fMaxError;
+        result.uDiffPixels = diff.uDiffPixels;
+        results.push_back(result);
+    }
+    return results;
+}
+
+std::vector<CPURaymarcher::PacketResult>
+CPURaymarcher::BenchmarkPackets(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso,
+    const std::vector<uint>& ballCounts, uint width, uint height,
+    WorkStealingPool* pool)
+{
+    std::vector<PacketResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+
+    const uint packetSizes[] = {0, 4, 8, 16};
+    RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    Image singleImage, packetImage;
+    for (uint ballCount : ballCounts) {
+        cb.uNumOfBalls = std::min<uint>(ballCount, MAX_BALLS);
+        vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+        updater.Update(perFrame, cb, vol, false,
+            CPUVolumeUpdater::kSIMDLane, pool);
+        for (uint packetSize : packetSizes) {
+            settings.uPacketSize = packetSize;
+            Image& image = packetSize ? packetImage : singleImage;
+            const RenderStats stats =
+                Render(vol, perFrame, cb, settings, image, pool);
+            PacketResult result = {};
+            result.uNumOfBalls = cb.uNumOfBalls;
+            result.uPacketSize = packetSize;
+            result.dMs = stats.dMs;
+            result.dRaysPerSec = stats.dRaysPerSec;
+            result.dSamplesPerRay = stats.dSamplesPerRay;
+            result.fMaxError = packetSize ?
+                Compare(singleImage, packetImage, 0.f).fMaxError : 0.f;
+            results.push_back(result);
+        }
+    }
+    return results;
+}
+
+std::vector<CPURaymarcher::UpsampleResult>
+CPURaymarcher::BenchmarkUpsample(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, uint numOfBalls, uint width,
+    uint height, WorkStealingPool* pool)
+{
+    std::vector<UpsampleResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+    cb.uNumOfBalls = std::min<uint>(numOfBalls, MAX_BALLS);
+
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+    updater.Update(perFrame, cb, vol, false, CPUVolumeUpdater::kSIMDLane,
+        pool);
+
+    RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    settings.bUseNormal = true;
+    // g_SceneDepthBuffer clears to 0 (reversed z)
+    settings.fClearDepth = 0.f;
+    Image reference, image;
+    // full resolution first, it is the reference of the others
+    const uint scales[] = {1, 2, 4};
+    for (int iso = 0; iso < 2; ++iso) {
+        settings.bIsoSurface = iso != 0;
+        for (uint scale : scales) {
+            settings.uRenderScale = scale;
+            const RenderStats stats = Render(vol, perFrame, cb, settings,
+                scale == 1 ? reference : image, pool);
+            const ImageDiff diff = Compare(reference,
+                scale == 1 ? reference : image, 1.f / 255.f);
+            UpsampleResult result = {};
+            result.uRenderScale = scale;
+            result.bIsoSurface = settings.bIsoSurface;
+            result.dMs = stats.dMs;
+            result.dUpsampleMs = stats.dUpsampleMs;
+            result.dRaysPerPixel =
+                (double)stats.uRays / std::max(width * height, 1u);
+            result.dRMSE = diff.dRMSE;
+            result.fMaxError = diff.fMaxError;
+            result.uDiffPixels = diff.uDiffPixels;
+            results.push_back(result);
+        }
+    }
+    return results;
+}
\ No newline at end of file
@@ -0,0 +1,341 @@
+#pragma once
+// CPU port of the ray marching in SparseVolume_RayCast_ps.hlsl (IntersectBox,
+// readVolume, accumulatedShading, isoSurfaceShading) over a CPUVolume.
+// Headless like CPUVolumeUpdater, so images can be rendered and diffed
+// offline without a GPU. Voxel reads go through the volume's layout, so the
+// march walks memory in the same order the GPU buffer gets read.
+#include "CPUVolumeUpdater.h"
+
+class DensityPyramid;
+class NearFarRasterizer;
+class TransferFunctionLUT;
+
+class CPURaymarcher
+{
+public:
+    // Permutation of SparseVolume_RayCast_ps.hlsl to follow. Rays start at
+    // IntersectBox like ENABLE_BRICKS == 0 unless pNearFar is given
+    struct RenderSettings {
+        uint uWidth = 0;
+        uint uHeight = 0;
+        bool bIsoSurface = false; // ISO_SURFACE
+        bool bUseNormal = false; // USE_NORMAL
+        // NORMAL_GRADIENT_VOL, the volume's gradients have to be written
+        bool bGradientNormal = false;
+        bool bFilter = true; // FILTER_READ == 1
+        // BRICK_DDA, accumulated shading skips bricks not flagged in the
+        // volume's flags (dilated by a brick with bFilter)
+        bool bBrickDDA = false;
+        // accumulated shading jumps over the empty cells of the pyramid
+        // (built over the rendered volume), takes precedence over bBrickDDA.
+        // Iso surface shading guards its coarse steps with it (see
+        // IsoSettings::pGuard)
+        const DensityPyramid* pPyramid = nullptr;
+        // ENABLE_BRICKS, rays start and end at its near/far (rasterized for
+        // uWidth x uHeight at uRenderScale) instead of IntersectBox and go
+        // one by one
+        const NearFarRasterizer* pNearFar = nullptr;
+        // ADAPTIVE_STEP, bounded by perCall.fMinBallRadius
+        bool bAdaptiveStep = false;
+        // tables of perCall.uTransferMode (built for perCall.vParam),
+        // TRANSFER_POLYNOMIAL is used without
+        const TransferFunctionLUT* pTransferLUT = nullptr;
+        // accumulated shading traces packets of 4, 8 or 16 rays (2x2, 4x2 or
+        // 4x4 pixels) across the SIMD lanes, 0 traces rays one by one. Brick
+        // DDA and the pyramid always go ray by ray
+        uint uPacketSize = 8;
+        // rays are traced at 1/uRenderScale of uWidth x uHeight (the
+        // viewport of the low resolution raycast) and the image is brought
+        // back to full size with Upsample
+        uint uRenderScale = 1;
+        // follow the temporal schedule and jitter of perCall (see
+        // TemporalSchedule.inl), pixels off it are left cleared
+        bool bTemporal = false;
+        // pixels of the square tiles handed to the workers, a multiple of 4
+        // keeps packets whole
+        uint uTileSize = 16;
+        // left where rays miss the box (discard)
+        float4 f4ClearColor = float4(0.f, 0.f, 0.f, 0.f);
+        float fClearDepth = 1.f;
+    };
+
+    // Render target and depth (SV_Depth, only changed by iso surface hits)
+    // of Render, rows top to bottom
+    struct Image {
+        uint uWidth = 0;
+        uint uHeight = 0;
+        std::vector<float4> color;
+        std::vector<float> depth;
+    };
+
+    // accumulatedShading options, the PerCallDataCB fields of the same name
+    struct MarchSettings {
+        // > 0 steps like ADAPTIVE_STEP: below fMinDensity it jumps over the
+        // whole steps the metaball field can't reach it in
+        float fMinBallRadius = 0.f;
+        // steps are fVoxelSize * fStepScale long
+        float fStepScale = 1.f;
+        uint uTransferMode = TRANSFER_POLYNOMIAL;
+        // has to be set for TRANSFER_LUT and TRANSFER_PREINTEGRATED
+        const TransferFunctionLUT* pLUT = nullptr;
+        // added to the clamped tNear of packets, Render's temporal jitter
+        float fStartOffset = 0.f;
+    };
+
+    // isoSurfaceShading options, the PerCallDataCB fields of the same name
+    struct IsoSettings {
+        // > 0 skips ahead below the iso value like ADAPTIVE_STEP
+        float fMinBallRadius = 0.f;
+        // steps are fVoxelSize * fIsoStepScale long, crossings get narrowed
+        // down with uIsoRefineSteps refineCrossing iterations
+        float fIsoStepScale = 1.f;
+        uint uIsoRefineSteps = 0;
+        // a step into cells of the pyramid whose range may reach the iso
+        // value is only fVoxelSize long, so features thinner than a coarse
+        // step can't fall between two samples (PYRAMID_SKIP of the iso
+        // surface shader)
+        const DensityPyramid* pGuard = nullptr;
+    };
+
+    struct RenderStats {
+        uint64_t uRays; // rays hitting the volume box
+        // pixels traced, only less than all with the temporal schedule
+        uint64_t uPixels;
+        uint64_t uSamples; // readVolume calls of the march loops
+        uint uTiles;
+        uint uNumWorkers;
+        double dMs;
+        double dRaysPerSec;
+        double dSamplesPerRay;
+        double dUpsampleMs; // part of dMs
+    };
+
+    struct BrickDDAResult {
+        uint uNumOfBalls;
+        double dOccupiedBricks; // share of flagged bricks
+        double dPlainMs;
+        double dDDAMs;
+        double dPlainSamplesPerRay;
+        double dDDASamplesPerRay;
+        double dPlainRaysPerSec;
+        double dDDARaysPerSec;
+        // DDA image against the plain march
+        float fMaxError;
+        size_t uDiffPixels; // off by more than 1/255
+    };
+
+    struct AdaptiveStepResult {
+        uint uNumOfBalls;
+        bool bIsoSurface; // isoSurfaceShading, accumulatedShading otherwise
+        double dFixedMs;
+        double dAdaptiveMs;
+        double dFixedSamplesPerRay;
+        double dAdaptiveSamplesPerRay;
+        // adaptive image against the fixed step one
+        float fMaxError;
+        size_t uDiffPixels; // off by more than 1/255
+    };
+
+    struct PacketResult {
+        uint uNumOfBalls;
+        uint uPacketSize; // RenderSettings::uPacketSize
+        double dMs;
+        double dRaysPerSec;
+        double dSamplesPerRay;
+        // image against single rays, has to be 0
+        float fMaxError;
+    };
+
+    struct UpsampleResult {
+        uint uRenderScale; // RenderSettings::uRenderScale
+        bool bIsoSurface; // isoSurfaceShading, accumulatedShading otherwise
+        double dMs;
+        double dUpsampleMs;
+        double dRaysPerPixel; // rays traced per full resolution pixel
+        // against the full resolution image
+        double dRMSE;
+        float fMaxError;
+        size_t uDiffPixels; // off by more than 1/255
+    };
+
+    struct IsoRefineResult {
+        float fIsoStepScale; // PerCallDataCB::fIsoStepScale
+        uint uIsoRefineSteps; // PerCallDataCB::uIsoRefineSteps
+        bool bGuard; // IsoSettings::pGuard
+        double dMs;
+        double dSamplesPerRay;
+        // against a march at a quarter voxel refined to convergence
+        uint64_t uHits;
+        uint64_t uMissedHits; // pixels only the reference hits
+        // distance of the hits within a voxel of the reference's, in voxels
+        double dMeanErrorVoxels;
+        float fMaxErrorVoxels;
+        // hits further off (or where the reference has none), mostly a thin
+        // feature stepped over
+        uint64_t uFarOffHits;
+    };
+
+    struct NormalResult {
+        uint uNormal; // USE_NORMAL (NORMAL_*)
+        bool bFilter; // FILTER_READ == 1
+        // volume update, with the gradients for NORMAL_GRADIENT_VOL
+        double dUpdateMs;
+        double dMs;
+        double dRaysPerSec;
+        uint64_t uHits;
+        // getNormal alone, single threaded
+        double dNormalNsPerHit;
+        // angle to the analytic field gradient at the hits
+        double dMeanErrorDeg;
+        float fMaxErrorDeg;
+    };
+
+    // Per rgb channel difference of two images of the same size (what
+    // SavePFM keeps)
+    struct ImageDiff {
+        float fMaxError;
+        double dRMSE;
+        // pixels with any channel off by more than the tolerance
+        size_t uDiffPixels;
+        bool bSizeMismatch;
+    };
+
+    struct LayoutResult {
+        uint uLayout; // VOXEL_LAYOUT_*
+        const char* szRayDir; // main direction of the rays
+        uint64_t uSamples;
+        double dMs;
+        double dSamplesPerSec;
+        // cache model misses per sample (8 voxel reads with filtering)
+        double dL1MissesPerSample;
+        double dL2MissesPerSample;
+    };
+
+    // readVolume, filter is FILTER_READ == 1 (8 neighbors), point read
+    // otherwise. Reads past the buffer return 0 like buffer loads on GPU
+    static float4 ReadVolume(const CPUVolume& vol, const float3& f3Idx,
+        bool filter);
+    static bool IntersectBox(const float3& f3Origin, const float3& f3Dir,
+        const float3& f3BoxMin, const float3& f3BoxMax,
+        float& tNear, float& tFar);
+    // transferFunction, opacity before the * 0.25 of accumulatedShading
+    static float TransferFunction(const VolumeParam& vParam, float fDensity);
+    // accumulatedShading along one ray, samples returns the volume reads.
+    // Samples taken with march.fMinBallRadius > 0 stay on the plain march's
+    // grid
+    static float4 AccumulatedShading(const CPUVolume& vol,
+        const VolumeParam& vParam, const float3& f3Origin,
+        const float3& f3Dir, float tNear, float tFar, bool filter,
+        uint& samples, const MarchSettings& march);
+    // accumulatedShading with BRICK_DDA: a 3D-DDA walks the bricks along the
+    // ray and jumps over the ones whose samples can't reach a flagged brick
+    // (vol.flags as written with enableBricks), samples that are taken sit
+    // where the plain march puts them
+    static float4 AccumulatedShadingDDA(const CPUVolume& vol,
+        const VolumeParam& vParam, const float3& f3Origin,
+        const float3& f3Dir, float tNear, float tFar, bool filter,
+        uint& samples, const MarchSettings& march);
+    // accumulatedShading jumping over the coarsest empty pyramid cell
+    // around each sample (density range outside [fMinDensity, fMaxDensity]),
+    // samples that are taken sit where the plain march puts them
+    static float4 AccumulatedShadingPyramid(const CPUVolume& vol,
+        const DensityPyramid& pyramid, const VolumeParam& vParam,
+        const float3& f3Origin, const float3& f3Dir, float tNear, float tFar,
+        bool filter, uint& samples, const MarchSettings& march);
+    // isoSurfaceShading along one ray at fISOValue. Leaves color and depth
+    // alone when no crossing is found and returns whether there was one,
+    // depth is written like DEPTH_OUT, normal is USE_NORMAL (NORMAL_*).
+    // samples counts the refinement reads as well
+    static bool IsoSurfaceShading(const CPUVolume& vol,
+        const PerFrameDataCB& perFrame, const VolumeParam& vParam,
+        const float3& f3Origin, const float3& f3Dir, float tNear, float tFar,
+        float fISOValue, uint normal, bool filter, float4& f4Color,
+        float& fDepth, uint& samples, const IsoSettings& iso);
+
+    // PerCallDataCB::fMinBallRadius of the given balls, 0 (fixed steps)
+    // without any
+    static float MinBallRadius(const float4* f4Balls, uint numOfBalls);
+    // Matrices of the constant buffers as 16 floats, Transform is the
+    // shaders' mul(m, v). Invert returns false for a singular m
+    static float4 Transform(const float* m, float x, float y, float z,
+        float w);
+    static bool Invert(const float* m, float* inv);
+
+    // One ray per pixel from f4ViewPos through the pixel center, unprojected
+    // with the inverse of mWorldViewProj, shaded like the pixel shader.
+    // Tiles of settings.uTileSize^2 pixels are spread across the pool
+    static RenderStats Render(const CPUVolume& vol,
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        const RenderSettings& settings, Image& image,
+        WorkStealingPool* pool = nullptr);
+    // SparseVolume_Upsample_ps.hlsl: bilinear from the 4 nearest samples of
+    // lowRes, each weighted down by its depth difference to the nearest one
+    // (UPSAMPLE_DEPTH_TOLERANCE), so iso surface edges stay sharp. lowRes is
+    // the image of width x height traced at 1/scale, depth is the nearest
+    // sample's. Rows are spread across the pool
+    static void Upsample(const Image& lowRes, uint scale, uint width,
+        uint height, Image& image, WorkStealingPool* pool = nullptr);
+    // Portable float map (rgb, little endian) to keep reference images
+    // lossless, alpha and depth are not stored
+    static bool SavePFM(const Image& image, const char* fileName);
+    static bool LoadPFM(Image& image, const char* fileName);
+    static ImageDiff Compare(const Image& a, const Image& b,
+        float tolerance);
+
+    // Accumulated shading at reso^3 with and without BRICK_DDA for every
+    // ball count, rendered width x height through the camera of perFrame
+    static std::vector<BrickDDAResult> BenchmarkBrickDDA(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, const std::vector<uint>& ballCounts, uint width,
+        uint height, WorkStealingPool* pool = nullptr);
+
+    // Fixed vs ADAPTIVE_STEP march at reso^3 for every ball count,
+    // accumulated and iso surface shading (with normals) each, rendered
+    // width x height through the camera of perFrame
+    static std::vector<AdaptiveStepResult> BenchmarkAdaptiveStep(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, const std::vector<uint>& ballCounts, uint width,
+        uint height, WorkStealingPool* pool = nullptr);
+
+    // Accumulated shading at reso^3 with single rays and 4/8/16 ray packets
+    // for every ball count, rendered width x height through the camera of
+    // perFrame
+    static std::vector<PacketResult> BenchmarkPackets(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, const std::vector<uint>& ballCounts, uint width,
+        uint height, WorkStealingPool* pool = nullptr);
+
+    // Accumulated and iso surface shading (with normals) at reso^3 traced at
+    // full, 1/2 and 1/4 resolution (upsampled) against full resolution,
+    // rendered width x height through the camera of perFrame
+    static std::vector<UpsampleResult> BenchmarkUpsample(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, uint numOfBalls, uint width, uint height,
+        WorkStealingPool* pool = nullptr);
+
+    // Iso surface shading (without normals) at reso^3 with coarser steps
+    // and refinement iterations, with and without the pyramid guard,
+    // against a quarter voxel march refined to convergence, rendered
+    // width x height through the camera of perFrame
+    static std::vector<IsoRefineResult> BenchmarkIsoRefine(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, uint numOfBalls, uint width, uint height,
+        WorkStealingPool* pool = nullptr);
+
+    // Iso surface shading at reso^3 without normals (the baseline), with
+    // finite differences and with the gradient volume, filtered and point
+    // reads each, rendered width x height through the camera of perFrame
+    static std::vector<NormalResult> BenchmarkNormals(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, uint numOfBalls, uint width, uint height,
+        WorkStealingPool* pool = nullptr);
+
+    // Orthographic rays (one per voxel of the entry face) along x, z and
+    // the diagonal through a reso^3 volume, linear vs swizzled layout with
+    // filtered reads. Single threaded time, plus misses of a cache model
+    // (32KB 8 way L1, 1MB 16 way L2, 64B lines, LRU) fed with every voxel
+    // address
+    static std::vector<LayoutResult> BenchmarkLayouts(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso);
+};
@@ -0,0 +1,661 @@
+#include "CPUVolumeUpdater.h"
+#include "BallGrid.h"
+#include "SIMDLane.h"
+#include "WorkStealingPool.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+// F16C comes with every AVX2 CPU, MSVC's /arch:AVX2 exposes it as well
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+#define F16C_SUPPORTED 1
+#endif
+
+namespace {
+    // Same arithmetic order as main() in SparseVolume_VolumeUpdate_cs.hlsl,
+    // pow(x, 3) is expanded into multiplies the same way fxc does. With G
+    // the gradient direction goes to grad[0..2] like with GRADIENT_VOL
+    template <bool G, typename L>
+    inline void _AccumulateBall(const float4& ball, const float4& col,
+        L px, L py, L pz, L& density, L& r, L& g, L& b, L* grad)
+    {
+        // Ball()
+        L dx = px - L::Set1(ball.x);
+        L dy = py - L::Set1(ball.y);
+        L dz = pz - L::Set1(ball.z);
+        L distSq = dx * dx + dy * dy + dz * dz;
+        L invDistSq = L::Set1(1.f) / distSq;
+        L d = L::Set1(ball.w) * invDistSq;
+        density = density + d;
+        L d3 = d * d * d;
+        r = r + L::Set1(col.x) * d3 * L::Set1(1000.f);
+        g = g + L::Set1(col.y) * d3 * L::Set1(1000.f);
+        b = b + L::Set1(col.z) * d3 * L::Set1(1000.f);
+        if (G) {
+            const L k = d * invDistSq;
+            grad[0] = grad[0] - dx * k;
+            grad[1] = grad[1] - dy * k;
+            grad[2] = grad[2] - dz * k;
+        }
+    }
+
+    template <typename L>
+    inline void _Normalize(L& r, L& g, L& b)
+    {
+        L invLen = L::Set1(1.f) / Sqrt(r * r + g * g + b * b);
+        r = r * invLen;
+        g = g * invLen;
+        b = b * invLen;
+    }
+
+    // ballIdx lists the balls to accumulate (ascending), nullptr means
+    // 0..count-1
+    template <bool G, typename L, typename I>
+    inline void _EvaluateLanes(const float4* balls, const float4* cols,
+        const I* ballIdx, uint numOfBalls, L px, L py, L pz,
+        L& density, L& r, L& g, L& b, L* grad)
+    {
+        density = L::Set1(0.f);
+        r = L::Set1(1.f);
+        g = L::Set1(1.f);
+        b = L::Set1(1.f);
+        if (G) {
+            grad[0] = grad[1] = grad[2] = L::Set1(0.f);
+        }
+        for (uint i = 0; i < numOfBalls; ++i) {
+            const uint idx = ballIdx ? ballIdx[i] : i;
+            _AccumulateBall<G>(balls[idx], cols[idx], px, py, pz,
+                density, r, g, b, grad);
+        }
+        _Normalize(r, g, b);
+    }
+
+    // float -> half rounding to nearest even like F16C, denormals kept
+    inline uint16_t _FloatToHalf(float f)
+    {
+        const uint32_t f32Inf = 255u << 23;
+        const uint32_t f16Max = (127u + 16u) << 23;
+        const uint32_t denormMagicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+        uint32_t u;
+        memcpy(&u, &f, sizeof(u));
+        const uint32_t sign = u & 0x80000000u;
+        u ^= sign;
+        uint16_t h;
+        if (u >= f16Max) {
+            // Inf or NaN
+            h = u > f32Inf ? 0x7e00 : 0x7c00;
+        } else if (u < (113u << 23)) {
+            // subnormal or zero, let the float adder do the rounding
+            float denormMagic, in;
+            memcpy(&denormMagic, &denormMagicBits, sizeof(float));
+            memcpy(&in, &u, sizeof(float));
+            in += denormMagic;
+            memcpy(&u, &in, sizeof(u));
+            h = (uint16_t)(u - denormMagicBits);
+        } else {
+            const uint32_t mantOdd = (u >> 13) & 1u;
+            u += ((uint32_t)(15 - 127) << 23) + 0xfffu + mantOdd;
+            h = (uint16_t)(u >> 13);
+        }
+        return (uint16_t)(h | sign >> 16);
+    }
+
+    inline float _HalfToFloat(uint16_t h)
+    {
+        const uint32_t shiftedExp = 0x7c00u << 13;
+        uint32_t u = (h & 0x7fffu) << 13;
+        const uint32_t exp = shiftedExp & u;
+        u += (127u - 15u) << 23;
+        if (exp == shiftedExp) {
+            // Inf or NaN
+            u += (128u - 16u) << 23;
+        } else if (exp == 0) {
+            // subnormal, renormalize
+            const uint32_t magicBits = 113u << 23;
+            float f, magic;
+            u += 1u << 23;
+            memcpy(&f, &u, sizeof(f));
+            memcpy(&magic, &magicBits, sizeof(magic));
+            f -= magic;
+            memcpy(&u, &f, sizeof(u));
+        }
+        u |= (uint32_t)(h & 0x8000u) << 16;
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+
+    template <CPUVolume::BufBit B>
+    inline void _StoreVoxel(CPUVolume& vol, size_t idx, float den, float r,
+        float g, float b)
+    {
+        if (B == CPUVolume::k32Bit) {
+            vol.voxels[idx] = float4(den, r, g, b);
+            return;
+        }
+        uint16_t* dst = &vol.halfVoxels[idx * 4];
+#if F16C_SUPPORTED
+        _mm_storel_epi64((__m128i*)dst, _mm_cvtps_ph(
+            _mm_setr_ps(den, r, g, b), _MM_FROUND_TO_NEAREST_INT));
+#else
+        dst[0] = _FloatToHalf(den);
+        dst[1] = _FloatToHalf(r);
+        dst[2] = _FloatToHalf(g);
+        dst[3] = _FloatToHalf(b);
+#endif // F16C_SUPPORTED
+    }
+
+    // Evaluate the voxels in [lo, hi), with G their gradients as well
+    template <typename L, bool G>
+    void _UpdateBox(const PerFrameDataCB& perFrame,
+        const PerCallDataCB& perCall, const BallBins* bins,
+        const BallGrid* grid, CPUVolume& vol, bool enableBricks,
+        const uint3& lo, const uint3& hi)
+    {
+        const VolumeParam& vParam = perCall.vParam;
+        const uint3& reso = vParam.u3VoxelReso;
+        const uint ratio = vParam.uVoxelBrickRatio;
+        const uint numOfBalls = std::min<uint>(perCall.uNumOfBalls, MAX_BALLS);
+        const float voxelSize = vParam.fVoxelSize;
+        const float halfX = reso.x * 0.5f;
+        const float halfY = reso.y * 0.5f;
+        const float halfZ = reso.z * 0.5f;
+        const L minDen = L::Set1(vParam.fMinDensity);
+        const L maxDen = L::Set1(vParam.fMaxDensity);
+        // voxels sharing a ball list: grid cell, brick or the whole volume
+        const uint span = grid ? grid->GetCellSize() : bins ? ratio : 0;
+
+        const uint xEnd = std::min<uint>(hi.x, reso.x);
+        const uint yEnd = std::min<uint>(hi.y, reso.y);
+        const uint zEnd = std::min<uint>(hi.z, reso.z);
+
+        float den[L::kWidth], r[L::kWidth], g[L::kWidth], b[L::kWidth];
+        float grad[3][L::kWidth];
+        for (uint z = lo.z; z < zEnd; ++z) {
+            const L pz = L::Set1(((float)z - halfZ + 0.5f) * voxelSize);
+            for (uint y = lo.y; y < yEnd; ++y) {
+                const L py = L::Set1(((float)y - halfY + 0.5f) * voxelSize);
+                for (uint x = lo.x; x < xEnd; x += L::kWidth) {
+                    const uint count = std::min<uint>(L::kWidth, xEnd - x);
+                    const L px = (L::Ramp((float)x) - L::Set1(halfX) +
+                        L::Set1(0.5f)) * L::Set1(voxelSize);
+                    // Lanes may straddle bricks (cells) when the span is
+                    // smaller than the lane width, every voxel has to use
+                    // the ball list of its own brick so run once per brick
+                    uint spanX = span ? x / span : 0;
+                    const uint lastSpanX = span ? (x + count - 1) / span : 0;
+                    for (; spanX <= lastSpanX; ++spanX) {
+                        L lDen, lR, lG, lB, lGrad[3];
+                        if (grid) {
+                            const size_t cell =
+                                grid->CellIdx(spanX, y / span, z / span);
+                            _EvaluateLanes<G>(grid->f4Balls.data(),
+                                grid->f4BallsCol.data(), grid->GetBalls(cell),
+                                grid->GetBallCount(cell),
+                                px, py, pz, lDen, lR, lG, lB, lGrad);
+                        } else if (bins) {
+                            const size_t brick =
+                                vol.BrickIdx(spanX, y / ratio, z / ratio);
+                            _EvaluateLanes<G>(perFrame.f4Balls,
+                                perFrame.f4BallsCol, bins->GetBalls(brick),
+                                bins->GetBallCount(brick),
+                                px, py, pz, lDen, lR, lG, lB, lGrad);
+                        } else {
+                            _EvaluateLanes<G>(perFrame.f4Balls,
+                                perFrame.f4BallsCol, (const uint16_t*)nullptr,
+                                numOfBalls, px, py, pz, lDen, lR, lG, lB,
+                                lGrad);
+                        }
+                        lDen.Store(den);
+                        lR.Store(r);
+                        lG.Store(g);
+                        lB.Store(b);
+                        if (G) {
+                            lGrad[0].Store(grad[0]);
+                            lGrad[1].Store(grad[1]);
+                            lGrad[2].Store(grad[2]);
+                        }
+                        const uint laneBegin = span
+                            ? std::max(spanX * span, x) - x : 0;
+                        const uint laneEnd = span
+                            ? std::min((spanX + 1) * span, x + count) - x
+                            : count;
+                        for (uint i = laneBegin; i < laneEnd; ++i) {
+                            const size_t dst = vol.VoxelIdx(x + i, y, z);
+                            if (vol.bit == CPUVolume::k16Bit) {
+                                _StoreVoxel<CPUVolume::k16Bit>(vol, dst,
+                                    den[i], r[i], g[i], b[i]);
+                            } else {
+                                _StoreVoxel<CPUVolume::k32Bit>(vol, dst,
+                                    den[i], r[i], g[i], b[i]);
+                            }
+                            if (G) {
+                                vol.gradients[vol.FlatIdx(x + i, y, z)] =
+                                    packGradient(float3(grad[0][i],
+                                    grad[1][i], grad[2][i]));
+                            }
+                        }
+                        if (enableBricks) {
+                            uint32_t inRange =
+                                CmpGE(lDen, minDen) & CmpLE(lDen, maxDen);
+                            inRange &= ((1u << laneEnd) - 1u) &
+                                ~((1u << laneBegin) - 1u);
+                            for (uint i = 0; inRange; ++i, inRange >>= 1) {
+                                if (inRange & 1u) {
+                                    vol.flags.Set(vol.BrickIdx((x + i) / ratio,
+                                        y / ratio, z / ratio));
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void
+BallBins::Build(const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+    float cullRatio)
+{
+    const VolumeParam& vParam = perCall.vParam;
+    const uint3& reso = vParam.u3VoxelReso;
+    const uint ratio = vParam.uVoxelBrickRatio;
+    const uint numOfBalls = std::min<uint>(perCall.uNumOfBalls, MAX_BALLS);
+    const float voxelSize = vParam.fVoxelSize;
+    const float half[3] = {reso.x * 0.5f, reso.y * 0.5f, reso.z * 0.5f};
+    const uint resoArr[3] = {reso.x, reso.y, reso.z};
+    u3BrickReso = uint3(reso.x / ratio, reso.y / ratio, reso.z / ratio);
+    const uint brickReso[3] = {u3BrickReso.x, u3BrickReso.y, u3BrickReso.z};
+    fCullRatio = cullRatio;
+    const size_t brickCount =
+        (size_t)u3BrickReso.x * u3BrickReso.y * u3BrickReso.z;
+    offsets.assign(brickCount + 1, 0);
+
+    // Brick range touched by each ball's influence sphere
+    uint lo[MAX_BALLS][3], hi[MAX_BALLS][3];
+    float radiusSq[MAX_BALLS];
+    for (uint i = 0; i < numOfBalls; ++i) {
+        const float4& ball = perFrame.f4Balls[i];
+        const float center[3] = {ball.x, ball.y, ball.z};
+        const float radius =
+            BallBins::InfluenceRadius(ball.w, vParam.fMinDensity, cullRatio);
+        radiusSq[i] = radius * radius;
+        for (int axis = 0; axis < 3; ++axis) {
+            // voxel i has its center at (i - half + 0.5) * voxelSize
+            float c = center[axis] / voxelSize + half[axis] - 0.5f;
+            float r = radius / voxelSize;
+            float fLo = std::max(0.f, std::ceil(c - r));
+            float fHi = std::min(resoArr[axis] - 1.f, std::floor(c + r));
+            if (fLo > fHi) {
+                lo[i][axis] = 1;
+                hi[i][axis] = 0;
+                continue;
+            }
+            lo[i][axis] = std::min((uint)fLo / ratio, brickReso[axis] - 1);
+            hi[i][axis] = std::min((uint)fHi / ratio, brickReso[axis] - 1);
+        }
+    }
+
+    auto hitsBrick = [&](uint ball, uint bx, uint by, uint bz) {
+        const float4& b = perFrame.f4Balls[ball];
+        const uint brick[3] = {bx, by, bz};
+        const float center[3] = {b.x, b.y, b.z};
+        float distSq = 0.f;
+        for (int axis = 0; axis < 3; ++axis) {
+            // bounds of the voxel centers inside this brick
+            float bMin = (brick[axis] * ratio - half[axis] + 0.5f) * voxelSize;
+            float bMax = ((brick[axis] + 1) * ratio - 1 - half[axis] + 0.5f) *
+                voxelSize;
+            float d = center[axis] < bMin ? bMin - center[axis]
+                : center[axis] > bMax ? center[axis] - bMax : 0.f;
+            distSq += d * d;
+        }
+        return distSq <= radiusSq[ball];
+    };
+    auto forEachHit = [&](auto func) {
+        for (uint i = 0; i < numOfBalls; ++i) {
+            for (uint z = lo[i][2]; z <= hi[i][2]; ++z) {
+                for (uint y = lo[i][1]; y <= hi[i][1]; ++y) {
+                    for (uint x = lo[i][0]; x <= hi[i][0]; ++x) {
+                        if (hitsBrick(i, x, y, z)) {
+                            func(i, x + (size_t)y * u3BrickReso.x +
+                                (size_t)z * u3BrickReso.x * u3BrickReso.y);
+                        }
+                    }
+                }
+            }
+        }
+    };
+    forEachHit([&](uint, size_t brick) { ++offsets[brick + 1]; });
+    for (size_t i = 0; i < brickCount; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+    ballIdx.resize(offsets[brickCount]);
+    // balls are visited in ascending order so every list stays sorted and
+    // keeps the accumulation order of the full loop
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    forEachHit([&](uint ball, size_t brick) {
+        ballIdx[cursor[brick]++] = (uint16_t)ball;
+    });
+}
+
+void
+CPUVolume::Resize(const uint3& reso, uint brickRatio, BufType bufType,
+    BufBit bufBit, uint voxelLayout)
+{
+    u3Reso = reso;
+    uBrickRatio = brickRatio;
+    type = bufType;
+    bit = bufBit;
+    layout = voxelLayout;
+    // swizzled buffers pad partial tiles
+    const size_t voxelCount =
+        type != k3DTexBuffer && layout == VOXEL_LAYOUT_SWIZZLED
+        ? voxelBufferSize(reso) : (size_t)reso.x * reso.y * reso.z;
+    if (bit == k16Bit) {
+        voxels.clear();
+        halfVoxels.resize(voxelCount * 4);
+    } else {
+        halfVoxels.clear();
+        voxels.resize(voxelCount);
+    }
+    const uint3 brickReso = GetBrickReso();
+    flags.Resize((size_t)brickReso.x * brickReso.y * brickReso.z);
+    if (!gradients.empty()) {
+        EnableGradients();
+    }
+}
+
+float4
+CPUVolume::GetVoxel(size_t idx) const
+{
+    if (bit == k32Bit) {
+        return voxels[idx];
+    }
+    const uint16_t* h = &halfVoxels[idx * 4];
+    return float4(_HalfToFloat(h[0]), _HalfToFloat(h[1]), _HalfToFloat(h[2]),
+        _HalfToFloat(h[3]));
+}
+
+CPUVolumeUpdater::CPUVolumeUpdater()
+{
+}
+
+CPUVolumeUpdater::~CPUVolumeUpdater()
+{
+}
+
+void
+CPUVolumeUpdater::Update(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, CPUVolume& vol, bool enableBricks,
+    LaneType lane, WorkStealingPool* pool)
+{
+    const uint3& reso = perCall.vParam.u3VoxelReso;
+    const uint3 groups((reso.x + THREAD_X - 1) / THREAD_X,
+        (reso.y + THREAD_Y - 1) / THREAD_Y,
+        (reso.z + THREAD_Z - 1) / THREAD_Z);
+    if (!pool) {
+        for (uint z = 0; z < groups.z; ++z) {
+            for (uint y = 0; y < groups.y; ++y) {
+                for (uint x = 0; x < groups.x; ++x) {
+                    UpdateGroup(perFrame, perCall, vol, enableBricks,
+                        uint3(x, y, z), lane);
+                }
+            }
+        }
+        return;
+    }
+    // Groups of neighboring bricks share a 32-brick flag word, so
+    // BrickFlags::Set ORs the bit in atomically (__atomic_fetch_or, the
+    // InterlockedOr of the GPU update)
+    pool->ParallelFor(groups.x * groups.y * groups.z,
+        [&](uint32_t item, uint32_t) {
+        uint3 groupIdx(item % groups.x, (item / groups.x) % groups.y,
+            item / (groups.x * groups.y));
+        UpdateGroup(perFrame, perCall, vol, enableBricks, groupIdx, lane);
+    });
+}
+
+void
+CPUVolumeUpdater::UpdateGroup(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, CPUVolume& vol, bool enableBricks,
+    const uint3& groupIdx, LaneType lane)
+{
+    const uint3 lo(groupIdx.x * THREAD_X, groupIdx.y * THREAD_Y,
+        groupIdx.z * THREAD_Z);
+    const uint3 hi(lo.x + THREAD_X, lo.y + THREAD_Y, lo.z + THREAD_Z);
+    _UpdateBox(perFrame, perCall, vol, enableBricks, lo, hi, lane);
+}
+
+void
+CPUVolumeUpdater::UpdateBricks(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, CPUVolume& vol, bool enableBricks,
+    const std::vector<uint32_t>& bricks, LaneType lane,
+    WorkStealingPool* pool)
+{
+    const uint ratio = perCall.vParam.uVoxelBrickRatio;
+    const uint3 brickReso = vol.GetBrickReso();
+    auto updateBrick = [&](uint32_t item, uint32_t) {
+        const uint32_t brick = bricks[item];
+        const uint3 lo((brick % brickReso.x) * ratio,
+            (brick / brickReso.x % brickReso.y) * ratio,
+            (brick / (brickReso.x * brickReso.y)) * ratio);
+        const uint3 hi(lo.x + ratio, lo.y + ratio, lo.z + ratio);
+        _UpdateBox(perFrame, perCall, vol, enableBricks, lo, hi, lane);
+    };
+    if (pool) {
+        pool->ParallelFor((uint32_t)bricks.size(), updateBrick);
+    } else {
+        for (uint32_t i = 0; i < (uint32_t)bricks.size(); ++i) {
+            updateBrick(i, 0);
+        }
+    }
+}
+
+void
+CPUVolumeUpdater::_UpdateBox(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, CPUVolume& vol, bool enableBricks,
+    const uint3& lo, const uint3& hi, LaneType lane)
+{
+    const bool gradients = !vol.gradients.empty();
+    switch (lane) {
+    case kSIMDLane:
+        (gradients ? ::_UpdateBox<SIMD::LaneN, true>
+            : ::_UpdateBox<SIMD::LaneN, false>)(
+            perFrame, perCall, _bins, _grid, vol, enableBricks, lo, hi);
+        break;
+    case kScalarLane:
+    default:
+        (gradients ? ::_UpdateBox<SIMD::Lane1, true>
+            : ::_UpdateBox<SIMD::Lane1, false>)(
+            perFrame, perCall, _bins, _grid, vol, enableBricks, lo, hi);
+        break;
+    }
+}
+
+float4
+CPUVolumeUpdater::EvaluateVoxel(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, const uint3& idx)
+{
+    const VolumeParam& vParam = perCall.vParam;
+    const float voxelSize = vParam.fVoxelSize;
+    SIMD::Lane1 px = SIMD::Lane1::Set1(((float)idx.x -
+        vParam.u3VoxelReso.x * 0.5f + 0.5f) * voxelSize);
+    SIMD::Lane1 py = SIMD::Lane1::Set1(((float)idx.y -
+        vParam.u3VoxelReso.y * 0.5f + 0.5f) * voxelSize);
+    SIMD::Lane1 pz = SIMD::Lane1::Set1(((float)idx.z -
+        vParam.u3VoxelReso.z * 0.5f + 0.5f) * voxelSize);
+    SIMD::Lane1 den, r, g, b;
+    _EvaluateLanes<false>(perFrame.f4Balls, perFrame.f4BallsCol,
+        (const uint16_t*)nullptr, std::min<uint>(perCall.uNumOfBalls, MAX_BALLS),
+        px, py, pz, den, r, g, b, (SIMD::Lane1*)nullptr);
+    return float4(den.v, r.v, g.v, b.v);
+}
+
+std::vector<CPUVolumeUpdater::BenchmarkResult>
+CPUVolumeUpdater::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, const std::vector<uint>& resos,
+    uint iterations)
+{
+    std::vector<BenchmarkResult> results;
+    CPUVolumeUpdater updater;
+    CPUVolume scalarVol, simdVol;
+    PerCallDataCB cb = perCall;
+    for (uint reso : resos) {
+        VolumeParam& vParam = cb.vParam;
+        vParam.u3VoxelReso = uint3(reso, reso, reso);
+        vParam.f3InvVolSize = float3(1.f / reso, 1.f / reso, 1.f / reso);
+        float halfSize = 0.5f * reso * vParam.fVoxelSize;
+        vParam.f3BoxMax = float3(halfSize, halfSize, halfSize);
+        vParam.f3BoxMin = float3(-halfSize, -halfSize, -halfSize);
+        const uint ratio = std::max<uint>(1, vParam.uVoxelBrickRatio);
+        scalarVol.Resize(vParam.u3VoxelReso, ratio);
+        simdVol.Resize(vParam.u3VoxelReso, ratio);
+
+        BenchmarkResult result = {};
+        result.u3Reso = vParam.u3VoxelReso;
+        result.uNumOfBalls = cb.uNumOfBalls;
+        const double voxels = (double)reso * reso * reso * iterations;
+
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        for (uint i = 0; i < iterations; ++i) {
+            updater.Update(perFrame, cb, scalarVol, true, kScalarLane);
+        }
+        result.dScalarMs = ElapsedMs(start) / iterations;
+        result.dScalarVoxelsPerSec = voxels / (result.dScalarMs *
+            iterations * 1e-3);
+
+        start = BenchmarkClock::now();
+        for (uint i = 0; i < iterations; ++i) {
+            updater.Update(perFrame, cb, simdVol, true, kSIMDLane);
+        }
+        result.dSIMDMs = ElapsedMs(start) / iterations;
+        result.dSIMDVoxelsPerSec = voxels / (result.dSIMDMs *
+            iterations * 1e-3);
+
+        for (size_t i = 0; i < scalarVol.voxels.size(); ++i) {
+            const float4& a = scalarVol.voxels[i];
+            const float4& b = simdVol.voxels[i];
+            if (memcmp(&a, &b, sizeof(float4)) != 0) {
+                ++result.uMismatchVoxels;
+            }
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+std::vector<CPUVolumeUpdater::ScalingResult>
+CPUVolumeUpdater::BenchmarkScaling(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, uint maxWorkers, uint iterations)
+{
+    std::vector<ScalingResult> results;
+    if (maxWorkers == 0) {
+        maxWorkers = std::max<uint>(1, std::thread::hardware_concurrency());
+    }
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    PerCallDataCB cb = perCall;
+    cb.vParam.u3VoxelReso = uint3(reso, reso, reso);
+    vol.Resize(cb.vParam.u3VoxelReso,
+        std::max<uint>(1, cb.vParam.uVoxelBrickRatio));
+    const double voxels = (double)reso * reso * reso;
+    for (uint workers = 1;; workers = std::min(workers * 2, maxWorkers)) {
+        WorkStealingPool pool(workers);
+        // warm up worker threads and page in the volume
+        updater.Update(perFrame, cb, vol, true, kSIMDLane, &pool);
+        pool.ResetStats();
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        for (uint i = 0; i < iterations; ++i) {
+            updater.Update(perFrame, cb, vol, true, kSIMDLane, &pool);
+        }
+        ScalingResult result = {};
+        result.uNumWorkers = workers;
+        result.dMs = ElapsedMs(start) / iterations;
+        result.dVoxelsPerSec = voxels / (result.dMs * 1e-3);
+        result.dSpeedup = results.empty() ? 1.0 : results[0].dMs / result.dMs;
+        uint64_t minItems = UINT64_MAX, maxItems = 0, totalItems = 0;
+        for (auto& stats : pool.GetStats()) {
+            minItems = std::min(minItems, stats.uItemsExecuted);
+            maxItems = std::max(maxItems, stats.uItemsExecuted);
+            totalItems += stats.uItemsExecuted;
+            result.uItemsStolen += stats.uItemsStolen;
+        }
+        result.dMinWorkerShare = (double)minItems / totalItems;
+        result.dMaxWorkerShare = (double)maxItems / totalItems;
+        results.push_back(result);
+        if (workers == maxWorkers) {
+            break;
+        }
+    }
+    return results;
+}
+
+std::vector<CPUVolumeUpdater::CullingResult>
+CPUVolumeUpdater::BenchmarkCulling(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, const std::vector<uint>& ballCounts,
+    const std::vector<float>& cullRatios, WorkStealingPool* pool)
+{
+    std::vector<CullingResult> results;
+    CPUVolumeUpdater updater;
+    CPUVolume fullVol, culledVol;
+    BallBins bins;
+    PerCallDataCB cb = perCall;
+    cb.vParam.u3VoxelReso = uint3(reso, reso, reso);
+    const uint ratio = std::max<uint>(1, cb.vParam.uVoxelBrickRatio);
+    cb.vParam.uVoxelBrickRatio = ratio;
+    for (uint ballCount : ballCounts) {
+        cb.uNumOfBalls = std::min<uint>(ballCount, MAX_BALLS);
+        fullVol.Resize(cb.vParam.u3VoxelReso, ratio);
+        updater.SetBallBins(nullptr);
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        updater.Update(perFrame, cb, fullVol, true, kSIMDLane, pool);
+        const double fullMs = ElapsedMs(start);
+        for (float cullRatio : cullRatios) {
+            CullingResult result = {};
+            result.uNumOfBalls = cb.uNumOfBalls;
+            result.fCullRatio = cullRatio;
+            result.dFullMs = fullMs;
+            culledVol.Resize(cb.vParam.u3VoxelReso, ratio);
+            start = BenchmarkClock::now();
+            bins.Build(perFrame, cb, cullRatio);
+            result.dBinMs = ElapsedMs(start);
+            updater.SetBallBins(&bins);
+            start = BenchmarkClock::now();
+            updater.Update(perFrame, cb, culledVol, true, kSIMDLane, pool);
+            result.dCulledMs = ElapsedMs(start);
+            result.dAvgBallsPerBrick =
+                (double)bins.ballIdx.size() / culledVol.flags.GetBrickCount();
+            for (size_t i = 0; i < fullVol.voxels.size(); ++i) {
+                result.fMaxDensityError = std::max(result.fMaxDensityError,
+                    std::abs(fullVol.voxels[i].x - culledVol.voxels[i].x));
+            }
+            result.uFlagMismatches =
+                BrickFlags::CountDiff(fullVol.flags, culledVol.flags);
+            results.push_back(result);
+        }
+    }
+    return results;
+}
+
+const char*
+CPUVolumeUpdater::GetLaneName(LaneType lane)
+{
+    return lane == kScalarLane ? "Scalar" : SIMD::LaneName();
+}
+
+PerCallDataCB
+CPUVolumeUpdater::ScaledPerCall(const PerCallDataCB& perCall, uint reso)
+{
+    PerCallDataCB cb = perCall;
+    VolumeParam& vParam = cb.vParam;
+    vParam.fVoxelSize =
+        perCall.vParam.u3VoxelReso.x * perCall.vParam.fVoxelSize / reso;
+    vParam.u3VoxelReso = uint3(reso, reso, reso);
+    vParam.uVoxelBrickRatio = std::max<uint>(1, vParam.uVoxelBrickRatio);
+    return cb;
+}
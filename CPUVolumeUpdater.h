@@ -0,0 +1,216 @@
+#pragma once
+// CPU port of SparseVolume_VolumeUpdate_cs.hlsl. It consumes the very same
+// PerFrameDataCB/PerCallDataCB the GPU path uploads, so it can run headless
+// (no D3D12 device) and serve as reference for the GPU output.
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <d3d12.h>
+#include <DirectXMath.h>
+#endif
+#include <cmath>
+#include <vector>
+#include "SparseVolume.inl"
+#include "VoxelLayout.inl"
+#include "GradientVolume.inl"
+#include "BrickFlags.h"
+
+class WorkStealingPool;
+class BallGrid;
+
+// CPU side counterpart of ManagedBuf + _flagVol: voxels are stored in one of
+// the VoxelLayout.inl layouts (k3DTexBuffer is always linear), flags hold one
+// bit per brick
+struct CPUVolume {
+    // Same values as ManagedBuf::Type/Bit (ManagedBuf.h needs D3D12)
+    enum BufType {
+        kStructuredBuffer = 0,
+        kTypedBuffer,
+        k3DTexBuffer,
+        kNumBufType
+    };
+    enum BufBit {
+        k16Bit = 0,
+        k32Bit,
+        kNumBitType
+    };
+
+    uint3 u3Reso = uint3(0, 0, 0);
+    uint uBrickRatio = 1;
+    BufType type = kTypedBuffer;
+    BufBit bit = k32Bit;
+    uint layout = VOXEL_LAYOUT_LINEAR;
+    // k32Bit voxels
+    std::vector<float4> voxels;
+    // k16Bit voxels, 4 halfs each as in DXGI_FORMAT_R16G16B16A16_FLOAT
+    std::vector<uint16_t> halfVoxels;
+    BrickFlags flags;
+    // packGradient of every voxel at FlatIdx (_gradientVol), the updater
+    // writes them while not empty. Resize keeps them in use
+    std::vector<uint32_t> gradients;
+
+    void Resize(const uint3& reso, uint brickRatio,
+        BufType bufType = kTypedBuffer, BufBit bufBit = k32Bit,
+        uint voxelLayout = VOXEL_LAYOUT_LINEAR);
+    // Have the updater write gradients from now on
+    inline void EnableGradients() {
+        gradients.assign((size_t)u3Reso.x * u3Reso.y * u3Reso.z, 0);
+    }
+    // Voxel at storage index in either precision
+    float4 GetVoxel(size_t idx) const;
+    // Storage index of voxel (x, y, z), BUFFER_INDEX on the CPU
+    inline size_t VoxelIdx(uint x, uint y, uint z) const {
+        return type == k3DTexBuffer ? FlatIdx(x, y, z)
+            : voxelIdx(x, y, z, u3Reso, layout);
+    }
+    inline size_t GetVoxelCount() const {
+        return bit == k16Bit ? halfVoxels.size() / 4 : voxels.size();
+    }
+    inline uint3 GetBrickReso() const {
+        return uint3(u3Reso.x / uBrickRatio, u3Reso.y / uBrickRatio,
+            u3Reso.z / uBrickRatio);
+    }
+    inline size_t FlatIdx(uint x, uint y, uint z) const {
+        return x + (size_t)y * u3Reso.x + (size_t)z * u3Reso.x * u3Reso.y;
+    }
+    inline size_t BrickIdx(uint x, uint y, uint z) const {
+        const uint3 b = GetBrickReso();
+        return x + (size_t)y * b.x + (size_t)z * b.x * b.y;
+    }
+};
+
+// Per brick (at uVoxelBrickRatio) list of the balls that can reach it. A
+// ball is dropped from a brick once its Ball() contribution falls below
+// fMinDensity * cullRatio on every voxel of that brick, so cullRatio trades
+// accuracy (dropped density adds up) for fewer Ball() evaluations.
+struct BallBins {
+    uint3 u3BrickReso = uint3(0, 0, 0);
+    float fCullRatio = 0.f;
+    // CSR layout, balls of brick i are ballIdx[offsets[i], offsets[i+1])
+    std::vector<uint32_t> offsets;
+    std::vector<uint16_t> ballIdx;
+
+    void Build(const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        float cullRatio);
+    inline const uint16_t* GetBalls(size_t brick) const {
+        return ballIdx.data() + offsets[brick];
+    }
+    inline uint GetBallCount(size_t brick) const {
+        return offsets[brick + 1] - offsets[brick];
+    }
+    // Distance beyond which a ball of the given power contributes less
+    // than fMinDensity * cullRatio
+    static inline float InfluenceRadius(float fPower, float fMinDensity,
+        float cullRatio) {
+        return std::sqrt(fPower / (fMinDensity * cullRatio));
+    }
+};
+
+class CPUVolumeUpdater
+{
+public:
+    enum LaneType {
+        kScalarLane = 0, // reference path
+        kSIMDLane, // widest lane available: AVX2, SSE, NEON
+        kNumLaneType
+    };
+
+    struct BenchmarkResult {
+        uint3 u3Reso;
+        uint uNumOfBalls;
+        double dScalarMs;
+        double dSIMDMs;
+        double dScalarVoxelsPerSec;
+        double dSIMDVoxelsPerSec;
+        // voxels whose SIMD result differs from the scalar reference
+        size_t uMismatchVoxels;
+    };
+
+    struct ScalingResult {
+        uint uNumWorkers;
+        double dMs;
+        double dVoxelsPerSec;
+        // relative to the single worker run
+        double dSpeedup;
+        // min/max share of thread groups executed by one worker
+        double dMinWorkerShare;
+        double dMaxWorkerShare;
+        uint64_t uItemsStolen;
+    };
+
+    struct CullingResult {
+        uint uNumOfBalls;
+        float fCullRatio;
+        double dFullMs; // all balls for every voxel
+        double dBinMs; // building the bins
+        double dCulledMs; // update with bins
+        double dAvgBallsPerBrick;
+        // error against the full evaluation
+        float fMaxDensityError;
+        size_t uFlagMismatches;
+    };
+
+    CPUVolumeUpdater();
+    ~CPUVolumeUpdater();
+
+    // Equivalent of one Dispatch3D over the whole volume, vol has to be
+    // resized to perCall.vParam already. Flags are only written (never
+    // cleared) like with ENABLE_BRICKS on GPU. With a pool, thread groups are
+    // distributed across its workers.
+    void Update(const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        CPUVolume& vol, bool enableBricks, LaneType lane = kSIMDLane,
+        WorkStealingPool* pool = nullptr);
+    // Process a single THREAD_X*THREAD_Y*THREAD_Z thread group
+    void UpdateGroup(const PerFrameDataCB& perFrame,
+        const PerCallDataCB& perCall, CPUVolume& vol, bool enableBricks,
+        const uint3& groupIdx, LaneType lane = kSIMDLane);
+    // Update only the listed bricks (flat brick index), e.g. the dispatch
+    // list of BrickOccupancy
+    void UpdateBricks(const PerFrameDataCB& perFrame,
+        const PerCallDataCB& perCall, CPUVolume& vol, bool enableBricks,
+        const std::vector<uint32_t>& bricks, LaneType lane = kSIMDLane,
+        WorkStealingPool* pool = nullptr);
+    // With bins set (must match perCall), voxels only accumulate the balls
+    // binned to their brick, nullptr restores the full loop
+    inline void SetBallBins(const BallBins* bins) { _bins = bins; };
+    // With a grid set (takes precedence over bins), balls come from the
+    // grid's own storage instead of perFrame and voxels only accumulate the
+    // balls listed in their grid cell
+    inline void SetBallGrid(const BallGrid* grid) { _grid = grid; };
+    // Scalar evaluation of main() for one SV_DispatchThreadID
+    static float4 EvaluateVoxel(const PerFrameDataCB& perFrame,
+        const PerCallDataCB& perCall, const uint3& idx);
+
+    // Times scalar and SIMD path on reso x reso x reso grids using the given
+    // frame data (volume params are adjusted to each reso)
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        const std::vector<uint>& resos, uint iterations = 1);
+    // Times the SIMD path at reso^3 with 1, 2, 4... up to maxWorkers workers
+    static std::vector<ScalingResult> BenchmarkScaling(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, uint maxWorkers = 0, uint iterations = 1);
+    // Times full vs culled update at reso^3 for every ball count and cull
+    // ratio combination
+    static std::vector<CullingResult> BenchmarkCulling(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, const std::vector<uint>& ballCounts,
+        const std::vector<float>& cullRatios, WorkStealingPool* pool = nullptr);
+
+    static const char* GetLaneName(LaneType lane);
+    // perCall at reso^3 voxels over the same box, so the camera still frames
+    // it and the balls cover the same bricks, uVoxelBrickRatio at least 1.
+    // The CPU benchmarks start from it
+    static PerCallDataCB ScaledPerCall(const PerCallDataCB& perCall,
+        uint reso);
+
+private:
+    void _UpdateBox(const PerFrameDataCB& perFrame,
+        const PerCallDataCB& perCall, CPUVolume& vol, bool enableBricks,
+        const uint3& lo, const uint3& hi, LaneType lane);
+
+    const BallBins* _bins = nullptr;
+    const BallGrid* _grid = nullptr;
+};
@@ -0,0 +1,329 @@
+#include "DensityPyramid.h"
+#include "CPURaymarcher.h"
+#include "DirtyBrickTracker.h"
+#include "WorkStealingPool.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <cfloat>
+#include <random>
+
+namespace {
+    inline void _Grow(DensityPyramid::Range& range, float fDensity)
+    {
+        range.fMin = std::min(range.fMin, fDensity);
+        range.fMax = std::max(range.fMax, fDensity);
+    }
+}
+
+DensityPyramid::DensityPyramid()
+    : _volReso(0, 0, 0)
+{
+    for (uint level = 0; level < kNumLevels; ++level) {
+        _reso[level] = uint3(0, 0, 0);
+    }
+}
+
+DensityPyramid::~DensityPyramid()
+{
+}
+
+void
+DensityPyramid::Build(const CPUVolume& vol, WorkStealingPool* pool)
+{
+    Resize(vol.u3Reso);
+    for (uint level = 0; level < kNumLevels; ++level) {
+        const uint3 reso = _reso[level];
+        _ranges[level].resize((size_t)reso.x * reso.y * reso.z);
+        auto buildSlice = [&](uint32_t z, uint32_t) {
+            for (uint y = 0; y < reso.y; ++y) {
+                for (uint x = 0; x < reso.x; ++x) {
+                    if (level == 0) {
+                        _BuildLeaf(vol, x, y, z);
+                    } else {
+                        _BuildParent(level, x, y, z);
+                    }
+                }
+            }
+        };
+        if (pool) {
+            pool->ParallelFor(reso.z, buildSlice);
+        } else {
+            for (uint z = 0; z < reso.z; ++z) {
+                buildSlice(z, 0);
+            }
+        }
+    }
+}
+
+void
+DensityPyramid::Update(const CPUVolume& vol,
+    const std::vector<uint32_t>& bricks, WorkStealingPool* pool)
+{
+    const uint ratio = vol.uBrickRatio;
+    const uint3 brickReso = vol.GetBrickReso();
+    for (uint32_t brick : bricks) {
+        const uint3 lo(brick % brickReso.x * ratio,
+            brick / brickReso.x % brickReso.y * ratio,
+            brick / brickReso.x / brickReso.y * ratio);
+        MarkVoxels(lo, uint3(lo.x + ratio, lo.y + ratio, lo.z + ratio));
+    }
+    // parents reduce the refreshed level below
+    for (uint level = 0; level < kNumLevels; ++level) {
+        _RefreshCells(vol, level, pool);
+    }
+    ClearMarks();
+}
+
+void
+DensityPyramid::Resize(const uint3& volReso)
+{
+    if (volReso.x == _volReso.x && volReso.y == _volReso.y &&
+        volReso.z == _volReso.z) {
+        ClearMarks();
+        return;
+    }
+    _volReso = volReso;
+    for (uint level = 0; level < kNumLevels; ++level) {
+        _reso[level] = pyramidLevelReso(volReso, level);
+        const size_t cellCount =
+            (size_t)_reso[level].x * _reso[level].y * _reso[level].z;
+        _ranges[level].clear();
+        _marked[level].assign(cellCount, 0);
+        _dirtyCells[level].clear();
+    }
+}
+
+void
+DensityPyramid::MarkVoxels(const uint3& lo, const uint3& hi)
+{
+    // leaf c sees voxels [2c, 2c + 2], so voxel v reaches leaves
+    // (v - 1) / 2 up to v / 2
+    const uint3 leafReso = _reso[0];
+    const uint cellLo[3] = {lo.x >= 2 ? (lo.x - 1) / 2 : 0,
+        lo.y >= 2 ? (lo.y - 1) / 2 : 0, lo.z >= 2 ? (lo.z - 1) / 2 : 0};
+    const uint cellHi[3] = {std::min((hi.x - 1) / 2, leafReso.x - 1),
+        std::min((hi.y - 1) / 2, leafReso.y - 1),
+        std::min((hi.z - 1) / 2, leafReso.z - 1)};
+    for (uint z = cellLo[2]; z <= cellHi[2]; ++z) {
+        for (uint y = cellLo[1]; y <= cellHi[1]; ++y) {
+            for (uint x = cellLo[0]; x <= cellHi[0]; ++x) {
+                _MarkCell(0, x, y, z);
+            }
+        }
+    }
+}
+
+void
+DensityPyramid::ClearMarks()
+{
+    for (uint level = 0; level < kNumLevels; ++level) {
+        for (uint32_t cell : _dirtyCells[level]) {
+            _marked[level][cell] = 0;
+        }
+        _dirtyCells[level].clear();
+    }
+}
+
+void
+DensityPyramid::_BuildLeaf(const CPUVolume& vol, uint x, uint y, uint z)
+{
+    Range range = {FLT_MAX, -FLT_MAX};
+    for (uint k = z * 2; k <= z * 2 + 2; ++k) {
+        for (uint j = y * 2; j <= y * 2 + 2; ++j) {
+            for (uint i = x * 2; i <= x * 2 + 2; ++i) {
+                _Grow(range, i < _volReso.x && j < _volReso.y &&
+                    k < _volReso.z ? vol.GetVoxel(vol.VoxelIdx(i, j, k)).x
+                    : 0.f);
+            }
+        }
+    }
+    _ranges[0][x + ((size_t)y + (size_t)z * _reso[0].y) * _reso[0].x] =
+        range;
+}
+
+void
+DensityPyramid::_BuildParent(uint level, uint x, uint y, uint z)
+{
+    const uint3 childReso = _reso[level - 1];
+    const uint xEnd = std::min(x * 2 + 2, childReso.x);
+    const uint yEnd = std::min(y * 2 + 2, childReso.y);
+    const uint zEnd = std::min(z * 2 + 2, childReso.z);
+    Range range = {FLT_MAX, -FLT_MAX};
+    for (uint k = z * 2; k < zEnd; ++k) {
+        for (uint j = y * 2; j < yEnd; ++j) {
+            for (uint i = x * 2; i < xEnd; ++i) {
+                const Range& child = GetRange(level - 1, i, j, k);
+                range.fMin = std::min(range.fMin, child.fMin);
+                range.fMax = std::max(range.fMax, child.fMax);
+            }
+        }
+    }
+    _ranges[level][x + ((size_t)y + (size_t)z * _reso[level].y) *
+        _reso[level].x] = range;
+}
+
+void
+DensityPyramid::_RefreshCells(const CPUVolume& vol, uint level,
+    WorkStealingPool* pool)
+{
+    const std::vector<uint32_t>& cells = _dirtyCells[level];
+    const uint3 reso = _reso[level];
+    auto refreshCell = [&](uint32_t i, uint32_t) {
+        const uint32_t cell = cells[i];
+        const uint x = cell % reso.x;
+        const uint y = cell / reso.x % reso.y;
+        const uint z = cell / reso.x / reso.y;
+        if (level == 0) {
+            _BuildLeaf(vol, x, y, z);
+        } else {
+            _BuildParent(level, x, y, z);
+        }
+    };
+    if (pool) {
+        pool->ParallelFor((uint32_t)cells.size(), refreshCell);
+    } else {
+        for (uint32_t i = 0; i < cells.size(); ++i) {
+            refreshCell(i, 0);
+        }
+    }
+}
+
+void
+DensityPyramid::_MarkCell(uint level, uint x, uint y, uint z)
+{
+    for (; level < kNumLevels; ++level, x /= 2, y /= 2, z /= 2) {
+        const uint3 reso = _reso[level];
+        const uint32_t cell = x + (y + z * reso.y) * reso.x;
+        if (_marked[level][cell]) {
+            // so are its parents
+            return;
+        }
+        _marked[level][cell] = 1;
+        _dirtyCells[level].push_back(cell);
+    }
+}
+
+std::vector<DensityPyramid::BenchmarkResult>
+DensityPyramid::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso,
+    const std::vector<uint>& ballCounts, uint frames, float movingRatio,
+    uint width, uint height, WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    PerFrameDataCB frameCB = perFrame;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+    const float step = 0.5f * vParam.fVoxelSize;
+    const float cullRatio = 0.02f;
+
+    CPURaymarcher::RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    CPURaymarcher::Image plainImage, pyramidImage, brickImage;
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    DensityPyramid pyramid, reference;
+    for (uint ballCount : ballCounts) {
+        const uint numOfBalls = std::min<uint>(ballCount, MAX_BALLS);
+        cb.uNumOfBalls = numOfBalls;
+        std::copy(perFrame.f4Balls, perFrame.f4Balls + numOfBalls,
+            frameCB.f4Balls);
+        BenchmarkResult result = {};
+        result.uNumOfBalls = numOfBalls;
+
+        // first frame evaluates everything
+        DirtyBrickTracker tracker;
+        vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+        tracker.Update(frameCB.f4Balls, numOfBalls, vParam, cullRatio, 0.f);
+        updater.UpdateBricks(frameCB, cb, vol, true,
+            tracker.GetDirtyBricks(), CPUVolumeUpdater::kSIMDLane, pool);
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        pyramid.Build(vol, pool);
+        result.dBuildMs = ElapsedMs(start);
+        for (uint level = 0; level < kNumLevels; ++level) {
+            const uint3 levelReso = pyramid.GetLevelReso(level);
+            size_t empty = 0;
+            for (uint z = 0; z < levelReso.z; ++z) {
+                for (uint y = 0; y < levelReso.y; ++y) {
+                    for (uint x = 0; x < levelReso.x; ++x) {
+                        empty += pyramid.IsEmpty(level, x, y, z,
+                            vParam.fMinDensity, vParam.fMaxDensity,
+                            settings.bFilter) ? 1 : 0;
+                    }
+                }
+            }
+            result.dEmptyCells[level] = (double)empty /
+                ((size_t)levelReso.x * levelReso.y * levelReso.z);
+        }
+
+        settings.bBrickDDA = false;
+        settings.pPyramid = nullptr;
+        CPURaymarcher::RenderStats stats = CPURaymarcher::Render(
+            vol, frameCB, cb, settings, plainImage, pool);
+        result.dPlainMs = stats.dMs;
+        result.dPlainSamplesPerRay = stats.dSamplesPerRay;
+        settings.bBrickDDA = true;
+        stats = CPURaymarcher::Render(
+            vol, frameCB, cb, settings, brickImage, pool);
+        result.dBrickMs = stats.dMs;
+        result.dBrickSamplesPerRay = stats.dSamplesPerRay;
+        settings.bBrickDDA = false;
+        settings.pPyramid = &pyramid;
+        stats = CPURaymarcher::Render(
+            vol, frameCB, cb, settings, pyramidImage, pool);
+        result.dPyramidMs = stats.dMs;
+        result.dPyramidSamplesPerRay = stats.dSamplesPerRay;
+        const CPURaymarcher::ImageDiff diff =
+            CPURaymarcher::Compare(plainImage, pyramidImage, 1.f / 255.f);
+        result.fMaxError = diff.fMaxError;
+        result.uDiffPixels = diff.uDiffPixels;
+
+        std::mt19937 rng(0);
+        std::uniform_real_distribution<float> rand01(0.f, 1.f);
+        // moving balls keep their direction
+        std::vector<float4> dir(numOfBalls);
+        for (auto& d : dir) {
+            float x = rand01(rng) - 0.5f;
+            float y = rand01(rng) - 0.5f;
+            float z = rand01(rng) - 0.5f;
+            float len = std::sqrt(x * x + y * y + z * z) + 1e-6f;
+            d = rand01(rng) < movingRatio
+                ? float4(x / len * step, y / len * step, z / len * step, 0.f)
+                : float4(0.f, 0.f, 0.f, 0.f);
+        }
+        for (uint frame = 0; frame < frames; ++frame) {
+            for (uint i = 0; i < numOfBalls; ++i) {
+                frameCB.f4Balls[i].x += dir[i].x;
+                frameCB.f4Balls[i].y += dir[i].y;
+                frameCB.f4Balls[i].z += dir[i].z;
+            }
+            tracker.Update(frameCB.f4Balls, numOfBalls, vParam, cullRatio,
+                0.f);
+            const std::vector<uint32_t>& bricks = tracker.GetDirtyBricks();
+            result.dDirtyRatio +=
+                (double)bricks.size() / tracker.GetBrickCount();
+            // flags of dirty bricks are rebuilt from scratch
+            for (uint32_t brick : bricks) {
+                vol.flags.Reset(brick);
+            }
+            updater.UpdateBricks(frameCB, cb, vol, true, bricks,
+                CPUVolumeUpdater::kSIMDLane, pool);
+            start = BenchmarkClock::now();
+            pyramid.Update(vol, bricks, pool);
+            result.dUpdateMs += ElapsedMs(start);
+        }
+        result.dUpdateMs /= std::max<uint>(frames, 1);
+        result.dDirtyRatio /= std::max<uint>(frames, 1);
+        reference.Build(vol, pool);
+        for (uint level = 0; level < kNumLevels; ++level) {
+            for (size_t i = 0; i < pyramid._ranges[level].size(); ++i) {
+                const Range& a = pyramid._ranges[level][i];
+                const Range& b = reference._ranges[level][i];
+                result.uCellMismatches +=
+                    a.fMin != b.fMin || a.fMax != b.fMax ? 1 : 0;
+            }
+        }
+        results.push_back(result);
+    }
+    return results;
+}
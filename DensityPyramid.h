@@ -0,0 +1,114 @@
+#pragma once
+// Min/max density pyramid over a CPUVolume for hierarchical space skipping.
+// Level l has cells of (2 << l)^3 voxels, 2^3 up to 64^3 (the layout of
+// DensityPyramid.inl, which the GPU build shares), each holding the
+// density range every readVolume sample inside it can see: the cell's
+// voxels plus the next voxel along +xyz (the FILTER_READ == 1 neighbors),
+// voxels past the volume read as 0.
+//
+// After a brick update only the cells over the updated bricks and their
+// parents are refreshed.
+#include "CPUVolumeUpdater.h"
+#include "DensityPyramid.inl"
+
+class DensityPyramid
+{
+public:
+    enum {
+        kNumLevels = PYRAMID_LEVELS,
+    };
+
+    struct Range {
+        float fMin;
+        float fMax;
+    };
+
+    struct BenchmarkResult {
+        uint uNumOfBalls;
+        double dBuildMs; // full build
+        double dUpdateMs; // incremental refresh per frame
+        double dDirtyRatio; // average share of updated bricks per frame
+        // cells of the incremental pyramid differing from a full build
+        // after the last frame, has to be 0
+        size_t uCellMismatches;
+        double dEmptyCells[kNumLevels]; // share of empty cells per level
+        // accumulated shading per ray: plain march, brick DDA, pyramid
+        double dPlainSamplesPerRay;
+        double dBrickSamplesPerRay;
+        double dPyramidSamplesPerRay;
+        double dPlainMs;
+        double dBrickMs;
+        double dPyramidMs;
+        // pyramid image against the plain march
+        float fMaxError;
+        size_t uDiffPixels; // off by more than 1/255
+    };
+
+    DensityPyramid();
+    ~DensityPyramid();
+
+    void Build(const CPUVolume& vol, WorkStealingPool* pool = nullptr);
+    // Refresh after the listed bricks (flat indices at vol.uBrickRatio)
+    // got re-evaluated, vol has to keep the size of the last Build
+    void Update(const CPUVolume& vol, const std::vector<uint32_t>& bricks,
+        WorkStealingPool* pool = nullptr);
+
+    // Cell bookkeeping of Update, also for the GPU pyramid which keeps its
+    // ranges itself. Resize lays out the levels for volReso without ranges
+    // (Build allocates them), MarkVoxels marks the cells seeing the voxels
+    // in [lo, hi) along with their parents, GetMarkedCells lists them per
+    // level for the refresh and ClearMarks starts over
+    void Resize(const uint3& volReso);
+    void MarkVoxels(const uint3& lo, const uint3& hi);
+    inline const std::vector<uint32_t>& GetMarkedCells(uint level) const {
+        return _dirtyCells[level];
+    };
+    void ClearMarks();
+
+    inline const uint3& GetVolumeReso() const { return _volReso; };
+    inline uint GetCellSize(uint level) const { return 2u << level; };
+    inline const uint3& GetLevelReso(uint level) const {
+        return _reso[level];
+    };
+    inline const Range& GetRange(uint level, uint x, uint y, uint z) const {
+        const uint3& reso = _reso[level];
+        return _ranges[level][x + ((size_t)y + (size_t)z * reso.y) * reso.x];
+    };
+    // No readVolume sample inside the cell returns a density within
+    // [fMin, fMax]. Filtered reads weight the 8 neighbors with
+    // 1.5 - d / d - 0.5 (see readVolume), which can overshoot the voxel
+    // range by up to 3.5 times its width
+    inline bool IsEmpty(uint level, uint x, uint y, uint z, float fMin,
+        float fMax, bool filter) const {
+        const Range& range = GetRange(level, x, y, z);
+        const float fOvershoot =
+            filter ? 3.5f * (range.fMax - range.fMin) : 0.f;
+        return range.fMax + fOvershoot < fMin ||
+            range.fMin - fOvershoot > fMax;
+    };
+
+    // Animate frames (movingRatio of the balls moving half a voxel per
+    // frame, refreshed through DirtyBrickTracker) over the volume of
+    // perCall resampled to reso^3 for every ball count, and render it
+    // width x height through the camera of perFrame
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, const std::vector<uint>& ballCounts, uint frames,
+        float movingRatio, uint width, uint height,
+        WorkStealingPool* pool = nullptr);
+
+private:
+    void _BuildLeaf(const CPUVolume& vol, uint x, uint y, uint z);
+    void _BuildParent(uint level, uint x, uint y, uint z);
+    void _RefreshCells(const CPUVolume& vol, uint level,
+        WorkStealingPool* pool);
+    void _MarkCell(uint level, uint x, uint y, uint z);
+
+    uint3 _volReso;
+    uint3 _reso[kNumLevels];
+    std::vector<Range> _ranges[kNumLevels];
+    // cells to refresh per level, _marked flags the listed ones. A marked
+    // cell has its parents marked as well
+    std::vector<uint32_t> _dirtyCells[kNumLevels];
+    std::vector<uint8_t> _marked[kNumLevels];
+};
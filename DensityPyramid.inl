@@ -0,0 +1,35 @@
+#if !__hlsl
+#pragma once
+#endif // !__hlsl
+// Layout of the min/max density pyramid, shared by the GPU build
+// (SparseVolume_DensityPyramid_cs.hlsl), the PYRAMID_SKIP raycast and the
+// CPU DensityPyramid. Level l has cells of (2 << l)^3 voxels, x-major, and
+// the GPU keeps all levels in one buffer of float2 (min, max), the finest
+// first.
+#define PYRAMID_LEVELS 6
+
+#if __hlsl
+#define PYRAMID_FUNC
+#else
+#define PYRAMID_FUNC inline
+#endif // __hlsl
+
+// Cells along each axis of level
+PYRAMID_FUNC uint3 pyramidLevelReso(uint3 reso, uint level)
+{
+    uint cellSize = 2u << level;
+    return uint3((reso.x + cellSize - 1) >> (level + 1),
+        (reso.y + cellSize - 1) >> (level + 1),
+        (reso.z + cellSize - 1) >> (level + 1));
+}
+
+// First cell of level in the pyramid buffer, PYRAMID_LEVELS gives its size
+PYRAMID_FUNC uint pyramidLevelOffset(uint3 reso, uint level)
+{
+    uint offset = 0;
+    for (uint l = 0; l < level; ++l) {
+        uint3 cells = pyramidLevelReso(reso, l);
+        offset += cells.x * cells.y * cells.z;
+    }
+    return offset;
+}
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "DirtyBrickTracker.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+    inline bool _IsSameReso(const uint3& a, const uint3& b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+}
+
+DirtyBrickTracker::DirtyBrickTracker()
+    : _brickReso(0, 0, 0),
+    _cullRatio(0.f),
+    _invalidated(true),
+    _movedBalls(0)
+{
+    _vParam.u3VoxelReso = uint3(0, 0, 0);
+    _vParam.uVoxelBrickRatio = 0;
+    _vParam.fVoxelSize = 0.f;
+    _vParam.fMinDensity = 0.f;
+}
+
+DirtyBrickTracker::~DirtyBrickTracker()
+{
+}
+
+void
+DirtyBrickTracker::Update(const float4* balls, uint numOfBalls,
+    const VolumeParam& vParam, float cullRatio, float moveTolerance)
+{
+    if (!_IsSameReso(vParam.u3VoxelReso, _vParam.u3VoxelReso) ||
+        vParam.uVoxelBrickRatio != _vParam.uVoxelBrickRatio ||
+        vParam.fVoxelSize != _vParam.fVoxelSize ||
+        vParam.fMinDensity != _vParam.fMinDensity ||
+        vParam.fMaxDensity != _vParam.fMaxDensity ||
+        cullRatio != _cullRatio) {
+        _invalidated = true;
+    }
+    _vParam = vParam;
+    _cullRatio = cullRatio;
+    const uint ratio = vParam.uVoxelBrickRatio;
+    _brickReso = uint3(vParam.u3VoxelReso.x / ratio,
+        vParam.u3VoxelReso.y / ratio, vParam.u3VoxelReso.z / ratio);
+    const size_t brickCount =
+        (size_t)_brickReso.x * _brickReso.y * _brickReso.z;
+
+    _movedBalls = 0;
+    _dirtyBricks.clear();
+    if (_invalidated) {
+        _evaluated.assign(balls, balls + numOfBalls);
+        _dirty.assign(brickCount, 0);
+        _movedBalls = numOfBalls;
+        for (size_t i = 0; i < brickCount; ++i) {
+            _dirtyBricks.push_back((uint32_t)i);
+        }
+        _invalidated = false;
+        return;
+    }
+
+    const float toleranceSq = moveTolerance * vParam.fVoxelSize *
+        moveTolerance * vParam.fVoxelSize;
+    const uint oldBalls = (uint)_evaluated.size();
+    for (uint i = 0; i < std::max(numOfBalls, oldBalls); ++i) {
+        if (i < numOfBalls && i < oldBalls) {
+            const float4& a = balls[i];
+            const float4& b = _evaluated[i];
+            const float dx = a.x - b.x;
+            const float dy = a.y - b.y;
+            const float dz = a.z - b.z;
+            if (a.w == b.w && dx * dx + dy * dy + dz * dz <= toleranceSq) {
+                continue;
+            }
+        }
+        ++_movedBalls;
+        // where the volume still has it and where it is now
+        if (i < oldBalls) {
+            _MarkBox(_evaluated[i]);
+        }
+        if (i < numOfBalls) {
+            _MarkBox(balls[i]);
+            if (i < oldBalls) {
+                _evaluated[i] = balls[i];
+            } else {
+                _evaluated.push_back(balls[i]);
+            }
+        }
+    }
+    // balls within the tolerance keep their reference, so slow balls still
+    // trigger once they drifted far enough
+    _evaluated.resize(numOfBalls);
+    for (size_t i = 0; i < brickCount; ++i) {
+        if (_dirty[i]) {
+            _dirtyBricks.push_back((uint32_t)i);
+            _dirty[i] = 0;
+        }
+    }
+}
+
+void
+DirtyBrickTracker::_MarkBox(const float4& ball)
+{
+    const uint ratio = _vParam.uVoxelBrickRatio;
+    const float radius = BallBins::InfluenceRadius(
+        ball.w, _vParam.fMinDensity, _cullRatio) / _vParam.fVoxelSize;
+    const float center[3] = {ball.x, ball.y, ball.z};
+    const uint reso[3] = {_vParam.u3VoxelReso.x, _vParam.u3VoxelReso.y,
+        _vParam.u3VoxelReso.z};
+    uint lo[3], hi[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        // voxel i has its center at (i - half + 0.5) * voxelSize
+        float c = center[axis] / _vParam.fVoxelSize + reso[axis] * 0.5f - 0.5f;
+        float fLo = std::max(0.f, std::ceil(c - radius));
+        float fHi = std::min(reso[axis] - 1.f, std::floor(c + radius));
+        if (fLo > fHi) {
+            return;
+        }
+        lo[axis] = (uint)fLo / ratio;
+        hi[axis] = (uint)fHi / ratio;
+    }
+    for (uint z = lo[2]; z <= hi[2]; ++z) {
+        for (uint y = lo[1]; y <= hi[1]; ++y) {
+            for (uint x = lo[0]; x <= hi[0]; ++x) {
+                _dirty[x + (size_t)y * _brickReso.x +
+                    (size_t)z * _brickReso.x * _brickReso.y] = 1;
+            }
+        }
+    }
+}
+
+std::vector<DirtyBrickTracker::BenchmarkResult>
+DirtyBrickTracker::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, uint frames,
+    const std::vector<float>& movingRatios, float cullRatio,
+    float moveTolerance, WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    PerFrameDataCB frameCB = perFrame;
+    PerCallDataCB cb = perCall;
+    cb.vParam.u3VoxelReso = uint3(reso, reso, reso);
+    const uint ratio = std::max<uint>(1, cb.vParam.uVoxelBrickRatio);
+    cb.vParam.uVoxelBrickRatio = ratio;
+    const uint numOfBalls = std::min<uint>(cb.uNumOfBalls, MAX_BALLS);
+    const float step = 0.5f * cb.vParam.fVoxelSize;
+
+    CPUVolumeUpdater updater;
+    CPUVolume fullVol, incVol;
+    for (float movingRatio : movingRatios) {
+        std::mt19937 rng(0);
+        std::uniform_real_distribution<float> rand01(0.f, 1.f);
+        // moving balls keep their direction
+        std::vector<float4> dir(numOfBalls);
+        for (auto& d : dir) {
+            float x = rand01(rng) - 0.5f;
+            float y = rand01(rng) - 0.5f;
+            float z = rand01(rng) - 0.5f;
+            float len = std::sqrt(x * x + y * y + z * z) + 1e-6f;
+            d = rand01(rng) < movingRatio
+                ? float4(x / len * step, y / len * step, z / len * step, 0.f)
+                : float4(0.f, 0.f, 0.f, 0.f);
+        }
+        std::copy(perFrame.f4Balls, perFrame.f4Balls + numOfBalls,
+            frameCB.f4Balls);
+
+        BenchmarkResult result = {};
+        result.fMovingRatio = movingRatio;
+        DirtyBrickTracker tracker;
+        fullVol.Resize(cb.vParam.u3VoxelReso, ratio);
+        incVol.Resize(cb.vParam.u3VoxelReso, ratio);
+        // first frame evaluates everything
+        tracker.Update(frameCB.f4Balls, numOfBalls, cb.vParam, cullRatio,
+            moveTolerance);
+        updater.UpdateBricks(frameCB, cb, incVol, true,
+            tracker.GetDirtyBricks(), CPUVolumeUpdater::kSIMDLane, pool);
+        for (uint frame = 0; frame < frames; ++frame) {
+            for (uint i = 0; i < numOfBalls; ++i) {
+                frameCB.f4Balls[i].x += dir[i].x;
+                frameCB.f4Balls[i].y += dir[i].y;
+                frameCB.f4Balls[i].z += dir[i].z;
+            }
+            BenchmarkClock::time_point start = BenchmarkClock::now();
+            tracker.Update(frameCB.f4Balls, numOfBalls, cb.vParam,
+                cullRatio, moveTolerance);
+            result.dTrackMs += ElapsedMs(start);
+            const std::vector<uint32_t>& bricks = tracker.GetDirtyBricks();
+            result.dDirtyRatio +=
+                (double)bricks.size() / tracker.GetBrickCount();
+            start = BenchmarkClock::now();
+            // flags of dirty bricks are rebuilt from scratch
+            for (uint32_t brick : bricks) {
+                incVol.flags.Reset(brick);
+            }
+            updater.UpdateBricks(frameCB, cb, incVol, true, bricks,
+                CPUVolumeUpdater::kSIMDLane, pool);
+            result.dIncrementalMs += ElapsedMs(start);
+
+            start = BenchmarkClock::now();
+            fullVol.flags.ClearAll();
+            updater.Update(frameCB, cb, fullVol, true,
+                CPUVolumeUpdater::kSIMDLane, pool);
+            result.dFullMs += ElapsedMs(start);
+        }
+        result.dTrackMs /= frames;
+        result.dIncrementalMs /= frames;
+        result.dFullMs /= frames;
+        result.dDirtyRatio /= frames;
+        for (size_t i = 0; i < fullVol.voxels.size(); ++i) {
+            result.fMaxDensityError = std::max(result.fMaxDensityError,
+                std::abs(fullVol.voxels[i].x - incVol.voxels[i].x));
+        }
+        result.uFlagMismatches =
+            BrickFlags::CountDiff(fullVol.flags, incVol.flags);
+        results.push_back(result);
+    }
+    return results;
+}
@@ -0,0 +1,64 @@
+#pragma once
+// Dirty region tracking for incremental volume updates. Each ball's position
+// (and power) is diffed against the one the volume was last evaluated with,
+// a ball that moved more than the tolerance dirties every brick its old and
+// new influence box (BallBins::InfluenceRadius at cullRatio) overlaps. Only
+// those bricks are re-evaluated, the rest of the volume is reused.
+//
+// Bricks outside both boxes see a change below fMinDensity * cullRatio per
+// moved ball, balls within the tolerance keep their old position until they
+// drift further, so the reused content is off by at most that much.
+#include "CPUVolumeUpdater.h"
+
+class DirtyBrickTracker
+{
+public:
+    struct BenchmarkResult {
+        float fMovingRatio; // share of balls moving each frame
+        double dFullMs; // full update per frame
+        double dTrackMs; // tracker per frame
+        double dIncrementalMs; // update of the dirty bricks per frame
+        double dDirtyRatio; // average share of dirty bricks
+        // error of the incremental volume against a full update after the
+        // last frame
+        float fMaxDensityError;
+        size_t uFlagMismatches;
+    };
+
+    DirtyBrickTracker();
+    ~DirtyBrickTracker();
+
+    // Diff balls against the last evaluated state, the brick grid follows
+    // vParam (u3VoxelReso / uVoxelBrickRatio). moveTolerance is in voxels
+    void Update(const float4* balls, uint numOfBalls,
+        const VolumeParam& vParam, float cullRatio, float moveTolerance);
+    // Next Update dirties every brick (volume content lost)
+    inline void Invalidate() { _invalidated = true; };
+
+    inline const std::vector<uint32_t>& GetDirtyBricks() const {
+        return _dirtyBricks;
+    };
+    inline size_t GetBrickCount() const { return _dirty.size(); };
+    // Balls that triggered a re-evaluation in the last Update
+    inline size_t GetMovedBalls() const { return _movedBalls; };
+
+    // Animate frames with only movingRatios[i] of the balls moving (half a
+    // voxel per frame), tracked incremental update vs full update at reso^3
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, uint frames, const std::vector<float>& movingRatios,
+        float cullRatio, float moveTolerance, WorkStealingPool* pool = nullptr);
+
+private:
+    void _MarkBox(const float4& ball);
+
+    VolumeParam _vParam;
+    uint3 _brickReso;
+    float _cullRatio;
+    bool _invalidated;
+    size_t _movedBalls;
+    // ball state the volume content was evaluated with
+    std::vector<float4> _evaluated;
+    std::vector<uint8_t> _dirty;
+    std::vector<uint32_t> _dirtyBricks;
+};
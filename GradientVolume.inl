@@ -0,0 +1,73 @@
+#if !__hlsl
+#pragma once
+#endif // !__hlsl
+// Packed gradient volume of the iso surface normals (USE_NORMAL ==
+// NORMAL_GRADIENT_VOL), shared by the volume update, the raycast and the CPU
+// engine. One uint per voxel, addressed by (x, y, z) like a Texture3D
+// whatever the layout of the density. The update writes the direction of the
+// analytic field gradient at the voxel center, so a hit reads one voxel (8
+// with filtering) instead of the 4 readVolume calls of the finite
+// differences.
+//
+// Octahedral encoding: the direction is projected onto the octahedron
+// |x| + |y| + |z| = 1, the lower half folded over the upper one, and the
+// resulting (x, y) stored as two 16 bit snorm. 0 is kept for "no gradient"
+// (out of range loads, fields without a gradient) and decodes to a zero
+// vector, so it adds nothing to a filtered read.
+#define NORMAL_NONE 0
+#define NORMAL_FINITE_DIFF 1
+#define NORMAL_GRADIENT_VOL 2
+
+#if __hlsl
+#define GRADIENT_FUNC
+#else
+#define GRADIENT_FUNC inline
+#endif // __hlsl
+
+GRADIENT_FUNC float gradientSignNotZero(float f)
+{
+    return f >= 0.f ? 1.f : -1.f;
+}
+
+GRADIENT_FUNC uint packGradient(float3 f3Gradient)
+{
+    float fAbsX = f3Gradient.x < 0.f ? -f3Gradient.x : f3Gradient.x;
+    float fAbsY = f3Gradient.y < 0.f ? -f3Gradient.y : f3Gradient.y;
+    float fAbsZ = f3Gradient.z < 0.f ? -f3Gradient.z : f3Gradient.z;
+    float fL1 = fAbsX + fAbsY + fAbsZ;
+    if (!(fL1 > 0.f)) {
+        return 0;
+    }
+    float fU = f3Gradient.x / fL1;
+    float fV = f3Gradient.y / fL1;
+    if (f3Gradient.z < 0.f) {
+        float fFoldU = (1.f - fAbsY / fL1) * gradientSignNotZero(fU);
+        fV = (1.f - fAbsX / fL1) * gradientSignNotZero(fV);
+        fU = fFoldU;
+    }
+    int iU = (int)(fU * 32767.f + (fU < 0.f ? -0.5f : 0.5f));
+    int iV = (int)(fV * 32767.f + (fV < 0.f ? -0.5f : 0.5f));
+    uint uPacked = ((uint)iU & 0xffffu) | ((uint)iV << 16);
+    // +z encodes to 0, nudge it off the "no gradient" value
+    return uPacked == 0 ? 1u : uPacked;
+}
+
+// Unnormalized (length 1/sqrt(3) to 1), only the direction counts
+GRADIENT_FUNC float3 unpackGradient(uint uPacked)
+{
+    if (uPacked == 0) {
+        return float3(0.f, 0.f, 0.f);
+    }
+    float fU = (float)((int)(uPacked << 16) >> 16) / 32767.f;
+    float fV = (float)((int)uPacked >> 16) / 32767.f;
+    float fAbsU = fU < 0.f ? -fU : fU;
+    float fAbsV = fV < 0.f ? -fV : fV;
+    float fZ = 1.f - fAbsU - fAbsV;
+    if (fZ < 0.f) {
+        float fUnfoldU = (1.f - fAbsV) * gradientSignNotZero(fU);
+        fV = (1.f - fAbsU) * gradientSignNotZero(fV);
+        fU = fUnfoldU;
+    }
+    return float3(fU, fV, fZ);
+}
+#undef GRADIENT_FUNC
\ No newline at end of file
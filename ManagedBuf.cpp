@@ -24,8 +24,11 @@ ManagedBuf::ManagedBuf(DXGI_FORMAT format, DirectX::XMUINT3 reso,
     _newType(defaultType),
     _deprecatedType(defaultType),
     _currentBit(defaultBit),
-    _newBit(defaultBit)
+    _newBit(defaultBit),
+    _layout(kLinear),
+    _poolElements(0)
 {
+    _elementCount[0] = _elementCount[1] = 0;
 }
 
 ManagedBuf::~ManagedBuf()
@@ -77,31 +80,40 @@ ManagedBuf::GetResource()
         break;
     }
     BufInterface result;
-    result.type = _currentType;
-    result.dummyResource = &_dummyBuffer[_activeIndex];
-    switch (result.type) {
-    case kStructuredBuffer:
-        result.resource = &_structBuffer[_activeIndex];
-        result.SRV = _structBuffer[_activeIndex].GetSRV();
-        result.UAV = _structBuffer[_activeIndex].GetUAV();
-        result.RTV = _dummyBuffer[_activeIndex].GetRTV();
-        break;
-    case kTypedBuffer:
-        result.resource = &_typedBuffer[_activeIndex];
-        result.SRV = _typedBuffer[_activeIndex].GetSRV();
-        result.UAV = _typedBuffer[_activeIndex].GetUAV();
-        result.RTV = _dummyBuffer[_activeIndex].GetRTV();
-        break;
-    case k3DTexBuffer:
-        result.resource = &_volumeBuffer[_activeIndex];
-        result.SRV = _volumeBuffer[_activeIndex].GetSRV();
-        result.UAV = _volumeBuffer[_activeIndex].GetUAV();
-        result.RTV = _volumeBuffer[_activeIndex].GetRTV();
-        break;
-    }
+    _GetInterface(result);
     return result;
 }
 
+bool
+ManagedBuf::NeedsReallocate() const
+{
+    // not while a ChangeResource swaps buffers
+    return _bufState.load(std::memory_order_acquire) == kNormal &&
+        _currentType != k3DTexBuffer &&
+        _elementCount[_activeIndex] != _GetElementCount(_reso);
+}
+
+void
+ManagedBuf::Reallocate(BufInterface& buf,
+    RetireQueue<Microsoft::WRL::ComPtr<ID3D12Resource>>& retired,
+    uint64_t fenceValue)
+{
+    // no k3DTexBuffer, see NeedsReallocate. The structured buffer's UAV
+    // refers to its counter, which gets recreated along
+    GpuBuffer& old = _currentType == kStructuredBuffer
+        ? (GpuBuffer&)_structBuffer[_activeIndex]
+        : (GpuBuffer&)_typedBuffer[_activeIndex];
+    retired.Retire(fenceValue,
+        Microsoft::WRL::ComPtr<ID3D12Resource>(old.GetResource()));
+    if (_currentType == kStructuredBuffer) {
+        retired.Retire(fenceValue, Microsoft::WRL::ComPtr<ID3D12Resource>(
+            _structBuffer[_activeIndex].GetCounterBuffer().GetResource()));
+    }
+    _DestroyDataBuffer(_currentType, _activeIndex);
+    _CreateDataBuffer(_reso, _currentType, _currentBit, _activeIndex);
+    _GetInterface(buf);
+}
+
 void
 ManagedBuf::Destory()
 {
@@ -122,11 +134,50 @@ ManagedBuf::Destory()
     _structBuffer[1].Destroy();
 }
 
+void
+ManagedBuf::_GetInterface(BufInterface& buf)
+{
+    buf.type = _currentType;
+    buf.layout = _layout;
+    buf.dummyResource = &_dummyBuffer[_activeIndex];
+    switch (buf.type) {
+    case kStructuredBuffer:
+        buf.resource = &_structBuffer[_activeIndex];
+        buf.SRV = _structBuffer[_activeIndex].GetSRV();
+        buf.UAV = _structBuffer[_activeIndex].GetUAV();
+        buf.RTV = _dummyBuffer[_activeIndex].GetRTV();
+        break;
+    case kTypedBuffer:
+        buf.resource = &_typedBuffer[_activeIndex];
+        buf.SRV = _typedBuffer[_activeIndex].GetSRV();
+        buf.UAV = _typedBuffer[_activeIndex].GetUAV();
+        buf.RTV = _dummyBuffer[_activeIndex].GetRTV();
+        break;
+    case k3DTexBuffer:
+        buf.resource = &_volumeBuffer[_activeIndex];
+        buf.SRV = _volumeBuffer[_activeIndex].GetSRV();
+        buf.UAV = _volumeBuffer[_activeIndex].GetUAV();
+        buf.RTV = _volumeBuffer[_activeIndex].GetRTV();
+        break;
+    }
+}
+
 void
 ManagedBuf::_CreateVolume(const DirectX::XMUINT3 reso,
     const Type bufType, const Bit bufBit, uint targetIdx)
 {
-    uint32_t volumeBufferElementCount = reso.x * reso.y * reso.z;
+    _CreateDataBuffer(reso, bufType, bufBit, targetIdx);
+    DXGI_FORMAT format = bufBit == k16Bit
+        ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_R32G32B32A32_FLOAT;
+    _dummyBuffer[targetIdx].Create(L"Dummy Texture3D Buffer",
+        reso.x, reso.y, 1, 1, format);
+}
+
+void
+ManagedBuf::_CreateDataBuffer(const DirectX::XMUINT3 reso,
+    const Type bufType, const Bit bufBit, uint targetIdx)
+{
+    uint32_t volumeBufferElementCount = _GetElementCount(reso);
     uint32_t elementSize;
     DXGI_FORMAT format;
     switch (bufBit) {
@@ -139,6 +190,7 @@ ManagedBuf::_CreateVolume(const DirectX::XMUINT3 reso,
         format = DXGI_FORMAT_R32G32B32A32_FLOAT;
         break;
     }
+    _elementCount[targetIdx] = volumeBufferElementCount;
     switch (bufType) {
     case kStructuredBuffer:
         _structBuffer[targetIdx].Create(L"Struct Volume Buffer",
@@ -154,8 +206,30 @@ ManagedBuf::_CreateVolume(const DirectX::XMUINT3 reso,
             reso.x, reso.y, reso.z, 1, format);
         break;
     }
-    _dummyBuffer[targetIdx].Create(L"Dummy Texture3D Buffer",
-        reso.x, reso.y, 1, 1, format);
+}
+
+void
+ManagedBuf::_DestroyDataBuffer(const Type bufType, uint targetIdx)
+{
+    switch (bufType) {
+    case kTypedBuffer:
+        _typedBuffer[targetIdx].Destroy();
+        break;
+    case kStructuredBuffer:
+        _structBuffer[targetIdx].Destroy();
+        break;
+    case k3DTexBuffer:
+        _volumeBuffer[targetIdx].Destroy();
+        break;
+    }
+}
+
+uint32_t
+ManagedBuf::_GetElementCount(const DirectX::XMUINT3 reso) const
+{
+    // keep at least one element so there is always a valid view
+    return _layout == kBrickPool
+        ? std::max<uint32_t>(_poolElements, 1) : voxelBufferSize(reso);
 }
 
 void
@@ -168,17 +242,7 @@ ManagedBuf::_CookBuffer(const DirectX::XMUINT3 reso,
 	while (_bufState.load(std::memory_order_acquire) != kOldBufferRetired) {
 		std::this_thread::yield();
 	}
-	switch (_deprecatedType) {
-	case kTypedBuffer:
-		_typedBuffer[1 - _activeIndex].Destroy();
-		break;
-	case kStructuredBuffer:
-		_structBuffer[1 - _activeIndex].Destroy();
-		break;
-	case k3DTexBuffer:
-		_volumeBuffer[1 - _activeIndex].Destroy();
-		break;
-	}
+	_DestroyDataBuffer(_deprecatedType, 1 - _activeIndex);
 	_dummyBuffer[1 - _activeIndex].Destroy();
 	_bufState.store(kNormal, std::memory_order_release);
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 #include "SparseVolume.inl"
+#include "VoxelLayout.inl"
+#include "RetireQueue.h"
 
 class ManagedBuf
 {
@@ -17,8 +19,17 @@ public:
         kNumBitType
     };
 
+    // Voxel order of the buffer types, k3DTexBuffer ignores it
+    enum Layout {
+        kLinear = VOXEL_LAYOUT_LINEAR,
+        kSwizzled = VOXEL_LAYOUT_SWIZZLED,
+        kBrickPool = VOXEL_LAYOUT_BRICK_POOL,
+        kNumLayout
+    };
+
     struct BufInterface {
         Type type;
+        Layout layout;
         GpuResource* resource;
         GpuResource* dummyResource;
         D3D12_CPU_DESCRIPTOR_HANDLE SRV;
@@ -31,6 +42,23 @@ public:
     ~ManagedBuf();
     inline const Type GetType() const { return _currentType; };
     inline const Bit GetBit() const { return _currentBit; };
+    inline const Layout GetLayout() const { return _layout; };
+    // Dense buffers fit both kLinear and kSwizzled, switching to or from
+    // kBrickPool takes a Reallocate
+    inline void SetLayout(const Layout layout) { _layout = layout; };
+    // Elements of the kBrickPool buffer (BrickPool slots * ratio^3)
+    inline void SetPoolSize(uint32_t elementCount) {
+        _poolElements = elementCount;
+    };
+    inline uint32_t GetPoolSize() const { return _poolElements; };
+    // Active buffer doesn't match its layout (or pool size) any more
+    bool NeedsReallocate() const;
+    // Recreate the active buffer at the size its layout needs, content is
+    // lost and buf gets the new views. The old buffer goes to retired,
+    // fenceValue being the fence of its last use
+    void Reallocate(BufInterface& buf,
+        RetireQueue<Microsoft::WRL::ComPtr<ID3D12Resource>>& retired,
+        uint64_t fenceValue);
     inline const DirectX::XMUINT3 GetReso() const { return _reso; };
     void CreateResource();
     bool ChangeResource(const DirectX::XMUINT3& reso, const Type bufType,
@@ -41,6 +69,11 @@ public:
 private:
     void _CreateVolume(const DirectX::XMUINT3 reso,
         const Type bufType, const Bit bufBit, uint targetIdx);
+    void _CreateDataBuffer(const DirectX::XMUINT3 reso,
+        const Type bufType, const Bit bufBit, uint targetIdx);
+    void _DestroyDataBuffer(const Type bufType, uint targetIdx);
+    uint32_t _GetElementCount(const DirectX::XMUINT3 reso) const;
+    void _GetInterface(BufInterface& buf);
     void _CookBuffer(const DirectX::XMUINT3 reso, const Type bufType,
         const Bit bufBit);
 
@@ -56,6 +89,11 @@ private:
     Bit _currentBit;
     Bit _newBit;
 
+    Layout _layout;
+    uint32_t _poolElements;
+    // elements each buffer got created with
+    uint32_t _elementCount[2];
+
     DirectX::XMUINT3 _reso;
     DirectX::XMUINT3 _newReso;
 };
\ No newline at end of file
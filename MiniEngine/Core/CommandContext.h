@@ -283,6 +283,7 @@ public:
 	void DrawIndexedInstanced( UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation,
 		INT BaseVertexLocation, UINT StartInstanceLocation );
 	//void DrawIndirect(GpuBuffer& ArgumentBuffer, size_t ArgumentBufferOffset = 0);
+	void DrawIndexedIndirect( GpuBuffer& ArgumentBuffer, size_t ArgumentBufferOffset = 0 );
 };
 
 inline void GraphicsContext::SetRootSignature( const RootSignature& RootSig )
@@ -455,6 +456,13 @@ inline void GraphicsContext::DrawIndexedInstanced( UINT IndexCountPerInstance, U
 	m_CommandList->DrawIndexedInstanced( IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation );
 }
 
+inline void GraphicsContext::DrawIndexedIndirect( GpuBuffer& ArgumentBuffer, size_t ArgumentBufferOffset /* = 0 */ )
+{
+	FlushResourceBarriers();
+	m_DynamicDescriptorHeap.CommitGraphicsRootDescriptorTables( m_CommandList );
+	m_CommandList->ExecuteIndirect( Graphics::g_DrawIndexedIndirectCommandSignature.GetSignature(), 1, ArgumentBuffer.GetResource(), (UINT64)ArgumentBufferOffset, nullptr, 0 );
+}
+
 //inline void GraphicsContext::DrawIndirect(GpuBuffer& ArgumentBuffer, size_t ArgumentBufferOffset /* = 0 */)
 //{
 //	FlushResourceBarriers();
@@ -106,6 +106,7 @@ namespace Graphics
 
 	CommandSignature			g_DispatchIndirectCommandSignature(1);
 	CommandSignature			g_DrawIndirectCommandSignature(1);
+	CommandSignature			g_DrawIndexedIndirectCommandSignature(1);
 
 	RootSignature				s_PresentRS;
 	GraphicsPSO					s_BufferCopyPSO;
@@ -407,6 +408,9 @@ namespace Graphics
 		g_DrawIndirectCommandSignature[0].Draw();
 		g_DrawIndirectCommandSignature.Finalize();
 
+		g_DrawIndexedIndirectCommandSignature[0].DrawIndexed();
+		g_DrawIndexedIndirectCommandSignature.Finalize();
+
 		s_PresentRS.Reset( 1 );
 		s_PresentRS[0].InitAsDescriptorRange( D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 0, 1 );
 		s_PresentRS.Finalize(L"Present");
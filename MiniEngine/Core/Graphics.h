@@ -71,6 +71,7 @@ namespace Graphics
 
 	extern CommandSignature							g_DispatchIndirectCommandSignature;
 	extern CommandSignature							g_DrawIndirectCommandSignature;
+	extern CommandSignature							g_DrawIndexedIndirectCommandSignature;
 
 	void Init();
 	void Shutdown();
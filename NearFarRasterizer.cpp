@@ -0,0 +1,286 @@
+#include "NearFarRasterizer.h"
+#include "CPURaymarcher.h"
+#include "WorkStealingPool.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+    // flagged bricks get projected in chunks of this many
+    const uint32_t kBrickChunk = 256;
+}
+
+NearFarRasterizer::NearFarRasterizer()
+{
+}
+
+NearFarRasterizer::~NearFarRasterizer()
+{
+}
+
+void
+NearFarRasterizer::Rasterize(const CPUVolume& vol,
+    const PerFrameDataCB& perFrame, const VolumeParam& vParam, uint width,
+    uint height, uint scale, WorkStealingPool* pool)
+{
+    scale = std::max<uint>(1, scale);
+    _width = (width + scale - 1) / scale;
+    _height = (height + scale - 1) / scale;
+    _tilesX = (_width + kTileSize - 1) / kTileSize;
+    _tilesY = (_height + kTileSize - 1) / kTileSize;
+    const Range empty = {MAX_DEPTH, 0.f};
+    _pixels.assign((size_t)_width * _height, empty);
+    _tiles.assign((size_t)_tilesX * _tilesY, empty);
+    _bricks.clear();
+    _binOffsets.assign((size_t)_tilesX * _tilesY + 1, 0);
+    _binnedBricks.clear();
+    _coveredPixels = 0;
+    const float* wvp = (const float*)&perFrame.mWorldViewProj;
+    float invWVP[16];
+    if (!_width || !_height || !CPURaymarcher::Invert(wvp, invWVP)) {
+        return;
+    }
+    // same viewport and rays as CPURaymarcher::Render
+    const float fViewWidth = (float)width / scale;
+    const float fViewHeight = (float)height / scale;
+    const float3 f3Eye(perFrame.f4ViewPos.x, perFrame.f4ViewPos.y,
+        perFrame.f4ViewPos.z);
+
+    // brick placement of SparseVolume_StepInfo_vs.hlsl
+    const uint3 brickReso = vol.GetBrickReso();
+    const float fBrickSize = vParam.fVoxelSize * vol.uBrickRatio;
+    const float3 f3Origin(-(float)(vol.u3Reso.x >> 1) * vParam.fVoxelSize,
+        -(float)(vol.u3Reso.y >> 1) * vParam.fVoxelSize,
+        -(float)(vol.u3Reso.z >> 1) * vParam.fVoxelSize);
+    _compaction.Compact(vol, pool);
+    const std::vector<uint32_t>& flagged = _compaction.GetActiveBricks();
+    _bricks.resize(flagged.size());
+
+    // projected bounds, a brick reaching behind the eye plane may cover any
+    // pixel and one entirely behind it none
+    const uint32_t chunks =
+        ((uint32_t)flagged.size() + kBrickChunk - 1) / kBrickChunk;
+    auto projectChunk = [&](uint32_t chunk, uint32_t) {
+        const uint32_t end = std::min<uint32_t>(
+            (chunk + 1) * kBrickChunk, (uint32_t)flagged.size());
+        for (uint32_t i = chunk * kBrickChunk; i < end; ++i) {
+            const uint32_t idx = flagged[i];
+            const uint x = idx % brickReso.x;
+            const uint y = idx / brickReso.x % brickReso.y;
+            const uint z = idx / brickReso.x / brickReso.y;
+            Brick& brick = _bricks[i];
+            brick.f3Min = float3(f3Origin.x + x * fBrickSize,
+                f3Origin.y + y * fBrickSize, f3Origin.z + z * fBrickSize);
+            brick.f3Max = float3(brick.f3Min.x + fBrickSize,
+                brick.f3Min.y + fBrickSize, brick.f3Min.z + fBrickSize);
+            float fMinX = FLT_MAX, fMinY = FLT_MAX;
+            float fMaxX = -FLT_MAX, fMaxY = -FLT_MAX;
+            uint behind = 0;
+            for (uint corner = 0; corner < 8; ++corner) {
+                const float4 f4Clip = CPURaymarcher::Transform(wvp,
+                    corner & 1 ? brick.f3Max.x : brick.f3Min.x,
+                    corner & 2 ? brick.f3Max.y : brick.f3Min.y,
+                    corner & 4 ? brick.f3Max.z : brick.f3Min.z, 1.f);
+                if (f4Clip.w <= 0.f) {
+                    ++behind;
+                    continue;
+                }
+                // screen position in pixels of the viewport
+                const float fX = (f4Clip.x / f4Clip.w + 1.f) * 0.5f *
+                    fViewWidth;
+                const float fY = (1.f - f4Clip.y / f4Clip.w) * 0.5f *
+                    fViewHeight;
+                fMinX = std::min(fMinX, fX);
+                fMaxX = std::max(fMaxX, fX);
+                fMinY = std::min(fMinY, fY);
+                fMaxY = std::max(fMaxY, fY);
+            }
+            if (behind == 8) {
+                // culled, x0 > x1
+                brick.x0 = 1;
+                brick.x1 = 0;
+                brick.y0 = brick.y1 = 0;
+                continue;
+            }
+            if (behind) {
+                fMinX = fMinY = 0.f;
+                fMaxX = (float)_width;
+                fMaxY = (float)_height;
+            }
+            // pixels whose center is inside, give or take one
+            fMinX = std::floor(fMinX - 0.5f);
+            fMinY = std::floor(fMinY - 0.5f);
+            fMaxX = std::ceil(fMaxX - 0.5f);
+            fMaxY = std::ceil(fMaxY - 0.5f);
+            if (fMaxX < 0.f || fMaxY < 0.f || fMinX >= (float)_width ||
+                fMinY >= (float)_height) {
+                brick.x0 = 1;
+                brick.x1 = 0;
+                brick.y0 = brick.y1 = 0;
+                continue;
+            }
+            brick.x0 = (uint)std::max(fMinX, 0.f);
+            brick.y0 = (uint)std::max(fMinY, 0.f);
+            brick.x1 = (uint)std::min(fMaxX, (float)(_width - 1));
+            brick.y1 = (uint)std::min(fMaxY, (float)(_height - 1));
+        }
+    };
+    if (pool) {
+        pool->ParallelFor(chunks, projectChunk);
+    } else {
+        for (uint32_t chunk = 0; chunk < chunks; ++chunk) {
+            projectChunk(chunk, 0);
+        }
+    }
+
+    // bin into the tiles, counts first
+    for (const Brick& brick : _bricks) {
+        if (brick.x0 > brick.x1) {
+            continue;
+        }
+        _coveredPixels += (uint64_t)(brick.x1 - brick.x0 + 1) *
+            (brick.y1 - brick.y0 + 1);
+        for (uint ty = brick.y0 / kTileSize; ty <= brick.y1 / kTileSize;
+            ++ty) {
+            for (uint tx = brick.x0 / kTileSize;
+                tx <= brick.x1 / kTileSize; ++tx) {
+                ++_binOffsets[tx + (size_t)ty * _tilesX + 1];
+            }
+        }
+    }
+    for (size_t tile = 0; tile < _tiles.size(); ++tile) {
+        _binOffsets[tile + 1] += _binOffsets[tile];
+    }
+    _binnedBricks.resize(_binOffsets.back());
+    std::vector<uint32_t> cursor(_binOffsets.begin(), _binOffsets.end() - 1);
+    for (uint32_t i = 0; i < (uint32_t)_bricks.size(); ++i) {
+        const Brick& brick = _bricks[i];
+        if (brick.x0 > brick.x1) {
+            continue;
+        }
+        for (uint ty = brick.y0 / kTileSize; ty <= brick.y1 / kTileSize;
+            ++ty) {
+            for (uint tx = brick.x0 / kTileSize;
+                tx <= brick.x1 / kTileSize; ++tx) {
+                _binnedBricks[cursor[tx + (size_t)ty * _tilesX]++] = i;
+            }
+        }
+    }
+
+    auto resolveTile = [&](uint32_t tile, uint32_t) {
+        const uint32_t begin = _binOffsets[tile];
+        const uint32_t end = _binOffsets[tile + 1];
+        if (begin == end) {
+            return;
+        }
+        const uint x0 = tile % _tilesX * kTileSize;
+        const uint y0 = tile / _tilesX * kTileSize;
+        const uint x1 = std::min<uint>(x0 + kTileSize, _width);
+        const uint y1 = std::min<uint>(y0 + kTileSize, _height);
+        Range& tileRange = _tiles[tile];
+        for (uint y = y0; y < y1; ++y) {
+            for (uint x = x0; x < x1; ++x) {
+                const float fNdcX = (x + 0.5f) * 2.f / fViewWidth - 1.f;
+                const float fNdcY = 1.f - (y + 0.5f) * 2.f / fViewHeight;
+                const float4 f4Pos =
+                    CPURaymarcher::Transform(invWVP, fNdcX, fNdcY, 0.5f, 1.f);
+                float3 f3Dir(f4Pos.x / f4Pos.w - f3Eye.x,
+                    f4Pos.y / f4Pos.w - f3Eye.y, f4Pos.z / f4Pos.w - f3Eye.z);
+                const float fInvLength = 1.f / std::sqrt(f3Dir.x * f3Dir.x +
+                    f3Dir.y * f3Dir.y + f3Dir.z * f3Dir.z);
+                f3Dir = float3(f3Dir.x * fInvLength, f3Dir.y * fInvLength,
+                    f3Dir.z * fInvLength);
+                Range& range = _pixels[x + (size_t)y * _width];
+                for (uint32_t i = begin; i < end; ++i) {
+                    const Brick& brick = _bricks[_binnedBricks[i]];
+                    if (x < brick.x0 || x > brick.x1 || y < brick.y0 ||
+                        y > brick.y1) {
+                        continue;
+                    }
+                    float tNear, tFar;
+                    if (!CPURaymarcher::IntersectBox(f3Eye, f3Dir,
+                        brick.f3Min, brick.f3Max, tNear, tFar) ||
+                        tFar <= 0.f) {
+                        continue;
+                    }
+                    range.fNear = std::min(range.fNear, std::max(tNear, 0.f));
+                    range.fFar = std::max(range.fFar, tFar);
+                }
+                tileRange.fNear = std::min(tileRange.fNear, range.fNear);
+                tileRange.fFar = std::max(tileRange.fFar, range.fFar);
+            }
+        }
+    };
+    if (pool) {
+        pool->ParallelFor((uint32_t)_tiles.size(), resolveTile);
+    } else {
+        for (uint32_t tile = 0; tile < (uint32_t)_tiles.size(); ++tile) {
+            resolveTile(tile, 0);
+        }
+    }
+}
+
+std::vector<NearFarRasterizer::BenchmarkResult>
+NearFarRasterizer::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, const std::vector<uint>& ratios,
+    uint width, uint height, WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+
+    CPURaymarcher::RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    // the near/far path goes ray by ray, so does the box one to compare
+    settings.uPacketSize = 0;
+    CPURaymarcher::Image boxImage, nearFarImage;
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    NearFarRasterizer nearFar;
+    for (uint ratio : ratios) {
+        vParam.uVoxelBrickRatio = std::max<uint>(1, ratio);
+        vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+        updater.Update(perFrame, cb, vol, true, CPUVolumeUpdater::kSIMDLane,
+            pool);
+        BenchmarkResult result = {};
+        result.uBrickRatio = vParam.uVoxelBrickRatio;
+        result.uBrickCount = vol.flags.GetBrickCount();
+
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+        nearFar.Rasterize(vol, perFrame, vParam, width, height, 1, pool);
+        result.dRasterMs = ElapsedMs(start);
+        result.uFlaggedBricks = nearFar.GetFlaggedBricks();
+        result.dTilesPerBrick = (double)nearFar.GetBinnedBricks() /
+            std::max<size_t>(1, result.uFlaggedBricks);
+        size_t emptyTiles = 0;
+        for (uint ty = 0; ty < nearFar.GetTilesY(); ++ty) {
+            for (uint tx = 0; tx < nearFar.GetTilesX(); ++tx) {
+                const Range& range = nearFar.GetTileRange(tx, ty);
+                emptyTiles += range.fFar < range.fNear ? 1 : 0;
+            }
+        }
+        result.dEmptyTiles = (double)emptyTiles / std::max<size_t>(1,
+            (size_t)nearFar.GetTilesX() * nearFar.GetTilesY());
+
+        settings.pNearFar = nullptr;
+        CPURaymarcher::RenderStats stats = CPURaymarcher::Render(
+            vol, perFrame, cb, settings, boxImage, pool);
+        result.dBoxMs = stats.dMs;
+        result.dBoxSamplesPerPixel =
+            (double)stats.uSamples / std::max<uint64_t>(1, stats.uPixels);
+        settings.pNearFar = &nearFar;
+        stats = CPURaymarcher::Render(
+            vol, perFrame, cb, settings, nearFarImage, pool);
+        result.dNearFarMs = stats.dMs;
+        result.dNearFarSamplesPerPixel =
+            (double)stats.uSamples / std::max<uint64_t>(1, stats.uPixels);
+        const CPURaymarcher::ImageDiff diff =
+            CPURaymarcher::Compare(boxImage, nearFarImage, 1.f / 255.f);
+        result.fMaxError = diff.fMaxError;
+        result.uDiffPixels = diff.uDiffPixels;
+        results.push_back(result);
+    }
+    return results;
+}
@@ -0,0 +1,103 @@
+#pragma once
+// CPU counterpart of _RenderNearFar. As with the compacted indirect draw,
+// only the flagged bricks (BrickCompaction) get projected and binned into
+// the screen tiles their bounds cover. Every tile then resolves, per pixel
+// ray, the distance from f4ViewPos where it enters the first and leaves the
+// last flagged brick, which is what the min blend of
+// SparseVolume_StepInfo_ps.hlsl leaves in _stepInfoTex, plus the range of
+// the whole tile as conservative bounds. Tiles are spread across the pool.
+#include "BrickCompaction.h"
+
+class NearFarRasterizer
+{
+public:
+    enum {
+        kTileSize = 16, // pixels along each side of a tile
+    };
+
+    // Distances along the ray, fFar < fNear (MAX_DEPTH and 0 like the
+    // cleared _stepInfoTex) when no flagged brick is hit
+    struct Range {
+        float fNear;
+        float fFar;
+    };
+
+    struct BenchmarkResult {
+        uint uBrickRatio;
+        size_t uBrickCount; // instances of the full grid
+        size_t uFlaggedBricks;
+        double dTilesPerBrick; // tiles a flagged brick got binned into
+        double dEmptyTiles; // share of tiles without any flagged brick
+        double dRasterMs;
+        // accumulated shading from IntersectBox and from the near/far
+        // (ENABLE_BRICKS), the near/far skips rays missing every brick
+        double dBoxMs;
+        double dNearFarMs;
+        double dBoxSamplesPerPixel;
+        double dNearFarSamplesPerPixel;
+        // near/far image against the box one
+        float fMaxError;
+        size_t uDiffPixels; // off by more than 1/255
+    };
+
+    NearFarRasterizer();
+    ~NearFarRasterizer();
+
+    // Near/far of the pixels of a width x height target traced at 1/scale
+    // (the low resolution raycast viewport, see CPURaymarcher::Render)
+    // through the camera of perFrame, over the bricks flagged in vol.flags.
+    // Unlike the rasterized cubes, which get clipped at the near plane, a
+    // ray starting inside a flagged brick gets a near of 0
+    void Rasterize(const CPUVolume& vol, const PerFrameDataCB& perFrame,
+        const VolumeParam& vParam, uint width, uint height, uint scale = 1,
+        WorkStealingPool* pool = nullptr);
+
+    inline uint GetWidth() const { return _width; };
+    inline uint GetHeight() const { return _height; };
+    inline const Range& GetNearFar(uint x, uint y) const {
+        return _pixels[x + (size_t)y * _width];
+    };
+    inline uint GetTilesX() const { return _tilesX; };
+    inline uint GetTilesY() const { return _tilesY; };
+    // Nearest near and farthest far of the tile's pixels
+    inline const Range& GetTileRange(uint tileX, uint tileY) const {
+        return _tiles[tileX + (size_t)tileY * _tilesX];
+    };
+    inline size_t GetFlaggedBricks() const { return _bricks.size(); };
+    // brick and tile pairs of the last Rasterize
+    inline size_t GetBinnedBricks() const { return _binnedBricks.size(); };
+    // pixels of the flagged bricks' projected rects of the last Rasterize,
+    // summed, so overlaps count once per brick like the cube fill
+    inline uint64_t GetCoveredPixels() const { return _coveredPixels; };
+
+    // Rasterize against _RenderNearFar's instance count at reso^3 for every
+    // brick ratio, and accumulated shading from the near/far against
+    // IntersectBox, rendered width x height through the camera of perFrame
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, const std::vector<uint>& ratios, uint width, uint height,
+        WorkStealingPool* pool = nullptr);
+
+private:
+    struct Brick {
+        float3 f3Min;
+        float3 f3Max;
+        // inclusive pixel rect of the projected bounds, grown by a pixel
+        uint x0, y0, x1, y1;
+    };
+
+    uint _width = 0;
+    uint _height = 0;
+    uint _tilesX = 0;
+    uint _tilesY = 0;
+    // flagged bricks, the instances of the compacted draw
+    BrickCompaction _compaction;
+    std::vector<Brick> _bricks;
+    // CSR layout, bricks of tile i are _binnedBricks[_binOffsets[i],
+    // _binOffsets[i+1])
+    std::vector<uint32_t> _binOffsets;
+    std::vector<uint32_t> _binnedBricks;
+    uint64_t _coveredPixels = 0;
+    std::vector<Range> _pixels;
+    std::vector<Range> _tiles;
+};
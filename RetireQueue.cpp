@@ -0,0 +1,105 @@
+#include "RetireQueue.h"
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+    struct ReleaseRecord {
+        uint32_t uId;
+        uint64_t uFence; // as passed to Retire
+        uint64_t uCompleted; // fence counter when it got released
+    };
+
+    // Lives in the queue, logs its own release
+    struct Probe {
+        Probe(uint32_t id, uint64_t fence, const uint64_t& completed,
+            std::vector<ReleaseRecord>& log)
+            : uId(id), uFence(fence), completed(completed), log(log) {}
+        ~Probe() { log.push_back({uId, uFence, completed}); }
+        uint32_t uId;
+        uint64_t uFence;
+        const uint64_t& completed;
+        std::vector<ReleaseRecord>& log;
+    };
+}
+
+RetireQueueValidation
+ValidateRetireQueue(uint32_t steps)
+{
+    RetireQueueValidation result = {};
+    result.bNoEarlyRelease = true;
+    result.bInOrder = true;
+    result.bConsistent = true;
+
+    std::vector<ReleaseRecord> log;
+    // fake CmdListMngr: signaled by each submit, completed trails it
+    uint64_t signaled = 0;
+    uint64_t completed = 0;
+    // fence each pending entry waits for, after the clamp
+    std::deque<uint64_t> model;
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<uint32_t> action(0, 9);
+    RetireQueue<std::unique_ptr<Probe>> queue;
+    size_t checked = 0;
+
+    auto checkReleased = [&]() {
+        for (; checked < log.size(); ++checked) {
+            const ReleaseRecord& record = log[checked];
+            result.bNoEarlyRelease &= record.uFence <= record.uCompleted;
+            result.bInOrder &= record.uId == checked;
+        }
+    };
+    auto checkCounts = [&]() {
+        result.bConsistent &= queue.GetPendingCount() == model.size() &&
+            queue.GetLastFence() == (model.empty() ? 0 : model.back());
+    };
+
+    for (uint32_t step = 0; step < steps; ++step) {
+        const uint32_t a = action(rng);
+        if (a < 5) {
+            // last used by a submitted frame, or by the one being recorded
+            // (a Flush signals the next fence), some go with an older
+            // fence like a buffer retired at lastFrameEndFence
+            uint64_t fence = a == 0 ? ++signaled : signaled;
+            if (a == 1 && signaled > completed + 1) {
+                fence = completed + 1 + rng() % (signaled - completed);
+            }
+            const uint64_t last = model.empty() ? 0 : model.back();
+            result.uClamped += fence < last;
+            model.push_back(std::max(fence, last));
+            queue.Retire(fence, std::unique_ptr<Probe>(
+                new Probe(result.uRetired++, fence, completed, log)));
+        } else if (a < 8) {
+            if (completed < signaled) {
+                completed += 1 + rng() % (signaled - completed);
+            }
+            const size_t released = queue.Release(
+                [&](uint64_t fence) { return fence <= completed; });
+            size_t expected = 0;
+            while (!model.empty() && model.front() <= completed) {
+                model.pop_front();
+                ++expected;
+            }
+            result.bConsistent &= released == expected;
+            result.uReleased += (uint32_t)released;
+        } else if (a == 8 && rng() % 64 == 0) {
+            // device idle, everything completed
+            completed = signaled;
+            result.uReleased += (uint32_t)queue.GetPendingCount();
+            queue.ReleaseAll();
+            model.clear();
+        }
+        checkCounts();
+        checkReleased();
+    }
+    completed = signaled;
+    result.uReleased += (uint32_t)queue.GetPendingCount();
+    queue.ReleaseAll();
+    model.clear();
+    checkCounts();
+    checkReleased();
+    result.bConsistent &= log.size() == result.uRetired &&
+        result.uReleased == result.uRetired;
+    return result;
+}
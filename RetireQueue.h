@@ -0,0 +1,72 @@
+#pragma once
+// Deferred deletion keyed by fence value. A resource recreated while the
+// GPU may still be reading the old one (the ComPtr<ID3D12Resource> of a
+// buffer, say) gets retired along with the fence value signaled after its
+// last use, the way ManagedBuf retires its old buffer at lastFrameEndFence,
+// and is only released once that fence completed. Nothing waits, the new
+// resource is in use right away while the old one drains.
+//
+// Fence values only grow, so entries complete in order and Release stops
+// at the first pending one. A resource last used by the frame being
+// recorded goes with the fence of a Flush instead, and a later Retire at
+// lastFrameEndFence then waits for that fence as well. The queue never asks
+// the GPU itself: fence values come in with Retire and completion through
+// the isComplete of Release, so a plain counter can stand in for
+// CmdListMngr, as in ValidateRetireQueue.
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+template <typename T>
+class RetireQueue
+{
+public:
+    // item stays alive until fenceValue completes, or the fence of the last
+    // Retire if that one is higher, so the entries stay in order
+    inline void Retire(uint64_t fenceValue, T&& item) {
+        if (!_entries.empty() && _entries.back().first > fenceValue) {
+            fenceValue = _entries.back().first;
+        }
+        _entries.emplace_back(fenceValue, std::move(item));
+    };
+
+    // Release the items of the completed fences, isComplete(fenceValue)
+    // tells whether the GPU got past fenceValue. Returns the released count
+    template <typename IsComplete>
+    size_t Release(IsComplete isComplete) {
+        size_t count = 0;
+        while (!_entries.empty() && isComplete(_entries.front().first)) {
+            _entries.pop_front();
+            ++count;
+        }
+        return count;
+    };
+
+    // Only once the GPU idled
+    inline void ReleaseAll() { _entries.clear(); };
+
+    inline size_t GetPendingCount() const { return _entries.size(); };
+    // fence value the last pending item waits for
+    inline uint64_t GetLastFence() const {
+        return _entries.empty() ? 0 : _entries.back().first;
+    };
+
+private:
+    std::deque<std::pair<uint64_t, T>> _entries;
+};
+
+struct RetireQueueValidation {
+    uint32_t uRetired;
+    uint32_t uReleased;
+    uint32_t uClamped; // retired below the fence of the entry before
+    bool bNoEarlyRelease; // nothing went before its fence completed
+    bool bInOrder; // released in Retire order, clamped entries too
+    // GetPendingCount/GetLastFence matched a model queue after each call
+    bool bConsistent;
+};
+
+// Drive Retire/Release/ReleaseAll for steps random calls with a plain
+// counter as the GPU fence, each retired item records when it gets
+// released
+RetireQueueValidation ValidateRetireQueue(uint32_t steps = 10000);
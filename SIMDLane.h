@@ -0,0 +1,221 @@
+#pragma once
+// Thin wrapper over the SIMD instruction set available at compile time, so
+// the CPU kernels can be written once and run on AVX2, SSE, NEON or plain
+// scalar lanes. The scalar lane (SIMD::Lane1) is always available and is what
+// the reference path uses, all lane types must produce bit identical results
+// for the same sequence of operations (no fused multiply-add, no approximate
+// reciprocal)
+#include <cstdint>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+#endif
+
+namespace SIMD {
+
+//------------------------------------------------------------------------------
+// Scalar lane
+//------------------------------------------------------------------------------
+struct Lane1 {
+    enum { kWidth = 1 };
+    float v;
+
+    static inline Lane1 Set1(float f) { Lane1 r; r.v = f; return r; }
+    // lane i holds base + i
+    static inline Lane1 Ramp(float base) { return Set1(base); }
+    static inline Lane1 Load(const float* p) { return Set1(p[0]); }
+    inline void Store(float* p) const { p[0] = v; }
+};
+inline Lane1 operator+(Lane1 a, Lane1 b) { return Lane1::Set1(a.v + b.v); }
+inline Lane1 operator-(Lane1 a, Lane1 b) { return Lane1::Set1(a.v - b.v); }
+inline Lane1 operator*(Lane1 a, Lane1 b) { return Lane1::Set1(a.v * b.v); }
+inline Lane1 operator/(Lane1 a, Lane1 b) { return Lane1::Set1(a.v / b.v); }
+inline Lane1 Sqrt(Lane1 a) { return Lane1::Set1(std::sqrt(a.v)); }
+inline Lane1 Min(Lane1 a, Lane1 b) { return Lane1::Set1(b.v < a.v ? b.v : a.v); }
+inline Lane1 Max(Lane1 a, Lane1 b) { return Lane1::Set1(a.v < b.v ? b.v : a.v); }
+inline Lane1 Floor(Lane1 a) { return Lane1::Set1(std::floor(a.v)); }
+// Bit i of the returned mask is set when the comparison holds for lane i
+inline uint32_t CmpGE(Lane1 a, Lane1 b) { return a.v >= b.v ? 1u : 0u; }
+inline uint32_t CmpLE(Lane1 a, Lane1 b) { return a.v <= b.v ? 1u : 0u; }
+// Lane i of a where bit i of mask is set, of b otherwise
+inline Lane1 Select(uint32_t mask, Lane1 a, Lane1 b) {
+    return mask & 1u ? a : b;
+}
+
+//------------------------------------------------------------------------------
+// AVX2 lane
+//------------------------------------------------------------------------------
+#if SIMD_AVX2
+struct Lane8 {
+    enum { kWidth = 8 };
+    __m256 v;
+
+    static inline Lane8 Set1(float f) { Lane8 r; r.v = _mm256_set1_ps(f); return r; }
+    static inline Lane8 Ramp(float base) {
+        Lane8 r;
+        r.v = _mm256_add_ps(_mm256_set1_ps(base),
+            _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f));
+        return r;
+    }
+    static inline Lane8 Load(const float* p) { Lane8 r; r.v = _mm256_loadu_ps(p); return r; }
+    inline void Store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+inline Lane8 _Wrap8(__m256 v) { Lane8 r; r.v = v; return r; }
+inline Lane8 operator+(Lane8 a, Lane8 b) { return _Wrap8(_mm256_add_ps(a.v, b.v)); }
+inline Lane8 operator-(Lane8 a, Lane8 b) { return _Wrap8(_mm256_sub_ps(a.v, b.v)); }
+inline Lane8 operator*(Lane8 a, Lane8 b) { return _Wrap8(_mm256_mul_ps(a.v, b.v)); }
+inline Lane8 operator/(Lane8 a, Lane8 b) { return _Wrap8(_mm256_div_ps(a.v, b.v)); }
+inline Lane8 Sqrt(Lane8 a) { return _Wrap8(_mm256_sqrt_ps(a.v)); }
+inline Lane8 Min(Lane8 a, Lane8 b) { return _Wrap8(_mm256_min_ps(a.v, b.v)); }
+inline Lane8 Max(Lane8 a, Lane8 b) { return _Wrap8(_mm256_max_ps(a.v, b.v)); }
+inline Lane8 Floor(Lane8 a) { return _Wrap8(_mm256_floor_ps(a.v)); }
+inline uint32_t CmpGE(Lane8 a, Lane8 b) {
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ));
+}
+inline uint32_t CmpLE(Lane8 a, Lane8 b) {
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ));
+}
+inline Lane8 Select(uint32_t mask, Lane8 a, Lane8 b) {
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i m = _mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_set1_epi32((int)mask), bits), bits);
+    return _Wrap8(_mm256_blendv_ps(b.v, a.v, _mm256_castsi256_ps(m)));
+}
+typedef Lane8 LaneN;
+#endif // SIMD_AVX2
+
+//------------------------------------------------------------------------------
+// SSE / NEON lane
+//------------------------------------------------------------------------------
+#if SIMD_AVX2 || SIMD_SSE
+struct Lane4 {
+    enum { kWidth = 4 };
+    __m128 v;
+
+    static inline Lane4 Set1(float f) { Lane4 r; r.v = _mm_set1_ps(f); return r; }
+    static inline Lane4 Ramp(float base) {
+        Lane4 r;
+        r.v = _mm_add_ps(_mm_set1_ps(base), _mm_setr_ps(0.f, 1.f, 2.f, 3.f));
+        return r;
+    }
+    static inline Lane4 Load(const float* p) { Lane4 r; r.v = _mm_loadu_ps(p); return r; }
+    inline void Store(float* p) const { _mm_storeu_ps(p, v); }
+};
+inline Lane4 _Wrap4(__m128 v) { Lane4 r; r.v = v; return r; }
+inline Lane4 operator+(Lane4 a, Lane4 b) { return _Wrap4(_mm_add_ps(a.v, b.v)); }
+inline Lane4 operator-(Lane4 a, Lane4 b) { return _Wrap4(_mm_sub_ps(a.v, b.v)); }
+inline Lane4 operator*(Lane4 a, Lane4 b) { return _Wrap4(_mm_mul_ps(a.v, b.v)); }
+inline Lane4 operator/(Lane4 a, Lane4 b) { return _Wrap4(_mm_div_ps(a.v, b.v)); }
+inline Lane4 Sqrt(Lane4 a) { return _Wrap4(_mm_sqrt_ps(a.v)); }
+inline Lane4 Min(Lane4 a, Lane4 b) { return _Wrap4(_mm_min_ps(a.v, b.v)); }
+inline Lane4 Max(Lane4 a, Lane4 b) { return _Wrap4(_mm_max_ps(a.v, b.v)); }
+// SSE2 has no floor, truncate and step down where that rounded up (valid
+// for |a| < 2^31)
+inline Lane4 Floor(Lane4 a) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return _Wrap4(_mm_sub_ps(t,
+        _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.f))));
+}
+inline uint32_t CmpGE(Lane4 a, Lane4 b) {
+    return (uint32_t)_mm_movemask_ps(_mm_cmpge_ps(a.v, b.v));
+}
+inline uint32_t CmpLE(Lane4 a, Lane4 b) {
+    return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(a.v, b.v));
+}
+inline Lane4 Select(uint32_t mask, Lane4 a, Lane4 b) {
+    const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128 m = _mm_castsi128_ps(_mm_cmpeq_epi32(
+        _mm_and_si128(_mm_set1_epi32((int)mask), bits), bits));
+    return _Wrap4(_mm_or_ps(_mm_and_ps(m, a.v), _mm_andnot_ps(m, b.v)));
+}
+#elif SIMD_NEON
+struct Lane4 {
+    enum { kWidth = 4 };
+    float32x4_t v;
+
+    static inline Lane4 Set1(float f) { Lane4 r; r.v = vdupq_n_f32(f); return r; }
+    static inline Lane4 Ramp(float base) {
+        static const float ramp[4] = {0.f, 1.f, 2.f, 3.f};
+        Lane4 r;
+        r.v = vaddq_f32(vdupq_n_f32(base), vld1q_f32(ramp));
+        return r;
+    }
+    static inline Lane4 Load(const float* p) { Lane4 r; r.v = vld1q_f32(p); return r; }
+    inline void Store(float* p) const { vst1q_f32(p, v); }
+};
+inline Lane4 _Wrap4(float32x4_t v) { Lane4 r; r.v = v; return r; }
+inline Lane4 operator+(Lane4 a, Lane4 b) { return _Wrap4(vaddq_f32(a.v, b.v)); }
+inline Lane4 operator-(Lane4 a, Lane4 b) { return _Wrap4(vsubq_f32(a.v, b.v)); }
+inline Lane4 operator*(Lane4 a, Lane4 b) { return _Wrap4(vmulq_f32(a.v, b.v)); }
+#if defined(__aarch64__)
+inline Lane4 operator/(Lane4 a, Lane4 b) { return _Wrap4(vdivq_f32(a.v, b.v)); }
+inline Lane4 Sqrt(Lane4 a) { return _Wrap4(vsqrtq_f32(a.v)); }
+inline Lane4 Floor(Lane4 a) { return _Wrap4(vrndmq_f32(a.v)); }
+#else
+// ARMv7 NEON has no IEEE divide/sqrt, fall back per lane to stay bit exact
+inline Lane4 operator/(Lane4 a, Lane4 b) {
+    float fa[4], fb[4];
+    a.Store(fa); b.Store(fb);
+    for (int i = 0; i < 4; ++i) fa[i] /= fb[i];
+    return Lane4::Load(fa);
+}
+inline Lane4 Sqrt(Lane4 a) {
+    float fa[4];
+    a.Store(fa);
+    for (int i = 0; i < 4; ++i) fa[i] = std::sqrt(fa[i]);
+    return Lane4::Load(fa);
+}
+inline Lane4 Floor(Lane4 a) {
+    float fa[4];
+    a.Store(fa);
+    for (int i = 0; i < 4; ++i) fa[i] = std::floor(fa[i]);
+    return Lane4::Load(fa);
+}
+#endif
+inline Lane4 Min(Lane4 a, Lane4 b) { return _Wrap4(vminq_f32(a.v, b.v)); }
+inline Lane4 Max(Lane4 a, Lane4 b) { return _Wrap4(vmaxq_f32(a.v, b.v)); }
+inline uint32_t _MoveMask(uint32x4_t m) {
+    return (vgetq_lane_u32(m, 0) & 1u) | (vgetq_lane_u32(m, 1) & 2u) |
+        (vgetq_lane_u32(m, 2) & 4u) | (vgetq_lane_u32(m, 3) & 8u);
+}
+inline uint32_t CmpGE(Lane4 a, Lane4 b) { return _MoveMask(vcgeq_f32(a.v, b.v)); }
+inline uint32_t CmpLE(Lane4 a, Lane4 b) { return _MoveMask(vcleq_f32(a.v, b.v)); }
+inline Lane4 Select(uint32_t mask, Lane4 a, Lane4 b) {
+    static const uint32_t bits[4] = {1u, 2u, 4u, 8u};
+    const uint32x4_t b4 = vld1q_u32(bits);
+    const uint32x4_t m = vceqq_u32(vandq_u32(vdupq_n_u32(mask), b4), b4);
+    return _Wrap4(vbslq_f32(m, a.v, b.v));
+}
+#endif
+
+#if !SIMD_AVX2
+#if SIMD_SSE || SIMD_NEON
+typedef Lane4 LaneN;
+#else
+typedef Lane1 LaneN;
+#endif
+#endif
+
+// Name of the widest lane type, for logging
+inline const char* LaneName()
+{
+#if SIMD_AVX2
+    return "AVX2";
+#elif SIMD_SSE
+    return "SSE";
+#elif SIMD_NEON
+    return "NEON";
+#else
+    return "Scalar";
+#endif
+}
+}
@@ -1,5 +1,12 @@
 #include "stdafx.h"
 #include "SparseVolume.h"
+#include "WorkStealingPool.h"
+#include "CPURaymarcher.h"
+#include "DensityPyramid.h"
+#include "NearFarRasterizer.h"
+#include "BrickCompaction.h"
+#include "BrickRatioTuner.h"
+#include "GradientVolume.inl"
 
 using namespace DirectX;
 using namespace Microsoft::WRL;
@@ -7,15 +14,61 @@ using namespace std;
 
 #define frand() ((float)rand()/RAND_MAX)
 namespace {
+    // CPU engine mirrors ManagedBuf's buffer enums
+    static_assert(
+        (int)CPUVolume::kStructuredBuffer == ManagedBuf::kStructuredBuffer &&
+        (int)CPUVolume::kTypedBuffer == ManagedBuf::kTypedBuffer &&
+        (int)CPUVolume::k3DTexBuffer == ManagedBuf::k3DTexBuffer &&
+        (int)CPUVolume::k16Bit == ManagedBuf::k16Bit &&
+        (int)CPUVolume::k32Bit == ManagedBuf::k32Bit,
+        "CPUVolume::BufType/BufBit out of sync with ManagedBuf");
+    static_assert(SparseVolume::kNoNormal == NORMAL_NONE &&
+        SparseVolume::kUseNormal == NORMAL_FINITE_DIFF &&
+        SparseVolume::kGradientNormal == NORMAL_GRADIENT_VOL,
+        "SparseVolume::RaycastNormal out of sync with USE_NORMAL");
+
     const DXGI_FORMAT _stepInfoTexFormat = DXGI_FORMAT_R16G16_FLOAT;
     bool _typedLoadSupported = false;
 
     bool _useStepInfoTex = false;
+    // near/far and brick grid draw the bricks compacted from _flagVol
+    // through ExecuteIndirect rather than an instance per brick
+    bool _useCompactDraw = true;
+    // uVoxelBrickRatio picked by _ratioTuner every _tuneInterval frames
+    bool _autoRatio = false;
+    int _tuneInterval = 30;
     bool _stepInfoDebug = false;
     bool _usePSUpdate = false;
     bool _isoRender = false;
     bool _useNormal = false;
+    // normals from the gradients written by the compute update
+    bool _useGradientVol = false;
     bool _writeDepth = false;
+    bool _useOccupancyPrePass = false;
+    bool _useBallGrid = false;
+    float _ballGridCullRatio = 0.02f;
+    // per brick ball lists of the _cbPerFrame balls, without the ball grid
+    bool _useBallBins = false;
+    float _ballBinCullRatio = 0.02f;
+    // ball count limit with the ball grid
+    const int _maxGridBalls = 100000;
+    bool _useIncrementalUpdate = false;
+    bool _useBrickDDA = false;
+    bool _useAdaptiveStep = false;
+    // accumulated shading skips the empty cells of a min/max pyramid built
+    // on the GPU with each update, iso surfaces guard their coarse steps with
+    // it. Not with the sampler filters
+    bool _usePyramidSkip = false;
+    // balls moving less than this (in voxels) keep their evaluated position
+    float _dirtyMoveTolerance = 0.25f;
+    // influence cut-off of the dirty region without the ball grid
+    float _dirtyCullRatio = 0.02f;
+    // progressive accumulation of still frames at full resolution
+    bool _useTemporal = false;
+    // pixels sharing a ray each frame
+    const uint _temporalDividers[] = {1, 4, 16};
+    int _temporalDividerIdx = 2;
+    int _temporalMaxSamples = 8;
 
     // define the geometry for a triangle.
     const XMFLOAT3 cubeVertices[] = {
@@ -32,19 +85,56 @@ namespace {
     const uint16_t cubeLineStripIndices[CUBE_LINESTRIP_LENGTH] = {
         0, 1, 5, 4, 0, 2, 3, 7, 6, 2, 0xffff, 6, 4, 0xffff, 7, 5, 0xffff, 3, 1
     };
+    // D3D12_DRAW_INDEXED_ARGUMENTS at BRICK_DRAW_ARGS_NEAR_FAR and
+    // BRICK_DRAW_ARGS_GRID before the compaction adds the instances
+    const uint32_t brickDrawArgs[] = {
+        CUBE_TRIANGLESTRIP_LENGTH, 0, 0, 0, 0,
+        CUBE_LINESTRIP_LENGTH, 0, 0, 0, 0
+    };
 
     std::once_flag _psoCompiled_flag;
     RootSignature _rootsig;
-    ComputePSO _cptUpdatePSO[ManagedBuf::kNumType][SparseVolume::kNumStruct];
+    // last [1]: GRADIENT_VOL
+    ComputePSO _cptUpdatePSO[ManagedBuf::kNumType][SparseVolume::kNumStruct][2];
+    // [1][]: BALL_GRID, [2][]: BALL_BINS
+    ComputePSO _cptUpdateListPSO[ManagedBuf::kNumType][3][2];
+    ComputePSO
+        _cptUpdateGridPSO[ManagedBuf::kNumType][SparseVolume::kNumStruct][2];
+    ComputePSO
+        _cptUpdateBinsPSO[ManagedBuf::kNumType][SparseVolume::kNumStruct][2];
     GraphicsPSO _gfxUpdatePSO[ManagedBuf::kNumType][SparseVolume::kNumStruct];
     GraphicsPSO _gfxVolumeRenderPSO[ManagedBuf::kNumType]
         [SparseVolume::kNumStruct][SparseVolume::kNumFilter];
+    // BRICK_DDA, kFlagVol only
+    GraphicsPSO _gfxVolumeRenderDDAPSO[ManagedBuf::kNumType]
+        [SparseVolume::kNumFilter];
     GraphicsPSO _gfxISOSurfRenderPSO
         [ManagedBuf::kNumType][SparseVolume::kNumStruct]
         [SparseVolume::kNumFilter][SparseVolume::kNumNormal][2];
+    // PYRAMID_SKIP, kNoFilter and kLinearFilter only
+    GraphicsPSO _gfxVolumeRenderPyramidPSO[ManagedBuf::kNumType]
+        [SparseVolume::kNumStruct][SparseVolume::kNumFilter];
+    GraphicsPSO _gfxISOSurfRenderPyramidPSO
+        [ManagedBuf::kNumType][SparseVolume::kNumStruct]
+        [SparseVolume::kNumFilter][SparseVolume::kNumNormal][2];
+    // ADAPTIVE_STEP
+    GraphicsPSO _gfxVolumeRenderAdaptivePSO[ManagedBuf::kNumType]
+        [SparseVolume::kNumStruct][SparseVolume::kNumFilter];
+    GraphicsPSO _gfxISOSurfRenderAdaptivePSO
+        [ManagedBuf::kNumType][SparseVolume::kNumStruct]
+        [SparseVolume::kNumFilter][SparseVolume::kNumNormal][2];
     GraphicsPSO _gfxStepInfoPSO;
+    GraphicsPSO _gfxUpsamplePSO;
+    GraphicsPSO _gfxTemporalResolvePSO;
     GraphicsPSO _gfxStepInfoDebugPSO[2];
     ComputePSO _cptFlagVolResetPSO;
+    ComputePSO _cptFlagVolResetListPSO;
+    // BRICK_LIST, drawn from the compacted bricks
+    GraphicsPSO _gfxStepInfoListPSO;
+    GraphicsPSO _gfxStepInfoDebugListPSO[2];
+    ComputePSO _cptBrickCompactPSO;
+    // [1]: BRICK_LIST, rebuilds the listed cells only
+    ComputePSO _cptPyramidPSO[ManagedBuf::kNumType][2];
     StructuredBuffer _cubeVB;
     ByteAddressBuffer _cubeTriangleStripIB;
     ByteAddressBuffer _cubeLineStripIB;
@@ -71,11 +161,37 @@ namespace {
         }
     }
 
+    // Finest ratio _flagVol and _activeBrickBuf stay allocated for, so
+    // switching to a coarser one needs no new buffers. Bricks of a single
+    // voxel (ratio 1) only get them when picked
+    inline uint _ResidentRatio(const std::vector<uint16_t>& ratios)
+    {
+        return ratios.front() > 1 || ratios.size() == 1
+            ? ratios.front() : ratios[1];
+    }
+
     inline bool _IsResolutionChanged(const uint3& a, const uint3& b)
     {
         return a.x != b.x || a.y != b.y || a.z != b.z;
     }
 
+    // Dynamic allocations can't exceed one upload page, copy larger data
+    // page by page to destOffset bytes into dest
+    void _UploadBuffer(CommandContext& cmdContext, GpuBuffer& dest,
+        const void* data, size_t size, size_t destOffset = 0)
+    {
+        const uint8_t* src = (const uint8_t*)data;
+        for (size_t offset = 0; offset < size;
+            offset += kCpuAllocatorPageSize) {
+            const size_t chunk =
+                min(size - offset, (size_t)kCpuAllocatorPageSize);
+            DynAlloc mem = cmdContext.m_CpuLinearAllocator.Allocate(chunk);
+            memcpy(mem.DataPtr, src + offset, chunk);
+            cmdContext.CopyBufferRegion(
+                dest, destOffset + offset, mem.Buffer, mem.Offset, chunk);
+        }
+    }
+
     inline HRESULT _Compile(LPCWSTR fileName, LPCSTR target,
         const D3D_SHADER_MACRO* macro, ID3DBlob** bolb)
     {
@@ -117,16 +233,35 @@ namespace {
 
         // Compile Shaders
         ComPtr<ID3DBlob>
-            volUpdateCS[ManagedBuf::kNumType][SparseVolume::kNumStruct];
-        ComPtr<ID3DBlob> cubeVS, stepInfoVS, volUpdateVS;
+            volUpdateCS[ManagedBuf::kNumType][SparseVolume::kNumStruct][2];
+        ComPtr<ID3DBlob> volUpdateListCS[ManagedBuf::kNumType][3][2];
+        ComPtr<ID3DBlob>
+            volUpdateGridCS[ManagedBuf::kNumType][SparseVolume::kNumStruct][2];
+        ComPtr<ID3DBlob>
+            volUpdateBinsCS[ManagedBuf::kNumType][SparseVolume::kNumStruct][2];
+        ComPtr<ID3DBlob> cubeVS, stepInfoVS, volUpdateVS, upsampleVS;
+        ComPtr<ID3DBlob> upsamplePS, temporalResolvePS;
         ComPtr<ID3DBlob> volUpdateGS;
         ComPtr<ID3DBlob> raycastPS[ManagedBuf::kNumType]
             [SparseVolume::kNumStruct][SparseVolume::kNumFilter];
+        ComPtr<ID3DBlob>
+            raycastDDAPS[ManagedBuf::kNumType][SparseVolume::kNumFilter];
         ComPtr<ID3DBlob>
             volUpdatePS[ManagedBuf::kNumType][SparseVolume::kNumStruct];
         ComPtr<ID3DBlob> isoRenderPS[ManagedBuf::kNumType]
             [SparseVolume::kNumStruct][SparseVolume::kNumFilter]
             [SparseVolume::kNumNormal][2];
+        ComPtr<ID3DBlob> raycastAdaptivePS[ManagedBuf::kNumType]
+            [SparseVolume::kNumStruct][SparseVolume::kNumFilter];
+        ComPtr<ID3DBlob> raycastPyramidPS[ManagedBuf::kNumType]
+            [SparseVolume::kNumStruct][SparseVolume::kNumFilter];
+        ComPtr<ID3DBlob> isoRenderPyramidPS[ManagedBuf::kNumType]
+            [SparseVolume::kNumStruct][SparseVolume::kNumFilter]
+            [SparseVolume::kNumNormal][2];
+        ComPtr<ID3DBlob> pyramidCS[ManagedBuf::kNumType][2];
+        ComPtr<ID3DBlob> isoRenderAdaptivePS[ManagedBuf::kNumType]
+            [SparseVolume::kNumStruct][SparseVolume::kNumFilter]
+            [SparseVolume::kNumNormal][2];
 
         D3D_SHADER_MACRO macro[] = {
             {"__hlsl", "1"},//0
@@ -138,6 +273,13 @@ namespace {
             {"ISO_SURFACE", "0"},//6
             {"USE_NORMAL", "0"},//7
             {"DEPTH_OUT", "0"},//8
+            {"BRICK_LIST", "0"},//9
+            {"BALL_GRID", "0"},//10
+            {"BRICK_DDA", "0"},//11
+            {"ADAPTIVE_STEP", "0"},//12
+            {"GRADIENT_VOL", "0"},//13
+            {"BALL_BINS", "0"},//14
+            {"PYRAMID_SKIP", "0"},//15
             {nullptr, nullptr}
         };
 
@@ -146,6 +288,12 @@ namespace {
             macro,&volUpdateVS));
         V(_Compile(L"SparseVolume_VolumeUpdate_gs.hlsl", "gs_5_1",
             macro,&volUpdateGS));
+        V(_Compile(L"SparseVolume_Upsample_vs.hlsl", "vs_5_1",
+            macro, &upsampleVS));
+        V(_Compile(L"SparseVolume_Upsample_ps.hlsl", "ps_5_1",
+            macro, &upsamplePS));
+        V(_Compile(L"SparseVolume_TemporalResolve_ps.hlsl", "ps_5_1",
+            macro, &temporalResolvePS));
 
         uint DefIdx;
         for (int j = 0; j < SparseVolume::kNumStruct; ++j) {
@@ -157,47 +305,132 @@ namespace {
                 case ManagedBuf::k3DTexBuffer: DefIdx = 3; break;
                 }
                 macro[DefIdx].Definition = "1";
-                V(_Compile(L"SparseVolume_VolumeUpdate_cs.hlsl", "cs_5_1",
-                    macro, &volUpdateCS[i][j]));
+                for (int g = 0; g < 2; ++g) {
+                    macro[13].Definition = g ? "1" : "0"; // GRADIENT_VOL
+                    V(_Compile(L"SparseVolume_VolumeUpdate_cs.hlsl", "cs_5_1",
+                        macro, &volUpdateCS[i][j][g]));
+                    if (j == SparseVolume::kFlagVol) {
+                        macro[9].Definition = "1"; // BRICK_LIST
+                        V(_Compile(L"SparseVolume_VolumeUpdate_cs.hlsl",
+                            "cs_5_1", macro, &volUpdateListCS[i][0][g]));
+                        macro[10].Definition = "1"; // BALL_GRID
+                        V(_Compile(L"SparseVolume_VolumeUpdate_cs.hlsl",
+                            "cs_5_1", macro, &volUpdateListCS[i][1][g]));
+                        macro[10].Definition = "0"; // BALL_GRID
+                        macro[14].Definition = "1"; // BALL_BINS
+                        V(_Compile(L"SparseVolume_VolumeUpdate_cs.hlsl",
+                            "cs_5_1", macro, &volUpdateListCS[i][2][g]));
+                        macro[14].Definition = "0"; // BALL_BINS
+                        macro[9].Definition = "0"; // BRICK_LIST
+                    }
+                    macro[10].Definition = "1"; // BALL_GRID
+                    V(_Compile(L"SparseVolume_VolumeUpdate_cs.hlsl", "cs_5_1",
+                        macro, &volUpdateGridCS[i][j][g]));
+                    macro[10].Definition = "0"; // BALL_GRID
+                    macro[14].Definition = "1"; // BALL_BINS
+                    V(_Compile(L"SparseVolume_VolumeUpdate_cs.hlsl", "cs_5_1",
+                        macro, &volUpdateBinsCS[i][j][g]));
+                    macro[14].Definition = "0"; // BALL_BINS
+                }
+                macro[13].Definition = "0"; // GRADIENT_VOL
                 V(_Compile(L"SparseVolume_VolumeUpdate_ps.hlsl", "ps_5_1",
                     macro, &volUpdatePS[i][j]));
+                if (j == SparseVolume::kVoxel) {
+                    V(_Compile(L"SparseVolume_DensityPyramid_cs.hlsl",
+                        "cs_5_1", macro, &pyramidCS[i][0]));
+                    macro[9].Definition = "1"; // BRICK_LIST
+                    V(_Compile(L"SparseVolume_DensityPyramid_cs.hlsl",
+                        "cs_5_1", macro, &pyramidCS[i][1]));
+                    macro[9].Definition = "0"; // BRICK_LIST
+                }
                 for (int k = 0; k < SparseVolume::kNumFilter; ++k) {
                     char tmp[8];
                     sprintf_s(tmp, 8, "%d", k);
                     macro[4].Definition = tmp;
                     V(_Compile(L"SparseVolume_RayCast_ps.hlsl", "ps_5_1",
                         macro, &raycastPS[i][j][(SparseVolume::FilterType)k]));
+                    if (j == SparseVolume::kFlagVol) {
+                        macro[11].Definition = "1"; // BRICK_DDA
+                        V(_Compile(L"SparseVolume_RayCast_ps.hlsl", "ps_5_1",
+                            macro, &raycastDDAPS[i][k]));
+                        macro[11].Definition = "0"; // BRICK_DDA
+                    }
+                    if (k <= SparseVolume::kLinearFilter) {
+                        macro[15].Definition = "1"; // PYRAMID_SKIP
+                        V(_Compile(L"SparseVolume_RayCast_ps.hlsl", "ps_5_1",
+                            macro, &raycastPyramidPS[i][j][k]));
+                        macro[15].Definition = "0"; // PYRAMID_SKIP
+                    }
                     macro[6].Definition = "1"; // ISO_SURFACE
-                    V(_Compile(L"SparseVolume_RayCast_ps.hlsl", "ps_5_1", macro,
-                        &isoRenderPS[i][j][(SparseVolume::FilterType)k][0][0]));
-                    macro[8].Definition = "1"; // DEPTH_OUT
-                    V(_Compile(L"SparseVolume_RayCast_ps.hlsl", "ps_5_1", macro,
-                        &isoRenderPS[i][j][(SparseVolume::FilterType)k][0][1]));
+                    for (int n = 0; n < SparseVolume::kNumNormal; ++n) {
+                        // USE_NORMAL takes the NORMAL_* value
+                        char normal[8];
+                        sprintf_s(normal, 8, "%d", n);
+                        macro[7].Definition = normal;
+                        for (int d = 0; d < 2; ++d) {
+                            macro[8].Definition = d ? "1" : "0"; // DEPTH_OUT
+                            V(_Compile(L"SparseVolume_RayCast_ps.hlsl",
+                                "ps_5_1", macro, &isoRenderPS[i][j][k][n][d]));
+                            if (k <= SparseVolume::kLinearFilter) {
+                                macro[15].Definition = "1"; // PYRAMID_SKIP
+                                V(_Compile(L"SparseVolume_RayCast_ps.hlsl",
+                                    "ps_5_1", macro,
+                                    &isoRenderPyramidPS[i][j][k][n][d]));
+                                macro[15].Definition = "0"; // PYRAMID_SKIP
+                            }
+                        }
+                    }
                     macro[8].Definition = "0"; // DEPTH_OUT
-                    macro[7].Definition = "1"; // USE_NORMAL
-                    V(_Compile(L"SparseVolume_RayCast_ps.hlsl", "ps_5_1", macro,
-                        &isoRenderPS[i][j][(SparseVolume::FilterType)k][1][0]));
-                    macro[8].Definition = "1"; // DEPTH_OUT
-                    V(_Compile(L"SparseVolume_RayCast_ps.hlsl", "ps_5_1", macro,
-                        &isoRenderPS[i][j][(SparseVolume::FilterType)k][1][1]));
+                    macro[7].Definition = "0"; // USE_NORMAL
+                    macro[6].Definition = "0"; // ISO_SURFACE
+                    macro[12].Definition = "1"; // ADAPTIVE_STEP
+                    V(_Compile(L"SparseVolume_RayCast_ps.hlsl", "ps_5_1",
+                        macro, &raycastAdaptivePS[i][j][k]));
+                    macro[6].Definition = "1"; // ISO_SURFACE
+                    for (int n = 0; n < SparseVolume::kNumNormal; ++n) {
+                        char normal[8];
+                        sprintf_s(normal, 8, "%d", n);
+                        macro[7].Definition = normal; // USE_NORMAL
+                        for (int d = 0; d < 2; ++d) {
+                            macro[8].Definition = d ? "1" : "0"; // DEPTH_OUT
+                            V(_Compile(L"SparseVolume_RayCast_ps.hlsl",
+                                "ps_5_1", macro,
+                                &isoRenderAdaptivePS[i][j][k][n][d]));
+                        }
+                    }
                     macro[8].Definition = "0"; // DEPTH_OUT
                     macro[7].Definition = "0"; // USE_NORMAL
                     macro[6].Definition = "0"; // ISO_SURFACE
+                    macro[12].Definition = "0"; // ADAPTIVE_STEP
                 }
                 macro[4].Definition = "0"; // FILTER_READ
                 macro[DefIdx].Definition = "0";
             }
         }
         // Create Rootsignature
-        _rootsig.Reset(4, 2);
+        _rootsig.Reset(13, 2);
         _rootsig.InitStaticSampler(0, Graphics::g_SamplerLinearClampDesc);
         _rootsig.InitStaticSampler(1, Graphics::g_SamplerAnisoWrapDesc);
         _rootsig[0].InitAsConstantBuffer(0);
         _rootsig[1].InitAsConstantBuffer(1);
         _rootsig[2].InitAsDescriptorRange(
-            D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 0, 2);
+            D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 0, 3);
         _rootsig[3].InitAsDescriptorRange(
             D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 0, 2);
+        _rootsig[4].InitAsBufferSRV(2);
+        // BALL_GRID buffers, BALL_BINS takes the first two
+        _rootsig[5].InitAsDescriptorRange(
+            D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, SparseVolume::kNumBallGridBuf);
+        _rootsig[6].InitAsBufferSRV(7);
+        _rootsig[7].InitAsDescriptorRange(
+            D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 8, 1);
+        _rootsig[8].InitAsBufferSRV(9);
+        _rootsig[9].InitAsDescriptorRange(
+            D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 10, 2);
+        _rootsig[10].InitAsDescriptorRange(
+            D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 12, 1);
+        _rootsig[11].InitAsBufferUAV(3);
+        _rootsig[12].InitAsBufferSRV(13);
         _rootsig.Finalize(L"SparseVolume",
             D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT |
             D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
@@ -234,42 +467,97 @@ namespace {
                     _gfxVolumeRenderPSO[i][k][j].SetVertexShader(
                         cubeVS->GetBufferPointer(), cubeVS->GetBufferSize());
 
-                    _gfxISOSurfRenderPSO[i][k][j][0][0] =
+                    for (int n = 0; n < SparseVolume::kNumNormal; ++n) {
+                        for (int d = 0; d < 2; ++d) {
+                            GraphicsPSO& pso =
+                                _gfxISOSurfRenderPSO[i][k][j][n][d];
+                            pso = _gfxVolumeRenderPSO[i][k][j];
+                            pso.SetPixelShader(
+                                isoRenderPS[i][k][j][n][d]->GetBufferPointer(),
+                                isoRenderPS[i][k][j][n][d]->GetBufferSize());
+                            pso.Finalize();
+                        }
+                    }
+                    for (int n = 0; n < SparseVolume::kNumNormal; ++n) {
+                        for (int d = 0; d < 2; ++d) {
+                            GraphicsPSO& pso =
+                                _gfxISOSurfRenderAdaptivePSO[i][k][j][n][d];
+                            pso = _gfxVolumeRenderPSO[i][k][j];
+                            pso.SetPixelShader(
+                                isoRenderAdaptivePS[i][k][j][n][d]
+                                ->GetBufferPointer(),
+                                isoRenderAdaptivePS[i][k][j][n][d]
+                                ->GetBufferSize());
+                            pso.Finalize();
+                        }
+                    }
+                    _gfxVolumeRenderAdaptivePSO[i][k][j] =
                         _gfxVolumeRenderPSO[i][k][j];
-                    _gfxISOSurfRenderPSO[i][k][j][0][0].SetPixelShader(
-                        isoRenderPS[i][k][j][0][0]->GetBufferPointer(),
-                        isoRenderPS[i][k][j][0][0]->GetBufferSize());
-                    _gfxISOSurfRenderPSO[i][k][j][0][0].Finalize();
-                    _gfxISOSurfRenderPSO[i][k][j][0][1] =
-                        _gfxVolumeRenderPSO[i][k][j];
-                    _gfxISOSurfRenderPSO[i][k][j][0][1].SetPixelShader(
-                        isoRenderPS[i][k][j][0][1]->GetBufferPointer(),
-                        isoRenderPS[i][k][j][0][1]->GetBufferSize());
-                    _gfxISOSurfRenderPSO[i][k][j][0][1].Finalize();
+                    _gfxVolumeRenderAdaptivePSO[i][k][j].SetPixelShader(
+                        raycastAdaptivePS[i][k][j]->GetBufferPointer(),
+                        raycastAdaptivePS[i][k][j]->GetBufferSize());
+                    _gfxVolumeRenderAdaptivePSO[i][k][j].Finalize();
 
-                    _gfxISOSurfRenderPSO[i][k][j][1][0] =
-                        _gfxVolumeRenderPSO[i][k][j];
-                    _gfxISOSurfRenderPSO[i][k][j][1][0].SetPixelShader(
-                        isoRenderPS[i][k][j][1][0]->GetBufferPointer(),
-                        isoRenderPS[i][k][j][1][0]->GetBufferSize());
-                    _gfxISOSurfRenderPSO[i][k][j][1][0].Finalize();
-                    _gfxISOSurfRenderPSO[i][k][j][1][1] =
-                        _gfxVolumeRenderPSO[i][k][j];
-                    _gfxISOSurfRenderPSO[i][k][j][1][1].SetPixelShader(
-                        isoRenderPS[i][k][j][1][1]->GetBufferPointer(),
-                        isoRenderPS[i][k][j][1][1]->GetBufferSize());
-                    _gfxISOSurfRenderPSO[i][k][j][1][1].Finalize();
+                    if (j <= SparseVolume::kLinearFilter) {
+                        _gfxVolumeRenderPyramidPSO[i][k][j] =
+                            _gfxVolumeRenderPSO[i][k][j];
+                        _gfxVolumeRenderPyramidPSO[i][k][j].SetPixelShader(
+                            raycastPyramidPS[i][k][j]->GetBufferPointer(),
+                            raycastPyramidPS[i][k][j]->GetBufferSize());
+                        _gfxVolumeRenderPyramidPSO[i][k][j].Finalize();
+                        for (int n = 0; n < SparseVolume::kNumNormal; ++n) {
+                            for (int d = 0; d < 2; ++d) {
+                                GraphicsPSO& pso =
+                                    _gfxISOSurfRenderPyramidPSO[i][k][j][n][d];
+                                pso = _gfxVolumeRenderPSO[i][k][j];
+                                pso.SetPixelShader(
+                                    isoRenderPyramidPS[i][k][j][n][d]
+                                    ->GetBufferPointer(),
+                                    isoRenderPyramidPS[i][k][j][n][d]
+                                    ->GetBufferSize());
+                                pso.Finalize();
+                            }
+                        }
+                    }
 
+                    if (k == SparseVolume::kFlagVol) {
+                        _gfxVolumeRenderDDAPSO[i][j] =
+                            _gfxVolumeRenderPSO[i][k][j];
+                        _gfxVolumeRenderDDAPSO[i][j].SetPixelShader(
+                            raycastDDAPS[i][j]->GetBufferPointer(),
+                            raycastDDAPS[i][j]->GetBufferSize());
+                        _gfxVolumeRenderDDAPSO[i][j].Finalize();
+                    }
                     _gfxVolumeRenderPSO[i][k][j].SetPixelShader(
                         raycastPS[i][k][j]->GetBufferPointer(),
                         raycastPS[i][k][j]->GetBufferSize());
                     _gfxVolumeRenderPSO[i][k][j].Finalize();
                 }
-                _cptUpdatePSO[i][k].SetRootSignature(_rootsig);
-                _cptUpdatePSO[i][k].SetComputeShader(
-                    volUpdateCS[i][k]->GetBufferPointer(),
-                    volUpdateCS[i][k]->GetBufferSize());
-                _cptUpdatePSO[i][k].Finalize();
+                for (int n = 0; n < 2; ++n) {
+                    _cptUpdatePSO[i][k][n].SetRootSignature(_rootsig);
+                    _cptUpdatePSO[i][k][n].SetComputeShader(
+                        volUpdateCS[i][k][n]->GetBufferPointer(),
+                        volUpdateCS[i][k][n]->GetBufferSize());
+                    _cptUpdatePSO[i][k][n].Finalize();
+                    _cptUpdateGridPSO[i][k][n].SetRootSignature(_rootsig);
+                    _cptUpdateGridPSO[i][k][n].SetComputeShader(
+                        volUpdateGridCS[i][k][n]->GetBufferPointer(),
+                        volUpdateGridCS[i][k][n]->GetBufferSize());
+                    _cptUpdateGridPSO[i][k][n].Finalize();
+                    _cptUpdateBinsPSO[i][k][n].SetRootSignature(_rootsig);
+                    _cptUpdateBinsPSO[i][k][n].SetComputeShader(
+                        volUpdateBinsCS[i][k][n]->GetBufferPointer(),
+                        volUpdateBinsCS[i][k][n]->GetBufferSize());
+                    _cptUpdateBinsPSO[i][k][n].Finalize();
+                    for (int g = 0; k == SparseVolume::kFlagVol && g < 3;
+                        ++g) {
+                        _cptUpdateListPSO[i][g][n].SetRootSignature(_rootsig);
+                        _cptUpdateListPSO[i][g][n].SetComputeShader(
+                            volUpdateListCS[i][g][n]->GetBufferPointer(),
+                            volUpdateListCS[i][g][n]->GetBufferSize());
+                        _cptUpdateListPSO[i][g][n].Finalize();
+                    }
+                }
 
                 _gfxUpdatePSO[i][k].SetRootSignature(_rootsig);
                 _gfxUpdatePSO[i][k].SetInputLayout(
@@ -297,15 +585,50 @@ namespace {
             }
         }
 
+        // Create PSO for upsampling the low resolution raycast
+        _gfxUpsamplePSO.SetRootSignature(_rootsig);
+        _gfxUpsamplePSO.SetInputLayout(0, nullptr);
+        _gfxUpsamplePSO.SetRasterizerState(Graphics::g_RasterizerTwoSided);
+        _gfxUpsamplePSO.SetBlendState(Graphics::g_BlendDisable);
+        _gfxUpsamplePSO.SetDepthStencilState(Graphics::g_DepthStateReadWrite);
+        _gfxUpsamplePSO.SetSampleMask(UINT_MAX);
+        _gfxUpsamplePSO.SetPrimitiveTopologyType(
+            D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE);
+        _gfxUpsamplePSO.SetRenderTargetFormats(1, &ColorFormat, DepthFormat);
+        _gfxUpsamplePSO.SetVertexShader(
+            upsampleVS->GetBufferPointer(), upsampleVS->GetBufferSize());
+        _gfxUpsamplePSO.SetPixelShader(
+            upsamplePS->GetBufferPointer(), upsamplePS->GetBufferSize());
+        _gfxUpsamplePSO.Finalize();
+
+        // Create PSO for the temporal resolve, writes the history as well
+        const DXGI_FORMAT resolveFormats[] = {ColorFormat,
+            DXGI_FORMAT_R16G16B16A16_FLOAT, DXGI_FORMAT_R32_FLOAT};
+        _gfxTemporalResolvePSO = _gfxUpsamplePSO;
+        _gfxTemporalResolvePSO.SetRenderTargetFormats(
+            _countof(resolveFormats), resolveFormats, DepthFormat);
+        _gfxTemporalResolvePSO.SetPixelShader(
+            temporalResolvePS->GetBufferPointer(),
+            temporalResolvePS->GetBufferSize());
+        _gfxTemporalResolvePSO.Finalize();
+
         // Create PSO for render near far plane
-        ComPtr<ID3DBlob> stepInfoPS, stepInfoDebugPS, resetCS;
+        ComPtr<ID3DBlob> stepInfoPS, stepInfoDebugPS, resetCS, resetListCS;
+        ComPtr<ID3DBlob> stepInfoListVS, compactCS;
         D3D_SHADER_MACRO macro1[] = {
             {"__hlsl", "1"},
             {"DEBUG_VIEW", "0"},
+            {"BRICK_LIST", "0"},
             {nullptr, nullptr}
         };
         V(_Compile(L"SparseVolume_StepInfo_cs.hlsl", "cs_5_1",
             macro1, &resetCS));
+        macro1[2].Definition = "1"; // BRICK_LIST
+        V(_Compile(L"SparseVolume_StepInfo_cs.hlsl", "cs_5_1",
+            macro1, &resetListCS));
+        V(_Compile(L"SparseVolume_StepInfo_vs.hlsl", "vs_5_1",
+            macro1, &stepInfoListVS));
+        macro1[2].Definition = "0"; // BRICK_LIST
         V(_Compile(L"SparseVolume_StepInfo_ps.hlsl", "ps_5_1",
             macro1, &stepInfoPS));
         V(_Compile(L"SparseVolume_StepInfo_vs.hlsl", "vs_5_1",
@@ -319,6 +642,29 @@ namespace {
         _cptFlagVolResetPSO.SetComputeShader(
             resetCS->GetBufferPointer(), resetCS->GetBufferSize());
         _cptFlagVolResetPSO.Finalize();
+        _cptFlagVolResetListPSO.SetRootSignature(_rootsig);
+        _cptFlagVolResetListPSO.SetComputeShader(
+            resetListCS->GetBufferPointer(), resetListCS->GetBufferSize());
+        _cptFlagVolResetListPSO.Finalize();
+
+        // Create PSO for brick compaction
+        V(_Compile(L"SparseVolume_BrickCompact_cs.hlsl", "cs_5_1",
+            macro1, &compactCS));
+        _cptBrickCompactPSO.SetRootSignature(_rootsig);
+        _cptBrickCompactPSO.SetComputeShader(
+            compactCS->GetBufferPointer(), compactCS->GetBufferSize());
+        _cptBrickCompactPSO.Finalize();
+
+        // Create PSO for the density pyramid build
+        for (int i = 0; i < ManagedBuf::kNumType; ++i) {
+            for (int l = 0; l < 2; ++l) {
+                _cptPyramidPSO[i][l].SetRootSignature(_rootsig);
+                _cptPyramidPSO[i][l].SetComputeShader(
+                    pyramidCS[i][l]->GetBufferPointer(),
+                    pyramidCS[i][l]->GetBufferSize());
+                _cptPyramidPSO[i][l].Finalize();
+            }
+        }
 
         _gfxStepInfoPSO.SetRootSignature(_rootsig);
         _gfxStepInfoPSO.SetPrimitiveRestart(
@@ -366,6 +712,17 @@ namespace {
             Graphics::g_DepthStateReadOnly);
         _gfxStepInfoDebugPSO[1].Finalize();
         _gfxStepInfoDebugPSO[0].Finalize();
+        _gfxStepInfoListPSO = _gfxStepInfoPSO;
+        _gfxStepInfoListPSO.SetVertexShader(stepInfoListVS->GetBufferPointer(),
+            stepInfoListVS->GetBufferSize());
+        _gfxStepInfoListPSO.Finalize();
+        for (int i = 0; i < 2; ++i) {
+            _gfxStepInfoDebugListPSO[i] = _gfxStepInfoDebugPSO[i];
+            _gfxStepInfoDebugListPSO[i].SetVertexShader(
+                stepInfoListVS->GetBufferPointer(),
+                stepInfoListVS->GetBufferSize());
+            _gfxStepInfoDebugListPSO[i].Finalize();
+        }
 
         const uint32_t vertexBufferSize = sizeof(cubeVertices);
         _cubeVB.Create(L"Vertex Buffer", ARRAYSIZE(cubeVertices),
@@ -390,7 +747,12 @@ SparseVolume::SparseVolume()
     _volParam->fMinDensity = 0.8f;
     _volParam->fVoxelSize = 1.f / 256.f;
     _ratioIdx = 0;
-    _cbPerCall.uNumOfBalls = 20;
+    _numOfBalls = 20;
+    _cbPerCall.uNumOfBalls = _numOfBalls;
+    _cbPerCall.fStepScale = 1.f;
+    _cbPerCall.uTransferMode = TRANSFER_POLYNOMIAL;
+    _cbPerCall.fIsoStepScale = 1.f;
+    _cbPerCall.uIsoRefineSteps = 0;
 }
 
 SparseVolume::~SparseVolume()
@@ -412,7 +774,17 @@ SparseVolume::OnCreateResource()
     _volParam->uVoxelBrickRatio = _ratios[_ratioIdx];
     
     // Create Spacial Structure Buffer
-    _CreateBrickVolume(reso, _ratios[_ratioIdx]);
+    _CreateBrickVolume(reso,
+        min<uint>(_ratios[_ratioIdx], _ResidentRatio(_ratios)));
+    const uint32_t emptySlot = BRICK_POOL_EMPTY;
+    _brickSlotBufSize = 1;
+    _brickSlotBuf.Create(L"BrickPool Slots", 1, sizeof(uint32_t), &emptySlot);
+    _brickDrawArgs.Create(L"Brick DrawArgs", _countof(brickDrawArgs),
+        sizeof(uint32_t), brickDrawArgs);
+    _transferLUT.Update(*_volParam);
+    const std::vector<float>& lut = _transferLUT.GetData();
+    _transferLUTBuf.Create(L"Transfer LUT", (uint32_t)lut.size(),
+        sizeof(float), lut.data());
 
     for (int i = 0; i < MAX_BALLS; ++i) {
         _AddBall();
@@ -425,11 +797,38 @@ void
 SparseVolume::OnDestory()
 {
     _volBuf.Destory();
+    // the GPU idled before
+    _retiredResources.ReleaseAll();
     _flagVol.Destroy();
+    _activeBrickBuf.Destroy();
+    _brickDrawArgs.Destroy();
+    _gradientVol.Destroy();
+    _gradientReso = uint3(0, 0, 0);
+    _gradientVolValid = false;
     _stepInfoTex.Destroy();
+    _raycastColor.Destroy();
+    _raycastDepth.Destroy();
+    for (int i = 0; i < 2; ++i) {
+        _historyColor[i].Destroy();
+        _historyDepth[i].Destroy();
+    }
     _cubeVB.Destroy();
     _cubeTriangleStripIB.Destroy();
     _cubeLineStripIB.Destroy();
+    for (int i = 0; i < kNumBallGridBuf; ++i) {
+        _ballGridBuf[i].Destroy();
+        _ballGridBufSize[i] = 0;
+    }
+    for (int i = 0; i < kNumBallBinBuf; ++i) {
+        _ballBinBuf[i].Destroy();
+        _ballBinBufSize[i] = 0;
+    }
+    _brickSlotBuf.Destroy();
+    _brickSlotBufSize = 0;
+    _pyramidBuf.Destroy();
+    _pyramidBufSize = 0;
+    _pyramidValid = false;
+    _transferLUTBuf.Destroy();
 }
 
 void
@@ -439,20 +838,53 @@ SparseVolume::OnResize()
     // Create MinMax Buffer
     _stepInfoTex.Create(L"StepInfoTex", Graphics::g_SceneColorBuffer.GetWidth(),
         Graphics::g_SceneColorBuffer.GetHeight(), 0, _stepInfoTexFormat);
+    // full size, so switching the render scale needs no new targets
+    _raycastColor.Destroy();
+    _raycastDepth.Destroy();
+    _raycastColor.Create(L"RaycastColor",
+        Graphics::g_SceneColorBuffer.GetWidth(),
+        Graphics::g_SceneColorBuffer.GetHeight(), 1,
+        Graphics::g_SceneColorBuffer.GetFormat());
+    _raycastDepth.Create(L"RaycastDepth",
+        Graphics::g_SceneColorBuffer.GetWidth(),
+        Graphics::g_SceneColorBuffer.GetHeight(),
+        Graphics::g_SceneDepthBuffer.GetFormat());
+    for (int i = 0; i < 2; ++i) {
+        _historyColor[i].Destroy();
+        _historyDepth[i].Destroy();
+        _historyColor[i].Create(L"HistoryColor",
+            Graphics::g_SceneColorBuffer.GetWidth(),
+            Graphics::g_SceneColorBuffer.GetHeight(), 1,
+            DXGI_FORMAT_R16G16B16A16_FLOAT);
+        _historyDepth[i].Create(L"HistoryDepth",
+            Graphics::g_SceneColorBuffer.GetWidth(),
+            Graphics::g_SceneColorBuffer.GetHeight(), 1,
+            DXGI_FORMAT_R32_FLOAT);
+    }
+    _temporal.Reset();
 }
 
 void
 SparseVolume::OnUpdate()
 {
+    _retiredResources.Release([](uint64_t fenceValue) {
+        return Graphics::g_cmdListMngr.IsFenceComplete(fenceValue);
+    });
     ManagedBuf::BufInterface newBufInterface = _volBuf.GetResource();
-    _needVolumeRebuild = _curBufInterface.resource != newBufInterface.resource; 
+    _needVolumeRebuild = _curBufInterface.resource != newBufInterface.resource ||
+        _curBufInterface.layout != newBufInterface.layout;
     _curBufInterface = newBufInterface;
+    _cbPerCall.uVoxelLayout = _curBufInterface.layout;
 
     const uint3& reso = _volBuf.GetReso();
     if (_IsResolutionChanged(reso, _curReso)) {
         _curReso = reso;
         _UpdateVolumeSettings(reso);
-        _CreateBrickVolume(reso, _ratios[_ratioIdx]);
+        _CreateBrickVolume(reso,
+            min<uint>(_ratios[_ratioIdx], _ResidentRatio(_ratios)));
+    }
+    if (_useGradientVol && _IsResolutionChanged(reso, _gradientReso)) {
+        _CreateGradientVolume(reso);
     }
 }
 
@@ -461,7 +893,17 @@ SparseVolume::OnRender(CommandContext& cmdContext, const DirectX::XMMATRIX& wvp,
     const DirectX::XMMATRIX& mView, const DirectX::XMFLOAT4& eyePos)
 {
     static bool usePS = _usePSUpdate;
+    // the gradients only get written along with the density, by the compute
+    // update
+    const bool gradientVol = _useGradientVol && _isoRender && _useNormal &&
+        !usePS;
+    _needVolumeRebuild |= gradientVol && !_gradientVolValid;
+    const bool pyramid = _usePyramidSkip && _filterType <= kLinearFilter;
+    _needVolumeRebuild |= pyramid && !_pyramidValid;
     _UpdatePerFrameData(wvp, mView, eyePos);
+    if (_autoRatio && _useStepInfoTex) {
+        _TuneBrickRatio();
+    }
 
     cmdContext.BeginResourceTransition(Graphics::g_SceneColorBuffer,
         D3D12_RESOURCE_STATE_RENDER_TARGET);
@@ -469,6 +911,77 @@ SparseVolume::OnRender(CommandContext& cmdContext, const DirectX::XMMATRIX& wvp,
         D3D12_RESOURCE_STATE_DEPTH_WRITE);
 
     if (_isAnimated || _needVolumeRebuild) {
+        if (_needVolumeRebuild) {
+            _occupancy.Invalidate();
+            _dirtyTracker.Invalidate();
+            _brickPool.Invalidate();
+        }
+        if (_useBallGrid) {
+            _ballGrid.Update(*_volParam, THREAD_X, _ballGridCullRatio);
+            _cbPerCall.u3BallGridReso = _ballGrid.GetGridReso();
+            _cbPerCall.uBallGridCellSize = _ballGrid.GetCellSize();
+            _UploadBallGrid(cmdContext);
+        } else if (_useBallBins && !usePS) {
+            _ballBins.Build(_cbPerFrame, _cbPerCall, _ballBinCullRatio);
+            _UploadBallBins(cmdContext);
+        }
+        _dirtyListUpdate = false;
+        _brickPoolUpdate = _curBufInterface.layout == ManagedBuf::kBrickPool &&
+            _curBufInterface.type != ManagedBuf::k3DTexBuffer && !usePS;
+        if (_brickPoolUpdate) {
+            // the pool only holds the occupied bricks, so only those get
+            // updated, every frame as the occupancy moves
+            _dirtyTracker.Invalidate();
+            _occupancy.Build(_cbPerFrame, _cbPerCall);
+            const std::vector<uint32_t>& bricks = _occupancy.GetOccupiedBricks();
+            _brickPool.Update(bricks, _occupancy.GetBrickCount());
+            const uint ratio = _volParam->uVoxelBrickRatio;
+            _volBuf.SetPoolSize(
+                (uint32_t)_brickPool.GetCapacity() * ratio * ratio * ratio);
+            BrickOccupancy::GetDispatchGroups(bricks, _volParam->u3VoxelReso,
+                ratio, _activeGroups);
+            _UploadBrickSlots(cmdContext);
+        } else if (_useStepInfoTex && _useIncrementalUpdate && !usePS) {
+            _dirtyTracker.Update(_useBallGrid
+                ? _ballGrid.f4Balls.data() : _cbPerFrame.f4Balls,
+                _useBallGrid ? _numOfBalls : _cbPerCall.uNumOfBalls,
+                *_volParam, _useBallGrid ? _ballGridCullRatio
+                : _useBallBins ? _ballBinCullRatio : _dirtyCullRatio,
+                _dirtyMoveTolerance);
+            const std::vector<uint32_t>& bricks =
+                _dirtyTracker.GetDirtyBricks();
+            // Past half the volume (or a full upload page of brick indices)
+            // the plain full update is cheaper
+            _dirtyListUpdate =
+                bricks.size() * 2 <= _dirtyTracker.GetBrickCount() &&
+                bricks.size() * sizeof(uint32_t) <= kCpuAllocatorPageSize;
+            if (_dirtyListUpdate) {
+                BrickOccupancy::GetDispatchGroups(bricks,
+                    _volParam->u3VoxelReso, _volParam->uVoxelBrickRatio,
+                    _activeGroups);
+            }
+        } else {
+            // volume gets updated behind the tracker's back
+            _dirtyTracker.Invalidate();
+            if (_useStepInfoTex && _useOccupancyPrePass && !_useBallGrid &&
+                !usePS) {
+                _occupancy.Build(_cbPerFrame, _cbPerCall);
+                _occupancy.GetDispatchGroups(_activeGroups);
+            }
+        }
+        _adaptiveStepValid = !_brickPoolUpdate && !_useBallGrid &&
+            !_useBallBins && !(_useStepInfoTex &&
+            (_useOccupancyPrePass || _useIncrementalUpdate));
+        // wait for the layout switch to reach _curBufInterface first
+        if (_volBuf.NeedsReallocate() &&
+            _volBuf.GetLayout() == _curBufInterface.layout) {
+            // finish the split barrier of last frame before the buffer goes,
+            // the submit of that barrier is the last use to retire it after
+            cmdContext.TransitionResource(*_curBufInterface.resource,
+                D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+            _volBuf.Reallocate(_curBufInterface, _retiredResources,
+                cmdContext.Flush());
+        }
         ComputeContext& cptContext = cmdContext.GetComputeContext();
         if (_useStepInfoTex) {
             cptContext.TransitionResource(_flagVol,
@@ -481,15 +994,45 @@ SparseVolume::OnRender(CommandContext& cmdContext, const DirectX::XMMATRIX& wvp,
             usePS && _curBufInterface.type == ManagedBuf::k3DTexBuffer
             ? D3D12_RESOURCE_STATE_RENDER_TARGET
             : D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+        _gradientVolValid = gradientVol;
+        if (_gradientVolValid) {
+            cmdContext.TransitionResource(_gradientVol,
+                D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+        }
         _UpdateVolume(cmdContext, _curBufInterface, usePS);
+        if (_useStepInfoTex && _useCompactDraw) {
+            cmdContext.TransitionResource(_flagVol,
+                D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+            _CompactBricks(cmdContext.GetComputeContext());
+        }
+        // a dirty list update leaves the voxels outside _activeGroups as
+        // the last build saw them
+        const bool pyramidUpdate = _pyramidValid && _dirtyListUpdate;
+        _pyramidValid = pyramid;
+        if (_pyramidValid) {
+            cmdContext.TransitionResource(*_curBufInterface.resource,
+                D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+            _BuildPyramid(cmdContext.GetComputeContext(), _curBufInterface,
+                pyramidUpdate);
+            cmdContext.BeginResourceTransition(_pyramidBuf,
+                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+        }
         cmdContext.BeginResourceTransition(*_curBufInterface.resource,
             D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+        if (_gradientVolValid) {
+            cmdContext.BeginResourceTransition(_gradientVol,
+                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+        }
         if (_useStepInfoTex) {
+            // read by the near/far VS and the BRICK_DDA raycast PS
             cmdContext.BeginResourceTransition(_flagVol,
-                D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+                D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE |
+                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
         }
     }
 
+    _UploadTransferLUT(cmdContext);
+
     GraphicsContext& gfxContext = cmdContext.GetGraphicsContext();
     gfxContext.TransitionResource(Graphics::g_SceneColorBuffer,
         D3D12_RESOURCE_STATE_RENDER_TARGET);
@@ -504,19 +1047,57 @@ SparseVolume::OnRender(CommandContext& cmdContext, const DirectX::XMMATRIX& wvp,
     
     gfxContext.ClearColor(Graphics::g_SceneColorBuffer);
     gfxContext.ClearDepth(Graphics::g_SceneDepthBuffer);
-    
+
+    // near/far and raycast go to the top left 1/uRenderScale of the targets
+    const bool lowRes = _renderScale != kFullRes;
+    _cbPerCall.uRenderScale = 1u << _renderScale;
+    // accumulate while only the camera moves, the history starts over when
+    // the shader permutation changes (the constant buffers hold the rest)
+    const bool temporal = _useTemporal && !_isAnimated && !lowRes;
+    static uint lastPermutation = 0;
+    const uint permutation = _isoRender | _useNormal << 1 |
+        _useStepInfoTex << 2 | _useBrickDDA << 3 |
+        (_useAdaptiveStep && _adaptiveStepValid) << 4 |
+        _filterType << 5 | _curBufInterface.type << 8 |
+        (_useGradientVol && _gradientVolValid) << 10 |
+        (_usePyramidSkip && _pyramidValid) << 11;
+    _temporal.SetRayDivider(
+        temporal ? _temporalDividers[_temporalDividerIdx] : 0);
+    _temporal.SetMaxSamples(_temporalMaxSamples);
+    _temporal.BeginFrame(_cbPerFrame, _cbPerCall,
+        _needVolumeRebuild || permutation != lastPermutation);
+    lastPermutation = permutation;
+    D3D12_VIEWPORT viewport = Graphics::g_DisplayPlaneViewPort;
+    D3D12_RECT scissor = Graphics::g_DisplayPlaneScissorRect;
+    if (lowRes || temporal) {
+        gfxContext.TransitionResource(_raycastColor,
+            D3D12_RESOURCE_STATE_RENDER_TARGET);
+        gfxContext.TransitionResource(_raycastDepth,
+            D3D12_RESOURCE_STATE_DEPTH_WRITE, true);
+        gfxContext.ClearColor(_raycastColor);
+        gfxContext.ClearDepth(_raycastDepth);
+    }
+    if (lowRes) {
+        // fractional, pixel centers stay where the upsample expects them
+        viewport.Width /= _cbPerCall.uRenderScale;
+        viewport.Height /= _cbPerCall.uRenderScale;
+        scissor.right = (LONG)ceil(viewport.Width);
+        scissor.bottom = (LONG)ceil(viewport.Height);
+    }
+
     gfxContext.SetRootSignature(_rootsig);
     gfxContext.SetDynamicConstantBufferView(
         0, sizeof(_cbPerFrame), (void*)&_cbPerFrame);
     gfxContext.SetDynamicConstantBufferView(
         1, sizeof(_cbPerCall), (void*)&_cbPerCall);
-    gfxContext.SetViewport(Graphics::g_DisplayPlaneViewPort);
-    gfxContext.SetScisor(Graphics::g_DisplayPlaneScissorRect);
+    gfxContext.SetViewport(viewport);
+    gfxContext.SetScisor(scissor);
     gfxContext.SetVertexBuffer(0, _cubeVB.VertexBufferView());
     
     if (_useStepInfoTex) {
         gfxContext.TransitionResource(_flagVol,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE |
+            D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
         _RenderNearFar(gfxContext);
         gfxContext.TransitionResource(_stepInfoTex,
             D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
@@ -524,7 +1105,23 @@ SparseVolume::OnRender(CommandContext& cmdContext, const DirectX::XMMATRIX& wvp,
     
     gfxContext.TransitionResource(*_curBufInterface.resource,
         D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-    _RenderVolume(gfxContext, _curBufInterface);
+    // a converged history has nothing left to trace
+    if (!_temporal.IsConverged()) {
+        _RenderVolume(gfxContext, _curBufInterface);
+    }
+    if (lowRes || temporal) {
+        gfxContext.SetViewport(Graphics::g_DisplayPlaneViewPort);
+        gfxContext.SetScisor(Graphics::g_DisplayPlaneScissorRect);
+        gfxContext.TransitionResource(_raycastColor,
+            D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+        gfxContext.TransitionResource(_raycastDepth,
+            D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+        if (temporal) {
+            _ResolveTemporal(gfxContext);
+        } else {
+            _UpsampleVolume(gfxContext);
+        }
+    }
     usePS = _usePSUpdate;
     gfxContext.BeginResourceTransition(*_curBufInterface.resource,
         usePS && _curBufInterface.type == ManagedBuf::k3DTexBuffer
@@ -553,14 +1150,105 @@ SparseVolume::RenderGui()
         }
         ImGui::SameLine();
         ImGui::Checkbox("Debug", &_stepInfoDebug);
+        if (_useStepInfoTex) {
+            ImGui::SameLine();
+            if (ImGui::Checkbox("Occupancy PrePass", &_useOccupancyPrePass)) {
+                _needVolumeRebuild |= true;
+            }
+            if (_useOccupancyPrePass && !_useIncrementalUpdate) {
+                ImGui::Text("Active bricks: %d/%d",
+                    (int)_occupancy.GetOccupiedBricks().size(),
+                    (int)_occupancy.GetBrickCount());
+            }
+            if (!_isoRender) {
+                ImGui::SameLine();
+                ImGui::Checkbox("Brick DDA", &_useBrickDDA);
+            }
+            if (ImGui::Checkbox("Compact Draw", &_useCompactDraw)) {
+                // the list gets compacted along with the update
+                _needVolumeRebuild |= true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Checkbox("Incremental Update",
+                &_useIncrementalUpdate)) {
+                _needVolumeRebuild |= true;
+            }
+            if (_useIncrementalUpdate) {
+                ImGui::SameLine();
+                ImGui::SliderFloat("Move Tolerance", &_dirtyMoveTolerance,
+                    0.f, 2.f, "%.2f voxel");
+                if (!_useBallGrid && !_useBallBins &&
+                    ImGui::SliderFloat("Dirty Cull Ratio",
+                    &_dirtyCullRatio, 0.005f, 0.25f, "%.3f")) {
+                    _needVolumeRebuild |= true;
+                }
+                ImGui::Text("Dirty bricks: %d/%d (%d balls moved)%s",
+                    (int)_dirtyTracker.GetDirtyBricks().size(),
+                    (int)_dirtyTracker.GetBrickCount(),
+                    (int)_dirtyTracker.GetMovedBalls(),
+                    _dirtyListUpdate ? "" : " full update");
+            }
+        }
         ImGui::Checkbox("Use PS Update", &_usePSUpdate);
+        if (ImGui::Checkbox("Ball Grid", &_useBallGrid)) {
+            _numOfBalls = _useBallGrid ? _numOfBalls : min(_numOfBalls,
+                (uint)MAX_BALLS);
+            _useBallBins &= !_useBallGrid;
+            _needVolumeRebuild |= true;
+        }
+        if (_useBallGrid) {
+            // the PS update only knows the balls in _cbPerFrame
+            _usePSUpdate = false;
+            ImGui::SameLine();
+            if (ImGui::SliderFloat("Cull Ratio", &_ballGridCullRatio,
+                0.005f, 0.25f, "%.3f")) {
+                _needVolumeRebuild |= true;
+            }
+        } else {
+            ImGui::SameLine();
+            if (ImGui::Checkbox("Ball Bins", &_useBallBins)) {
+                _needVolumeRebuild |= true;
+            }
+            if (_useBallBins) {
+                ImGui::SameLine();
+                if (ImGui::SliderFloat("Bin Cull Ratio", &_ballBinCullRatio,
+                    0.005f, 0.25f, "%.3f")) {
+                    _needVolumeRebuild |= true;
+                }
+            }
+        }
 
+        // the pyramid, then Brick DDA, take precedence for accumulated
+        // shading, iso surfaces take the pyramid guard over the adaptive step
+        ImGui::Checkbox("Adaptive Step", &_useAdaptiveStep);
+        ImGui::SameLine();
+        ImGui::Checkbox("Pyramid Skip", &_usePyramidSkip);
+        if (_useAdaptiveStep && !_adaptiveStepValid) {
+            ImGui::Text("Adaptive Step off with culled or partial updates");
+        }
         ImGui::Checkbox("ISOSurface", &_isoRender);
         if (_isoRender) {
             ImGui::SameLine();
             ImGui::Checkbox("Use Normal", &_useNormal);
+            if (_useNormal) {
+                ImGui::SameLine();
+                ImGui::Checkbox("Gradient Volume", &_useGradientVol);
+            }
             ImGui::SameLine();
             ImGui::Checkbox("WriteDepth", &_writeDepth);
+            ImGui::SliderFloat("Iso Step Scale", &_cbPerCall.fIsoStepScale,
+                1.f, 4.f, "%.1f");
+            ImGui::SliderInt("Refine Steps",
+                (int*)&_cbPerCall.uIsoRefineSteps, 0, 8);
+        } else {
+            ImGui::RadioButton("Polynomial", (int*)&_cbPerCall.uTransferMode,
+                TRANSFER_POLYNOMIAL); ImGui::SameLine();
+            ImGui::RadioButton("LUT", (int*)&_cbPerCall.uTransferMode,
+                TRANSFER_LUT); ImGui::SameLine();
+            ImGui::RadioButton("Pre-integrated",
+                (int*)&_cbPerCall.uTransferMode, TRANSFER_PREINTEGRATED);
+            ImGui::SliderFloat("Step Scale", &_cbPerCall.fStepScale,
+                1.f, 8.f, "%.1f");
         }
         ImGui::Separator();
 
@@ -574,10 +1262,35 @@ SparseVolume::RenderGui()
             iFilterType = _filterType;
         }
         _filterType = (FilterType)iFilterType;
+        static int iRenderScale = (int)_renderScale;
+        ImGui::RadioButton("Full Res", &iRenderScale, kFullRes);
+        ImGui::SameLine();
+        ImGui::RadioButton("Half Res", &iRenderScale, kHalfRes);
+        ImGui::SameLine();
+        ImGui::RadioButton("Quarter Res", &iRenderScale, kQuarterRes);
+        _renderScale = (RenderScale)iRenderScale;
+        ImGui::Checkbox("Temporal Accumulation", &_useTemporal);
+        if (_useTemporal) {
+            ImGui::SameLine();
+            ImGui::SliderInt("Max Samples", &_temporalMaxSamples, 1, 32);
+            ImGui::RadioButton("All Rays", &_temporalDividerIdx, 0);
+            ImGui::SameLine();
+            ImGui::RadioButton("1/4 Rays", &_temporalDividerIdx, 1);
+            ImGui::SameLine();
+            ImGui::RadioButton("1/16 Rays", &_temporalDividerIdx, 2);
+            if (_temporal.GetRayDivider()) {
+                ImGui::Text("Rays/pixel this frame: %.4f%s",
+                    _temporal.GetRaysPerPixel(),
+                    _temporal.IsConverged() ? " (converged)" : "");
+            } else {
+                ImGui::Text("Off while animated or below full res");
+            }
+        }
         static int uMetaballCount =
             (int)_cbPerCall.uNumOfBalls;
-        if (ImGui::DragInt("Metaball Count",
-            (int*)&_cbPerCall.uNumOfBalls, 0.5f, 5, 128)) {
+        if (ImGui::DragInt("Metaball Count", (int*)&_numOfBalls,
+            _useBallGrid ? 10.f : 0.5f, 5,
+            _useBallGrid ? _maxGridBalls : MAX_BALLS)) {
             _needVolumeRebuild |= true;
         }
 
@@ -611,10 +1324,40 @@ SparseVolume::RenderGui()
                 (ManagedBuf::Bit)uBufferBitChoice)) {
                 uBufferTypeChoice = _volBuf.GetType();
         }
+        if (uBufferTypeChoice != ManagedBuf::k3DTexBuffer) {
+            static int iLayout = _volBuf.GetLayout();
+            ImGui::RadioButton("Linear", &iLayout, ManagedBuf::kLinear);
+            ImGui::SameLine();
+            ImGui::RadioButton("Swizzled", &iLayout, ManagedBuf::kSwizzled);
+            ImGui::SameLine();
+            ImGui::RadioButton("Brick Pool", &iLayout, ManagedBuf::kBrickPool);
+            _volBuf.SetLayout((ManagedBuf::Layout)iLayout);
+            if (iLayout == ManagedBuf::kBrickPool) {
+                // the pool is filled from the occupancy pre-pass, which
+                // only knows the balls in _cbPerFrame
+                _useStepInfoTex = true;
+                _usePSUpdate = false;
+                if (_useBallGrid) {
+                    _useBallGrid = false;
+                    _numOfBalls = min(_numOfBalls, (uint)MAX_BALLS);
+                    _needVolumeRebuild |= true;
+                }
+                const uint ratio = _volParam->uVoxelBrickRatio;
+                const double slotMB = ratio * ratio * ratio * 4.0 *
+                    (_volBuf.GetBit() == ManagedBuf::k16Bit ? 2 : 4) /
+                    (1024.0 * 1024.0);
+                ImGui::Text("Brick pool: %d/%d bricks, %.1fMB (dense %.1fMB)",
+                    (int)_brickPool.GetUsedSlots(),
+                    (int)_brickPool.GetCapacity(),
+                    _brickPool.GetCapacity() * slotMB,
+                    _occupancy.GetBrickCount() * slotMB);
+            }
+        }
 
         ImGui::Separator();
         ImGui::Text("Spacial Structure:");
-        static int iIdx = _ratioIdx;
+        // follows _ratioIdx, which the tuner moves with _autoRatio
+        int iIdx = _ratioIdx;
         ImGui::SliderInt("BrickBox Ratio", &iIdx, 0,
             (uint)(_ratios.size() - 1), "");
         iIdx = iIdx >= (int)_ratios.size() ? (int)_ratios.size() - 1 : iIdx;
@@ -622,8 +1365,21 @@ SparseVolume::RenderGui()
             _ratioIdx = iIdx;
             PRINTINFO("Ratio:%d", _ratios[_ratioIdx]);
             _volParam->uVoxelBrickRatio = _ratios[_ratioIdx];
-            _CreateBrickVolume(_curReso, _ratios[_ratioIdx]);
+            if (_ratios[_ratioIdx] < _brickVolRatio) {
+                _CreateBrickVolume(_curReso, _ratios[_ratioIdx]);
+            }
             _needVolumeRebuild |= true;
+            _autoRatio = false;
+        }
+        if (_useStepInfoTex) {
+            if (ImGui::Checkbox("Auto Ratio", &_autoRatio)) {
+                _ratioTuner.Reset();
+                _tuneFrame = 0;
+            }
+            if (_autoRatio) {
+                ImGui::SameLine();
+                ImGui::SliderInt("Tune Interval", &_tuneInterval, 1, 120);
+            }
         }
         ImGui::Separator();
 
@@ -655,16 +1411,156 @@ SparseVolume::RenderGui()
         } else {
             uiReso = _submittedReso;
         }
+        ImGui::Separator();
+
+        ImGui::Text("CPU Engine:");
+        if (ImGui::Button("Benchmark CPU Update")) {
+            _BenchmarkCPUUpdate();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Benchmark Ball Culling")) {
+            _BenchmarkCPUCulling();
+        }
+        if (ImGui::Button("Benchmark Occupancy PrePass")) {
+            _BenchmarkCPUOccupancy();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Benchmark Ball Grid")) {
+            _BenchmarkBallGrid();
+        }
+        if (ImGui::Button("Benchmark Ball Orbits")) {
+            _BenchmarkBallOrbits();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Benchmark Incremental Update")) {
+            _BenchmarkIncrementalUpdate();
+        }
+        if (ImGui::Button("Benchmark Voxel Layout")) {
+            _BenchmarkVoxelLayout();
+        }
+        if (ImGui::Button("Benchmark Brick Pool")) {
+            _BenchmarkBrickPool();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("CPU Reference Render")) {
+            _RenderCPUReference();
+        }
+        if (ImGui::Button("Benchmark Brick DDA")) {
+            _BenchmarkBrickDDA();
+        }
+        if (ImGui::Button("Benchmark Density Pyramid")) {
+            _BenchmarkDensityPyramid();
+        }
+        if (ImGui::Button("Benchmark Adaptive Step")) {
+            _BenchmarkAdaptiveStep();
+        }
+        if (ImGui::Button("Benchmark Transfer LUT")) {
+            _BenchmarkTransferLUT();
+        }
+        if (ImGui::Button("Benchmark Ray Packets")) {
+            _BenchmarkPackets();
+        }
+        if (ImGui::Button("Benchmark Upsample")) {
+            _BenchmarkUpsample();
+        }
+        if (ImGui::Button("Benchmark Temporal")) {
+            _BenchmarkTemporal();
+        }
+        if (ImGui::Button("Benchmark Gradient Volume")) {
+            _BenchmarkGradientVolume();
+        }
+        if (ImGui::Button("Benchmark Iso Refinement")) {
+            _BenchmarkIsoRefine();
+        }
+        if (ImGui::Button("Benchmark Near/Far Raster")) {
+            _BenchmarkNearFar();
+        }
+        if (ImGui::Button("Benchmark Brick Compaction")) {
+            _BenchmarkBrickCompaction();
+        }
+        if (ImGui::Button("Benchmark Brick Ratio Tuner")) {
+            _BenchmarkBrickRatioTuner();
+        }
+        if (ImGui::Button("Validate Retire Queue")) {
+            _ValidateRetireQueue();
+        }
     }
 }
 
 void
 SparseVolume::_CreateBrickVolume(const uint3& reso, const uint ratio)
 {
-    Graphics::g_cmdListMngr.IdleGPU();
-    _flagVol.Destroy();
-    _flagVol.Create(L"FlagVol", reso.x / ratio, reso.y / ratio,
-        reso.z / ratio, 1, DXGI_FORMAT_R8_UINT);
+    const uint32_t brickCount =
+        (reso.x / ratio) * (reso.y / ratio) * (reso.z / ratio);
+    _RetireBuffer(_flagVol);
+    _flagVol.Create(L"FlagVol", (brickCount + 31) / 32, sizeof(uint32_t));
+    // room for every brick being flagged
+    _RetireBuffer(_activeBrickBuf);
+    _activeBrickBuf.Create(L"Active Bricks", brickCount, sizeof(uint32_t));
+    _brickVolRatio = ratio;
+}
+
+void
+SparseVolume::_RetireResource(GpuResource& resource)
+{
+    // work of past frames is all the GPU may still run on it, as with
+    // ManagedBuf::GetResource
+    if (resource.GetResource()) {
+        _retiredResources.Retire(Graphics::g_stats.lastFrameEndFence,
+            ComPtr<ID3D12Resource>(resource.GetResource()));
+    }
+}
+
+void
+SparseVolume::_RetireBuffer(StructuredBuffer& buffer)
+{
+    // the UAV refers to the counter, which Create replaces as well. Views
+    // get rewritten in place, fine as they only get bound through dynamic
+    // descriptors and root views, both taken at record time
+    _RetireResource(buffer);
+    _RetireResource(buffer.GetCounterBuffer());
+    buffer.Destroy();
+}
+
+void
+SparseVolume::_TuneBrickRatio()
+{
+    if (++_tuneFrame < (uint)_tuneInterval) {
+        return;
+    }
+    _tuneFrame = 0;
+    // candidates the brick buffers already fit
+    std::vector<uint> ratios;
+    for (uint16_t ratio : _ratios) {
+        if (ratio >= _ResidentRatio(_ratios)) {
+            ratios.push_back(ratio);
+        }
+    }
+    const uint ratio = _ratioTuner.Tune(_cbPerFrame, _cbPerCall, ratios,
+        Graphics::g_SceneColorBuffer.GetWidth(),
+        Graphics::g_SceneColorBuffer.GetHeight(), &_tunerPool);
+    if (ratio == _volParam->uVoxelBrickRatio) {
+        return;
+    }
+    for (uint i = 0; i < _ratios.size(); ++i) {
+        if (_ratios[i] == ratio) {
+            _ratioIdx = i;
+        }
+    }
+    PRINTINFO("Auto ratio:%d", ratio);
+    _volParam->uVoxelBrickRatio = ratio;
+    _needVolumeRebuild |= true;
+}
+
+void
+SparseVolume::_CreateGradientVolume(const uint3& reso)
+{
+    _RetireResource(_gradientVol);
+    _gradientVol.Destroy();
+    _gradientVol.Create(L"GradientVol", reso.x, reso.y, reso.z, 1,
+        DXGI_FORMAT_R32_UINT);
+    _gradientReso = reso;
+    _gradientVolValid = false;
 }
 
 void
@@ -676,21 +1572,28 @@ SparseVolume::_UpdatePerFrameData(const DirectX::XMMATRIX& wvp,
     _cbPerFrame.f4ViewPos = eyePos;
     if (_isAnimated || _needVolumeRebuild) {
         _animateTime += Core::g_deltaTime;
-        for (uint i = 0; i < _cbPerCall.uNumOfBalls; i++) {
-            Ball ball = _ballsData[i];
-            _cbPerFrame.f4Balls[i].x =
-                ball.fOribtRadius * (float)cosf((float)_animateTime *
-                    ball.fOribtSpeed + ball.fOribtStartPhase);
-            _cbPerFrame.f4Balls[i].y =
-                ball.fOribtRadius * (float)sinf((float)_animateTime *
-                    ball.fOribtSpeed + ball.fOribtStartPhase);
-            _cbPerFrame.f4Balls[i].z =
-                0.3f * ball.fOribtRadius * (float)sinf(
-                    2.f * (float)_animateTime * ball.fOribtSpeed +
-                    ball.fOribtStartPhase);
-            _cbPerFrame.f4Balls[i].w = ball.fPower;
-            _cbPerFrame.f4BallsCol[i] = ball.f4Color;
+        for (size_t i = _ballsData.Size(); i < _numOfBalls; ++i) {
+            _AddBall();
+        }
+        _numOfBalls = min(_numOfBalls, (uint)_ballsData.Size());
+        _cbPerCall.uNumOfBalls = min(_numOfBalls, (uint)MAX_BALLS);
+        if (_useBallGrid) {
+            _ballGrid.f4Balls.resize(_numOfBalls);
+            _ballGrid.f4BallsCol.resize(_numOfBalls);
+            _ballsData.Evaluate((float)_animateTime, _numOfBalls,
+                _ballGrid.f4Balls.data(), _ballGrid.f4BallsCol.data());
+            // paths without the grid only see the first MAX_BALLS
+            memcpy(_cbPerFrame.f4Balls, _ballGrid.f4Balls.data(),
+                _cbPerCall.uNumOfBalls * sizeof(float4));
+            memcpy(_cbPerFrame.f4BallsCol, _ballGrid.f4BallsCol.data(),
+                _cbPerCall.uNumOfBalls * sizeof(float4));
+        } else {
+            _ballsData.Evaluate((float)_animateTime, _cbPerCall.uNumOfBalls,
+                _cbPerFrame.f4Balls, _cbPerFrame.f4BallsCol);
         }
+        _cbPerCall.fMinBallRadius = CPURaymarcher::MinBallRadius(_useBallGrid
+            ? _ballGrid.f4Balls.data() : _cbPerFrame.f4Balls,
+            _useBallGrid ? _numOfBalls : _cbPerCall.uNumOfBalls);
     }
 }
 
@@ -733,8 +1636,9 @@ SparseVolume::_AddBall()
     col.w = 1.f;
     ball.f4Color = col;
 
-    if (_ballsData.size() < MAX_BALLS) {
-        _ballsData.push_back(ball);
+    if (_ballsData.Size() < (size_t)_maxGridBalls) {
+        _ballsData.Add(ball.fPower, ball.fOribtRadius, ball.fOribtSpeed,
+            ball.fOribtStartPhase, ball.f4Color);
     }
 }
 
@@ -762,13 +1666,47 @@ void
 SparseVolume::_CleanBrickVolume(ComputeContext& cptContext)
 {
     GPU_PROFILE(cptContext, L"Volume Reset");
+    if (_dirtyListUpdate) {
+        // Flags of clean bricks stay valid with their reused voxels
+        const std::vector<uint32_t>& bricks = _dirtyTracker.GetDirtyBricks();
+        const uint brickCount = (uint)bricks.size();
+        if (brickCount == 0) {
+            return;
+        }
+        const uint groupSize = THREAD_X * THREAD_Y * THREAD_Z;
+        const uint groupCount = (brickCount + groupSize - 1) / groupSize;
+        _cbPerCall.uNumOfDirtyBricks = brickCount;
+        cptContext.SetPipelineState(_cptFlagVolResetListPSO);
+        cptContext.SetRootSignature(_rootsig);
+        cptContext.SetDynamicDescriptors(2, 1, 1, &_flagVol.GetUAV());
+        cptContext.SetDynamicConstantBufferView(
+            1, sizeof(_cbPerCall), (void*)&_cbPerCall);
+        cptContext.SetDynamicSRV(4, brickCount * sizeof(uint32_t),
+            bricks.data());
+        cptContext.Dispatch(min(groupCount, (uint)ACTIVE_GROUPS_PER_ROW),
+            (groupCount + ACTIVE_GROUPS_PER_ROW - 1) / ACTIVE_GROUPS_PER_ROW);
+        return;
+    }
     cptContext.SetPipelineState(_cptFlagVolResetPSO);
     cptContext.SetRootSignature(_rootsig);
     cptContext.SetDynamicDescriptors(2, 1, 1, &_flagVol.GetUAV());
+    cptContext.SetDynamicConstantBufferView(
+        1, sizeof(_cbPerCall), (void*)&_cbPerCall);
+    _DispatchFlagWords(cptContext);
+}
+
+void
+SparseVolume::_DispatchFlagWords(ComputeContext& cptContext)
+{
+    // a thread per word of _flagVol
     const uint3 xyz = _volParam->u3VoxelReso;
     const uint ratio = _volParam->uVoxelBrickRatio;
-    cptContext.Dispatch3D(xyz.x / ratio, xyz.y / ratio, xyz.z / ratio,
-        THREAD_X, THREAD_Y, THREAD_Z);
+    const uint wordCount =
+        ((xyz.x / ratio) * (xyz.y / ratio) * (xyz.z / ratio) + 31) / 32;
+    const uint groupSize = THREAD_X * THREAD_Y * THREAD_Z;
+    const uint groupCount = (wordCount + groupSize - 1) / groupSize;
+    cptContext.Dispatch(min(groupCount, (uint)ACTIVE_GROUPS_PER_ROW),
+        (groupCount + ACTIVE_GROUPS_PER_ROW - 1) / ACTIVE_GROUPS_PER_ROW);
 }
 
 void
@@ -790,6 +1728,7 @@ SparseVolume::_UpdateVolume(CommandContext& cmdCtx,
             1, sizeof(_cbPerCall), (void*)&_cbPerCall);
         gfxCtx.SetDynamicDescriptors(2, 1, 1, &_flagVol.GetUAV());
         gfxCtx.SetDynamicDescriptors(2, 0, 1, &buf.UAV);
+        gfxCtx.SetBufferSRV(6, _brickSlotBuf);
         D3D12_VIEWPORT viewPort = {};
         viewPort.Width = (FLOAT)xyz.x;
         viewPort.Height = (FLOAT)xyz.y;
@@ -803,30 +1742,195 @@ SparseVolume::_UpdateVolume(CommandContext& cmdCtx,
         gfxCtx.SetRenderTarget(buf.RTV);
         gfxCtx.SetVertexBuffer(0, _cubeVB.VertexBufferView());
         gfxCtx.Draw(xyz.z);
+    } else if (_brickPoolUpdate || (type == kFlagVol && (_dirtyListUpdate ||
+        (_useOccupancyPrePass && !_useIncrementalUpdate && !_useBallGrid)))) {
+        // Only thread groups overlapping dirty or possibly occupied bricks
+        const uint groupCount = (uint)_activeGroups.size();
+        if (groupCount == 0) {
+            return;
+        }
+        _cbPerCall.uNumOfActiveGroups = groupCount;
+        ComputeContext& cptCtx = cmdCtx.GetComputeContext();
+        const uint balls = _useBallGrid ? 1 : _useBallBins ? 2 : 0;
+        cptCtx.SetPipelineState(
+            _cptUpdateListPSO[buf.type][balls][_gradientVolValid]);
+        cptCtx.SetRootSignature(_rootsig);
+        cptCtx.SetDynamicDescriptors(2, 0, 1, &buf.UAV);
+        cptCtx.SetDynamicDescriptors(2, 1, 1, &_flagVol.GetUAV());
+        if (_gradientVolValid) {
+            cptCtx.SetDynamicDescriptors(2, 2, 1, &_gradientVol.GetUAV());
+        }
+        for (int i = 0; _useBallGrid && i < kNumBallGridBuf; ++i) {
+            cptCtx.SetDynamicDescriptors(5, i, 1, &_ballGridBuf[i].GetSRV());
+        }
+        for (int i = 0; _useBallBins && i < kNumBallBinBuf; ++i) {
+            cptCtx.SetDynamicDescriptors(5, i, 1, &_ballBinBuf[i].GetSRV());
+        }
+        cptCtx.SetDynamicConstantBufferView(
+            0, sizeof(_cbPerFrame), (void*)&_cbPerFrame);
+        cptCtx.SetDynamicConstantBufferView(
+            1, sizeof(_cbPerCall), (void*)&_cbPerCall);
+        cptCtx.SetDynamicSRV(4, groupCount * sizeof(uint32_t),
+            _activeGroups.data());
+        cptCtx.SetBufferSRV(6, _brickSlotBuf);
+        cptCtx.Dispatch(min(groupCount, (uint)ACTIVE_GROUPS_PER_ROW),
+            (groupCount + ACTIVE_GROUPS_PER_ROW - 1) / ACTIVE_GROUPS_PER_ROW);
+    } else if (_useBallGrid || _useBallBins) {
+        ComputeContext& cptCtx = cmdCtx.GetComputeContext();
+        cptCtx.SetPipelineState(_useBallGrid
+            ? _cptUpdateGridPSO[buf.type][type][_gradientVolValid]
+            : _cptUpdateBinsPSO[buf.type][type][_gradientVolValid]);
+        cptCtx.SetRootSignature(_rootsig);
+        cptCtx.SetDynamicDescriptors(2, 0, 1, &buf.UAV);
+        cptCtx.SetDynamicDescriptors(2, 1, 1, &_flagVol.GetUAV());
+        if (_gradientVolValid) {
+            cptCtx.SetDynamicDescriptors(2, 2, 1, &_gradientVol.GetUAV());
+        }
+        for (int i = 0; _useBallGrid && i < kNumBallGridBuf; ++i) {
+            cptCtx.SetDynamicDescriptors(5, i, 1, &_ballGridBuf[i].GetSRV());
+        }
+        for (int i = 0; _useBallBins && i < kNumBallBinBuf; ++i) {
+            cptCtx.SetDynamicDescriptors(5, i, 1, &_ballBinBuf[i].GetSRV());
+        }
+        cptCtx.SetDynamicConstantBufferView(
+            0, sizeof(_cbPerFrame), (void*)&_cbPerFrame);
+        cptCtx.SetDynamicConstantBufferView(
+            1, sizeof(_cbPerCall), (void*)&_cbPerCall);
+        cptCtx.SetBufferSRV(6, _brickSlotBuf);
+        cptCtx.Dispatch3D(xyz.x, xyz.y, xyz.z, THREAD_X, THREAD_Y, THREAD_Z);
     } else {
         ComputeContext& cptCtx = cmdCtx.GetComputeContext();
-        cptCtx.SetPipelineState(_cptUpdatePSO[buf.type][type]);
+        cptCtx.SetPipelineState(
+            _cptUpdatePSO[buf.type][type][_gradientVolValid]);
         cptCtx.SetRootSignature(_rootsig);
         cptCtx.SetDynamicDescriptors(2, 0, 1, &buf.UAV);
         cptCtx.SetDynamicDescriptors(2, 1, 1, &_flagVol.GetUAV());
+        if (_gradientVolValid) {
+            cptCtx.SetDynamicDescriptors(2, 2, 1, &_gradientVol.GetUAV());
+        }
         cptCtx.SetDynamicConstantBufferView(
             0, sizeof(_cbPerFrame), (void*)&_cbPerFrame);
         cptCtx.SetDynamicConstantBufferView(
             1, sizeof(_cbPerCall), (void*)&_cbPerCall);
+        cptCtx.SetBufferSRV(6, _brickSlotBuf);
         cptCtx.Dispatch3D(xyz.x, xyz.y, xyz.z, THREAD_X, THREAD_Y, THREAD_Z);
     }
 }
 
+void
+SparseVolume::_CompactBricks(ComputeContext& cptContext)
+{
+    GPU_PROFILE(cptContext, L"Brick Compaction");
+    // instance counts start over from 0
+    _UploadBuffer(cptContext, _brickDrawArgs, brickDrawArgs,
+        sizeof(brickDrawArgs));
+    cptContext.TransitionResource(_brickDrawArgs,
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    cptContext.TransitionResource(_activeBrickBuf,
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    cptContext.SetPipelineState(_cptBrickCompactPSO);
+    cptContext.SetRootSignature(_rootsig);
+    cptContext.SetDynamicConstantBufferView(
+        1, sizeof(_cbPerCall), (void*)&_cbPerCall);
+    cptContext.SetDynamicDescriptors(2, 0, 1, &_activeBrickBuf.GetUAV());
+    cptContext.SetDynamicDescriptors(2, 1, 1, &_brickDrawArgs.GetUAV());
+    cptContext.SetDynamicDescriptors(3, 1, 1, &_flagVol.GetSRV());
+    _DispatchFlagWords(cptContext);
+    cptContext.TransitionResource(_brickDrawArgs,
+        D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+    cptContext.TransitionResource(_activeBrickBuf,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+}
+
+void
+SparseVolume::_BuildPyramid(ComputeContext& cptContext,
+    const ManagedBuf::BufInterface& buf, bool update)
+{
+    GPU_PROFILE(cptContext, L"Density Pyramid");
+    const uint3 reso = _volParam->u3VoxelReso;
+    const uint32_t cellCount = pyramidLevelOffset(reso, PYRAMID_LEVELS);
+    if (cellCount > _pyramidBufSize) {
+        // only past frames read the old one
+        _RetireBuffer(_pyramidBuf);
+        _pyramidBufSize = cellCount;
+        _pyramidBuf.Create(L"Density Pyramid", cellCount, sizeof(float2));
+        update = false;
+    }
+    const uint3 lastReso = _pyramidCells.GetVolumeReso();
+    update &= reso.x == lastReso.x && reso.y == lastReso.y &&
+        reso.z == lastReso.z;
+    _pyramidCells.Resize(reso);
+    if (update) {
+        // cells seeing the re-evaluated thread groups, and their parents
+        for (uint32_t group : _activeGroups) {
+            const uint3 lo((group & 0x3ff) * THREAD_X,
+                (group >> 10 & 0x3ff) * THREAD_Y, (group >> 20) * THREAD_Z);
+            _pyramidCells.MarkVoxels(lo,
+                uint3(lo.x + THREAD_X, lo.y + THREAD_Y, lo.z + THREAD_Z));
+        }
+        // parents list no more cells than their children, past a full
+        // upload page of leaves the full build is cheaper anyway
+        update = _pyramidCells.GetMarkedCells(0).size() * sizeof(uint32_t) <=
+            kCpuAllocatorPageSize;
+    }
+    cptContext.TransitionResource(
+        _pyramidBuf, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    cptContext.SetPipelineState(_cptPyramidPSO[buf.type][update]);
+    cptContext.SetRootSignature(_rootsig);
+    cptContext.SetDynamicDescriptors(3, 0, 1, &buf.SRV);
+    cptContext.SetBufferSRV(6, _brickSlotBuf);
+    cptContext.SetBufferUAV(11, _pyramidBuf);
+    for (uint level = 0; level < PYRAMID_LEVELS; ++level) {
+        const std::vector<uint32_t>& marked =
+            _pyramidCells.GetMarkedCells(level);
+        if (update && marked.empty()) {
+            break;
+        }
+        // each level reduces the one written before
+        if (level > 0) {
+            cptContext.InsertUAVBarrier(_pyramidBuf);
+        }
+        _cbPerCall.uPyramidLevel = level;
+        if (update) {
+            const uint markedCount = (uint)marked.size();
+            const uint groupSize = THREAD_X * THREAD_Y * THREAD_Z;
+            const uint groupCount = (markedCount + groupSize - 1) / groupSize;
+            _cbPerCall.uNumOfPyramidCells = markedCount;
+            cptContext.SetDynamicConstantBufferView(
+                1, sizeof(_cbPerCall), (void*)&_cbPerCall);
+            cptContext.SetDynamicSRV(4, markedCount * sizeof(uint32_t),
+                marked.data());
+            cptContext.Dispatch(min(groupCount, (uint)ACTIVE_GROUPS_PER_ROW),
+                (groupCount + ACTIVE_GROUPS_PER_ROW - 1) /
+                ACTIVE_GROUPS_PER_ROW);
+            continue;
+        }
+        cptContext.SetDynamicConstantBufferView(
+            1, sizeof(_cbPerCall), (void*)&_cbPerCall);
+        const uint3 cells = pyramidLevelReso(reso, level);
+        cptContext.Dispatch3D(cells.x, cells.y, cells.z,
+            THREAD_X, THREAD_Y, THREAD_Z);
+    }
+    _pyramidCells.ClearMarks();
+}
+
 void
 SparseVolume::_RenderNearFar(GraphicsContext& gfxContext)
 {
     GPU_PROFILE(gfxContext, L"Render NearFar");
     gfxContext.SetRootSignature(_rootsig);
-    gfxContext.SetPipelineState(_gfxStepInfoPSO);
+    gfxContext.SetPipelineState(
+        _useCompactDraw ? _gfxStepInfoListPSO : _gfxStepInfoPSO);
     gfxContext.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
     gfxContext.SetRenderTargets(1, &_stepInfoTex.GetRTV());
-    gfxContext.SetDynamicDescriptors(3, 1, 1, &_flagVol.GetSRV());
     gfxContext.SetIndexBuffer(_cubeTriangleStripIB.IndexBufferView());
+    if (_useCompactDraw) {
+        gfxContext.SetBufferSRV(4, _activeBrickBuf);
+        gfxContext.DrawIndexedIndirect(
+            _brickDrawArgs, BRICK_DRAW_ARGS_NEAR_FAR);
+        return;
+    }
+    gfxContext.SetDynamicDescriptors(3, 1, 1, &_flagVol.GetSRV());
     const uint3 xyz = _volParam->u3VoxelReso;
     const uint ratio = _volParam->uVoxelBrickRatio;
     uint BrickCount = xyz.x * xyz.y * xyz.z / ratio / ratio / ratio;
@@ -840,30 +1944,113 @@ SparseVolume::_RenderVolume(GraphicsContext& gfxContext,
 {
     GPU_PROFILE(gfxContext, L"Rendering");
     VolumeStruct type = _useStepInfoTex ? kFlagVol : kVoxel;
+    // the upsample and the reprojection are guided by the DEPTH_OUT depth
+    const bool offscreen =
+        _renderScale != kFullRes || _temporal.GetRayDivider() != 0;
+    const bool adaptiveStep = _useAdaptiveStep && _adaptiveStepValid;
+    const bool pyramid = _usePyramidSkip && _pyramidValid &&
+        _filterType <= kLinearFilter;
+    if (pyramid) {
+        gfxContext.TransitionResource(_pyramidBuf,
+            D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+        gfxContext.SetBufferSRV(12, _pyramidBuf);
+    }
     if (_isoRender) {
+        // finite differences until the update wrote the gradients
+        const RaycastNormal normal = !_useNormal ? kNoNormal
+            : _useGradientVol && _gradientVolValid ? kGradientNormal
+            : kUseNormal;
+        // the pyramid guard takes precedence over the adaptive step
+        gfxContext.SetPipelineState((pyramid ? _gfxISOSurfRenderPyramidPSO
+            : adaptiveStep ? _gfxISOSurfRenderAdaptivePSO
+            : _gfxISOSurfRenderPSO)[buf.type][type][_filterType][normal]
+            [_writeDepth || offscreen]);
+        if (normal == kGradientNormal) {
+            gfxContext.TransitionResource(_gradientVol,
+                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+            gfxContext.SetDynamicDescriptors(10, 0, 1, &_gradientVol.GetSRV());
+        }
+    } else if (pyramid) {
+        gfxContext.SetPipelineState(
+            _gfxVolumeRenderPyramidPSO[buf.type][type][_filterType]);
+    } else if (type == kFlagVol && _useBrickDDA) {
         gfxContext.SetPipelineState(
-            _gfxISOSurfRenderPSO
-            [buf.type][type][_filterType][_useNormal][_writeDepth]);
+            _gfxVolumeRenderDDAPSO[buf.type][_filterType]);
+        gfxContext.SetDynamicDescriptors(7, 0, 1, &_flagVol.GetSRV());
+    } else if (adaptiveStep) {
+        gfxContext.SetPipelineState(
+            _gfxVolumeRenderAdaptivePSO[buf.type][type][_filterType]);
     } else {
         gfxContext.SetPipelineState(
             _gfxVolumeRenderPSO[buf.type][type][_filterType]);
     }
     gfxContext.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
     gfxContext.SetDynamicDescriptors(3, 0, 1, &buf.SRV);
+    gfxContext.SetBufferSRV(6, _brickSlotBuf);
+    gfxContext.SetBufferSRV(8, _transferLUTBuf);
     if (_useStepInfoTex) {
         gfxContext.SetDynamicDescriptors(3, 1, 1, &_stepInfoTex.GetSRV());
     }
-    gfxContext.SetRenderTargets(1, &Graphics::g_SceneColorBuffer.GetRTV(),
-        Graphics::g_SceneDepthBuffer.GetDSV());
+    if (offscreen) {
+        gfxContext.SetRenderTargets(1, &_raycastColor.GetRTV(),
+            _raycastDepth.GetDSV());
+    } else {
+        gfxContext.SetRenderTargets(1, &Graphics::g_SceneColorBuffer.GetRTV(),
+            Graphics::g_SceneDepthBuffer.GetDSV());
+    }
     gfxContext.SetIndexBuffer(_cubeTriangleStripIB.IndexBufferView());
     gfxContext.DrawIndexed(CUBE_TRIANGLESTRIP_LENGTH);
 }
 
+void
+SparseVolume::_UpsampleVolume(GraphicsContext& gfxContext)
+{
+    GPU_PROFILE(gfxContext, L"Upsample");
+    gfxContext.SetPipelineState(_gfxUpsamplePSO);
+    gfxContext.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    gfxContext.SetDynamicDescriptors(3, 0, 1, &_raycastColor.GetSRV());
+    gfxContext.SetDynamicDescriptors(3, 1, 1, &_raycastDepth.GetDepthSRV());
+    gfxContext.SetRenderTargets(1, &Graphics::g_SceneColorBuffer.GetRTV(),
+        Graphics::g_SceneDepthBuffer.GetDSV());
+    gfxContext.Draw(3);
+}
+
+void
+SparseVolume::_ResolveTemporal(GraphicsContext& gfxContext)
+{
+    GPU_PROFILE(gfxContext, L"Temporal Resolve");
+    const uint next = 1 - _historyIdx;
+    gfxContext.TransitionResource(_historyColor[_historyIdx],
+        D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+    gfxContext.TransitionResource(_historyDepth[_historyIdx],
+        D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+    gfxContext.TransitionResource(_historyColor[next],
+        D3D12_RESOURCE_STATE_RENDER_TARGET);
+    gfxContext.TransitionResource(_historyDepth[next],
+        D3D12_RESOURCE_STATE_RENDER_TARGET, true);
+    gfxContext.SetPipelineState(_gfxTemporalResolvePSO);
+    gfxContext.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    gfxContext.SetDynamicDescriptors(3, 0, 1, &_raycastColor.GetSRV());
+    gfxContext.SetDynamicDescriptors(3, 1, 1, &_raycastDepth.GetDepthSRV());
+    gfxContext.SetDynamicDescriptors(9, 0, 1,
+        &_historyColor[_historyIdx].GetSRV());
+    gfxContext.SetDynamicDescriptors(9, 1, 1,
+        &_historyDepth[_historyIdx].GetSRV());
+    const D3D12_CPU_DESCRIPTOR_HANDLE RTVs[] = {
+        Graphics::g_SceneColorBuffer.GetRTV(), _historyColor[next].GetRTV(),
+        _historyDepth[next].GetRTV()};
+    gfxContext.SetRenderTargets(_countof(RTVs), RTVs,
+        Graphics::g_SceneDepthBuffer.GetDSV());
+    gfxContext.Draw(3);
+    _historyIdx = next;
+}
+
 void
 SparseVolume::_RenderBrickGrid(GraphicsContext& gfxContext)
 {
     GPU_PROFILE(gfxContext, L"Render BrickGrid");
-    gfxContext.SetPipelineState(_gfxStepInfoDebugPSO[_writeDepth]);
+    gfxContext.SetPipelineState((_useCompactDraw
+        ? _gfxStepInfoDebugListPSO : _gfxStepInfoDebugPSO)[_writeDepth]);
     gfxContext.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_LINESTRIP);
     if (_writeDepth) {
         gfxContext.SetRenderTargets(1, &Graphics::g_SceneColorBuffer.GetRTV(),
@@ -871,10 +2058,587 @@ SparseVolume::_RenderBrickGrid(GraphicsContext& gfxContext)
     } else {
         gfxContext.SetRenderTargets(1, &Graphics::g_SceneColorBuffer.GetRTV());
     }
-    gfxContext.SetDynamicDescriptors(3, 1, 1, &_flagVol.GetSRV());
     gfxContext.SetIndexBuffer(_cubeLineStripIB.IndexBufferView());
+    if (_useCompactDraw) {
+        gfxContext.SetBufferSRV(4, _activeBrickBuf);
+        gfxContext.DrawIndexedIndirect(_brickDrawArgs, BRICK_DRAW_ARGS_GRID);
+        return;
+    }
+    gfxContext.SetDynamicDescriptors(3, 1, 1, &_flagVol.GetSRV());
     const uint3 xyz = _volParam->u3VoxelReso;
     const uint ratio = _volParam->uVoxelBrickRatio;
     uint BrickCount = xyz.x * xyz.y * xyz.z / ratio / ratio / ratio;
     gfxContext.DrawIndexedInstanced(CUBE_LINESTRIP_LENGTH, BrickCount, 0, 0, 0);
+}
+
+void
+SparseVolume::_UploadBallGrid(CommandContext& cmdContext)
+{
+    const void* data[kNumBallGridBuf] = {_ballGrid.f4Balls.data(),
+        _ballGrid.f4BallsCol.data(), _ballGrid.GetCellOffsets().data(),
+        _ballGrid.GetCellEntries().data()};
+    const uint32_t count[kNumBallGridBuf] = {
+        (uint32_t)_ballGrid.f4Balls.size(),
+        (uint32_t)_ballGrid.f4BallsCol.size(),
+        (uint32_t)_ballGrid.GetCellOffsets().size(),
+        (uint32_t)_ballGrid.GetCellEntries().size()};
+    const uint32_t elementSize[kNumBallGridBuf] = {sizeof(float4),
+        sizeof(float4), sizeof(uint32_t), sizeof(uint32_t)};
+    const wchar_t* name[kNumBallGridBuf] = {L"BallGrid Balls",
+        L"BallGrid BallsCol", L"BallGrid CellOffsets", L"BallGrid CellEntries"};
+    for (int i = 0; i < kNumBallGridBuf; ++i) {
+        // keep at least one element so there is always a valid SRV
+        if (max(count[i], 1u) > _ballGridBufSize[i]) {
+            // grow by doubling so reallocation stays rare, nothing of this
+            // frame used the old buffer yet
+            _RetireBuffer(_ballGridBuf[i]);
+            _ballGridBufSize[i] =
+                max(max(count[i], 1u), _ballGridBufSize[i] * 2);
+            _ballGridBuf[i].Create(
+                name[i], _ballGridBufSize[i], elementSize[i]);
+        }
+        _UploadBuffer(cmdContext, _ballGridBuf[i], data[i],
+            (size_t)count[i] * elementSize[i]);
+        cmdContext.TransitionResource(_ballGridBuf[i],
+            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    }
+}
+
+void
+SparseVolume::_UploadBallBins(CommandContext& cmdContext)
+{
+    const void* data[kNumBallBinBuf] = {
+        _ballBins.offsets.data(), _ballBins.ballIdx.data()};
+    // the uint16 ball indices go two per uint
+    const size_t size[kNumBallBinBuf] = {
+        _ballBins.offsets.size() * sizeof(uint32_t),
+        _ballBins.ballIdx.size() * sizeof(uint16_t)};
+    const wchar_t* name[kNumBallBinBuf] = {
+        L"BallBins Offsets", L"BallBins Entries"};
+    for (int i = 0; i < kNumBallBinBuf; ++i) {
+        // keep at least one element so there is always a valid SRV
+        const uint32_t count = max((uint32_t)((size[i] + 3) / 4), 1u);
+        if (count > _ballBinBufSize[i]) {
+            // grow by doubling so reallocation stays rare, nothing of this
+            // frame used the old buffer yet
+            _RetireBuffer(_ballBinBuf[i]);
+            _ballBinBufSize[i] = max(count, _ballBinBufSize[i] * 2);
+            _ballBinBuf[i].Create(
+                name[i], _ballBinBufSize[i], sizeof(uint32_t));
+        }
+        _UploadBuffer(cmdContext, _ballBinBuf[i], data[i], size[i]);
+        cmdContext.TransitionResource(_ballBinBuf[i],
+            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    }
+}
+
+void
+SparseVolume::_UploadBrickSlots(CommandContext& cmdContext)
+{
+    const std::vector<uint32_t>& slots = _brickPool.GetSlots();
+    size_t begin = _brickPool.GetDirtyBegin();
+    size_t end = _brickPool.GetDirtyEnd();
+    if (slots.size() > _brickSlotBufSize) {
+        // grow by doubling like _UploadBallGrid, nothing of this frame used
+        // the old table yet
+        _RetireBuffer(_brickSlotBuf);
+        _brickSlotBufSize =
+            max((uint32_t)slots.size(), _brickSlotBufSize * 2);
+        _brickSlotBuf.Create(
+            L"BrickPool Slots", _brickSlotBufSize, sizeof(uint32_t));
+        begin = 0;
+        end = slots.size();
+    }
+    if (begin < end) {
+        cmdContext.TransitionResource(
+            _brickSlotBuf, D3D12_RESOURCE_STATE_COPY_DEST, true);
+        _UploadBuffer(cmdContext, _brickSlotBuf, slots.data() + begin,
+            (end - begin) * sizeof(uint32_t), begin * sizeof(uint32_t));
+    }
+    cmdContext.TransitionResource(_brickSlotBuf,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE |
+        D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+}
+
+void
+SparseVolume::_UploadTransferLUT(CommandContext& cmdContext)
+{
+    if (!_transferLUT.Update(*_volParam)) {
+        return;
+    }
+    const std::vector<float>& lut = _transferLUT.GetData();
+    cmdContext.TransitionResource(
+        _transferLUTBuf, D3D12_RESOURCE_STATE_COPY_DEST, true);
+    _UploadBuffer(cmdContext, _transferLUTBuf, lut.data(),
+        lut.size() * sizeof(float));
+    cmdContext.TransitionResource(_transferLUTBuf,
+        D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+}
+
+void
+SparseVolume::_BenchmarkCPUUpdate()
+{
+    const std::vector<uint> resos = {128, 256, 384};
+    std::vector<CPUVolumeUpdater::BenchmarkResult> results =
+        CPUVolumeUpdater::Benchmark(_cbPerFrame, _cbPerCall, resos);
+    for (auto& result : results) {
+        PRINTINFO("CPU Update %dx%dx%d, %d balls: %s %.2fms (%.2fMVoxel/s), "
+            "%s %.2fms (%.2fMVoxel/s), %zu mismatched voxels",
+            result.u3Reso.x, result.u3Reso.y, result.u3Reso.z,
+            result.uNumOfBalls,
+            CPUVolumeUpdater::GetLaneName(CPUVolumeUpdater::kScalarLane),
+            result.dScalarMs, result.dScalarVoxelsPerSec * 1e-6,
+            CPUVolumeUpdater::GetLaneName(CPUVolumeUpdater::kSIMDLane),
+            result.dSIMDMs, result.dSIMDVoxelsPerSec * 1e-6,
+            result.uMismatchVoxels);
+    }
+    std::vector<CPUVolumeUpdater::ScalingResult> scaling =
+        CPUVolumeUpdater::BenchmarkScaling(_cbPerFrame, _cbPerCall, 256);
+    for (auto& result : scaling) {
+        PRINTINFO("CPU Update 256^3 with %d workers: %.2fms (%.2fMVoxel/s), "
+            "speedup %.2fx, per worker share %.1f%%-%.1f%%, %llu groups stolen",
+            result.uNumWorkers, result.dMs, result.dVoxelsPerSec * 1e-6,
+            result.dSpeedup, result.dMinWorkerShare * 100.0,
+            result.dMaxWorkerShare * 100.0, result.uItemsStolen);
+    }
+}
+
+void
+SparseVolume::_BenchmarkCPUCulling()
+{
+    const std::vector<uint> ballCounts = {16, 32, 64, 128};
+    const std::vector<float> cullRatios = {0.01f, 0.05f, 0.1f, 0.25f};
+    WorkStealingPool pool;
+    std::vector<CPUVolumeUpdater::CullingResult> results =
+        CPUVolumeUpdater::BenchmarkCulling(_cbPerFrame, _cbPerCall, 256,
+            ballCounts, cullRatios, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Ball Culling 256^3, %d balls, cull ratio %.2f: full %.2fms, "
+            "bin %.2fms + culled %.2fms, %.1f balls/brick, max density error "
+            "%f, %zu flag mismatches", result.uNumOfBalls, result.fCullRatio,
+            result.dFullMs, result.dBinMs, result.dCulledMs,
+            result.dAvgBallsPerBrick, result.fMaxDensityError,
+            result.uFlagMismatches);
+    }
+}
+
+void
+SparseVolume::_BenchmarkCPUOccupancy()
+{
+    const std::vector<uint> resos = {128, 256, 384};
+    WorkStealingPool pool;
+    std::vector<BrickOccupancy::BenchmarkResult> results =
+        BrickOccupancy::Benchmark(_cbPerFrame, _cbPerCall, resos, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Occupancy PrePass %dx%dx%d: %zu/%zu bricks occupied, "
+            "full %.2fms, prepass %.2fms + sparse %.2fms, %zu flag and %zu "
+            "voxel mismatches", result.u3Reso.x, result.u3Reso.y,
+            result.u3Reso.z, result.uOccupiedBricks, result.uBrickCount,
+            result.dFullMs, result.dPrePassMs, result.dSparseMs,
+            result.uFlagMismatches, result.uVoxelMismatches);
+    }
+}
+
+void
+SparseVolume::_BenchmarkBallGrid()
+{
+    const std::vector<uint> ballCounts = {128, 1000, 10000, 100000};
+    WorkStealingPool pool;
+    std::vector<BallGrid::ScalingResult> results =
+        BallGrid::BenchmarkScaling(_cbPerCall, 256, ballCounts, THREAD_X,
+            _ballGridCullRatio, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Ball Grid 256^3, %d balls: rebuild %.2fms, incremental "
+            "%.2fms (%zu balls moved), update %.2fms (%.2fMVoxel/s), "
+            "%.1f balls/cell", result.uNumOfBalls, result.dRebuildMs,
+            result.dIncrementalMs, result.uMovedBalls, result.dUpdateMs,
+            result.dVoxelsPerSec * 1e-6, result.dAvgBallsPerCell);
+    }
+}
+
+void
+SparseVolume::_BenchmarkBallOrbits()
+{
+    const std::vector<uint> ballCounts = {128, 1000, 10000, 100000};
+    std::vector<BallOrbits::BenchmarkResult> results =
+        BallOrbits::Benchmark(ballCounts);
+    for (auto& result : results) {
+        PRINTINFO("Ball Orbits %d balls: AoS loop %.3fms, SoA %s %.3fms "
+            "(%.2fx), max position error %g", result.uNumOfBalls,
+            result.dAoSMs, CPUVolumeUpdater::GetLaneName(
+                CPUVolumeUpdater::kSIMDLane), result.dSoAMs,
+            result.dAoSMs / result.dSoAMs, result.fMaxError);
+    }
+}
+
+void
+SparseVolume::_BenchmarkIncrementalUpdate()
+{
+    const std::vector<float> movingRatios = {0.f, 0.01f, 0.05f, 0.25f, 1.f};
+    WorkStealingPool pool;
+    std::vector<DirtyBrickTracker::BenchmarkResult> results =
+        DirtyBrickTracker::Benchmark(_cbPerFrame, _cbPerCall, 256, 10,
+            movingRatios, _dirtyCullRatio, _dirtyMoveTolerance, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Incremental Update 256^3, %.0f%% balls moving: full "
+            "%.2fms, tracking %.3fms + dirty update %.2fms (%.1f%% bricks "
+            "dirty), max density error %g, %zu flag mismatches",
+            result.fMovingRatio * 100.f, result.dFullMs, result.dTrackMs,
+            result.dIncrementalMs, result.dDirtyRatio * 100.0,
+            result.fMaxDensityError, result.uFlagMismatches);
+    }
+}
+
+void
+SparseVolume::_BenchmarkVoxelLayout()
+{
+    std::vector<CPURaymarcher::LayoutResult> results =
+        CPURaymarcher::BenchmarkLayouts(_cbPerFrame, _cbPerCall, 256);
+    for (auto& result : results) {
+        PRINTINFO("Voxel Layout 256^3 %s, rays along %s: %llu samples "
+            "%.2fms (%.2fM samples/s), %.3f L1 and %.3f L2 misses/sample",
+            result.uLayout == VOXEL_LAYOUT_SWIZZLED ? "swizzled" : "linear",
+            result.szRayDir, (unsigned long long)result.uSamples, result.dMs,
+            result.dSamplesPerSec * 1e-6, result.dL1MissesPerSample,
+            result.dL2MissesPerSample);
+    }
+}
+
+void
+SparseVolume::_BenchmarkBrickPool()
+{
+    WorkStealingPool pool;
+    std::vector<BrickPool::BenchmarkResult> results =
+        BrickPool::Benchmark(_cbPerFrame, _cbPerCall, {256, 512, 1024}, 10,
+            &pool);
+    for (auto& result : results) {
+        PRINTINFO("Brick Pool %dx%dx%d: %.0f/%zu bricks occupied, %zu slots "
+            "(%u reallocations), occupancy %.2fms pool %.3fms, %.1f%% of "
+            "table uploaded, pool %.1fMB + table %.1fMB (dense %.1fMB), %zu "
+            "slot errors", result.u3Reso.x, result.u3Reso.y, result.u3Reso.z,
+            result.dOccupiedBricks, result.uBrickCount, result.uCapacity,
+            result.uReallocations, result.dOccupancyMs, result.dPoolMs,
+            result.dTableUpload * 100.0, result.dPoolMB, result.dTableMB,
+            result.dDenseMB, result.uSlotErrors);
+    }
+}
+
+void
+SparseVolume::_RenderCPUReference()
+{
+    // the brick pool has no CPU counterpart, its voxels match linear
+    const ManagedBuf::Layout layout =
+        _volBuf.GetLayout() == ManagedBuf::kBrickPool
+        ? ManagedBuf::kLinear : _volBuf.GetLayout();
+    CPUVolume vol;
+    vol.Resize(_volParam->u3VoxelReso, _volParam->uVoxelBrickRatio,
+        (CPUVolume::BufType)_volBuf.GetType(),
+        (CPUVolume::BufBit)_volBuf.GetBit(), layout);
+    WorkStealingPool pool;
+    CPUVolumeUpdater updater;
+    updater.SetBallGrid(_useBallGrid ? &_ballGrid : nullptr);
+    BallBins bins;
+    if (_useBallBins && !_useBallGrid) {
+        bins.Build(_cbPerFrame, _cbPerCall, _ballBinCullRatio);
+        updater.SetBallBins(&bins);
+    }
+    updater.Update(_cbPerFrame, _cbPerCall, vol, _useStepInfoTex,
+        CPUVolumeUpdater::kSIMDLane, &pool);
+
+    CPURaymarcher::RenderSettings settings;
+    settings.uWidth = Graphics::g_SceneColorBuffer.GetWidth();
+    settings.uHeight = Graphics::g_SceneColorBuffer.GetHeight();
+    settings.bIsoSurface = _isoRender;
+    settings.bUseNormal = _useNormal;
+    // only where the GPU raycast takes it as well
+    settings.bAdaptiveStep = _useAdaptiveStep && _adaptiveStepValid;
+    settings.pTransferLUT = &_transferLUT;
+    settings.uRenderScale = 1u << _renderScale;
+    settings.fClearDepth = Graphics::g_SceneDepthBuffer.GetClearDepth();
+    // samplers filter like FILTER_READ == 1 up to sampler precision
+    settings.bFilter = _filterType != kNoFilter;
+    // ray bounds of _RenderNearFar from the flagged bricks
+    DensityPyramid pyramid;
+    if (_usePyramidSkip && _pyramidValid && _filterType <= kLinearFilter) {
+        pyramid.Build(vol, &pool);
+        settings.pPyramid = &pyramid;
+        // the GPU iso guard takes precedence over the adaptive step
+        settings.bAdaptiveStep &= !_isoRender;
+    }
+    NearFarRasterizer nearFar;
+    if (_useStepInfoTex) {
+        nearFar.Rasterize(vol, _cbPerFrame, *_volParam, settings.uWidth,
+            settings.uHeight, settings.uRenderScale, &pool);
+        settings.pNearFar = &nearFar;
+    }
+    CPURaymarcher::Image image;
+    CPURaymarcher::RenderStats stats = CPURaymarcher::Render(
+        vol, _cbPerFrame, _cbPerCall, settings, image, &pool);
+    const bool saved = CPURaymarcher::SavePFM(image, "CPUReference.pfm");
+    PRINTINFO("CPU Reference %dx%d %s 1/%d res: %llu rays in %.2fms with %d "
+        "workers (%.2fMRays/s), %.1f samples/ray, %s", settings.uWidth,
+        settings.uHeight, _isoRender ? "iso surface" : "accumulated",
+        settings.uRenderScale,
+        (unsigned long long)stats.uRays, stats.dMs, stats.uNumWorkers,
+        stats.dRaysPerSec * 1e-6, stats.dSamplesPerRay,
+        saved ? "saved to CPUReference.pfm" : "saving failed");
+}
+
+void
+SparseVolume::_BenchmarkBrickDDA()
+{
+    const std::vector<uint> ballCounts = {8, 20, 64, 128};
+    WorkStealingPool pool;
+    std::vector<CPURaymarcher::BrickDDAResult> results =
+        CPURaymarcher::BenchmarkBrickDDA(_cbPerFrame, _cbPerCall, 256,
+            ballCounts, 480, 270, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Brick DDA 256^3 ratio %d, %d balls, %.1f%% bricks "
+            "flagged: plain %.2fms %.1f samples/ray, DDA %.2fms %.1f "
+            "samples/ray (%.2fx), max error %f, %zu pixels off",
+            _volParam->uVoxelBrickRatio, result.uNumOfBalls,
+            result.dOccupiedBricks * 100.0, result.dPlainMs,
+            result.dPlainSamplesPerRay, result.dDDAMs,
+            result.dDDASamplesPerRay, result.dPlainMs / result.dDDAMs,
+            result.fMaxError, result.uDiffPixels);
+    }
+}
+
+void
+SparseVolume::_BenchmarkDensityPyramid()
+{
+    const std::vector<uint> ballCounts = {8, 20, 64, 128};
+    WorkStealingPool pool;
+    std::vector<DensityPyramid::BenchmarkResult> results =
+        DensityPyramid::Benchmark(_cbPerFrame, _cbPerCall, 256, ballCounts,
+            10, 0.25f, 480, 270, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Density pyramid 256^3, %d balls: build %.2fms, update "
+            "%.2fms (%.1f%% bricks dirty), %zu cells off a full build",
+            result.uNumOfBalls, result.dBuildMs, result.dUpdateMs,
+            result.dDirtyRatio * 100.0, result.uCellMismatches);
+        PRINTINFO("    empty cells 2^3 %.1f%% 4^3 %.1f%% 8^3 %.1f%% 16^3 "
+            "%.1f%% 32^3 %.1f%% 64^3 %.1f%%", result.dEmptyCells[0] * 100.0,
+            result.dEmptyCells[1] * 100.0, result.dEmptyCells[2] * 100.0,
+            result.dEmptyCells[3] * 100.0, result.dEmptyCells[4] * 100.0,
+            result.dEmptyCells[5] * 100.0);
+        PRINTINFO("    plain %.2fms %.1f samples/ray, brick DDA %.2fms %.1f "
+            "samples/ray, pyramid %.2fms %.1f samples/ray, max error %f, "
+            "%zu pixels off", result.dPlainMs, result.dPlainSamplesPerRay,
+            result.dBrickMs, result.dBrickSamplesPerRay, result.dPyramidMs,
+            result.dPyramidSamplesPerRay, result.fMaxError,
+            result.uDiffPixels);
+    }
+}
+
+void
+SparseVolume::_BenchmarkAdaptiveStep()
+{
+    const std::vector<uint> ballCounts = {8, 20, 64, 128};
+    WorkStealingPool pool;
+    std::vector<CPURaymarcher::AdaptiveStepResult> results =
+        CPURaymarcher::BenchmarkAdaptiveStep(_cbPerFrame, _cbPerCall, 256,
+            ballCounts, 480, 270, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Adaptive step 256^3 %s, %d balls: fixed %.2fms %.1f "
+            "samples/ray, adaptive %.2fms %.1f samples/ray (%.2fx), max "
+            "error %f, %zu pixels off",
+            result.bIsoSurface ? "iso surface" : "accumulated",
+            result.uNumOfBalls, result.dFixedMs, result.dFixedSamplesPerRay,
+            result.dAdaptiveMs, result.dAdaptiveSamplesPerRay,
+            result.dFixedMs / result.dAdaptiveMs, result.fMaxError,
+            result.uDiffPixels);
+    }
+}
+
+void
+SparseVolume::_BenchmarkTransferLUT()
+{
+    const char* modeNames[] = {"polynomial", "LUT", "pre-integrated"};
+    const std::vector<float> stepScales = {1.f, 2.f, 4.f, 8.f};
+    WorkStealingPool pool;
+    std::vector<TransferFunctionLUT::BenchmarkResult> results =
+        TransferFunctionLUT::Benchmark(_cbPerFrame, _cbPerCall, 256,
+            _cbPerCall.uNumOfBalls, stepScales, 480, 270, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Transfer %s 256^3, %d balls, step scale %.0f: %.2fms "
+            "%.1f samples/ray, RMSE %f max error %f against step scale "
+            "0.25%s", modeNames[result.uTransferMode],
+            _cbPerCall.uNumOfBalls, result.fStepScale, result.dMs,
+            result.dSamplesPerRay, result.dRMSE, result.fMaxError,
+            result.bMatched ? ", matches step scale 1 polynomial" : "");
+    }
+}
+
+void
+SparseVolume::_BenchmarkPackets()
+{
+    WorkStealingPool pool;
+    std::vector<CPURaymarcher::PacketResult> results =
+        CPURaymarcher::BenchmarkPackets(_cbPerFrame, _cbPerCall, 256,
+            {8, 20, 64, 128}, 480, 270, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Ray packets of %u, 256^3, %u balls: %.2fms "
+            "%.2f MRays/s %.1f samples/ray, max error %f against single "
+            "rays", result.uPacketSize, result.uNumOfBalls, result.dMs,
+            result.dRaysPerSec * 1e-6, result.dSamplesPerRay,
+            result.fMaxError);
+    }
+}
+
+void
+SparseVolume::_BenchmarkUpsample()
+{
+    WorkStealingPool pool;
+    std::vector<CPURaymarcher::UpsampleResult> results =
+        CPURaymarcher::BenchmarkUpsample(_cbPerFrame, _cbPerCall, 256,
+            _cbPerCall.uNumOfBalls, 480, 272, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Upsample 1/%u res 256^3 %s, %d balls: %.2fms (upsample "
+            "%.2fms) %.3f rays/pixel, RMSE %f max error %f, %zu pixels off "
+            "full res", result.uRenderScale,
+            result.bIsoSurface ? "iso surface" : "accumulated",
+            _cbPerCall.uNumOfBalls, result.dMs, result.dUpsampleMs,
+            result.dRaysPerPixel, result.dRMSE, result.fMaxError,
+            result.uDiffPixels);
+    }
+}
+
+void
+SparseVolume::_BenchmarkTemporal()
+{
+    WorkStealingPool pool;
+    const std::vector<uint> dividers = {0, 1, 4, 16};
+    std::vector<TemporalAccumulator::BenchmarkResult> results =
+        TemporalAccumulator::Benchmark(_cbPerFrame, _cbPerCall, 256,
+            _cbPerCall.uNumOfBalls, dividers, _temporalMaxSamples, 480, 272,
+            &pool);
+    for (auto& result : results) {
+        PRINTINFO("Temporal divider %u 256^3, %d balls: %u frames %.2fms/frame "
+            "%.4f rays/pixel %.2f samples/pixel per frame, RMSE %f at frame "
+            "0 %f converged (max error %f), after a pan %f reprojected %f "
+            "without", result.uRayDivider, _cbPerCall.uNumOfBalls,
+            result.uFrames, result.dMsPerFrame, result.dRaysPerPixel,
+            result.dSamplesPerPixel, result.dFirstRMSE, result.dRMSE,
+            result.fMaxError, result.dReprojectedRMSE, result.dPlainRMSE);
+    }
+}
+
+void
+SparseVolume::_BenchmarkGradientVolume()
+{
+    WorkStealingPool pool;
+    const char* names[] = {"none", "finite differences", "gradient volume"};
+    std::vector<CPURaymarcher::NormalResult> results =
+        CPURaymarcher::BenchmarkNormals(_cbPerFrame, _cbPerCall, 256,
+            _cbPerCall.uNumOfBalls, 480, 272, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Normals %s %s 256^3, %d balls: update %.2fms render "
+            "%.2fms, %.1fns per normal, %llu hits %.3f deg mean (%.3f max) "
+            "off the analytic gradient", names[result.uNormal],
+            result.bFilter ? "filtered" : "point", _cbPerCall.uNumOfBalls,
+            result.dUpdateMs, result.dMs, result.dNormalNsPerHit,
+            (unsigned long long)result.uHits, result.dMeanErrorDeg,
+            result.fMaxErrorDeg);
+    }
+}
+
+void
+SparseVolume::_BenchmarkIsoRefine()
+{
+    WorkStealingPool pool;
+    std::vector<CPURaymarcher::IsoRefineResult> results =
+        CPURaymarcher::BenchmarkIsoRefine(_cbPerFrame, _cbPerCall, 256,
+            _cbPerCall.uNumOfBalls, 480, 272, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Iso step %.0fx, %d refine steps%s 256^3, %d balls: "
+            "%.2fms %.1f samples/ray, %llu hits %.4f voxels mean (%.4f max) "
+            "off, %llu missed %llu far off", result.fIsoStepScale,
+            result.uIsoRefineSteps, result.bGuard ? " guarded" : "",
+            _cbPerCall.uNumOfBalls, result.dMs, result.dSamplesPerRay,
+            (unsigned long long)result.uHits, result.dMeanErrorVoxels,
+            result.fMaxErrorVoxels, (unsigned long long)result.uMissedHits,
+            (unsigned long long)result.uFarOffHits);
+    }
+}
+
+void
+SparseVolume::_BenchmarkNearFar()
+{
+    const std::vector<uint> ratios = {4, 8, 16, 32};
+    WorkStealingPool pool;
+    std::vector<NearFarRasterizer::BenchmarkResult> results =
+        NearFarRasterizer::Benchmark(_cbPerFrame, _cbPerCall, 256, ratios,
+            480, 272, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Near/far 256^3 ratio %d, %zu of %zu bricks flagged: "
+            "raster %.2fms, %.1f tiles per brick, %.1f%% tiles empty, box "
+            "%.2fms %.1f samples/pixel, near/far %.2fms %.1f samples/pixel, "
+            "max error %f, %zu pixels off", result.uBrickRatio,
+            result.uFlaggedBricks, result.uBrickCount, result.dRasterMs,
+            result.dTilesPerBrick, result.dEmptyTiles * 100.0, result.dBoxMs,
+            result.dBoxSamplesPerPixel, result.dNearFarMs,
+            result.dNearFarSamplesPerPixel, result.fMaxError,
+            result.uDiffPixels);
+    }
+}
+
+void
+SparseVolume::_BenchmarkBrickCompaction()
+{
+    const std::vector<uint> ratios = {2, 4, 8, 16, 32};
+    WorkStealingPool pool;
+    std::vector<BrickCompaction::BenchmarkResult> results =
+        BrickCompaction::Benchmark(_cbPerFrame, _cbPerCall, 256, ratios,
+            &pool);
+    for (auto& result : results) {
+        PRINTINFO("Compaction 256^3 ratio %d, %zu of %zu bricks flagged: "
+            "%.3fms, serial scan of %zu bytes %.3fms, of %zu flag bytes "
+            "%.3fms, near/far indices %zu -> %zu%s", result.uBrickRatio,
+            result.uFlaggedBricks, result.uBrickCount, result.dCompactMs,
+            result.uBrickCount, result.dByteScanMs, result.uFlagBytes,
+            result.dBitScanMs, result.uGridIndices, result.uCompactIndices,
+            result.bMatches ? "" : ", MISMATCH");
+    }
+}
+
+void
+SparseVolume::_BenchmarkBrickRatioTuner()
+{
+    const std::vector<uint> ratios = {2, 4, 8, 16, 32, 64};
+    const std::vector<uint> ballCounts = {5, 20, MAX_BALLS};
+    WorkStealingPool pool;
+    std::vector<BrickRatioTuner::BenchmarkResult> results =
+        BrickRatioTuner::Benchmark(_cbPerFrame, _cbPerCall, 256, ratios,
+            ballCounts, 480, 272, &pool);
+    for (auto& result : results) {
+        PRINTINFO("Ratio tuner 256^3 %d balls: tuned to ratio %d in %d "
+            "tunes of %.2fms, cheapest modeled %d, fastest measured %d",
+            result.uNumOfBalls, result.uTunedRatio, result.uTunes,
+            result.dTuneMs, result.uCheapestRatio, result.uMeasuredRatio);
+        for (size_t i = 0; i < result.candidates.size(); ++i) {
+            const BrickRatioTuner::Candidate& candidate =
+                result.candidates[i];
+            // measured for every ratio, modeled for the priced tail
+            const size_t measured =
+                ratios.size() - result.candidates.size() + i;
+            PRINTINFO("    ratio %d, %zu of %zu bricks flagged: cost %.0f "
+                "(near/far %.0f, raymarch %.0f), raster %.2fms, render "
+                "%.2fms", candidate.uRatio, candidate.uFlaggedBricks,
+                candidate.uBrickCount, candidate.dCost, candidate.dStepCost,
+                candidate.dMarchCost, result.rasterMs[measured],
+                result.renderMs[measured]);
+        }
+    }
+}
+
+void
+SparseVolume::_ValidateRetireQueue()
+{
+    const RetireQueueValidation result = ValidateRetireQueue();
+    PRINTINFO("Retire queue: %u retired (%u below the fence before), %u "
+        "released%s%s%s", result.uRetired, result.uClamped, result.uReleased,
+        result.bNoEarlyRelease ? "" : ", RELEASED EARLY",
+        result.bInOrder ? "" : ", OUT OF ORDER",
+        result.bConsistent ? "" : ", COUNT MISMATCH");
 }
\ No newline at end of file
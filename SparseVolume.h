@@ -1,5 +1,16 @@
 #pragma once
 #include "ManagedBuf.h"
+#include "BrickOccupancy.h"
+#include "BallGrid.h"
+#include "BallOrbits.h"
+#include "DirtyBrickTracker.h"
+#include "DensityPyramid.h"
+#include "BrickPool.h"
+#include "TransferFunctionLUT.h"
+#include "TemporalAccumulator.h"
+#include "BrickRatioTuner.h"
+#include "WorkStealingPool.h"
+#include "RetireQueue.h"
 #include "SparseVolume.inl"
 class SparseVolume
 {
@@ -18,9 +29,33 @@ public:
         kNumFilter
     };
 
+    enum BallGridBuf {
+        kBallPos = 0,
+        kBallCol,
+        kCellOffset,
+        kCellEntry,
+        kNumBallGridBuf
+    };
+
+    enum BallBinBuf {
+        kBinOffset = 0,
+        kBinEntry,
+        kNumBallBinBuf
+    };
+
+    // raycast resolution, below full the result gets upsampled
+    enum RenderScale {
+        kFullRes = 0,
+        kHalfRes,
+        kQuarterRes,
+        kNumRenderScale
+    };
+
+    // USE_NORMAL values (NORMAL_* of GradientVolume.inl)
     enum RaycastNormal {
         kNoNormal = 0,
         kUseNormal,
+        kGradientNormal,
         kNumNormal
     };
 
@@ -45,6 +80,13 @@ public:
 private:
     void _AddBall();
     void _CreateBrickVolume(const uint3& reso, const uint ratio);
+    void _CreateGradientVolume(const uint3& reso);
+    // Hand the resource to _retiredResources, released once the frames that
+    // may use it completed. _RetireBuffer takes the counter along and
+    // destroys the buffer
+    void _RetireResource(GpuResource& resource);
+    void _RetireBuffer(StructuredBuffer& buffer);
+    void _TuneBrickRatio();
     // Data update
     void _UpdatePerFrameData(const DirectX::XMMATRIX& wvp,
         const DirectX::XMMATRIX& mView,const DirectX::XMFLOAT4& eyePos);
@@ -55,20 +97,86 @@ private:
         const ManagedBuf::BufInterface& buf, bool usePS);
     void _RenderVolume(GraphicsContext& gfxContext,
         const ManagedBuf::BufInterface& buf);
+    void _DispatchFlagWords(ComputeContext& cptContext);
+    void _CompactBricks(ComputeContext& cptContext);
+    // min/max density pyramid of buf into _pyramidBuf, level by level. With
+    // update only the cells over _activeGroups and their parents, unless the
+    // volume got resized since the last build
+    void _BuildPyramid(ComputeContext& cptContext,
+        const ManagedBuf::BufInterface& buf, bool update);
     void _RenderNearFar(GraphicsContext& gfxContext);
     void _RenderBrickGrid(GraphicsContext& gfxContext);
+    void _UpsampleVolume(GraphicsContext& gfxContext);
+    void _ResolveTemporal(GraphicsContext& gfxContext);
+    void _UploadBallGrid(CommandContext& cmdContext);
+    void _UploadBallBins(CommandContext& cmdContext);
+    void _UploadBrickSlots(CommandContext& cmdContext);
+    void _UploadTransferLUT(CommandContext& cmdContext);
+    // CPU engine
+    void _BenchmarkCPUUpdate();
+    void _BenchmarkCPUCulling();
+    void _BenchmarkCPUOccupancy();
+    void _BenchmarkBallGrid();
+    void _BenchmarkBallOrbits();
+    void _BenchmarkIncrementalUpdate();
+    void _BenchmarkVoxelLayout();
+    void _BenchmarkBrickPool();
+    void _RenderCPUReference();
+    void _BenchmarkBrickDDA();
+    void _BenchmarkDensityPyramid();
+    void _BenchmarkAdaptiveStep();
+    void _BenchmarkTransferLUT();
+    void _BenchmarkPackets();
+    void _BenchmarkUpsample();
+    void _BenchmarkTemporal();
+    void _BenchmarkGradientVolume();
+    void _BenchmarkIsoRefine();
+    void _BenchmarkNearFar();
+    void _BenchmarkBrickCompaction();
+    void _BenchmarkBrickRatioTuner();
+    void _ValidateRetireQueue();
 
     // Volume settings currently in use
     VolumeStruct _curVolStruct = kVoxel;
     FilterType _filterType = kNoFilter;
+    RenderScale _renderScale = kFullRes;
     uint3 _curReso;
     // new vol reso setting sent to ManagedBuf _volBuf
     uint3 _submittedReso;
 
     // per instance buffer resource
     ManagedBuf _volBuf;
-    VolumeTexture _flagVol;
+    // a bit per brick in uint words, see flagWordCount
+    StructuredBuffer _flagVol;
+    // flat indices of the flagged bricks and the draw records of the near/far
+    // and brick grid cubes, written by _CompactBricks with each update
+    StructuredBuffer _activeBrickBuf;
+    IndirectArgsBuffer _brickDrawArgs;
+    // packed iso surface normals (GradientVolume.inl), allocated once they
+    // get used and valid while the last update wrote them
+    VolumeTexture _gradientVol;
+    uint3 _gradientReso = uint3(0, 0, 0);
+    bool _gradientVolValid = false;
+    // all levels of the PYRAMID_SKIP min/max pyramid (DensityPyramid.inl),
+    // valid while the last update built it
+    StructuredBuffer _pyramidBuf;
+    uint32_t _pyramidBufSize = 0;
+    bool _pyramidValid = false;
+    // cells of _pyramidBuf an incremental build rebuilds, no ranges
+    DensityPyramid _pyramidCells;
+    // replaced brick, gradient and volume buffers and the outgrown upload
+    // buffers, so recreating them never waits for the GPU
+    RetireQueue<Microsoft::WRL::ComPtr<ID3D12Resource>> _retiredResources;
     ColorBuffer _stepInfoTex;
+    // raycast target below full resolution or with temporal accumulation,
+    // its depth guides the upsample and the reprojection
+    ColorBuffer _raycastColor;
+    DepthBuffer _raycastDepth;
+    // accumulated color (sample count in alpha) and depth, read from
+    // [_historyIdx] and written to the other
+    ColorBuffer _historyColor[2];
+    ColorBuffer _historyDepth[2];
+    uint _historyIdx = 0;
     PerFrameDataCB _cbPerFrame;
     PerCallDataCB _cbPerCall;
     // point to vol data section in _cbPerCall
@@ -78,13 +186,55 @@ private:
     ManagedBuf::BufInterface _curBufInterface;
 
     // info. to control volume update, processed by cpu
-    std::vector<Ball> _ballsData;
+    BallOrbits _ballsData;
+    // analytic occupancy pre-pass and the thread groups it keeps
+    BrickOccupancy _occupancy;
+    std::vector<uint32_t> _activeGroups;
+    // balls in use, only the first MAX_BALLS go into _cbPerFrame
+    uint _numOfBalls;
+    // all balls and their cell lists for the BALL_GRID update
+    BallGrid _ballGrid;
+    StructuredBuffer _ballGridBuf[kNumBallGridBuf];
+    // element capacity of each _ballGridBuf
+    uint32_t _ballGridBufSize[kNumBallGridBuf] = {};
+    // per brick lists of the _cbPerFrame balls for the BALL_BINS update
+    BallBins _ballBins;
+    StructuredBuffer _ballBinBuf[kNumBallBinBuf];
+    // uint capacity of each _ballBinBuf
+    uint32_t _ballBinBufSize[kNumBallBinBuf] = {};
+    // bricks touched by moved balls, with _dirtyListUpdate only those are
+    // reset and _activeGroups covers them
+    DirtyBrickTracker _dirtyTracker;
+    bool _dirtyListUpdate = false;
+    // occupied bricks' slots with ManagedBuf::kBrickPool, with
+    // _brickPoolUpdate only those get updated
+    BrickPool _brickPool;
+    StructuredBuffer _brickSlotBuf;
+    uint32_t _brickSlotBufSize = 0;
+    bool _brickPoolUpdate = false;
+    // ADAPTIVE_STEP bounds the distance to the balls by the stored density,
+    // only while the last update wrote every ball everywhere: brick pool,
+    // occupancy pre-pass and incremental updates leave bricks stale or
+    // unwritten, the ball grid and bins cull the far balls
+    bool _adaptiveStepValid = false;
+    // TRANSFER_LUT/TRANSFER_PREINTEGRATED tables, uploaded again whenever
+    // fMinDensity/fMaxDensity change
+    TransferFunctionLUT _transferLUT;
+    StructuredBuffer _transferLUTBuf;
+    // progressive accumulation while nothing but the camera moves
+    TemporalAccumulator _temporal;
 
 
     // available ratios for current volume resolution
     std::vector<uint16_t> _ratios;
     // current selected ratio idx
     uint _ratioIdx;
+    // finest ratio _flagVol and _activeBrickBuf are sized for
+    uint _brickVolRatio = 0;
+    // picks _ratioIdx from the modeled cost of each ratio with _autoRatio
+    BrickRatioTuner _ratioTuner;
+    WorkStealingPool _tunerPool;
+    uint _tuneFrame = 0;
 
     double _animateTime = 0.0;
     bool _isAnimated = true;
@@ -1,7 +1,12 @@
+#include "VoxelLayout.inl"
+
+// Slot of every brick with VOXEL_LAYOUT_BRICK_POOL (see BrickPool)
+StructuredBuffer<uint> buf_srvBrickSlots : register(t7);
+
 #if TEX3D_UAV
 #define BUFFER_INDEX(idx) idx
 #else
-#define BUFFER_INDEX(idx) flatIDX(idx)
+#define BUFFER_INDEX(idx) bufferIDX(idx)
 #endif
 
 uint flatIDX(uint3 idx)
@@ -10,6 +15,42 @@ uint flatIDX(uint3 idx)
         idx.z * vParam.u3VoxelReso.x * vParam.u3VoxelReso.y;
 }
 
+// Element of voxel idx in the buffer, uVoxelLayout is uniform so the branch
+// costs next to nothing. Voxels outside the volume or of bricks without a
+// pool slot get BRICK_POOL_EMPTY
+uint bufferIDX(uint3 idx)
+{
+    if (uVoxelLayout == VOXEL_LAYOUT_BRICK_POOL) {
+        uint uRatio = vParam.uVoxelBrickRatio;
+        uint3 u3BrickReso = vParam.u3VoxelReso / uRatio;
+        uint3 u3Brick = idx / uRatio;
+        if (any(u3Brick >= u3BrickReso)) {
+            return BRICK_POOL_EMPTY;
+        }
+        return brickPoolVoxelIdx(idx.x, idx.y, idx.z, uRatio,
+            buf_srvBrickSlots[linearVoxelIdx(
+                u3Brick.x, u3Brick.y, u3Brick.z, u3BrickReso)]);
+    }
+    return voxelIdx(idx.x, idx.y, idx.z, vParam.u3VoxelReso, uVoxelLayout);
+}
+
+// _flagVol packs a bit per brick, bit (idx & 31) of word idx >> 5 for the
+// flat brick index idx (makeU3Idx order)
+uint flagWordCount(uint3 u3BrickReso)
+{
+    return (u3BrickReso.x * u3BrickReso.y * u3BrickReso.z + 31) >> 5;
+}
+
+uint flatBrickIdx(uint3 u3Brick, uint3 u3BrickReso)
+{
+    return u3Brick.x + (u3Brick.y + u3Brick.z * u3BrickReso.y) * u3BrickReso.x;
+}
+
+uint flagBit(uint uBrick)
+{
+    return 1u << (uBrick & 31);
+}
+
 uint3 makeU3Idx(uint idx, uint3 res)
 {
     uint stripCount = res.x * res.y;
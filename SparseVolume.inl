@@ -9,18 +9,46 @@
 #define THREAD_Y 8
 #define THREAD_Z 8
 #define MAX_DEPTH 10000
+// Voxels the ADAPTIVE_STEP distance bound keeps clear of the threshold, it
+// only holds for the analytic field, not the filtered voxel reads
+#define ADAPTIVE_STEP_MARGIN 2
+// Share of the threshold ADAPTIVE_STEP assumes at least. The stored density
+// is 0 without balls (rsqrt goes infinite) and tiny far from them, the
+// floor keeps a jump within about 6 fMinBallRadius / sqrt(threshold)
+#define ADAPTIVE_STEP_FLOOR 0.02f
+// Entries per density axis of the transfer function tables
+#define TRANSFER_LUT_SIZE 256
+// Relative depth difference at which a low resolution sample counts half in
+// the depth aware upsample (reversed z, so about the relative distance)
+#define UPSAMPLE_DEPTH_TOLERANCE 0.02f
+// Relative depth difference up to which a reprojected iso surface hit still
+// takes the history of the last camera
+#define TEMPORAL_DEPTH_TOLERANCE 0.01f
 // Do not modify below this line
 
+// Classification of accumulatedShading samples (uTransferMode)
+#define TRANSFER_POLYNOMIAL 0 // transferFunction() per sample
+#define TRANSFER_LUT 1 // 1D table of transferFunction()
+#define TRANSFER_PREINTEGRATED 2 // 2D table over front and back density
+
 // The length of cube triangles-strip vertices
 #define CUBE_TRIANGLESTRIP_LENGTH 14
 // The length of cube line-strip vertices
 #define CUBE_LINESTRIP_LENGTH 19
+// Thread groups per row when dispatching over a list of active groups
+#define ACTIVE_GROUPS_PER_ROW 1024
+// Byte offsets of the D3D12_DRAW_INDEXED_ARGUMENTS records the brick
+// compaction fills: cube triangle strips of the near/far pass and cube line
+// strips of the brick grid, and of InstanceCount within a record
+#define BRICK_DRAW_ARGS_NEAR_FAR 0
+#define BRICK_DRAW_ARGS_GRID 20
+#define BRICK_DRAW_ARGS_INSTANCES 4
 
 #if __hlsl
 #define CBUFFER_ALIGN
 #define REGISTER(x) :register(x)
 #define STRUCT(x) x
-#else
+#elif defined(_WIN32)
 #define CBUFFER_ALIGN __declspec( \
     align(D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT))
 #define REGISTER(x)
@@ -31,6 +59,40 @@ typedef DirectX::XMFLOAT3 float3;
 typedef DirectX::XMFLOAT2 float2;
 typedef DirectX::XMUINT3 uint3;
 typedef uint32_t uint;
+#else
+// Headless build (CPU engine without D3D12/DirectXMath), plain structs with
+// the same memory layout as the DirectXMath types above
+#include <cstdint>
+#include <cstdlib>
+#define D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT 256
+#define CBUFFER_ALIGN
+#define REGISTER(x)
+#define STRUCT(x) struct alignas(D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT)
+#define _aligned_malloc(size, alignment) aligned_alloc(alignment, size)
+#define _aligned_free(p) free(p)
+struct alignas(16) matrix { float m[4][4]; };
+struct float4 {
+    float x, y, z, w;
+    float4() {}
+    float4(float _x, float _y, float _z, float _w)
+        : x(_x), y(_y), z(_z), w(_w) {}
+};
+struct float3 {
+    float x, y, z;
+    float3() {}
+    float3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+};
+struct float2 {
+    float x, y;
+    float2() {}
+    float2(float _x, float _y) : x(_x), y(_y) {}
+};
+struct uint3 {
+    uint32_t x, y, z;
+    uint3() {}
+    uint3(uint32_t _x, uint32_t _y, uint32_t _z) : x(_x), y(_y), z(_z) {}
+};
+typedef uint32_t uint;
 #endif
 
 // will be put into constant buffer, pay attention to alignment
@@ -49,6 +111,9 @@ CBUFFER_ALIGN STRUCT(cbuffer) PerFrameDataCB REGISTER(b0)
 {
     matrix mWorldViewProj;
     matrix mView;
+    // temporal resolve: pixel rays of this frame, reprojection into the last
+    matrix mInvWorldViewProj;
+    matrix mPrevWorldViewProj;
     float4 f4ViewPos;
     float4 f4Balls[MAX_BALLS];
     float4 f4BallsCol[MAX_BALLS];
@@ -66,8 +131,40 @@ CBUFFER_ALIGN STRUCT(cbuffer) PerFrameDataCB REGISTER(b0)
 CBUFFER_ALIGN STRUCT(cbuffer) PerCallDataCB REGISTER(b1)
 {
     VolumeParam vParam;
+    // cells along each axis and cell edge in voxels of the BALL_GRID update
+    uint3 u3BallGridReso;
+    uint uBallGridCellSize;
     uint uNumOfBalls;
-    uint NIU[3];
+    // length of the active group list used by the BRICK_LIST update
+    uint uNumOfActiveGroups;
+    // length of the brick list reset by the BRICK_LIST flag volume clean
+    uint uNumOfDirtyBricks;
+    // VOXEL_LAYOUT_* of buffer volumes (see VoxelLayout.inl)
+    uint uVoxelLayout;
+    // sqrt of the smallest ball power, distance bound of ADAPTIVE_STEP
+    float fMinBallRadius;
+    // accumulatedShading steps fVoxelSize * fStepScale
+    float fStepScale;
+    // TRANSFER_* classification of accumulatedShading
+    uint uTransferMode;
+    // isoSurfaceShading steps fVoxelSize * fIsoStepScale and narrows every
+    // crossing down with uIsoRefineSteps refineCrossing iterations, 1 and 0
+    // is the plain voxel step march
+    float fIsoStepScale;
+    uint uIsoRefineSteps;
+    // raycast resolution divider (1, 2 or 4) the upsample pass reads with
+    uint uRenderScale;
+    // progressive accumulation (see TemporalSchedule.inl), frames since the
+    // history got reset or reprojected, uTemporalRayDivider 0 is off
+    uint uTemporalFrame;
+    uint uTemporalRayDivider;
+    uint uTemporalMaxSamples;
+    // history of the last camera, to be reprojected in frame 0
+    uint uTemporalReproject;
+    // level the density pyramid build writes (see DensityPyramid.inl)
+    uint uPyramidLevel;
+    // length of the cell list rebuilt by the BRICK_LIST pyramid build
+    uint uNumOfPyramidCells;
 #if !__hlsl
     void* operator new(size_t i) {
         return _aligned_malloc(i, 
@@ -0,0 +1,44 @@
+#include "SparseVolume.inl"
+#include "SparseVolume.hlsli"
+StructuredBuffer<uint> buf_srvFlagVol : register(t1);
+// flat indices of the flagged bricks, packed group by group in no
+// particular order
+RWStructuredBuffer<uint> buf_uavActiveBricks : register(u0);
+// BRICK_DRAW_ARGS_* records, their instance counts start from 0
+RWByteAddressBuffer buf_uavDrawArgs : register(u1);
+
+groupshared uint uGroupCount;
+groupshared uint uGroupOffset;
+
+[numthreads(THREAD_X, THREAD_Y, THREAD_Z)]
+void main(uint uGIdx : SV_GroupIndex, uint3 u3Gid : SV_GroupID)
+{
+    // a word of 32 bricks per thread
+    uint uIdx = (u3Gid.y * ACTIVE_GROUPS_PER_ROW + u3Gid.x) *
+        THREAD_X * THREAD_Y * THREAD_Z + uGIdx;
+    if (uGIdx == 0) {
+        uGroupCount = 0;
+    }
+    GroupMemoryBarrierWithGroupSync();
+    uint uWord = uIdx < flagWordCount(vParam.u3VoxelReso /
+        vParam.uVoxelBrickRatio) ? buf_srvFlagVol[uIdx] : 0;
+    uint uSlot = 0;
+    if (uWord) {
+        InterlockedAdd(uGroupCount, countbits(uWord), uSlot);
+    }
+    GroupMemoryBarrierWithGroupSync();
+    // one global atomic per record and group, both draw the same bricks
+    if (uGIdx == 0 && uGroupCount) {
+        buf_uavDrawArgs.InterlockedAdd(
+            BRICK_DRAW_ARGS_NEAR_FAR + BRICK_DRAW_ARGS_INSTANCES,
+            uGroupCount, uGroupOffset);
+        buf_uavDrawArgs.InterlockedAdd(
+            BRICK_DRAW_ARGS_GRID + BRICK_DRAW_ARGS_INSTANCES, uGroupCount);
+    }
+    GroupMemoryBarrierWithGroupSync();
+    while (uWord) {
+        buf_uavActiveBricks[uGroupOffset + uSlot++] =
+            (uIdx << 5) + firstbitlow(uWord);
+        uWord &= uWord - 1;
+    }
+}
\ No newline at end of file
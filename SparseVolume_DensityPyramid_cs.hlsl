@@ -0,0 +1,76 @@
+#include "SparseVolume.inl"
+#include "SparseVolume.hlsli"
+#include "DensityPyramid.inl"
+
+#if TYPED_UAV
+Buffer<float4> tex_srvDataVol : register(t0);
+#elif STRUCT_UAV
+StructuredBuffer<float4> tex_srvDataVol : register(t0);
+#else // TEX3D_UAV
+Texture3D<float4> tex_srvDataVol : register(t0);
+#endif
+#if BRICK_LIST
+// flat indices of the cells to rebuild, uNumOfPyramidCells of them
+StructuredBuffer<uint> buf_srvCells : register(t2);
+#endif // BRICK_LIST
+// all levels, see DensityPyramid.inl
+RWStructuredBuffer<float2> buf_uavPyramid : register(u3);
+
+//------------------------------------------------------------------------------
+// Compute Shader
+//------------------------------------------------------------------------------
+// One thread per cell of level uPyramidLevel (per listed one with
+// BRICK_LIST), levels above 0 reduce the 2^3 cells below them, which the
+// dispatch before wrote
+[numthreads(THREAD_X, THREAD_Y, THREAD_Z)]
+#if BRICK_LIST
+void main(uint uGIdx : SV_GroupIndex, uint3 u3Gid : SV_GroupID)
+#else
+void main(uint3 u3DTid : SV_DispatchThreadID)
+#endif // BRICK_LIST
+{
+    uint3 u3Reso = pyramidLevelReso(vParam.u3VoxelReso, uPyramidLevel);
+#if BRICK_LIST
+    uint uIdx = (u3Gid.y * ACTIVE_GROUPS_PER_ROW + u3Gid.x) *
+        THREAD_X * THREAD_Y * THREAD_Z + uGIdx;
+    if (uIdx >= uNumOfPyramidCells) {
+        return;
+    }
+    uint uCell = buf_srvCells[uIdx];
+    uint3 u3DTid = uint3(uCell % u3Reso.x, uCell / u3Reso.x % u3Reso.y,
+        uCell / u3Reso.x / u3Reso.y);
+#else
+    if (any(u3DTid >= u3Reso)) {
+        return;
+    }
+#endif // BRICK_LIST
+    float2 f2Range = float2(3.402823466e+38f, -3.402823466e+38f);
+    if (uPyramidLevel == 0) {
+        // the cell's voxels plus the next one along +xyz (the FILTER_READ ==
+        // 1 neighbors), voxels past the volume read as 0. Bricks without a
+        // pool slot read 0 as they do in the raycast
+        for (uint i = 0; i < 27; ++i) {
+            uint3 u3Voxel = u3DTid * 2 + uint3(i % 3, i / 3 % 3, i / 9);
+            float fDensity = all(u3Voxel < vParam.u3VoxelReso) ?
+                tex_srvDataVol[BUFFER_INDEX(u3Voxel)].x : 0.f;
+            f2Range = float2(min(f2Range.x, fDensity),
+                max(f2Range.y, fDensity));
+        }
+    } else {
+        uint3 u3ChildReso =
+            pyramidLevelReso(vParam.u3VoxelReso, uPyramidLevel - 1);
+        uint uChildOffset =
+            pyramidLevelOffset(vParam.u3VoxelReso, uPyramidLevel - 1);
+        for (uint i = 0; i < 8; ++i) {
+            uint3 u3Child = u3DTid * 2 + uint3(i & 1, (i >> 1) & 1, i >> 2);
+            if (all(u3Child < u3ChildReso)) {
+                float2 f2Child = buf_uavPyramid[uChildOffset + linearVoxelIdx(
+                    u3Child.x, u3Child.y, u3Child.z, u3ChildReso)];
+                f2Range = float2(min(f2Range.x, f2Child.x),
+                    max(f2Range.y, f2Child.y));
+            }
+        }
+    }
+    buf_uavPyramid[pyramidLevelOffset(vParam.u3VoxelReso, uPyramidLevel) +
+        linearVoxelIdx(u3DTid.x, u3DTid.y, u3DTid.z, u3Reso)] = f2Range;
+}
\ No newline at end of file
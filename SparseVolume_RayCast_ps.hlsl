@@ -1,5 +1,8 @@
 #include "SparseVolume.inl"
 #include "SparseVolume.hlsli"
+#include "TemporalSchedule.inl"
+#include "GradientVolume.inl"
+#include "DensityPyramid.inl"
 
 #if TYPED_UAV
 Buffer<float4> tex_srvDataVol : register(t0);
@@ -12,6 +15,21 @@ Texture3D<float4> tex_srvDataVol : register(t0);
 Texture2D<float2> tex_srvNearFar : register(t1);
 //Texture3D<int> tex_srvFlagVol : register(t1);
 #endif // ENABLE_BRICKS
+#if BRICK_DDA
+StructuredBuffer<uint> buf_srvFlagVol : register(t8);
+#endif // BRICK_DDA
+#if PYRAMID_SKIP
+// min/max density of every level, see DensityPyramid.inl
+StructuredBuffer<float2> buf_srvPyramid : register(t13);
+#endif // PYRAMID_SKIP
+#if !ISO_SURFACE
+// TransferFunctionLUT tables: TRANSFER_LUT_SIZE opacities, then the
+// TRANSFER_LUT_SIZE^2 pre-integrated mean extinctions (front major)
+StructuredBuffer<float> buf_srvTransferLUT : register(t9);
+#endif // !ISO_SURFACE
+#if USE_NORMAL == NORMAL_GRADIENT_VOL
+Texture3D<uint> tex_srvGradientVol : register(t12);
+#endif // USE_NORMAL == NORMAL_GRADIENT_VOL
 SamplerState samp_Linear : register(s0);
 SamplerState samp_Aniso : register(s1);
 
@@ -98,36 +116,294 @@ float4 readVolume(float3 f3Idx)
 #endif
 }
 
+#if BRICK_DDA
+// Bricks outside the grid are empty
+uint brickFlag(int3 i3Brick)
+{
+    uint3 u3BrickReso = vParam.u3VoxelReso / vParam.uVoxelBrickRatio;
+    if (any(i3Brick < 0) || any(i3Brick >= (int3)u3BrickReso)) {
+        return 0;
+    }
+    uint uBrick = flatBrickIdx(i3Brick, u3BrickReso);
+    return buf_srvFlagVol[uBrick >> 5] & flagBit(uBrick);
+}
+
+// No sample inside i3Brick can read an occupied voxel. Filtered reads reach
+// one voxel further along +xyz (samplers one back too) and extrapolate past
+// the voxels they read, so the flags get dilated by a brick
+bool emptyBrick(int3 i3Brick)
+{
+#if FILTER_READ
+    uint uFlags = 0;
+    [unroll] for (uint i = 0; i < 27; ++i) {
+        uFlags |= brickFlag(i3Brick + int3(i % 3, i / 3 % 3, i / 9) - 1);
+    }
+    return uFlags == 0;
+#else
+    return brickFlag(i3Brick) == 0;
+#endif // FILTER_READ
+}
+#endif // BRICK_DDA
+
+#if PYRAMID_SKIP
+// No readVolume sample inside cell u3Cell of the level starting at uOffset
+// returns a density within f2MinMaxDen (DensityPyramid::IsEmpty). Filtered
+// reads weight the 8 neighbors with 1.5 - d / d - 0.5, which can overshoot
+// the voxel range by up to 3.5 times its width
+bool emptyCell(uint uOffset, uint3 u3Reso, uint3 u3Cell, float2 f2MinMaxDen)
+{
+    float2 f2Range = buf_srvPyramid[uOffset +
+        linearVoxelIdx(u3Cell.x, u3Cell.y, u3Cell.z, u3Reso)];
+#if FILTER_READ == 1
+    float fOvershoot = 3.5f * (f2Range.y - f2Range.x);
+#else
+    float fOvershoot = 0.f;
+#endif // FILTER_READ == 1
+    return f2Range.y + fOvershoot < f2MinMaxDen.x ||
+        f2Range.x - fOvershoot > f2MinMaxDen.y;
+}
+
+// Whole steps of fDeltaT to the first sample past the coarsest empty cell
+// around f3Idx, 0 if its level 0 cell may be visible
+float pyramidSteps(float3 f3Idx, float3 f3IdxStep, float2 f2MinMaxDen)
+{
+    if (any(f3Idx < 0.f) || any(f3Idx >= (float3)vParam.u3VoxelReso)) {
+        return 0.f;
+    }
+    uint3 u3Voxel = f3Idx;
+    // level iLevel + 1 starts at uOffset and has u3Reso cells
+    int iLevel = -1;
+    uint uOffset = 0;
+    uint3 u3Reso = pyramidLevelReso(vParam.u3VoxelReso, 0);
+    while (iLevel + 1 < PYRAMID_LEVELS && emptyCell(uOffset, u3Reso,
+        u3Voxel >> (iLevel + 2), f2MinMaxDen)) {
+        ++iLevel;
+        uOffset += u3Reso.x * u3Reso.y * u3Reso.z;
+        u3Reso = pyramidLevelReso(vParam.u3VoxelReso, iLevel + 1);
+    }
+    if (iLevel < 0) {
+        return 0.f;
+    }
+    float fSize = 2u << iLevel;
+    float3 f3Bound =
+        ((u3Voxel >> (iLevel + 1)) + (f3IdxStep > 0.f)) * fSize;
+    float3 f3Exit = f3IdxStep == 0.f ? 1e30f : (f3Bound - f3Idx) / f3IdxStep;
+    return max(1.f, ceil(min(f3Exit.x, min(f3Exit.y, f3Exit.z))));
+}
+
+// Some cell of level uLevel (starting at uOffset) in the bounding box of the
+// voxel positions f3A and f3B may return fThreshold or more
+bool mayReach(uint uLevel, uint uOffset, float3 f3A, float3 f3B,
+    float fThreshold)
+{
+    uint3 u3Reso = pyramidLevelReso(vParam.u3VoxelReso, uLevel);
+    float fSize = 2u << uLevel;
+    float3 f3LastCell = u3Reso - 1;
+    uint3 u3Lo = clamp(floor(min(f3A, f3B) / fSize), 0.f, f3LastCell);
+    uint3 u3Hi = clamp(floor(max(f3A, f3B) / fSize), 0.f, f3LastCell);
+    for (uint z = u3Lo.z; z <= u3Hi.z; ++z) {
+        for (uint y = u3Lo.y; y <= u3Hi.y; ++y) {
+            for (uint x = u3Lo.x; x <= u3Hi.x; ++x) {
+                if (!emptyCell(uOffset, u3Reso, uint3(x, y, z),
+                    float2(fThreshold, 3.402823466e+38f))) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+#endif // PYRAMID_SKIP
+
+#if ADAPTIVE_STEP
+// Steps of fDeltaT the field stays below fThreshold for, at least 1.
+// Every ball adds r^2 / d^2, so at density D a ball of radius r is at least
+// r / sqrt(D) away and reaches fThreshold r / sqrt(fThreshold) from its
+// center. The smallest ball is the worst case, more balls only split D up.
+// Filtered reads extrapolate (even below 0 next to a ball center), so the
+// bound starts from the voxel the sample is in, whose value is exact
+float safeSteps(float3 f3Idx, float fThreshold, float fDeltaT)
+{
+    float fDensity = max(tex_srvDataVol[BUFFER_INDEX(int3(f3Idx))].x,
+        fThreshold * ADAPTIVE_STEP_FLOOR);
+    if (fDensity >= fThreshold) {
+        return 1.f;
+    }
+    float fDist = fMinBallRadius * (rsqrt(fDensity) - rsqrt(fThreshold));
+    return max(floor(fDist / fDeltaT - ADAPTIVE_STEP_MARGIN), 1.f);
+}
+#endif // ADAPTIVE_STEP
+
 #if !ISO_SURFACE
+// Table position of an in range density
+float lutIndex(float fDensity)
+{
+    return (fDensity - vParam.fMinDensity) * (TRANSFER_LUT_SIZE - 1) /
+        (vParam.fMaxDensity - vParam.fMinDensity);
+}
+
+// transferFunction() * 0.25 from the 1D table
+float transferLUT(float fDensity)
+{
+    float fIdx = lutIndex(fDensity);
+    uint uIdx = min((uint)fIdx, TRANSFER_LUT_SIZE - 2);
+    return lerp(buf_srvTransferLUT[uIdx], buf_srvTransferLUT[uIdx + 1],
+        fIdx - uIdx);
+}
+
+// Mean extinction per fVoxelSize from fFront to fBack. The transfer
+// function is 0 outside the density range, so only the clamped part of the
+// segment adds to it
+float preintegratedExtinction(float fFront, float fBack)
+{
+    float2 f2Clamped =
+        clamp(float2(fFront, fBack), vParam.fMinDensity, vParam.fMaxDensity);
+    float2 f2Idx = float2(lutIndex(f2Clamped.x), lutIndex(f2Clamped.y));
+    uint2 u2Idx = min((uint2)f2Idx, TRANSFER_LUT_SIZE - 2);
+    float2 f2W = f2Idx - u2Idx;
+    uint uRow = TRANSFER_LUT_SIZE * (u2Idx.x + 1) + u2Idx.y;
+    float fMean = lerp(
+        lerp(buf_srvTransferLUT[uRow], buf_srvTransferLUT[uRow + 1], f2W.y),
+        lerp(buf_srvTransferLUT[uRow + TRANSFER_LUT_SIZE],
+            buf_srvTransferLUT[uRow + TRANSFER_LUT_SIZE + 1], f2W.y),
+        f2W.x);
+    if (f2Clamped.x == f2Clamped.y) {
+        return fFront == f2Clamped.x ? fMean : 0.f;
+    }
+    return fMean * (f2Clamped.y - f2Clamped.x) / (fBack - fFront);
+}
+
+// Premultiplied color and opacity of a fVoxelSize * fStepScale long step
+// ending at f4Field, f4Front is the sample one step before
+float4 classify(float4 f4Field, float4 f4Front, float2 f2MinMaxDen)
+{
+    float fAlpha = 0.f;
+    float3 f3Color = f4Field.yzw;
+    [branch] if (uTransferMode == TRANSFER_PREINTEGRATED) {
+        fAlpha = 1.f - exp(-fStepScale *
+            preintegratedExtinction(f4Front.x, f4Field.x));
+        f3Color = (f4Front.yzw + f4Field.yzw) * 0.5f;
+    } else if (f4Field.x >= f2MinMaxDen.x && f4Field.x <= f2MinMaxDen.y) {
+        fAlpha = uTransferMode == TRANSFER_LUT ?
+            transferLUT(f4Field.x) : transferFunction(f4Field.x) * 0.25f;
+        if (fStepScale != 1.f) {
+            fAlpha = 1.f - pow(1.f - fAlpha, fStepScale);
+        }
+    }
+    return float4(f3Color * fAlpha, fAlpha);
+}
+
 void accumulatedShading(Ray eyeray, float2 f2NearFar, float2 f2MinMaxDen,
     inout float4 f4OutColor)
 {
     float3 f3P = eyeray.f4o.xyz + eyeray.f4d.xyz * f2NearFar.x;
     float t = f2NearFar.x;
-    float fDeltaT = vParam.fVoxelSize;
+    float fDeltaT = vParam.fVoxelSize * fStepScale;
     float3 f3Step = eyeray.f4d.xyz * fDeltaT;
 
     float4 f4AccuData = 0;
+    // sample one step back for TRANSFER_PREINTEGRATED, none at the start
+    // and after a jump
+    float4 f4Front = 0;
+    bool bFront = false;
+#if BRICK_DDA
+    // 3D-DDA over the bricks, f3MaxT holds the t of the next brick border
+    // along each axis
+    float fBrickSize = vParam.fVoxelSize * vParam.uVoxelBrickRatio;
+    float3 f3Brick = (f3P / vParam.fVoxelSize + vParam.u3VoxelReso * 0.5f) /
+        vParam.uVoxelBrickRatio;
+    int3 i3Brick = floor(f3Brick);
+    int3 i3BrickStep = eyeray.f4d.xyz > 0.f ? 1 : -1;
+    float3 f3DeltaT = abs(fBrickSize / eyeray.f4d.xyz);
+    float3 f3MaxT = eyeray.f4d.xyz == 0.f ? 1e30f : t +
+        (i3Brick + (i3BrickStep > 0) - f3Brick) * fBrickSize /
+        eyeray.f4d.xyz;
+#endif // BRICK_DDA
     while (t <= f2NearFar.y) {
-        float4 f4CurData = float4(0.001f, 0.001f, 0.001f, 0.005f);
-        float4 f4Field =
-            readVolume(f3P / vParam.fVoxelSize + vParam.u3VoxelReso * 0.5f);
-        if (f4Field.x >= f2MinMaxDen.x && f4Field.x <= f2MinMaxDen.y) {
-            f4CurData = float4(f4Field.yzw, transferFunction(f4Field.x));
-            f4CurData.a *= 0.25f;
-            f4CurData.rgb *= f4CurData.a;
-            f4AccuData = (1.0f - f4AccuData.a) * f4CurData + f4AccuData;
+#if BRICK_DDA
+        // catch up with the brick t is in
+        while (t >= min(f3MaxT.x, min(f3MaxT.y, f3MaxT.z))) {
+            if (f3MaxT.x <= f3MaxT.y && f3MaxT.x <= f3MaxT.z) {
+                i3Brick.x += i3BrickStep.x;
+                f3MaxT.x += f3DeltaT.x;
+            } else if (f3MaxT.y <= f3MaxT.z) {
+                i3Brick.y += i3BrickStep.y;
+                f3MaxT.y += f3DeltaT.y;
+            } else {
+                i3Brick.z += i3BrickStep.z;
+                f3MaxT.z += f3DeltaT.z;
+            }
+        }
+        if (emptyBrick(i3Brick)) {
+            // jump to the first step past the brick, samples stay where
+            // the plain march puts them
+            float fSteps = ceil(
+                (min(f3MaxT.x, min(f3MaxT.y, f3MaxT.z)) - t) / fDeltaT);
+            f3P += f3Step * fSteps;
+            t += fDeltaT * fSteps;
+            bFront = false;
+            continue;
         }
+#endif // BRICK_DDA
+        float3 f3Idx = f3P / vParam.fVoxelSize + vParam.u3VoxelReso * 0.5f;
+#if PYRAMID_SKIP
+        // samples stay where the plain march puts them
+        float fSkip = pyramidSteps(f3Idx, f3Step / vParam.fVoxelSize,
+            f2MinMaxDen);
+        if (fSkip > 0.f) {
+            f3P += f3Step * fSkip;
+            t += fDeltaT * fSkip;
+            bFront = false;
+            continue;
+        }
+#endif // PYRAMID_SKIP
+        float4 f4Field = readVolume(f3Idx);
+        float4 f4CurData =
+            classify(f4Field, bFront ? f4Front : f4Field, f2MinMaxDen);
+        f4AccuData = (1.0f - f4AccuData.a) * f4CurData + f4AccuData;
+        f4Front = f4Field;
+        bFront = true;
         if (f4AccuData.a >= 0.95f) {
             break;
         }
+#if ADAPTIVE_STEP
+        // whole steps, samples stay where the plain march puts them
+        float fSteps = f4Field.x < f2MinMaxDen.x ?
+            safeSteps(f3Idx, f2MinMaxDen.x, fDeltaT) : 1.f;
+        f3P += f3Step * fSteps;
+        t += fDeltaT * fSteps;
+        bFront = fSteps == 1.f;
+#else
         f3P += f3Step;
         t += fDeltaT;
+#endif // ADAPTIVE_STEP
     }
     f4OutColor = f4AccuData * f4AccuData.a;
     return;
 }
 #else
+#if USE_NORMAL == NORMAL_GRADIENT_VOL
+// One packed gradient (8 with FILTER_READ) in place of 4 readVolume calls.
+// Packed values can't go through a sampler, every filter but none reads
+// the 8 neighbors
+float3 getNormal(float3 f3Idx)
+{
+    int3 i3Idx000;
+    float3 f3d = modf(f3Idx, i3Idx000) - 0.5f;
+#if FILTER_READ
+    float3 f3Gradient = float3(0.f, 0.f, 0.f);
+    [unroll] for (uint i = 0; i < 8; ++i) {
+        uint3 u3Corner = uint3(i & 1, (i >> 1) & 1, i >> 2);
+        float3 f3w = u3Corner ? f3d : 1.f - f3d;
+        f3Gradient += unpackGradient(tex_srvGradientVol[
+            i3Idx000 + u3Corner]) * (f3w.x * f3w.y * f3w.z);
+    }
+    return normalize(f3Gradient);
+#else
+    return normalize(unpackGradient(tex_srvGradientVol[i3Idx000]));
+#endif // FILTER_READ
+}
+#else
 float3 getNormal(float3 f3Idx)
 {
     float f000 = readVolume(f3Idx).x;
@@ -136,6 +412,41 @@ float3 getNormal(float3 f3Idx)
     float f001 = readVolume(f3Idx + float3(0.f, 0.f, 1.f)).x;
     return normalize(float3(f100 - f000, f010 - f000, f001 - f000));
 }
+#endif // USE_NORMAL == NORMAL_GRADIENT_VOL
+
+// Density minus fISOValue at f3P
+float isoDistance(float3 f3P, float fISOValue)
+{
+    return readVolume(f3P / vParam.fVoxelSize + vParam.u3VoxelReso * 0.5f).x -
+        fISOValue;
+}
+
+// Surface position between f3PreP and f3P, whose isoDistance fPre and fCur
+// bracket a crossing. Every iteration samples the false position (the secant
+// kept inside the bracket) and moves the end of its sign there. An end that
+// stays twice gets its distance halved (Illinois), so curved fields can't pin
+// it down like plain false position does
+float3 refineCrossing(float3 f3PreP, float3 f3P, float fPre, float fCur,
+    float fISOValue)
+{
+    int iMoved = 0;
+    for (uint i = 0; i < uIsoRefineSteps; ++i) {
+        float3 f3M = lerp(f3PreP, f3P, fPre / (fPre - fCur));
+        float fM = isoDistance(f3M, fISOValue);
+        if (sign(fM) == sign(fPre)) {
+            f3PreP = f3M;
+            fPre = fM;
+            fCur *= iMoved < 0 ? 0.5f : 1.f;
+            iMoved = -1;
+        } else {
+            f3P = f3M;
+            fCur = fM;
+            fPre *= iMoved > 0 ? 0.5f : 1.f;
+            iMoved = 1;
+        }
+    }
+    return lerp(f3PreP, f3P, fPre / (fPre - fCur));
+}
 
 void isoSurfaceShading(Ray eyeray, float2 f2NearFar, float fISOValue,
     inout float4 f4OutColor, inout float fDepth)
@@ -143,8 +454,18 @@ void isoSurfaceShading(Ray eyeray, float2 f2NearFar, float fISOValue,
     float3 f3P = eyeray.f4o.xyz + eyeray.f4d.xyz * f2NearFar.x;
     float3 f3PreP = f3P;
     float t = f2NearFar.x;
-    float fDeltaT = vParam.fVoxelSize;
+    float fDeltaT = vParam.fVoxelSize * fIsoStepScale;
     float3 f3Step = eyeray.f4d.xyz * fDeltaT;
+#if PYRAMID_SKIP
+    // guard cells hold a whole coarse step, so its bounding box covers at
+    // most 2 of them along each axis
+    uint uGuardLevel = 0;
+    while (uGuardLevel + 1 < PYRAMID_LEVELS &&
+        (float)(2u << uGuardLevel) < fIsoStepScale) {
+        ++uGuardLevel;
+    }
+    uint uGuardOffset = pyramidLevelOffset(vParam.u3VoxelReso, uGuardLevel);
+#endif // PYRAMID_SKIP
     float fPreDensity = 0;
     float fCurDensity = 0;
     while (t <= f2NearFar.y) {
@@ -153,8 +474,8 @@ void isoSurfaceShading(Ray eyeray, float2 f2NearFar, float fISOValue,
         float4 f4Field = readVolume(f3Idx);
         fCurDensity = f4Field.x;
         if (sign(fCurDensity - fISOValue) != sign(fPreDensity - fISOValue)) {
-            float3 f3SurfPos = lerp(f3PreP, f3P,
-                (fISOValue - fPreDensity) / (fCurDensity - fPreDensity));
+            float3 f3SurfPos = refineCrossing(f3PreP, f3P,
+                fPreDensity - fISOValue, fCurDensity - fISOValue, fISOValue);
 #if DEPTH_OUT
             float4 f4ProjPos = mul(mWorldViewProj, float4(f3SurfPos, 1.f));
             fDepth = f4ProjPos.z / f4ProjPos.w;
@@ -170,6 +491,27 @@ void isoSurfaceShading(Ray eyeray, float2 f2NearFar, float fISOValue,
             return;
         }
         f3PreP = f3P;
+#if ADAPTIVE_STEP
+        if (fCurDensity < fISOValue) {
+            // land one step short of the bound, so the crossing still gets
+            // bracketed by two neighboring samples
+            float fSkip = safeSteps(f3Idx, fISOValue, fDeltaT) - 1.f;
+            f3P += f3Step * fSkip;
+            t += fDeltaT * fSkip;
+        }
+#endif // ADAPTIVE_STEP
+#if PYRAMID_SKIP
+        // the march is below fISOValue here, a coarse step may only skip
+        // cells that can't reach it
+        f3Idx = f3P / vParam.fVoxelSize + vParam.u3VoxelReso * 0.5f;
+        if (fDeltaT > vParam.fVoxelSize && mayReach(uGuardLevel,
+            uGuardOffset, f3Idx, f3Idx + f3Step / vParam.fVoxelSize,
+            fISOValue)) {
+            f3P += eyeray.f4d.xyz * vParam.fVoxelSize;
+            t += vParam.fVoxelSize;
+            continue;
+        }
+#endif // PYRAMID_SKIP
         f3P += f3Step;
         t += fDeltaT;
     }
@@ -201,12 +543,22 @@ void main( float4 f4Pos : POSITION, float4 f4ProjPos : SV_POSITION,
     bool bHit = 
         IntersectBox(eyeray, vParam.f3BoxMin, vParam.f3BoxMax , fTnear, fTfar);
 #endif // ENABLE_BRICKS
-    if (!bHit) {
+    // pixels off the progressive schedule keep their history
+    if (!bHit || !temporalScheduled(uint(f4ProjPos.x), uint(f4ProjPos.y),
+        uTemporalFrame, uTemporalRayDivider, uTemporalMaxSamples)) {
         discard;
     }
     if (fTnear <= 0) {
         fTnear = 0;
     }
+    // jittered start, the history converges to a finer march
+#if ISO_SURFACE
+    fTnear += temporalJitter(uTemporalFrame, uTemporalRayDivider) *
+        vParam.fVoxelSize * fIsoStepScale;
+#else
+    fTnear += temporalJitter(uTemporalFrame, uTemporalRayDivider) *
+        vParam.fVoxelSize * fStepScale;
+#endif // ISO_SURFACE
     f4Col = float4(1.f, 1.f, 1.f, 0.f) * 0.01f;
     fDepth = 0.f;
 #if ISO_SURFACE
@@ -1,8 +1,27 @@
 #include "SparseVolume.inl"
-RWTexture3D<int> tex_uavFlagVol : register(u1);
+#include "SparseVolume.hlsli"
+#if BRICK_LIST
+// flat indices of the bricks to reset, uNumOfDirtyBricks of them
+StructuredBuffer<uint> buf_srvBricks : register(t2);
+#endif // BRICK_LIST
+RWStructuredBuffer<uint> buf_uavFlagVol : register(u1);
 
 [numthreads(THREAD_X, THREAD_Y, THREAD_Z)]
-void main(uint3 u3DTid : SV_DispatchThreadID)
+void main(uint uGIdx : SV_GroupIndex, uint3 u3Gid : SV_GroupID)
 {
-    tex_uavFlagVol[u3DTid] = 0;
+    uint uIdx = (u3Gid.y * ACTIVE_GROUPS_PER_ROW + u3Gid.x) *
+        THREAD_X * THREAD_Y * THREAD_Z + uGIdx;
+#if BRICK_LIST
+    if (uIdx >= uNumOfDirtyBricks) {
+        return;
+    }
+    // clean bricks of the same word keep their flags
+    uint uBrick = buf_srvBricks[uIdx];
+    InterlockedAnd(buf_uavFlagVol[uBrick >> 5], ~flagBit(uBrick));
+#else
+    // a word of 32 bricks per thread
+    if (uIdx < flagWordCount(vParam.u3VoxelReso / vParam.uVoxelBrickRatio)) {
+        buf_uavFlagVol[uIdx] = 0;
+    }
+#endif // BRICK_LIST
 }
\ No newline at end of file
@@ -1,16 +1,28 @@
 #include "SparseVolume.inl"
 #include "SparseVolume.hlsli"
-Texture3D<int> tex_srvFlagVol : register(t1);
+#if BRICK_LIST
+// flat indices of the flagged bricks, one per instance of the indirect draw
+StructuredBuffer<uint> buf_srvActiveBricks : register(t2);
+#else
+StructuredBuffer<uint> buf_srvFlagVol : register(t1);
+#endif // BRICK_LIST
 
 void main(uint uInstanceID : SV_InstanceID, in float4 f4Pos : POSITION,
     out float4 f4ProjPos : SV_POSITION, out float4 f4CamPos : NORMAL0)
 {
-    uint3 u3Idx = makeU3Idx(uInstanceID,
-        vParam.u3VoxelReso / vParam.uVoxelBrickRatio);
+    uint3 u3BrickReso = vParam.u3VoxelReso / vParam.uVoxelBrickRatio;
+#if BRICK_LIST
+    uint3 u3Idx = makeU3Idx(buf_srvActiveBricks[uInstanceID], u3BrickReso);
+#else
+    uint3 u3Idx = makeU3Idx(uInstanceID, u3BrickReso);
+#endif // BRICK_LIST
     f4ProjPos = float4(0.f, 0.f, 0.f, 1.f);
     f4CamPos = float4(0.f, 0.f, 0.f, 1.f);
+#if !BRICK_LIST
     // check whether it is occupied 
-    if (tex_srvFlagVol[u3Idx]) {
+    if (buf_srvFlagVol[uInstanceID >> 5] & flagBit(uInstanceID))
+#endif // !BRICK_LIST
+    {
         float3 f3BrickOffset = 
             u3Idx * vParam.uVoxelBrickRatio * vParam.fVoxelSize -
             (vParam.u3VoxelReso >> 1) * vParam.fVoxelSize;
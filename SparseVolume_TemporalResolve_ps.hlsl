@@ -0,0 +1,91 @@
+#include "SparseVolume.inl"
+#include "TemporalSchedule.inl"
+// Raycast of this frame, only the pixels on the schedule got traced. Depth
+// is 0 (the reversed z clear) but at DEPTH_OUT iso surface hits
+Texture2D<float4> tex_srvColor : register(t0);
+Texture2D<float> tex_srvDepth : register(t1);
+// History: color with its sample count in alpha, the latest sample's depth
+Texture2D<float4> tex_srvHistoryColor : register(t10);
+Texture2D<float> tex_srvHistoryDepth : register(t11);
+
+// History of the last camera for the pixel at f2Pos, count at most 1. The
+// point followed is the iso surface hit or where the pixel ray enters the
+// box. Hits only take history hits of about the same depth, the rest only
+// history without one
+float4 reproject(float2 f2Pos, float2 f2Size, float fDepth)
+{
+    float2 f2Ndc = f2Pos / f2Size * float2(2.f, -2.f) + float2(-1.f, 1.f);
+    bool bSurface = fDepth != 0.f;
+    float4 f4P;
+    if (bSurface) {
+        f4P = mul(mInvWorldViewProj, float4(f2Ndc, fDepth, 1.f));
+        f4P /= f4P.w;
+    } else {
+        float4 f4Mid = mul(mInvWorldViewProj, float4(f2Ndc, 0.5f, 1.f));
+        float3 f3Dir = normalize(f4Mid.xyz / f4Mid.w - f4ViewPos.xyz);
+        float3 f3InvR = 1.f / f3Dir;
+        float3 f3Bot = f3InvR * (vParam.f3BoxMin - f4ViewPos.xyz);
+        float3 f3Top = f3InvR * (vParam.f3BoxMax - f4ViewPos.xyz);
+        float3 f3Min = min(f3Top, f3Bot);
+        float3 f3Max = max(f3Top, f3Bot);
+        float fNear = max(max(f3Min.x, f3Min.y), max(f3Min.x, f3Min.z));
+        float fFar = min(min(f3Max.x, f3Max.y), min(f3Max.x, f3Max.z));
+        if (fNear > fFar) {
+            return 0.f;
+        }
+        f4P = float4(f4ViewPos.xyz + f3Dir * max(fNear, 0.f), 1.f);
+    }
+    float4 f4Prev = mul(mPrevWorldViewProj, f4P);
+    if (f4Prev.w <= 0.f) {
+        return 0.f;
+    }
+    float2 f2Prev =
+        (f4Prev.xy / f4Prev.w * float2(0.5f, -0.5f) + 0.5f) * f2Size;
+    if (any(f2Prev < 0.f) || any(f2Prev >= f2Size)) {
+        return 0.f;
+    }
+    int3 i3Idx = int3(f2Prev, 0);
+    float fPrevDepth = tex_srvHistoryDepth.Load(i3Idx);
+    if ((fPrevDepth != 0.f) != bSurface) {
+        return 0.f;
+    }
+    float fExpected = f4Prev.z / f4Prev.w;
+    if (bSurface && abs(fPrevDepth - fExpected) >
+        TEMPORAL_DEPTH_TOLERANCE * max(fPrevDepth, fExpected)) {
+        return 0.f;
+    }
+    float4 f4History = tex_srvHistoryColor.Load(i3Idx);
+    return float4(f4History.rgb, min(f4History.a, 1.f));
+}
+
+//------------------------------------------------------------------------------
+// Pixel Shader
+//------------------------------------------------------------------------------
+void main(float4 f4ProjPos : SV_POSITION,
+    out float4 f4Col : SV_Target0, out float4 f4History : SV_Target1,
+    out float fHistoryDepth : SV_Target2, out float fDepth : SV_Depth)
+{
+    uint2 u2Size;
+    tex_srvColor.GetDimensions(u2Size.x, u2Size.y);
+    int3 i3Idx = int3(f4ProjPos.xy, 0);
+    float4 f4Prev = 0.f;
+    float fPrevDepth = 0.f;
+    if (uTemporalFrame != 0) {
+        f4Prev = tex_srvHistoryColor.Load(i3Idx);
+        fPrevDepth = tex_srvHistoryDepth.Load(i3Idx);
+    } else if (uTemporalReproject) {
+        f4Prev = reproject(f4ProjPos.xy, u2Size, tex_srvDepth.Load(i3Idx));
+    }
+    f4History = f4Prev;
+    fHistoryDepth = fPrevDepth;
+    if (temporalScheduled(i3Idx.x, i3Idx.y, uTemporalFrame,
+        uTemporalRayDivider, uTemporalMaxSamples)) {
+        float4 f4Cur = tex_srvColor.Load(i3Idx);
+        float fCount = f4Prev.a;
+        f4History = float4((f4Prev.rgb * fCount + f4Cur.rgb) / (fCount + 1.f),
+            min(fCount + 1.f, uTemporalMaxSamples));
+        fHistoryDepth = tex_srvDepth.Load(i3Idx);
+    }
+    f4Col = float4(f4History.rgb, 1.f);
+    fDepth = fHistoryDepth;
+}
\ No newline at end of file
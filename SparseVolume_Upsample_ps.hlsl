@@ -0,0 +1,49 @@
+#include "SparseVolume.inl"
+// Raycast result at 1/uRenderScale resolution in the top left corner of
+// full size targets, depth as written by the DEPTH_OUT raycast
+Texture2D<float4> tex_srvLowResColor : register(t0);
+Texture2D<float> tex_srvLowResDepth : register(t1);
+
+// Weight of a sample by its depth against the reference one, samples across
+// an iso surface edge (or against the cleared background) barely count
+float depthWeight(float fRefDepth, float fDepth)
+{
+    float fRelative = abs(fDepth - fRefDepth) /
+        max(max(fRefDepth, fDepth), 1e-6f);
+    float fScaled = fRelative / UPSAMPLE_DEPTH_TOLERANCE;
+    return 1.f / (1.f + fScaled * fScaled);
+}
+
+//------------------------------------------------------------------------------
+// Pixel Shader
+//------------------------------------------------------------------------------
+void main(float4 f4ProjPos : SV_POSITION,
+    out float4 f4Col : SV_Target, out float fDepth : SV_Depth)
+{
+    uint2 u2Size;
+    tex_srvLowResColor.GetDimensions(u2Size.x, u2Size.y);
+    int2 i2Max = (u2Size + uRenderScale - 1) / uRenderScale - 1;
+    // low res texel space, texel centers at integers
+    float2 f2Pos = f4ProjPos.xy / uRenderScale - 0.5f;
+    float2 f2Base = floor(f2Pos);
+    float2 f2Frac = f2Pos - f2Base;
+    // the nearest low res sample is the depth reference
+    int2 i2Nearest = clamp(int2(floor(f2Pos + 0.5f)), 0, i2Max);
+    float fRefDepth = tex_srvLowResDepth.Load(int3(i2Nearest, 0));
+
+    float4 f4Sum = 0.f;
+    float fWeightSum = 0.f;
+    [unroll]
+    for (int i = 0; i < 4; ++i) {
+        int2 i2Offset = int2(i & 1, i >> 1);
+        int3 i3Idx = int3(clamp(int2(f2Base) + i2Offset, 0, i2Max), 0);
+        float2 f2Bilinear = i2Offset ? f2Frac : 1.f - f2Frac;
+        float fWeight = f2Bilinear.x * f2Bilinear.y *
+            depthWeight(fRefDepth, tex_srvLowResDepth.Load(i3Idx));
+        f4Sum += tex_srvLowResColor.Load(i3Idx) * fWeight;
+        fWeightSum += fWeight;
+    }
+    // the nearest sample has a bilinear weight of at least 0.25
+    f4Col = f4Sum / fWeightSum;
+    fDepth = fRefDepth;
+}
\ No newline at end of file
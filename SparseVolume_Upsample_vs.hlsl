@@ -0,0 +1,7 @@
+// Full screen triangle for the upsample and temporal resolve passes, no
+// vertex buffer needed
+void main(uint uVertID : SV_VertexID, out float4 f4ProjPos : SV_POSITION)
+{
+    float2 f2UV = float2((uVertID << 1) & 2, uVertID & 2);
+    f4ProjPos = float4(f2UV * float2(2.f, -2.f) + float2(-1.f, 1.f), 0.f, 1.f);
+}
\ No newline at end of file
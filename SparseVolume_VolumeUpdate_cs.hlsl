@@ -1,5 +1,6 @@
 #include "SparseVolume.inl"
 #include "SparseVolume.hlsli"
+#include "GradientVolume.inl"
 
 #if TYPED_UAV
 RWBuffer<float4> tex_uavDataVol : register(u0);
@@ -11,8 +12,30 @@ RWStructuredBuffer<float4> tex_uavDataVol : register(u0);
 RWTexture3D<float4> tex_uavDataVol : register(u0);
 #endif // TEX3D_UAV
 #if ENABLE_BRICKS
-RWTexture3D<int> tex_uavFlagVol : register(u1);
+RWStructuredBuffer<uint> buf_uavFlagVol : register(u1);
 #endif // ENABLE_BRICKS
+#if GRADIENT_VOL
+RWTexture3D<uint> tex_uavGradientVol : register(u2);
+#endif // GRADIENT_VOL
+#if BRICK_LIST
+// Thread groups to update, packed as x | y << 10 | z << 20
+StructuredBuffer<uint> buf_srvActiveGroups : register(t2);
+#endif // BRICK_LIST
+#if BALL_GRID
+// BallGrid storage and its per cell ball lists, balls of cell i are
+// buf_srvCellEntries[buf_srvCellOffsets[i], buf_srvCellOffsets[i + 1])
+StructuredBuffer<float4> buf_srvBalls : register(t3);
+StructuredBuffer<float4> buf_srvBallsCol : register(t4);
+StructuredBuffer<uint> buf_srvCellOffsets : register(t5);
+StructuredBuffer<uint> buf_srvCellEntries : register(t6);
+#endif // BALL_GRID
+#if BALL_BINS
+// Per brick lists of the f4Balls reaching it (BallBins), balls of brick i
+// are entries [buf_srvBinOffsets[i], buf_srvBinOffsets[i + 1]) of
+// buf_srvBinEntries, which holds two uint16 ball indices per uint
+StructuredBuffer<uint> buf_srvBinOffsets : register(t3);
+StructuredBuffer<uint> buf_srvBinEntries : register(t4);
+#endif // BALL_BINS
 
 //------------------------------------------------------------------------------
 // Utility Funcs
@@ -25,31 +48,100 @@ float Ball(float3 f3Pos, float3 f3Center, float fRadiusSq)
     return fRadiusSq * fInvDistSq;
 }
 
+// Ball() adding its gradient direction: d(r^2 / |d|^2) / dp is
+// -2 r^2 d / |d|^4, the factor 2 goes away with the normalization
+float Ball(float3 f3Pos, float3 f3Center, float fRadiusSq,
+    inout float3 f3Gradient)
+{
+    float3 f3d = f3Pos - f3Center;
+    float fDistSq = dot(f3d, f3d);
+    float fInvDistSq = 1.f / fDistSq;
+    float fDensity = fRadiusSq * fInvDistSq;
+    f3Gradient -= f3d * (fDensity * fInvDistSq);
+    return fDensity;
+}
+
 //------------------------------------------------------------------------------
 // Compute Shader
 //------------------------------------------------------------------------------
 [numthreads(THREAD_X, THREAD_Y, THREAD_Z)]
+#if BRICK_LIST
+void main(uint3 u3GTid : SV_GroupThreadID, uint3 u3Gid : SV_GroupID)
+#else
 void main(uint3 u3DTid: SV_DispatchThreadID)
+#endif // BRICK_LIST
 {
+#if BRICK_LIST
+    uint uGroupIdx = u3Gid.y * ACTIVE_GROUPS_PER_ROW + u3Gid.x;
+    if (uGroupIdx >= uNumOfActiveGroups) {
+        return;
+    }
+    uint uPacked = buf_srvActiveGroups[uGroupIdx];
+    uint3 u3DTid = uint3(uPacked & 0x3ff, (uPacked >> 10) & 0x3ff,
+        uPacked >> 20) * uint3(THREAD_X, THREAD_Y, THREAD_Z) + u3GTid;
+#endif // BRICK_LIST
     // Current voxel pos in local space
     float3 currentPos =
         (u3DTid - vParam.u3VoxelReso * 0.5f + 0.5f) * vParam.fVoxelSize;
     // Voxel content: x-density, yzw-color
     float4 f4Field = float4(0.f, 1.f, 1.f, 1.f);
+#if GRADIENT_VOL
+    float3 f3Gradient = float3(0.f, 0.f, 0.f);
+#define BALL(pos, center, radiusSq) Ball(pos, center, radiusSq, f3Gradient)
+#else
+#define BALL(pos, center, radiusSq) Ball(pos, center, radiusSq)
+#endif // GRADIENT_VOL
     // Update voxel based on its position
+#if BALL_GRID
+    // Only balls reaching this voxel's cell, with a cell edge of THREAD_X
+    // the whole thread group walks the same list
+    uint3 u3Cell = u3DTid / uBallGridCellSize;
+    uint uCell = u3Cell.x + (u3Cell.y + u3Cell.z * u3BallGridReso.y) *
+        u3BallGridReso.x;
+    uint uEnd = buf_srvCellOffsets[uCell + 1];
+    for (uint j = buf_srvCellOffsets[uCell]; j < uEnd; j++) {
+        uint i = buf_srvCellEntries[j];
+        float4 f4Ball = buf_srvBalls[i];
+        float fDensity = BALL(currentPos, f4Ball.xyz, f4Ball.w);
+        f4Field.x += fDensity;
+        f4Field.yzw += buf_srvBallsCol[i].xyz * pow(fDensity, 3) * 1000.f;
+    }
+#elif BALL_BINS
+    // Only balls reaching this voxel's brick, the whole brick walks the same
+    // list
+    uint uBin = flatBrickIdx(u3DTid / vParam.uVoxelBrickRatio,
+        vParam.u3VoxelReso / vParam.uVoxelBrickRatio);
+    uint uEnd = buf_srvBinOffsets[uBin + 1];
+    for (uint j = buf_srvBinOffsets[uBin]; j < uEnd; j++) {
+        uint i = (buf_srvBinEntries[j >> 1] >> ((j & 1) << 4)) & 0xffff;
+        float fDensity = BALL(currentPos, f4Balls[i].xyz, f4Balls[i].w);
+        f4Field.x += fDensity;
+        f4Field.yzw += f4BallsCol[i].xyz * pow(fDensity, 3) * 1000.f;
+    }
+#else
     for (uint i = 0; i < uNumOfBalls; i++) {
-        float fDensity = Ball(currentPos, f4Balls[i].xyz, f4Balls[i].w);
+        float fDensity = BALL(currentPos, f4Balls[i].xyz, f4Balls[i].w);
         f4Field.x += fDensity;
         f4Field.yzw += f4BallsCol[i].xyz * pow(fDensity, 3) * 1000.f;
     }
+#endif // BALL_GRID, BALL_BINS
     // Make color vivid
     f4Field.yzw = normalize(f4Field.yzw);
     // Write back to voxel 
     tex_uavDataVol[BUFFER_INDEX(u3DTid)] = f4Field;
+#if GRADIENT_VOL
+    // dense, bricks out of the update keep their last gradients
+    tex_uavGradientVol[u3DTid] = packGradient(f3Gradient);
+#endif // GRADIENT_VOL
 #if ENABLE_BRICKS
     // Update brick structure
     if (f4Field.x >= vParam.fMinDensity && f4Field.x <= vParam.fMaxDensity) {
-        tex_uavFlagVol[u3DTid / vParam.uVoxelBrickRatio] = 1;
+        uint uBrick = flatBrickIdx(u3DTid / vParam.uVoxelBrickRatio,
+            vParam.u3VoxelReso / vParam.uVoxelBrickRatio);
+        // most voxels find their brick flagged already, skip the atomic
+        if (!(buf_uavFlagVol[uBrick >> 5] & flagBit(uBrick))) {
+            InterlockedOr(buf_uavFlagVol[uBrick >> 5], flagBit(uBrick));
+        }
     }
 #endif // ENABLE_BRICKS
 }
\ No newline at end of file
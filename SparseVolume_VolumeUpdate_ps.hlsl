@@ -8,7 +8,7 @@ RWBuffer<float4> tex_uavDataVol : register(u0);
 RWStructuredBuffer<float4> tex_uavDataVol : register(u0);
 #endif // STRUCT_UAV
 #if ENABLE_BRICKS
-RWTexture3D<int> tex_uavFlagVol : register(u1);
+RWStructuredBuffer<uint> buf_uavFlagVol : register(u1);
 #endif // ENABLE_BRICKS
 
 //------------------------------------------------------------------------------
@@ -46,7 +46,12 @@ float4 main(float4 f4Pos : SV_Position,
 #if ENABLE_BRICKS
     // Update brick structure
     if (f4Field.x >= vParam.fMinDensity && f4Field.x <= vParam.fMaxDensity) {
-        tex_uavFlagVol[u3DTid / vParam.uVoxelBrickRatio] = 1;
+        uint uBrick = flatBrickIdx(u3DTid / vParam.uVoxelBrickRatio,
+            vParam.u3VoxelReso / vParam.uVoxelBrickRatio);
+        // most voxels find their brick flagged already, skip the atomic
+        if (!(buf_uavFlagVol[uBrick >> 5] & flagBit(uBrick))) {
+            InterlockedOr(buf_uavFlagVol[uBrick >> 5], flagBit(uBrick));
+        }
     }
 #endif // ENABLE_BRICKS
 #if !TEX3D_UAV
@@ -0,0 +1,328 @@
+#include "TemporalAccumulator.h"
+#include "TemporalSchedule.inl"
+#include "WorkStealingPool.h"
+#include "BenchmarkClock.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+    // bytes of PerCallDataCB up to the last field, the rest is padding
+    const size_t _perCallSize =
+        offsetof(PerCallDataCB, uTemporalReproject) + sizeof(uint);
+}
+
+TemporalAccumulator::TemporalAccumulator()
+    : _divider(0), _maxSamples(8), _frame(0), _reproject(false),
+    _valid(false), _width(0), _height(0)
+{
+    memset(_prevWVP, 0, sizeof(_prevWVP));
+}
+
+TemporalAccumulator::~TemporalAccumulator()
+{
+}
+
+void
+TemporalAccumulator::SetRayDivider(uint divider)
+{
+    _divider = divider;
+}
+
+void
+TemporalAccumulator::SetMaxSamples(uint maxSamples)
+{
+    _maxSamples = std::max<uint>(1, maxSamples);
+}
+
+void
+TemporalAccumulator::BeginFrame(PerFrameDataCB& perFrame,
+    PerCallDataCB& perCall, bool sceneChanged)
+{
+    const float* wvp = (const float*)&perFrame.mWorldViewProj;
+    float* invWVP = (float*)&perFrame.mInvWorldViewProj;
+    if (!CPURaymarcher::Invert(wvp, invWVP)) {
+        memset(invWVP, 0, sizeof(_prevWVP));
+    }
+    memcpy(&perFrame.mPrevWorldViewProj, _valid ? _prevWVP : wvp,
+        sizeof(_prevWVP));
+
+    // what this frame gets rendered with, the schedule settings included
+    perCall.uTemporalFrame = 0;
+    perCall.uTemporalRayDivider = _divider;
+    perCall.uTemporalMaxSamples = _maxSamples;
+    perCall.uTemporalReproject = 0;
+    const uint8_t* perCallBytes = (const uint8_t*)&perCall;
+    std::vector<uint8_t> perCallData(perCallBytes,
+        perCallBytes + _perCallSize);
+    const uint numOfBalls = std::min<uint>(perCall.uNumOfBalls, MAX_BALLS);
+    std::vector<float4> balls(perFrame.f4Balls,
+        perFrame.f4Balls + numOfBalls);
+    balls.insert(balls.end(), perFrame.f4BallsCol,
+        perFrame.f4BallsCol + numOfBalls);
+
+    const bool unchanged = _valid && !sceneChanged &&
+        perCallData == _perCall && balls.size() == _balls.size() &&
+        !memcmp(balls.data(), _balls.data(), balls.size() * sizeof(float4));
+    const bool moved = memcmp(wvp, _prevWVP, sizeof(_prevWVP)) != 0;
+    _reproject = false;
+    if (_divider == 0 || !unchanged) {
+        _frame = 0;
+    } else if (moved) {
+        _frame = 0;
+        _reproject = true;
+    } else if (!IsConverged()) {
+        ++_frame;
+    }
+    perCall.uTemporalFrame = _frame;
+    perCall.uTemporalReproject = _reproject ? 1 : 0;
+
+    _perCall.swap(perCallData);
+    _balls.swap(balls);
+    memcpy(_prevWVP, wvp, sizeof(_prevWVP));
+    _valid = true;
+}
+
+double
+TemporalAccumulator::GetRaysPerPixel() const
+{
+    if (_divider == 0 || _frame == 0) {
+        return 1.0;
+    }
+    return IsConverged() ? 0.0 : 1.0 / _divider;
+}
+
+bool
+TemporalAccumulator::IsConverged() const
+{
+    return temporalConverged(_frame, _divider, _maxSamples);
+}
+
+void
+TemporalAccumulator::Resolve(const CPURaymarcher::Image& current,
+    const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+    float fClearDepth, CPURaymarcher::Image& image, WorkStealingPool* pool)
+{
+    const uint width = current.uWidth;
+    const uint height = current.uHeight;
+    const size_t size = (size_t)width * height;
+    image.uWidth = width;
+    image.uHeight = height;
+    image.color.resize(size);
+    image.depth.resize(size);
+    std::vector<float4> historyColor(size);
+    std::vector<float> historyDepth(size);
+    // history of another size can't go on
+    const bool hasHistory = _width == width && _height == height;
+    const uint frame = perCall.uTemporalFrame;
+    const uint divider = perCall.uTemporalRayDivider;
+    const uint maxSamples = perCall.uTemporalMaxSamples;
+    const bool reproject = perCall.uTemporalReproject != 0 && hasHistory;
+    const VolumeParam& vParam = perCall.vParam;
+    const float* invWVP = (const float*)&perFrame.mInvWorldViewProj;
+    const float* prevWVP = (const float*)&perFrame.mPrevWorldViewProj;
+    const float3 f3Eye(perFrame.f4ViewPos.x, perFrame.f4ViewPos.y,
+        perFrame.f4ViewPos.z);
+    const float4 f4None(0.f, 0.f, 0.f, 0.f);
+
+    auto isSurface = [&](float fDepth) {
+        return fDepth != 0.f && fDepth != fClearDepth;
+    };
+    // History of the last camera, count at most 1. The point followed is
+    // the iso surface hit or where the pixel ray enters the box. Hits only
+    // take history hits of about the same depth, the rest only history
+    // without one
+    auto reprojectPixel = [&](uint x, uint y, float fDepth) {
+        const float fNdcX = (x + 0.5f) * 2.f / width - 1.f;
+        const float fNdcY = 1.f - (y + 0.5f) * 2.f / height;
+        const bool surface = isSurface(fDepth);
+        float3 f3P;
+        if (surface) {
+            const float4 f4P =
+                CPURaymarcher::Transform(invWVP, fNdcX, fNdcY, fDepth, 1.f);
+            f3P = float3(f4P.x / f4P.w, f4P.y / f4P.w, f4P.z / f4P.w);
+        } else {
+            const float4 f4Mid =
+                CPURaymarcher::Transform(invWVP, fNdcX, fNdcY, 0.5f, 1.f);
+            float3 f3Dir(f4Mid.x / f4Mid.w - f3Eye.x,
+                f4Mid.y / f4Mid.w - f3Eye.y, f4Mid.z / f4Mid.w - f3Eye.z);
+            const float fInvLen = 1.f / std::sqrt(f3Dir.x * f3Dir.x +
+                f3Dir.y * f3Dir.y + f3Dir.z * f3Dir.z);
+            f3Dir = float3(f3Dir.x * fInvLen, f3Dir.y * fInvLen,
+                f3Dir.z * fInvLen);
+            float tNear, tFar;
+            if (!CPURaymarcher::IntersectBox(f3Eye, f3Dir, vParam.f3BoxMin,
+                vParam.f3BoxMax, tNear, tFar)) {
+                return f4None;
+            }
+            tNear = std::max(tNear, 0.f);
+            f3P = float3(f3Eye.x + f3Dir.x * tNear,
+                f3Eye.y + f3Dir.y * tNear, f3Eye.z + f3Dir.z * tNear);
+        }
+        const float4 f4Prev =
+            CPURaymarcher::Transform(prevWVP, f3P.x, f3P.y, f3P.z, 1.f);
+        if (!(f4Prev.w > 0.f)) {
+            return f4None;
+        }
+        const float fX = (f4Prev.x / f4Prev.w * 0.5f + 0.5f) * width;
+        const float fY = (0.5f - f4Prev.y / f4Prev.w * 0.5f) * height;
+        if (!(fX >= 0.f && fX < width && fY >= 0.f && fY < height)) {
+            return f4None;
+        }
+        const size_t prev = (size_t)fY * width + (uint)fX;
+        const float fPrevDepth = _historyDepth[prev];
+        if (isSurface(fPrevDepth) != surface) {
+            return f4None;
+        }
+        const float fExpected = f4Prev.z / f4Prev.w;
+        if (surface && std::fabs(fPrevDepth - fExpected) >
+            TEMPORAL_DEPTH_TOLERANCE * std::max(fPrevDepth, fExpected)) {
+            return f4None;
+        }
+        const float4& f4History = _historyColor[prev];
+        return float4(f4History.x, f4History.y, f4History.z,
+            std::min(f4History.w, 1.f));
+    };
+
+    auto resolveRow = [&](uint32_t y, uint32_t) {
+        for (uint x = 0; x < width; ++x) {
+            const size_t pixel = (size_t)y * width + x;
+            float4 f4Prev = f4None;
+            float fPrevDepth = fClearDepth;
+            if (frame != 0 && hasHistory) {
+                f4Prev = _historyColor[pixel];
+                fPrevDepth = _historyDepth[pixel];
+            } else if (reproject) {
+                f4Prev = reprojectPixel(x, y, current.depth[pixel]);
+            }
+            float4 f4History = f4Prev;
+            float fHistoryDepth = fPrevDepth;
+            if (temporalScheduled(x, y, frame, divider, maxSamples)) {
+                const float4& f4Cur = current.color[pixel];
+                const float fCount = f4Prev.w;
+                f4History = float4(
+                    (f4Prev.x * fCount + f4Cur.x) / (fCount + 1.f),
+                    (f4Prev.y * fCount + f4Cur.y) / (fCount + 1.f),
+                    (f4Prev.z * fCount + f4Cur.z) / (fCount + 1.f),
+                    std::min(fCount + 1.f, (float)maxSamples));
+                fHistoryDepth = current.depth[pixel];
+            }
+            historyColor[pixel] = f4History;
+            historyDepth[pixel] = fHistoryDepth;
+            image.color[pixel] =
+                float4(f4History.x, f4History.y, f4History.z, 1.f);
+            image.depth[pixel] = fHistoryDepth;
+        }
+    };
+    if (pool) {
+        pool->ParallelFor(height, resolveRow);
+    } else {
+        for (uint y = 0; y < height; ++y) {
+            resolveRow(y, 0);
+        }
+    }
+    _historyColor.swap(historyColor);
+    _historyDepth.swap(historyDepth);
+    _width = width;
+    _height = height;
+}
+
+std::vector<TemporalAccumulator::BenchmarkResult>
+TemporalAccumulator::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, uint numOfBalls,
+    const std::vector<uint>& dividers, uint maxSamples, uint width,
+    uint height, WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    PerFrameDataCB frameCB = perFrame;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+    cb.uNumOfBalls = std::min<uint>(numOfBalls, MAX_BALLS);
+    cb.uTransferMode = TRANSFER_POLYNOMIAL;
+    cb.uTemporalRayDivider = 0;
+
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+    updater.Update(perFrame, cb, vol, false, CPUVolumeUpdater::kSIMDLane,
+        pool);
+
+    // the camera panned by 8 pixels, clip space x shifted by 16 / width
+    PerFrameDataCB pannedCB = perFrame;
+    float* panned = (float*)&pannedCB.mWorldViewProj;
+    for (int row = 0; row < 4; ++row) {
+        panned[row * 4] += 16.f / width * panned[row * 4 + 3];
+    }
+
+    CPURaymarcher::RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    settings.bTemporal = true;
+    // g_SceneDepthBuffer clears to 0 (reversed z)
+    settings.fClearDepth = 0.f;
+    CPURaymarcher::Image reference, pannedReference, current, image;
+    cb.fStepScale = 0.25f;
+    CPURaymarcher::Render(vol, frameCB, cb, settings, reference, pool);
+    CPURaymarcher::Render(vol, pannedCB, cb, settings, pannedReference,
+        pool);
+    cb.fStepScale = 1.f;
+    // what the panned camera gets without history
+    CPURaymarcher::Render(vol, pannedCB, cb, settings, image, pool);
+    const double dPlainRMSE = CPURaymarcher::Compare(pannedReference, image,
+        1.f / 255.f).dRMSE;
+
+    const double dPixels = (double)width * height;
+    for (uint divider : dividers) {
+        TemporalAccumulator accumulator;
+        accumulator.SetRayDivider(divider);
+        accumulator.SetMaxSamples(maxSamples);
+        BenchmarkResult result = {};
+        result.uRayDivider = divider;
+        uint64_t pixels = 0;
+        uint64_t samples = 0;
+        double dMs = 0.0;
+        // without a divider every frame is frame 0, one of them will do
+        for (;;) {
+            accumulator.BeginFrame(frameCB, cb, false);
+            if (accumulator.IsConverged()) {
+                break;
+            }
+            BenchmarkClock::time_point start = BenchmarkClock::now();
+            const CPURaymarcher::RenderStats stats = CPURaymarcher::Render(
+                vol, frameCB, cb, settings, current, pool);
+            accumulator.Resolve(current, frameCB, cb,
+                settings.fClearDepth, image, pool);
+            dMs += ElapsedMs(start);
+            pixels += stats.uPixels;
+            samples += stats.uSamples;
+            if (result.uFrames++ == 0) {
+                result.dFirstRMSE = CPURaymarcher::Compare(reference, image,
+                    1.f / 255.f).dRMSE;
+            }
+            if (divider == 0) {
+                break;
+            }
+        }
+        const CPURaymarcher::ImageDiff diff =
+            CPURaymarcher::Compare(reference, image, 1.f / 255.f);
+        result.dMsPerFrame = dMs / result.uFrames;
+        result.dRaysPerPixel = pixels / (dPixels * result.uFrames);
+        result.dSamplesPerPixel = samples / (dPixels * result.uFrames);
+        result.dRMSE = diff.dRMSE;
+        result.fMaxError = diff.fMaxError;
+        result.dPlainRMSE = dPlainRMSE;
+        result.dReprojectedRMSE = dPlainRMSE;
+        if (divider != 0) {
+            accumulator.BeginFrame(pannedCB, cb, false);
+            CPURaymarcher::Render(vol, pannedCB, cb, settings, current,
+                pool);
+            accumulator.Resolve(current, pannedCB, cb,
+                settings.fClearDepth, image, pool);
+            result.dReprojectedRMSE = CPURaymarcher::Compare(
+                pannedReference, image, 1.f / 255.f).dRMSE;
+        }
+        results.push_back(result);
+    }
+    return results;
+}
\ No newline at end of file
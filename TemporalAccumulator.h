@@ -0,0 +1,84 @@
+#pragma once
+// Progressive accumulation of still frames (see TemporalSchedule.inl).
+// BeginFrame decides whether the history goes on, gets reprojected (only
+// the camera moved) or starts over, and fills the temporal fields of the
+// constant buffers read by the raycast and the temporal resolve
+// (SparseVolume_TemporalResolve_ps.hlsl). Resolve is the CPU port of that
+// pass over images of CPURaymarcher::Render.
+#include "CPURaymarcher.h"
+
+class TemporalAccumulator
+{
+public:
+    struct BenchmarkResult {
+        uint uRayDivider; // 0 traces every pixel every frame
+        uint uFrames; // until converged
+        double dMsPerFrame; // render and resolve
+        // traced per pixel and frame on average
+        double dRaysPerPixel;
+        double dSamplesPerPixel;
+        // against the fStepScale 0.25 reference
+        double dFirstRMSE; // frame 0, one sample per pixel
+        double dRMSE; // converged
+        float fMaxError;
+        // frame 0 after a camera pan, reprojected history vs none
+        double dReprojectedRMSE;
+        double dPlainRMSE;
+    };
+
+    TemporalAccumulator();
+    ~TemporalAccumulator();
+
+    // Pixels sharing a ray each frame (1, 4 or 16), 0 turns it off
+    void SetRayDivider(uint divider);
+    // Samples a pixel holds when converged, at least 1
+    void SetMaxSamples(uint maxSamples);
+    inline uint GetRayDivider() const { return _divider; };
+    inline uint GetMaxSamples() const { return _maxSamples; };
+    // The next BeginFrame starts over
+    inline void Reset() { _valid = false; };
+
+    // Fills mInvWorldViewProj, mPrevWorldViewProj and the uTemporal* fields.
+    // The history starts over when sceneChanged (settings the constant
+    // buffers don't hold) or perCall or the balls changed, and gets
+    // reprojected when only mWorldViewProj did
+    void BeginFrame(PerFrameDataCB& perFrame, PerCallDataCB& perCall,
+        bool sceneChanged);
+    // Rays traced per pixel in the current frame
+    double GetRaysPerPixel() const;
+    // Every pixel holds GetMaxSamples(), nothing gets traced
+    bool IsConverged() const;
+
+    // Blends the pixels current got traced for (perCall's schedule) into
+    // the history and returns it in image, depth is the latest sample's.
+    // Iso surface hits are depths other than 0 and fClearDepth
+    void Resolve(const CPURaymarcher::Image& current,
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        float fClearDepth, CPURaymarcher::Image& image,
+        WorkStealingPool* pool = nullptr);
+
+    // Accumulated shading at reso^3 and fStepScale 1, run to convergence
+    // with every ray divider, rendered width x height through the camera
+    // of perFrame, then panned by a few pixels
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, uint numOfBalls, const std::vector<uint>& dividers,
+        uint maxSamples, uint width, uint height,
+        WorkStealingPool* pool = nullptr);
+
+private:
+    uint _divider;
+    uint _maxSamples;
+    uint _frame;
+    bool _reproject;
+    bool _valid;
+    float _prevWVP[16];
+    // what the last frame was rendered with, temporal fields zeroed
+    std::vector<uint8_t> _perCall;
+    std::vector<float4> _balls;
+    // color with its sample count in w, and the latest sample's depth
+    uint _width;
+    uint _height;
+    std::vector<float4> _historyColor;
+    std::vector<float> _historyDepth;
+};
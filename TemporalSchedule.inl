@@ -0,0 +1,66 @@
+#if !__hlsl
+#pragma once
+#endif // !__hlsl
+// Progressive accumulation of still frames, shared by the raycast, the
+// temporal resolve and the CPU engine (TemporalAccumulator). Frame 0 after a
+// reset (or a camera move) traces every pixel. Later frames trace one phase
+// of an ordered (Bayer) pattern over blocks of uDivider pixels, 2x2 for 4 and
+// 4x4 for 16, so every pixel gets a new sample each uDivider frames until it
+// holds uMaxSamples. uDivider 0 turns the schedule off and every frame traces
+// every pixel without jitter.
+
+#if __hlsl
+#define TEMPORAL_FUNC
+#else
+#define TEMPORAL_FUNC inline
+#endif
+
+// Bayer index of pixel (x, y) in its block of uDivider (1, 4 or 16) pixels
+TEMPORAL_FUNC uint temporalPhase(uint x, uint y, uint uDivider)
+{
+    uint uPhase = 0;
+    for (uint uBlock = 1; uBlock < uDivider; uBlock <<= 2) {
+        uPhase = uPhase * 4 + (((x & 1) << 1) ^ ((y & 1) * 3));
+        x >>= 1;
+        y >>= 1;
+    }
+    return uPhase;
+}
+
+// Every pixel holds uMaxSamples, nothing is traced anymore
+TEMPORAL_FUNC bool temporalConverged(uint uFrame, uint uDivider,
+    uint uMaxSamples)
+{
+    return uDivider != 0 && uFrame > uDivider * (uMaxSamples - 1);
+}
+
+TEMPORAL_FUNC bool temporalScheduled(uint x, uint y, uint uFrame,
+    uint uDivider, uint uMaxSamples)
+{
+    if (uDivider == 0 || uFrame == 0) {
+        return true;
+    }
+    if (temporalConverged(uFrame, uDivider, uMaxSamples)) {
+        return false;
+    }
+    return (uFrame - 1) % uDivider == temporalPhase(x, y, uDivider);
+}
+
+// Ray start offset in steps of the pixels traced in uFrame. Those all take
+// their sample number k of the same frames, the radical inverse of k
+// (0, 1/2, 1/4, 3/4, ...) spreads a pixel's samples evenly over one step
+TEMPORAL_FUNC float temporalJitter(uint uFrame, uint uDivider)
+{
+    uint uSample = 0;
+    if (uDivider != 0 && uFrame != 0) {
+        uSample = (uFrame - 1) / uDivider + 1;
+    }
+    float fJitter = 0.f;
+    float fScale = 0.5f;
+    for (; uSample != 0; uSample >>= 1) {
+        fJitter += (uSample & 1) * fScale;
+        fScale *= 0.5f;
+    }
+    return fJitter;
+}
+#undef TEMPORAL_FUNC
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "TransferFunctionLUT.h"
+#include "CPURaymarcher.h"
+
+TransferFunctionLUT::TransferFunctionLUT()
+    : _fMinDensity(0.f), _fMaxDensity(0.f), _fScale(0.f)
+{
+}
+
+TransferFunctionLUT::~TransferFunctionLUT()
+{
+}
+
+bool
+TransferFunctionLUT::Update(const VolumeParam& vParam)
+{
+    if (!_data.empty() && vParam.fMinDensity == _fMinDensity &&
+        vParam.fMaxDensity == _fMaxDensity) {
+        return false;
+    }
+    const uint N = TRANSFER_LUT_SIZE;
+    _fMinDensity = vParam.fMinDensity;
+    _fMaxDensity = vParam.fMaxDensity;
+    const float fRange = _fMaxDensity - _fMinDensity;
+    _fScale = fRange > 0.f ? (N - 1) / fRange : 0.f;
+    _data.resize(N + N * N);
+
+    // extinction at the entries, with its integral up to each of them (in
+    // entries) so the mean over any segment of the piecewise linear
+    // extinction is exact
+    std::vector<double> extinction(N);
+    std::vector<double> integral(N, 0.0);
+    for (uint i = 0; i < N; ++i) {
+        const float fDensity = i == N - 1 ? _fMaxDensity :
+            _fMinDensity + fRange * i / (N - 1);
+        const float fOpacity =
+            CPURaymarcher::TransferFunction(vParam, fDensity) * 0.25f;
+        _data[i] = fOpacity;
+        extinction[i] = -std::log(1.0 - std::min(fOpacity, 0.999999f));
+        if (i > 0) {
+            integral[i] = integral[i - 1] +
+                (extinction[i - 1] + extinction[i]) * 0.5;
+        }
+    }
+    for (uint f = 0; f < N; ++f) {
+        float* row = &_data[N * (f + 1)];
+        for (uint b = 0; b < N; ++b) {
+            row[b] = f == b ? (float)extinction[f] :
+                (float)((integral[b] - integral[f]) / ((double)b - f));
+        }
+    }
+    return true;
+}
+
+std::vector<TransferFunctionLUT::BenchmarkResult>
+TransferFunctionLUT::Benchmark(const PerFrameDataCB& perFrame,
+    const PerCallDataCB& perCall, uint reso, uint numOfBalls,
+    const std::vector<float>& stepScales, uint width, uint height,
+    WorkStealingPool* pool)
+{
+    std::vector<BenchmarkResult> results;
+    PerCallDataCB cb = CPUVolumeUpdater::ScaledPerCall(perCall, reso);
+    VolumeParam& vParam = cb.vParam;
+    cb.uNumOfBalls = std::min<uint>(numOfBalls, MAX_BALLS);
+
+    CPUVolumeUpdater updater;
+    CPUVolume vol;
+    vol.Resize(vParam.u3VoxelReso, vParam.uVoxelBrickRatio);
+    updater.Update(perFrame, cb, vol, false, CPUVolumeUpdater::kSIMDLane,
+        pool);
+    TransferFunctionLUT lut;
+    lut.Update(vParam);
+
+    CPURaymarcher::RenderSettings settings;
+    settings.uWidth = width;
+    settings.uHeight = height;
+    settings.pTransferLUT = &lut;
+    CPURaymarcher::Image reference, image;
+    cb.uTransferMode = TRANSFER_POLYNOMIAL;
+    cb.fStepScale = 0.25f;
+    CPURaymarcher::Render(vol, perFrame, cb, settings, reference, pool);
+    // error budget: the default march
+    cb.fStepScale = 1.f;
+    CPURaymarcher::Render(vol, perFrame, cb, settings, image, pool);
+    const double dMatchedRMSE =
+        CPURaymarcher::Compare(reference, image, 1.f / 255.f).dRMSE;
+
+    const uint modes[] = {TRANSFER_POLYNOMIAL, TRANSFER_LUT,
+        TRANSFER_PREINTEGRATED};
+    for (uint mode : modes) {
+        for (float fStepScale : stepScales) {
+            cb.uTransferMode = mode;
+            cb.fStepScale = fStepScale;
+            const CPURaymarcher::RenderStats stats = CPURaymarcher::Render(
+                vol, perFrame, cb, settings, image, pool);
+            const CPURaymarcher::ImageDiff diff =
+                CPURaymarcher::Compare(reference, image, 1.f / 255.f);
+            BenchmarkResult result = {};
+            result.uTransferMode = mode;
+            result.fStepScale = fStepScale;
+            result.dMs = stats.dMs;
+            result.dSamplesPerRay = stats.dSamplesPerRay;
+            result.dRMSE = diff.dRMSE;
+            result.fMaxError = diff.fMaxError;
+            result.bMatched = diff.dRMSE <= dMatchedRMSE;
+            results.push_back(result);
+        }
+    }
+    return results;
+}
\ No newline at end of file
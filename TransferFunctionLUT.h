@@ -0,0 +1,93 @@
+#pragma once
+// Tables replacing transferFunction() in accumulatedShading, laid out the
+// way the pixel shader reads them from one StructuredBuffer<float>:
+// - [0, N): opacity of one fVoxelSize step (transferFunction() * 0.25) at N
+//   evenly spaced densities over [fMinDensity, fMaxDensity]
+// - [N, N + N * N): pre-integrated table, entry front * N + back holds the
+//   mean extinction (-ln(1 - opacity) per fVoxelSize) of a segment whose
+//   density goes linearly from front to back
+// N is TRANSFER_LUT_SIZE. The transfer function is 0 outside the density
+// range, both tables only cover the range itself.
+#include <algorithm>
+#include "CPUVolumeUpdater.h"
+
+class TransferFunctionLUT
+{
+public:
+    struct BenchmarkResult {
+        uint uTransferMode; // TRANSFER_*
+        float fStepScale;
+        double dMs;
+        double dSamplesPerRay;
+        // against TRANSFER_POLYNOMIAL at the reference step scale
+        double dRMSE;
+        float fMaxError;
+        // error at most the one of TRANSFER_POLYNOMIAL at step scale 1
+        bool bMatched;
+    };
+
+    TransferFunctionLUT();
+    ~TransferFunctionLUT();
+
+    // Rebuild when fMinDensity/fMaxDensity changed since the last call,
+    // returns whether the tables changed
+    bool Update(const VolumeParam& vParam);
+
+    inline const std::vector<float>& GetData() const { return _data; };
+    // Opacity of one fVoxelSize step, densities outside the range are 0
+    inline float GetOpacity(float fDensity) const {
+        if (!(fDensity >= _fMinDensity && fDensity <= _fMaxDensity)) {
+            return 0.f;
+        }
+        float fIdx;
+        const uint i = _Cell(fDensity, fIdx);
+        const float w = fIdx - i;
+        return _data[i] * (1.f - w) + _data[i + 1] * w;
+    };
+    // Mean extinction per fVoxelSize from fFront to fBack. Only the part of
+    // the segment inside the density range adds to it
+    inline float GetExtinction(float fFront, float fBack) const {
+        const float fClampedFront =
+            std::min(std::max(fFront, _fMinDensity), _fMaxDensity);
+        const float fClampedBack =
+            std::min(std::max(fBack, _fMinDensity), _fMaxDensity);
+        if (fClampedFront == fClampedBack) {
+            return fFront == fClampedFront ?
+                _Lookup2D(fClampedFront, fClampedBack) : 0.f;
+        }
+        return _Lookup2D(fClampedFront, fClampedBack) *
+            ((fClampedBack - fClampedFront) / (fBack - fFront));
+    };
+
+    // Accumulated shading at reso^3 with every TRANSFER_* mode and step
+    // scale, rendered width x height through the camera of perFrame. The
+    // reference is TRANSFER_POLYNOMIAL at fStepScale 0.25
+    static std::vector<BenchmarkResult> Benchmark(
+        const PerFrameDataCB& perFrame, const PerCallDataCB& perCall,
+        uint reso, uint numOfBalls, const std::vector<float>& stepScales,
+        uint width, uint height, WorkStealingPool* pool = nullptr);
+
+private:
+    // Table cell of an in range density, fIdx returns its position
+    inline uint _Cell(float fDensity, float& fIdx) const {
+        fIdx = (fDensity - _fMinDensity) * _fScale;
+        return std::min((uint)fIdx, (uint)TRANSFER_LUT_SIZE - 2);
+    };
+    inline float _Lookup2D(float fFront, float fBack) const {
+        float fIdxF, fIdxB;
+        const uint f = _Cell(fFront, fIdxF);
+        const uint b = _Cell(fBack, fIdxB);
+        const float wf = fIdxF - f;
+        const float wb = fIdxB - b;
+        const float* row0 = &_data[TRANSFER_LUT_SIZE * (f + 1)];
+        const float* row1 = row0 + TRANSFER_LUT_SIZE;
+        return (row0[b] * (1.f - wb) + row0[b + 1] * wb) * (1.f - wf) +
+            (row1[b] * (1.f - wb) + row1[b + 1] * wb) * wf;
+    };
+
+    std::vector<float> _data;
+    float _fMinDensity;
+    float _fMaxDensity;
+    // table entries per density unit
+    float _fScale;
+};
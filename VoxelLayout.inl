@@ -0,0 +1,78 @@
+#if !__hlsl
+#pragma once
+#endif // !__hlsl
+// Voxel layouts of the buffer backed volumes (ManagedBuf::kStructuredBuffer,
+// kTypedBuffer), shared by the shaders and the CPU engine. Texture3D volumes
+// are tiled by the driver and always take (x, y, z).
+//
+// VOXEL_LAYOUT_LINEAR: x-major rows (flatIDX), neighbors along y and z are a
+// row or a whole slice apart.
+// VOXEL_LAYOUT_SWIZZLED: VOXEL_TILE^3 tiles one after another (tile grid
+// x-major), voxels inside a tile in Morton order. The 8 neighbors of a
+// trilinear read and short steps in any direction mostly stay in one tile.
+// VOXEL_LAYOUT_BRICK_POOL: only occupied bricks are stored, one after another
+// in the slots of a pool, voxels inside a brick x-major. A per brick slot
+// table (BrickPool) maps bricks to slots, bricks without a slot map to
+// BRICK_POOL_EMPTY, out of range of any buffer so reads return 0 and writes
+// are dropped.
+#define VOXEL_LAYOUT_LINEAR 0
+#define VOXEL_LAYOUT_SWIZZLED 1
+#define VOXEL_LAYOUT_BRICK_POOL 2
+#define BRICK_POOL_EMPTY 0xffffffffu
+#define VOXEL_TILE_BITS 3
+#define VOXEL_TILE (1 << VOXEL_TILE_BITS)
+
+#if __hlsl
+#define LAYOUT_FUNC
+#else
+#define LAYOUT_FUNC inline
+#endif // __hlsl
+
+// Spread the 3 low bits of v to every third bit
+LAYOUT_FUNC uint spreadTileBits(uint v)
+{
+    return (v & 1u) | ((v & 2u) << 2) | ((v & 4u) << 4);
+}
+
+LAYOUT_FUNC uint linearVoxelIdx(uint x, uint y, uint z, uint3 reso)
+{
+    return x + (y + z * reso.y) * reso.x;
+}
+
+LAYOUT_FUNC uint swizzledVoxelIdx(uint x, uint y, uint z, uint3 reso)
+{
+    uint tilesX = (reso.x + VOXEL_TILE - 1) >> VOXEL_TILE_BITS;
+    uint tilesY = (reso.y + VOXEL_TILE - 1) >> VOXEL_TILE_BITS;
+    uint tile = (x >> VOXEL_TILE_BITS) + ((y >> VOXEL_TILE_BITS) +
+        (z >> VOXEL_TILE_BITS) * tilesY) * tilesX;
+    uint mask = VOXEL_TILE - 1;
+    return (tile << (3 * VOXEL_TILE_BITS)) | spreadTileBits(x & mask) |
+        (spreadTileBits(y & mask) << 1) | (spreadTileBits(z & mask) << 2);
+}
+
+// Element of voxel (x, y, z) of a brick living in pool slot, ratio^3 voxels
+// per slot
+LAYOUT_FUNC uint brickPoolVoxelIdx(uint x, uint y, uint z, uint ratio,
+    uint slot)
+{
+    return slot == BRICK_POOL_EMPTY ? BRICK_POOL_EMPTY
+        : (slot * ratio + z % ratio) * ratio * ratio +
+        (y % ratio) * ratio + x % ratio;
+}
+
+LAYOUT_FUNC uint voxelIdx(uint x, uint y, uint z, uint3 reso, uint layout)
+{
+    return layout == VOXEL_LAYOUT_SWIZZLED
+        ? swizzledVoxelIdx(x, y, z, reso) : linearVoxelIdx(x, y, z, reso);
+}
+
+// Elements a buffer needs to hold reso voxels in the linear or swizzled
+// layout (partial tiles are padded)
+LAYOUT_FUNC uint voxelBufferSize(uint3 reso)
+{
+    return ((reso.x + VOXEL_TILE - 1) >> VOXEL_TILE_BITS) *
+        ((reso.y + VOXEL_TILE - 1) >> VOXEL_TILE_BITS) *
+        ((reso.z + VOXEL_TILE - 1) >> VOXEL_TILE_BITS) <<
+        (3 * VOXEL_TILE_BITS);
+}
+#undef LAYOUT_FUNC
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "WorkStealingPool.h"
+#include <chrono>
+
+namespace {
+    typedef std::chrono::high_resolution_clock Clock;
+}
+
+WorkStealingPool::WorkStealingPool(uint32_t numWorkers)
+    : _numWorkers(numWorkers),
+    _remainingItems(0)
+{
+    if (_numWorkers == 0) {
+        _numWorkers = std::thread::hardware_concurrency();
+        _numWorkers = _numWorkers == 0 ? 1 : _numWorkers;
+    }
+    _slices.reset(new WorkerSlice[_numWorkers]);
+    _stats.resize(_numWorkers);
+    ResetStats();
+    for (uint32_t i = 1; i < _numWorkers; ++i) {
+        _threads.push_back(
+            std::thread(&WorkStealingPool::_WorkerLoop, this, i));
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_jobLock);
+        _exiting = true;
+    }
+    _jobStart.notify_all();
+    for (auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+void
+WorkStealingPool::ParallelFor(uint32_t itemCount, const JobFunc& func)
+{
+    if (itemCount == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < _numWorkers; ++i) {
+        std::lock_guard<std::mutex> lock(_slices[i].lock);
+        _slices[i].begin = (uint32_t)((uint64_t)itemCount * i / _numWorkers);
+        _slices[i].end =
+            (uint32_t)((uint64_t)itemCount * (i + 1) / _numWorkers);
+    }
+    _remainingItems.store(itemCount, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(_jobLock);
+        _job = &func;
+        _activeWorkers = _numWorkers - 1;
+        ++_jobGeneration;
+    }
+    _jobStart.notify_all();
+    _RunJob(0);
+    // func has to outlive every worker still inside _RunJob
+    std::unique_lock<std::mutex> lock(_jobLock);
+    _jobDone.wait(lock, [this] { return _activeWorkers == 0; });
+    _job = nullptr;
+}
+
+void
+WorkStealingPool::ResetStats()
+{
+    for (auto& stats : _stats) {
+        stats = WorkerStats();
+    }
+}
+
+void
+WorkStealingPool::_WorkerLoop(uint32_t workerIdx)
+{
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_jobLock);
+            _jobStart.wait(lock, [&] {
+                return _exiting || _jobGeneration != seenGeneration;
+            });
+            if (_exiting) {
+                return;
+            }
+            seenGeneration = _jobGeneration;
+        }
+        _RunJob(workerIdx);
+        std::lock_guard<std::mutex> lock(_jobLock);
+        if (--_activeWorkers == 0) {
+            _jobDone.notify_all();
+        }
+    }
+}
+
+void
+WorkStealingPool::_RunJob(uint32_t workerIdx)
+{
+    WorkerStats& stats = _stats[workerIdx];
+    uint32_t item;
+    while (true) {
+        if (_PopItem(workerIdx, item) ||
+            (_StealItems(workerIdx) && _PopItem(workerIdx, item))) {
+            Clock::time_point start = Clock::now();
+            (*_job)(item, workerIdx);
+            stats.dBusyMs += std::chrono::duration<double, std::milli>(
+                Clock::now() - start).count();
+            ++stats.uItemsExecuted;
+            _remainingItems.fetch_sub(1, std::memory_order_acq_rel);
+        } else if (_remainingItems.load(std::memory_order_acquire) == 0) {
+            break;
+        } else {
+            // Everything left is in flight on other workers
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool
+WorkStealingPool::_PopItem(uint32_t workerIdx, uint32_t& item)
+{
+    WorkerSlice& slice = _slices[workerIdx];
+    std::lock_guard<std::mutex> lock(slice.lock);
+    if (slice.begin >= slice.end) {
+        return false;
+    }
+    item = slice.begin++;
+    return true;
+}
+
+bool
+WorkStealingPool::_StealItems(uint32_t workerIdx)
+{
+    // Pick the victim with most items left, sizes can change right after
+    // being read so the choice is only a hint
+    uint32_t victim = workerIdx;
+    uint32_t victimSize = 0;
+    for (uint32_t i = 1; i < _numWorkers; ++i) {
+        uint32_t idx = (workerIdx + i) % _numWorkers;
+        WorkerSlice& slice = _slices[idx];
+        std::lock_guard<std::mutex> lock(slice.lock);
+        uint32_t size = slice.end - slice.begin;
+        if (slice.begin < slice.end && size > victimSize) {
+            victim = idx;
+            victimSize = size;
+        }
+    }
+    if (victim == workerIdx) {
+        return false;
+    }
+    uint32_t begin, end;
+    {
+        WorkerSlice& slice = _slices[victim];
+        std::lock_guard<std::mutex> lock(slice.lock);
+        if (slice.begin >= slice.end) {
+            return false;
+        }
+        // Take the back half, rounded up so a single item can be stolen
+        end = slice.end;
+        begin = slice.end - (slice.end - slice.begin + 1) / 2;
+        slice.end = begin;
+    }
+    WorkerSlice& own = _slices[workerIdx];
+    std::lock_guard<std::mutex> lock(own.lock);
+    own.begin = begin;
+    own.end = end;
+    WorkerStats& stats = _stats[workerIdx];
+    stats.uItemsStolen += end - begin;
+    ++stats.uStealCount;
+    return true;
+}
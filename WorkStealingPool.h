@@ -0,0 +1,68 @@
+#pragma once
+// Fixed size thread pool running index ranges with work stealing. Each worker
+// owns a contiguous slice of the job, pops items from the front of it, and
+// when it runs dry steals the back half of the fullest victim's slice, so
+// neighboring items (e.g. thread groups) mostly stay on the same core.
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool
+{
+public:
+    struct WorkerStats {
+        uint64_t uItemsExecuted; // items executed by this worker
+        uint64_t uItemsStolen; // items taken from other workers
+        uint64_t uStealCount; // successful steals
+        double dBusyMs; // time spent inside job functions
+    };
+
+    // func(itemIdx, workerIdx)
+    typedef std::function<void(uint32_t, uint32_t)> JobFunc;
+
+    // numWorkers includes the calling thread, 0 means all hardware threads
+    explicit WorkStealingPool(uint32_t numWorkers = 0);
+    ~WorkStealingPool();
+
+    // Runs func for every item in [0, itemCount) and returns when all are
+    // done, the calling thread works as worker 0
+    void ParallelFor(uint32_t itemCount, const JobFunc& func);
+
+    inline uint32_t GetNumWorkers() const { return _numWorkers; };
+    inline const std::vector<WorkerStats>& GetStats() const { return _stats; };
+    void ResetStats();
+
+private:
+    struct WorkerSlice {
+        std::mutex lock;
+        uint32_t begin = 0;
+        uint32_t end = 0;
+        // keep neighboring slices off the same cache line
+        char padding[64];
+    };
+
+    void _WorkerLoop(uint32_t workerIdx);
+    void _RunJob(uint32_t workerIdx);
+    bool _PopItem(uint32_t workerIdx, uint32_t& item);
+    bool _StealItems(uint32_t workerIdx);
+
+    uint32_t _numWorkers;
+    std::vector<std::thread> _threads;
+    std::unique_ptr<WorkerSlice[]> _slices;
+    std::vector<WorkerStats> _stats;
+
+    // job dispatching
+    std::mutex _jobLock;
+    std::condition_variable _jobStart;
+    std::condition_variable _jobDone;
+    const JobFunc* _job = nullptr;
+    uint64_t _jobGeneration = 0;
+    uint32_t _activeWorkers = 0;
+    std::atomic<uint32_t> _remainingItems;
+    bool _exiting = false;
+};